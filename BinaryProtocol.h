@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BINARYPROTOCOL_H_
+#define BINARYPROTOCOL_H_
+
+#include <Arduino.h>
+
+/*
+* The binary websocket protocol, for test harnesses that send a lot of
+* commands. A client gets it by asking for the BINARY_SUBPROTOCOL
+* subprotocol when it connects, and then sends and receives binary frames
+* of whole 16 byte records (little endian). Readers and peripherals are
+* referred to by handle, see PACSDoorManager.
+*
+* Commands (client to server). Every command is answered by an ACK record
+* with the same handle and sequence number, in the same order. All ACKs
+* for a frame are sent back as one frame.
+*
+*   REQUEST_UPDATE    Sends a STATE event for every peripheral before the ACK.
+*   SWIPE_CARD        value: card number, extra: facility code (bits 0-23)
+*                     and format index (bits 24-31, 0xFF for the reader's).
+*   ENTER_PIN         value, extra: up to 8 digits, NUL padded.
+*   OPEN_DOOR, CLOSE_DOOR, PUSH_REX, ACTIVATE_INPUT, DEACTIVATE_INPUT
+*
+* Events (server to client). Events are numbered in sequence, so a gap
+* means that events were dropped. The STATE events of a snapshot, sent to
+* one client on request, don't take a number of their own: they repeat
+* the number of the last event.
+*
+*   ACK               value: 1 if the command succeeded, 0 if it failed.
+*                     extra: the frame queued by SWIPE_CARD and ENTER_PIN.
+*   STATE             micros: when the level changed, value: 1 if active
+*                     (bit 0) and the number of pulses (bits 8-15), extra:
+*                     the pulse width in microseconds.
+*   TRANSMITTED       micros: when the frame ended, value: frame number.
+*/
+
+#define BINARY_SUBPROTOCOL "dctt.binary.1" // Websocket subprotocol name.
+
+// Commands.
+#define BIN_CMD_REQUEST_UPDATE 0x01
+#define BIN_CMD_SWIPE_CARD 0x02
+#define BIN_CMD_ENTER_PIN 0x03
+#define BIN_CMD_OPEN_DOOR 0x04
+#define BIN_CMD_CLOSE_DOOR 0x05
+#define BIN_CMD_PUSH_REX 0x06
+#define BIN_CMD_ACTIVATE_INPUT 0x07
+#define BIN_CMD_DEACTIVATE_INPUT 0x08
+
+// Events.
+#define BIN_EVT_ACK 0x80
+#define BIN_EVT_STATE 0x81
+#define BIN_EVT_TRANSMITTED 0x82
+
+#define BIN_FORMAT_DEFAULT 0xFF // Format index for the reader's default format.
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t handle; // The reader or peripheral.
+    uint16_t sequence; // Chosen by the client for commands, event number for events.
+    uint32_t micros; // Timestamp of events, micros() on the test tool.
+    uint32_t value;
+    uint32_t extra;
+} BinaryRecord_t;
+
+#endif
@@ -0,0 +1,177 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "ConfigImage.h"
+#include <util/crc16.h>
+
+#define CONFIG_READ_BLOCK 64 // Bytes read at a time when stamping the source files.
+
+uint16_t ConfigImage::crc(uint16_t crc, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (length--)
+        crc = _crc_ccitt_update(crc, *p++);
+    return crc;
+}
+
+/*
+* Runs the contents of a file through the CRC, and adds its size to size.
+* A missing file counts as empty.
+*/
+uint16_t ConfigImage::fileCRC(const char* filename, uint16_t value, uint32_t& size) {
+    uint8_t buffer[CONFIG_READ_BLOCK];
+    int bytesRead;
+
+    File file = SD.open(filename);
+    if (!file)
+        return value;
+    while ((bytesRead = file.read(buffer, sizeof(buffer))) > 0) {
+        value = crc(value, buffer, bytesRead);
+        size += bytesRead;
+    }
+    file.close();
+    return value;
+}
+
+/*
+* Returns a stamp of the pins and doors config files, which changes when
+* either of them does: their total size, folded to 16 bits, and a CRC of
+* their contents. The files are only read, not parsed, which takes a few
+* milliseconds.
+*/
+uint32_t ConfigImage::stamp(const char* pinsFilename, const char* doorsFilename) {
+    uint32_t size = 0;
+    uint16_t value = fileCRC(pinsFilename, 0xFFFF, size);
+    value = fileCRC(doorsFilename, value, size);
+    return ((uint32_t)(uint16_t)(size ^ (size >> 16)) << 16) | value;
+}
+
+/*
+* Builds the records of the configured doors, writing them to out if it's
+* not NULL, and returns their number and CRC.
+*/
+uint16_t ConfigImage::records(PACSDoorManager& manager, File* out, uint16_t& value) {
+    ConfigRecord_t record;
+    uint16_t count = 0;
+    value = 0xFFFF;
+
+    for (unsigned i=0; i < manager.doors.size(); i++) {
+        PACSDoor& door = manager.doors[i];
+
+        for (int j=-1; j < (int)(door.readers.size() + door.peripherals.size()); j++) {
+            memset(&record, 0, sizeof(record));
+            if (j < 0) {
+                record.kind = CONFIG_DOOR;
+                strcpy(record.id, door.id);
+            }
+            else if (j < (int)door.readers.size()) {
+                PACSReader& r = door.readers[j];
+                record.kind = CONFIG_READER;
+                strcpy(record.id, r.id);
+                record.pin = r.pin0;
+                record.pin1 = r.pin1;
+                record.level = r.format;
+            }
+            else {
+                PACSPeripheral& p = door.peripherals[j - door.readers.size()];
+                record.kind = CONFIG_PERIPHERAL;
+                strcpy(record.id, p.id());
+                record.type = p.type;
+                record.pin = p.pin();
+                record.level = p.activeLevel();
+                record.debounceMs = p.debounceMs();
+                record.pulseGapMs = p.pulseGapMs();
+            }
+            value = crc(value, &record, sizeof(record));
+            if (out != NULL)
+                out->write((const uint8_t*)&record, sizeof(record));
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+* Writes the configured doors to an image file, stamped with the stamp of
+* the config files they were parsed from.
+*/
+bool ConfigImage::save(const char* filename, uint32_t sourceStamp, PACSDoorManager& manager) {
+    ConfigImageHeader_t header;
+    header.magic = CONFIG_IMAGE_MAGIC;
+    header.version = CONFIG_IMAGE_VERSION;
+    header.recordSize = sizeof(ConfigRecord_t);
+    header.sourceStamp = sourceStamp;
+    // A first pass for the CRC, as the header goes first.
+    header.recordCount = records(manager, NULL, header.crc);
+
+    if (SD.exists((char*)filename))
+        SD.remove((char*)filename);
+    File file = SD.open(filename, FILE_WRITE);
+    if (!file)
+        return false;
+    file.write((const uint8_t*)&header, sizeof(header));
+    records(manager, &file, header.crc);
+    file.close();
+    return true;
+}
+
+/*
+* Adds the doors of an image file to the door manager. The image must have
+* been compiled from config files with the specified stamp, and pass its
+* CRC check, which is done before anything is added.
+*/
+bool ConfigImage::load(const char* filename, uint32_t sourceStamp, PACSDoorManager& manager) {
+    ConfigImageHeader_t header;
+    ConfigRecord_t record;
+
+    File file = SD.open(filename);
+    if (!file)
+        return false;
+
+    bool valid = (file.read(&header, sizeof(header)) == sizeof(header)) &&
+                 (header.magic == CONFIG_IMAGE_MAGIC) &&
+                 (header.version == CONFIG_IMAGE_VERSION) &&
+                 (header.recordSize == sizeof(ConfigRecord_t)) &&
+                 (header.sourceStamp == sourceStamp) &&
+                 (file.size() == sizeof(header) + (uint32_t)header.recordCount * sizeof(record));
+
+    // Check the CRC, and that the records start with a door.
+    uint16_t value = 0xFFFF;
+    for (uint16_t i=0; valid && i < header.recordCount; i++) {
+        valid = (file.read(&record, sizeof(record)) == sizeof(record)) &&
+                (record.kind <= CONFIG_PERIPHERAL) && (i > 0 || record.kind == CONFIG_DOOR);
+        value = crc(value, &record, sizeof(record));
+    }
+    if (!valid || value != header.crc) {
+        file.close();
+        return false;
+    }
+
+    // The records go to the manager as they are. If they don't all fit,
+    // the doors are loaded from the config files instead.
+    file.seek(sizeof(header));
+    for (uint16_t i=0; i < header.recordCount; i++) {
+        file.read(&record, sizeof(record));
+        if (manager.addRecord(record) == NULL) {
+            manager.discardRecords();
+            file.close();
+            return false;
+        }
+    }
+    file.close();
+    return true;
+}
@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CONFIGIMAGE_H_
+#define CONFIGIMAGE_H_
+
+#include <Arduino.h>
+#include <SD.h>
+#include "PACSDoorManager.h"
+
+#define CONFIG_IMAGE_MAGIC 0x49544344UL // "DCTI" in the file.
+#define CONFIG_IMAGE_VERSION 1 // Change when the layout of the records changes.
+
+// The records are ConfigRecord_t, see PACSDoorManager.h.
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t recordSize; // sizeof(ConfigRecord_t), in case a different build packs it differently.
+    uint16_t recordCount;
+    uint32_t sourceStamp; // Identifies the config files the image was compiled from.
+    uint16_t crc; // CRC of the records.
+} ConfigImageHeader_t;
+
+/*
+* The door configuration compiled to a binary image: the doors, readers and
+* peripherals as fixed size records, in the order they were added. Loading
+* it takes a read of a few hundred bytes instead of tokenizing the JSON
+* config files, which only need to be parsed again when they change.
+*/
+class ConfigImage {
+    public:
+        static uint32_t stamp(const char*, const char*); // Stamp of the source files.
+        static bool load(const char*, uint32_t, PACSDoorManager&); // Load an image compiled from the stamped files.
+        static bool save(const char*, uint32_t, PACSDoorManager&); // Compile the configured doors to an image.
+
+    private:
+        static uint16_t crc(uint16_t, const void*, size_t);
+        static uint16_t fileCRC(const char*, uint16_t, uint32_t&);
+        static uint16_t records(PACSDoorManager&, File*, uint16_t&);
+};
+
+#endif
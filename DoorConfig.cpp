@@ -0,0 +1,350 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "DoorConfig.h"
+#include "WiegandFormat.h"
+#include <serstream>
+
+using namespace std;
+
+char DoorConfig::pinIds[PIN_COUNT][PIN_ID_LENGTH + 1];
+uint8_t DoorConfig::pinIndex[PIN_COUNT];
+
+/*
+* Returns the index of a pin in the pins config (0-53 digital, 54-69
+* analog) by its name there, e.g. "13" or "A2". -1 if there is no such pin.
+*/
+int8_t DoorConfig::parsePinName(const char* name) {
+    uint8_t offset = 0;
+    int number = 0;
+
+    if (name[0] == 'A') {
+        offset = 54;
+        name++;
+    }
+    if (*name == '\0')
+        return -1;
+    for (; *name != '\0'; name++) {
+        if (*name < '0' || *name > '9' || number > 69)
+            return -1;
+        number = number * 10 + (*name - '0');
+    }
+    if (number >= (offset ? 16 : 54))
+        return -1;
+    return offset + number;
+}
+
+/*
+* Sorts the pins by id, so that the pins of the doors config can be looked
+* up with a binary search. Insertion sort, the table is small and loaded 
+* once.
+*/
+void DoorConfig::buildPinIndex() {
+    for (uint8_t i=0; i < PIN_COUNT; i++) {
+        uint8_t index = i;
+        uint8_t j = i;
+        while (j > 0 && strcmp(pinIds[pinIndex[j - 1]], pinIds[index]) > 0) {
+            pinIndex[j] = pinIndex[j - 1];
+            j--;
+        }
+        pinIndex[j] = index;
+    }
+}
+
+/*
+* Reads the pins config, one object of pin name/pin id members in any
+* order, e.g. "22": "R01". Each id is 3 characters long.
+*/
+bool DoorConfig::parsePins(Stream& stream) {
+    bool parsed = false;
+
+    // Pins that aren't in the file can't be used.
+    for (uint8_t i=0; i < PIN_COUNT; i++) {
+        strcpy(pinIds[i], "N/A");
+    }
+
+    char token[CONFIG_TOKEN_LENGTH];
+    JsonTokenizer json(stream, token, sizeof(token));
+    JsonToken_t t = json.next();
+    if (t == JSON_BEGIN_OBJECT) {
+        while ((t = json.next()) == JSON_KEY) {
+            int8_t index = parsePinName(token);
+            if (index < 0) {
+                cout << F("Unknown pin ") << token << endl;
+                break;
+            }
+            if (json.next() != JSON_STRING) {
+                cout << F("Expected an id for pin ") << (int)index << endl;
+                break;
+            }
+            // Longer ids are cut to their first three characters.
+            token[PIN_ID_LENGTH] = '\0';
+            strcpy(pinIds[index], token);
+        }
+        parsed = (t == JSON_END_OBJECT) && (json.next() == JSON_END);
+    }
+    if (parsed)
+        buildPinIndex();
+    return parsed;
+}
+
+/*
+* Returns a pin number given the passed pin id.
+*/
+uint8_t DoorConfig::getPinNumber(const char* pinId) {
+    uint8_t low = 0;
+    uint8_t high = PIN_COUNT;
+
+    while (low < high) {
+        uint8_t middle = (low + high) / 2;
+        int result = strcmp(pinIds[pinIndex[middle]], pinId);
+        if (result == 0) {
+            uint8_t index = pinIndex[middle];
+            return (index < 54) ? index : A0 + (index - 54);
+        }
+        if (result < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    // If we find nothing...
+    cout << F("No matching pin number found for pin id ") << pinId << endl;
+    return 255;
+}
+
+/*
+* Returns the peripheral type of a door config container, by its key, or
+* -1 if it isn't a peripheral container.
+*/
+int8_t DoorConfig::peripheralType(const char* key) {
+    if (strcmp(key, "REX") == 0) return REX;
+    if (strcmp(key, "DoorMonitor") == 0) return DOORMONITOR;
+    if (strcmp(key, "Lock") == 0) return LOCK;
+    if (strcmp(key, "Input") == 0) return DIGITAL_INPUT;
+    if (strcmp(key, "Output") == 0) return DIGITAL_OUTPUT;
+    if (strcmp(key, "GreenLED") == 0) return GREENLED;
+    if (strcmp(key, "Beeper") == 0) return BEEPER;
+    return -1;
+}
+
+/*
+* Reads the settings of a reader or peripheral into record, from the object
+* just begun to its end. Values can be strings or numbers, and settings
+* that don't apply are ignored, like unknown ones.
+*/
+bool DoorConfig::parseSettings(JsonTokenizer& json, char* token, ConfigRecord_t& record) {
+    JsonToken_t t;
+
+    while ((t = json.next()) == JSON_KEY) {
+        uint8_t setting;
+        if (strcmp(token, "Id") == 0) setting = 0;
+        else if (strcmp(token, "Pin") == 0 || strcmp(token, "Pin0") == 0) setting = 1;
+        else if (strcmp(token, "Pin1") == 0) setting = 2;
+        else if (strcmp(token, "ActiveLevel") == 0 || strcmp(token, "Format") == 0) setting = 3;
+        else if (strcmp(token, "Debounce") == 0) setting = 4;
+        else if (strcmp(token, "PulseGap") == 0) setting = 5;
+        else {
+            if (!json.skip())
+                return false;
+            continue;
+        }
+
+        t = json.next();
+        if (t != JSON_STRING && t != JSON_NUMBER)
+            return false;
+        switch (setting) {
+            case 0:
+                strcpy(record.id, token);
+                break;
+            case 1:
+                record.pin = getPinNumber(token);
+                if (record.pin == 255)
+                    return false;
+                break;
+            case 2:
+                record.pin1 = getPinNumber(token);
+                if (record.pin1 == 255)
+                    return false;
+                break;
+            case 3:
+                if (record.kind == CONFIG_READER) {
+                    if (WiegandFormats::find(token) < 0) {
+                        cout << F("Unknown card format ") << token << endl;
+                        return false;
+                    }
+                    record.level = WiegandFormats::find(token);
+                }
+                else if (strcmp(token, "HIGH") == 0) {
+                    record.level = HIGH;
+                }
+                else if (strcmp(token, "LOW") == 0) {
+                    record.level = LOW;
+                }
+                else {
+                    cout << F("Unknown active level ") << token << endl;
+                    return false;
+                }
+                break;
+            case 4:
+                record.debounceMs = atoi(token);
+                break;
+            case 5:
+                record.pulseGapMs = atoi(token);
+                break;
+        }
+    }
+    return (t == JSON_END_OBJECT);
+}
+
+/*
+* Adds a record to the configuration being loaded. Returns NULL if the
+* door tables are out of room.
+*/
+ConfigRecord_t* DoorConfig::stageRecord(PACSDoorManager& manager, const ConfigRecord_t& record) {
+    ConfigRecord_t* staged = manager.addRecord(record);
+    if (staged == NULL)
+        cout << F("Out of memory for ") << record.id << endl;
+    return staged;
+}
+
+/*
+* Reads a peripheral object, just begun, and adds the peripheral to the
+* last door.
+*/
+bool DoorConfig::parsePeripheral(PACSDoorManager& manager, JsonTokenizer& json, char* token, PACSPeripheralType_t type) {
+    ConfigRecord_t record = {CONFIG_PERIPHERAL, "", type, 255, 255, LOW, 0, 0};
+
+    if (!parseSettings(json, token, record) || record.pin == 255)
+        return false;
+    return (stageRecord(manager, record) != NULL);
+}
+
+/*
+* Reads a reader object, just begun: its Wiegand interface, which becomes
+* the reader, and its LED and beeper, which become peripherals of the
+* last door.
+*/
+bool DoorConfig::parseReader(PACSDoorManager& manager, JsonTokenizer& json, char* token) {
+    JsonToken_t t;
+
+    while ((t = json.next()) == JSON_KEY) {
+        int8_t type = peripheralType(token);
+        if (strcmp(token, "Wiegand") == 0) {
+            ConfigRecord_t record = {CONFIG_READER, "", 0, 255, 255, WIEGAND_DEFAULT_FORMAT, 0, 0};
+            if (json.next() != JSON_BEGIN_OBJECT || !parseSettings(json, token, record) ||
+                record.pin == 255 || record.pin1 == 255 || stageRecord(manager, record) == NULL)
+                return false;
+        }
+        else if (type == GREENLED || type == BEEPER) {
+            if (json.next() != JSON_BEGIN_OBJECT || !parsePeripheral(manager, json, token, (PACSPeripheralType_t)type))
+                return false;
+        }
+        else if (!json.skip()) {
+            return false;
+        }
+    }
+    return (t == JSON_END_OBJECT);
+}
+
+/*
+* Reads the value of a reader or peripheral container of a door, e.g. 
+* "REX": [{...}, {...}]. A single object is taken as well as an array.
+*/
+bool DoorConfig::parseContainer(PACSDoorManager& manager, JsonTokenizer& json, char* token, int8_t type) {
+    JsonToken_t t = json.next();
+    bool array = (t == JSON_BEGIN_ARRAY);
+
+    if (array)
+        t = json.next();
+    while (t == JSON_BEGIN_OBJECT) {
+        if (type < 0 ? !parseReader(manager, json, token) : !parsePeripheral(manager, json, token, (PACSPeripheralType_t)type))
+            return false;
+        if (!array)
+            return true;
+        t = json.next();
+    }
+    return array && (t == JSON_END_ARRAY);
+}
+
+/*
+* Reads a door object, just begun, and adds the door. The door is named
+* by its key in the file, unless it has an Id.
+*/
+bool DoorConfig::parseDoor(PACSDoorManager& manager, JsonTokenizer& json, char* token) {
+    ConfigRecord_t record = {CONFIG_DOOR, "", 0, 255, 255, 0, 0, 0};
+    strcpy(record.id, token);
+    ConfigRecord_t* door = stageRecord(manager, record);
+    JsonToken_t t;
+
+    if (door == NULL)
+        return false;
+
+    while ((t = json.next()) == JSON_KEY) {
+        int8_t type = peripheralType(token);
+        bool parsed;
+        if (strcmp(token, "Id") == 0) {
+            parsed = (json.next() == JSON_STRING);
+            strcpy(door->id, token);
+        }
+        else if (strcmp(token, "Reader") == 0) {
+            parsed = parseContainer(manager, json, token, -1);
+        }
+        else if (type >= 0 && type != GREENLED && type != BEEPER) {
+            parsed = parseContainer(manager, json, token, type);
+        }
+        else {
+            parsed = json.skip();
+        }
+        if (!parsed)
+            return false;
+    }
+    return (t == JSON_END_OBJECT);
+}
+
+/*
+* Parses the doors config, one object of door objects, in a single pass.
+* The doors can have any keys and come in any order, and there can be as
+* many as there is room for in the door tables. The pins config has to be
+* parsed first.
+*/
+bool DoorConfig::parseDoors(Stream& stream, PACSDoorManager& manager) {
+    char token[CONFIG_TOKEN_LENGTH];
+    JsonTokenizer json(stream, token, sizeof(token));
+    JsonToken_t t;
+
+    if (json.next() != JSON_BEGIN_OBJECT) {
+        cout << F("The door configuration is not a JSON object.\n");
+        return false;
+    }
+
+    while ((t = json.next()) == JSON_KEY) {
+        char key[CONFIG_TOKEN_LENGTH];
+        strcpy(key, token);
+        if (json.next() != JSON_BEGIN_OBJECT || !parseDoor(manager, json, token)) {
+            cout << F("Error parsing door ") << key << endl;
+            return false;
+        }
+    }
+
+    if (t != JSON_END_OBJECT || json.next() != JSON_END) {
+        cout << F("The door configuration is not valid JSON.\n");
+        return false;
+    }
+    return true;
+}
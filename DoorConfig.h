@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef DOORCONFIG_H_
+#define DOORCONFIG_H_
+
+#include <Arduino.h>
+#include "PACSDoorManager.h"
+#include "JsonTokenizer.h"
+
+#define PIN_COUNT 70 // Pins of the Mega in the pins config: digital 0-53, then analog 0-15.
+#define PIN_ID_LENGTH 3 // Pin ids are three characters, e.g. "R01".
+#define CONFIG_TOKEN_LENGTH (CONFIG_ID_MAX_LENGTH + 1) // Longest id, or other value, in the config files.
+
+/*
+* Parsers of the config files. The pins config gives the pins ids, and the
+* doors config refers to the pins by those ids. Both are read from a stream
+* in a single pass with a JsonTokenizer, as there isn't memory enough to
+* load either file, and the doors are added to the door manager a record at
+* a time.
+*/
+class DoorConfig {
+    public:
+        static bool parsePins(Stream&); // Read the pin ids, pins that aren't in the file get "N/A".
+        static bool parseDoors(Stream&, PACSDoorManager&); // Add the records of the doors.
+        static int8_t parsePinName(const char*); // Index of a pin by its name in the pins config, -1 if none.
+        static uint8_t getPinNumber(const char*); // Pin number by id, 255 if there is none.
+
+    private:
+        static void buildPinIndex();
+        static int8_t peripheralType(const char*);
+        static bool parseSettings(JsonTokenizer&, char*, ConfigRecord_t&);
+        static ConfigRecord_t* stageRecord(PACSDoorManager&, const ConfigRecord_t&);
+        static bool parsePeripheral(PACSDoorManager&, JsonTokenizer&, char*, PACSPeripheralType_t);
+        static bool parseReader(PACSDoorManager&, JsonTokenizer&, char*);
+        static bool parseContainer(PACSDoorManager&, JsonTokenizer&, char*, int8_t);
+        static bool parseDoor(PACSDoorManager&, JsonTokenizer&, char*);
+
+        static char pinIds[PIN_COUNT][PIN_ID_LENGTH + 1]; // By index, see parsePinName().
+        static uint8_t pinIndex[PIN_COUNT]; // Indices sorted by id, see buildPinIndex().
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "EdgeCapture.h"
+
+#define EXTERNAL_INTERRUPTS 8 // INT0...INT7, the most any AVR has.
+
+EdgeSlot_t EdgeCapture::slots[EDGE_MAX_PINS];
+uint8_t EdgeCapture::slotCount = 0;
+
+EdgeEvent_t EdgeCapture::events[EDGE_QUEUE_LENGTH];
+volatile uint8_t EdgeCapture::queueHead = 0;
+volatile uint8_t EdgeCapture::queueTail = 0;
+volatile uint16_t EdgeCapture::overflows = 0;
+
+// attachInterrupt() doesn't tell the handler which interrupt fired, so
+// every external interrupt gets its own handler.
+template <uint8_t N> static void onExternalInterrupt() {
+    EdgeCapture::sample(EDGE_SOURCE_EXTERNAL + N);
+}
+
+static void (* const externalHandlers[EXTERNAL_INTERRUPTS])() = {
+    onExternalInterrupt<0>, onExternalInterrupt<1>, onExternalInterrupt<2>, onExternalInterrupt<3>,
+    onExternalInterrupt<4>, onExternalInterrupt<5>, onExternalInterrupt<6>, onExternalInterrupt<7>
+};
+
+/*
+* Starts capturing level changes on a pin. The level is what the caller
+* currently assumes the pin to be, if it's something else a change is
+* queued right away. Pin change interrupts are preferred, as they leave the
+* external interrupts free. Attaching the same pin twice has no effect.
+*/
+bool EdgeCapture::attach(uint8_t pin, uint8_t level) {
+    for (uint8_t i=0; i < slotCount; i++) {
+        if (slots[i].pin == pin)
+            return true;
+    }
+    if (slotCount == EDGE_MAX_PINS || pin >= NUM_DIGITAL_PINS || 
+        digitalPinToPort(pin) == NOT_A_PORT)
+        return false;
+
+    uint8_t source;
+    int external = digitalPinToInterrupt(pin);
+#if defined(PCICR)
+    if (digitalPinToPCICR(pin) != 0) {
+        source = EDGE_SOURCE_PCINT + digitalPinToPCICRbit(pin);
+    }
+    else
+#endif
+    if (external != NOT_AN_INTERRUPT && external < EXTERNAL_INTERRUPTS) {
+        source = EDGE_SOURCE_EXTERNAL + external;
+    }
+    else {
+        return false;
+    }
+
+    uint8_t oldSREG = SREG;
+    cli();
+    EdgeSlot_t& slot = slots[slotCount++];
+    slot.pin = pin;
+    slot.source = source;
+    slot.in = portInputRegister(digitalPinToPort(pin));
+    slot.mask = digitalPinToBitMask(pin);
+    slot.level = level;
+
+#if defined(PCICR)
+    if (source < EDGE_SOURCE_EXTERNAL) {
+        *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+        PCICR |= _BV(digitalPinToPCICRbit(pin));
+    }
+#endif
+    // Queue the difference between the assumed and the actual level.
+    sample(source);
+    SREG = oldSREG;
+
+    if (source >= EDGE_SOURCE_EXTERNAL) {
+        attachInterrupt(external, externalHandlers[external], CHANGE);
+    }
+    return true;
+}
+
+/*
+* Stops capturing a pin. Changes of it that are already queued are kept.
+*/
+void EdgeCapture::detach(uint8_t pin) {
+    for (uint8_t i=0; i < slotCount; i++) {
+        if (slots[i].pin != pin)
+            continue;
+
+        uint8_t source = slots[i].source;
+        uint8_t oldSREG = SREG;
+        cli();
+#if defined(PCICR)
+        if (source < EDGE_SOURCE_EXTERNAL) {
+            *digitalPinToPCMSK(pin) &= ~_BV(digitalPinToPCMSKbit(pin));
+        }
+#endif
+        slots[i] = slots[--slotCount];
+        SREG = oldSREG;
+
+        if (source >= EDGE_SOURCE_EXTERNAL) {
+            detachInterrupt(source - EDGE_SOURCE_EXTERNAL);
+        }
+        return;
+    }
+}
+
+/*
+* Takes the oldest change from the queue. Returns false if it is empty.
+*/
+bool EdgeCapture::read(EdgeEvent_t& event) {
+    uint8_t head = queueHead;
+    if (head == queueTail)
+        return false;
+    event = events[head];
+    queueHead = (head + 1) & (EDGE_QUEUE_LENGTH - 1);
+    return true;
+}
+
+/*
+* Returns the number of changes that were dropped because the queue was
+* full, and resets the count.
+*/
+uint16_t EdgeCapture::takeOverflows() {
+    uint8_t oldSREG = SREG;
+    cli();
+    uint16_t count = overflows;
+    overflows = 0;
+    SREG = oldSREG;
+    return count;
+}
+
+/*
+* Compares the pins of an interrupt source against their last known levels
+* and queues the ones that changed. Runs in interrupt context.
+*/
+void EdgeCapture::sample(uint8_t source) {
+    for (uint8_t i=0; i < slotCount; i++) {
+        EdgeSlot_t& slot = slots[i];
+        if (slot.source != source)
+            continue;
+        uint8_t level = (*slot.in & slot.mask) ? HIGH : LOW;
+        if (level != slot.level) {
+            slot.level = level;
+            push(slot.pin, level);
+        }
+    }
+}
+
+/*
+* Puts a change in the queue, or counts it as lost if the queue is full.
+*/
+void EdgeCapture::push(uint8_t pin, uint8_t level) {
+    uint8_t tail = queueTail;
+    uint8_t next = (tail + 1) & (EDGE_QUEUE_LENGTH - 1);
+    if (next == queueHead) {
+        overflows++;
+        return;
+    }
+    events[tail].pin = pin;
+    events[tail].level = level;
+    events[tail].micros = micros();
+    queueTail = next;
+}
+
+#if defined(PCINT0_vect)
+ISR(PCINT0_vect) {
+    EdgeCapture::sample(EDGE_SOURCE_PCINT + 0);
+}
+#endif
+
+#if defined(PCINT1_vect)
+ISR(PCINT1_vect) {
+    EdgeCapture::sample(EDGE_SOURCE_PCINT + 1);
+}
+#endif
+
+#if defined(PCINT2_vect)
+ISR(PCINT2_vect) {
+    EdgeCapture::sample(EDGE_SOURCE_PCINT + 2);
+}
+#endif
@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef EDGECAPTURE_H_
+#define EDGECAPTURE_H_
+
+#include <Arduino.h>
+
+#define EDGE_QUEUE_LENGTH 64 // Size of the edge queue (power of two, one slot is always kept free).
+#ifndef EDGE_MAX_PINS
+#define EDGE_MAX_PINS 32 // Max number of pins that can be captured.
+#endif
+
+// Interrupt sources of a captured pin (EdgeCapture::slots[].source).
+#define EDGE_SOURCE_PCINT 0 // Pin change interrupt bank 0-2 (PCINT0_vect...PCINT2_vect).
+#define EDGE_SOURCE_EXTERNAL 3 // External interrupt INT0...INT7, offset by the interrupt number.
+
+// A level change on a captured pin.
+typedef struct {
+    uint8_t pin; // The hardware-pin that changed.
+    uint8_t level; // The new level, HIGH or LOW.
+    unsigned long micros; // micros() when the change was seen.
+} EdgeEvent_t;
+
+// A pin being captured. The level is the last one seen by the interrupt,
+// which is what a change is detected against.
+typedef struct {
+    uint8_t pin;
+    uint8_t source;
+    volatile uint8_t* in;
+    uint8_t mask;
+    uint8_t level;
+} EdgeSlot_t;
+
+/*
+* Interrupt driven capture of input level changes. Pins are watched through
+* their pin change (PCINTn) or external (INTn) interrupt, and every change is
+* put in a queue together with its timestamp. The queue has one producer (the
+* interrupts, which don't nest) and one consumer (the main loop), so it needs
+* no locking beyond the volatile head and tail indices.
+*
+* Pins without an interrupt are not captured, and have to be polled.
+*/
+class EdgeCapture {
+    public:
+        static bool attach(uint8_t, uint8_t); // Capture a pin, given its assumed level. False if it has no interrupt.
+        static void detach(uint8_t); // Stop capturing a pin.
+        static bool read(EdgeEvent_t&); // Take the oldest change from the queue.
+        static uint16_t takeOverflows(); // Number of changes lost to a full queue since last call.
+        static void sample(uint8_t); // Called from the interrupts of a source.
+
+    private:
+        static void push(uint8_t, uint8_t);
+
+        static EdgeSlot_t slots[EDGE_MAX_PINS];
+        static uint8_t slotCount;
+
+        static EdgeEvent_t events[EDGE_QUEUE_LENGTH];
+        static volatile uint8_t queueHead; // Index of the oldest change.
+        static volatile uint8_t queueTail; // Index where the next change will be put.
+        static volatile uint16_t overflows;
+};
+
+#endif
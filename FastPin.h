@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FASTPIN_H_
+#define FASTPIN_H_
+
+#include <Arduino.h>
+
+/*
+* Direct port access to a pin. The port registers and bit mask are looked
+* up once in attach(), after that reads and writes are single register
+* operations instead of going through digitalRead/digitalWrite.
+*
+* attach() does not change the pin mode, that is still done with pinMode().
+*/
+class FastPin {
+    public:
+        FastPin() : in(&unused), out(&unused), mask(0) {}
+
+        // Resolve the port registers of the pin. Invalid pins are attached
+        // to a dummy register, so they can be used without further checks.
+        void attach(uint8_t pin) {
+            if (pin >= NUM_DIGITAL_PINS || digitalPinToPort(pin) == NOT_A_PORT) {
+                in = out = &unused;
+                mask = 0;
+                return;
+            }
+            uint8_t port = digitalPinToPort(pin);
+            in = portInputRegister(port);
+            out = portOutputRegister(port);
+            mask = digitalPinToBitMask(pin);
+        }
+
+        inline uint8_t read() const {
+            return (*in & mask) ? HIGH : LOW;
+        }
+
+        // The input register and bit of the pin, for reading several pins
+        // of the same port at once. The mask is 0 for invalid pins.
+        inline volatile uint8_t* inputRegister() const { return in; }
+        inline uint8_t bitMask() const { return mask; }
+
+        // Writes are read-modify-write on the port register, so interrupts
+        // are disabled while writing from the main loop.
+        inline void write(uint8_t level) {
+            uint8_t oldSREG = SREG;
+            cli();
+            writeFromISR(level);
+            SREG = oldSREG;
+        }
+
+        template <uint8_t LEVEL> inline void write() {
+            uint8_t oldSREG = SREG;
+            cli();
+            writeFromISR<LEVEL>();
+            SREG = oldSREG;
+        }
+
+        // Only to be used where interrupts are already disabled.
+        inline void writeFromISR(uint8_t level) {
+            if (level == LOW) *out &= ~mask;
+            else *out |= mask;
+        }
+
+        template <uint8_t LEVEL> inline void writeFromISR() {
+            if (LEVEL == LOW) *out &= ~mask;
+            else *out |= mask;
+        }
+
+    private:
+        volatile uint8_t* in;
+        volatile uint8_t* out;
+        uint8_t mask;
+
+        static volatile uint8_t unused;
+};
+
+#endif
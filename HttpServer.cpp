@@ -0,0 +1,621 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "HttpServer.h"
+#include "JsonWriter.h"
+#include <avr/pgmspace.h>
+
+#define HTTP_HEAD_LENGTH 256 // Room for the status line and headers of a response.
+#define HTTP_CHUNK_HEAD 4 // Room for the size line of a chunk, e.g. "80\r\n".
+
+char HttpServer::requestLine[HTTP_REQUEST_LINE_LENGTH + 1];
+
+HttpServer::HttpServer(const char* prefix, uint16_t port)
+    : server(port), urlPrefix(prefix), defaultCommand(NULL), failureCommand(NULL), urlPathCommand(NULL),
+      commandCount(0), client(NULL), requestType(INVALID) {
+    for (uint8_t i=0; i < HTTP_MAX_CONNECTIONS; i++) {
+        connections[i].open = false;
+    }
+}
+
+void HttpServer::begin() {
+    server.begin();
+}
+
+void HttpServer::setDefaultCommand(Command* command) {
+    defaultCommand = command;
+}
+
+void HttpServer::setFailureCommand(Command* command) {
+    failureCommand = command;
+}
+
+void HttpServer::setUrlPathCommand(UrlPathCommand* command) {
+    urlPathCommand = command;
+}
+
+void HttpServer::addCommand(const char* name, Command* command) {
+    if (commandCount == HTTP_MAX_COMMANDS)
+        return;
+    commandNames[commandCount] = name;
+    commands[commandCount++] = command;
+}
+
+/*
+* Accepts new connections and serves the requests that have arrived on the
+* open ones, a few at a time so that the rest of the loop keeps running. A
+* new connection that finds all slots taken replaces the one that has been
+* idle the longest.
+*/
+void HttpServer::processConnection() {
+    EthernetClient incoming = server.accept();
+    if (incoming) {
+        Connection_t* c = &connections[0];
+        for (uint8_t i=0; i < HTTP_MAX_CONNECTIONS; i++) {
+            if (!connections[i].open) {
+                c = &connections[i];
+                break;
+            }
+            if ((long)(connections[i].lastActive - c->lastActive) < 0)
+                c = &connections[i];
+        }
+        if (c->open)
+            close(*c);
+
+        incoming.setConnectionTimeout(100);
+        c->client = incoming;
+        c->open = true;
+        c->lastActive = millis();
+    }
+
+    for (uint8_t i=0; i < HTTP_MAX_CONNECTIONS; i++) {
+        Connection_t& c = connections[i];
+        if (!c.open)
+            continue;
+
+        for (uint8_t served=0; c.open && served < HTTP_MAX_PIPELINED && c.client.available(); served++) {
+            if (!serveRequest(c))
+                close(c);
+        }
+
+        if (c.open && (!c.client.connected() || (millis() - c.lastActive > HTTP_KEEPALIVE_TIMEOUT_MS)))
+            close(c);
+    }
+}
+
+uint8_t HttpServer::connectionCount() const {
+    uint8_t count = 0;
+    for (uint8_t i=0; i < HTTP_MAX_CONNECTIONS; i++) {
+        if (connections[i].open)
+            count++;
+    }
+    return count;
+}
+
+/*
+* Closes the connection that has been idle longest, if no request is
+* waiting on it. A kept-alive connection is only a convenience, the client
+* reconnects for its next request.
+*/
+bool HttpServer::closeIdle() {
+    Connection_t* c = NULL;
+    for (uint8_t i=0; i < HTTP_MAX_CONNECTIONS; i++) {
+        if (!connections[i].open || connections[i].client.available())
+            continue;
+        if (c == NULL || (long)(connections[i].lastActive - c->lastActive) < 0)
+            c = &connections[i];
+    }
+    if (c == NULL)
+        return false;
+    close(*c);
+    return true;
+}
+
+void HttpServer::close(Connection_t& c) {
+    c.client.stop();
+    c.open = false;
+}
+
+/*
+* Reads and answers one request. Returns false if the connection has to be
+* closed afterwards.
+*/
+bool HttpServer::serveRequest(Connection_t& c) {
+    client = &c.client;
+    c.lastActive = millis();
+
+    requestType = INVALID;
+    http11 = false;
+    keepAlive = false;
+    contentLeft = 0;
+    lengthKnown = true;
+    bodyLost = false;
+    gzipAccepted = false;
+    ifNoneMatch[0] = '\0';
+    status = NULL;
+    contentType = NULL;
+    extraHeaders[0] = '\0';
+    headersSent = false;
+    chunked = false;
+    noBody = false;
+    contentLength = -1;
+    txLength = 0;
+    headLength = 0;
+
+    // Empty lines before a request are allowed, and skipped.
+    bool complete;
+    do {
+        if (!readLine(requestLine, sizeof(requestLine), complete))
+            return false;
+    } while (requestLine[0] == '\0');
+
+    // <method> <url> <version>
+    char* url = strchr(requestLine, ' ');
+    char* version = (url != NULL) ? strchr(url + 1, ' ') : NULL;
+    if (version != NULL) {
+        *url++ = '\0';
+        *version++ = '\0';
+        http11 = (strcmp_P(version, PSTR("HTTP/1.1")) == 0);
+
+        if (strcmp_P(requestLine, PSTR("GET")) == 0) requestType = GET;
+        else if (strcmp_P(requestLine, PSTR("HEAD")) == 0) requestType = HEAD;
+        else if (strcmp_P(requestLine, PSTR("POST")) == 0) requestType = POST;
+        else if (strcmp_P(requestLine, PSTR("PUT")) == 0) requestType = PUT;
+        else if (strcmp_P(requestLine, PSTR("DELETE")) == 0) requestType = DELETE;
+        else if (strcmp_P(requestLine, PSTR("PATCH")) == 0) requestType = PATCH;
+    }
+    keepAlive = http11;
+    readHeaders();
+
+    if (!complete || requestType == INVALID) {
+        keepAlive = false;
+        if (failureCommand)
+            failureCommand(*this, requestType, (char*)"", false);
+    }
+    else {
+        dispatch(requestType, url);
+    }
+    finishResponse();
+
+    // Skip what's left of the body, to get to the next request.
+    while (read() != -1)
+        ;
+    return keepAlive;
+}
+
+/*
+* Reads the headers that matter for serving the request, and skips the rest.
+*/
+void HttpServer::readHeaders() {
+    char line[HTTP_HEADER_LINE_LENGTH + 1];
+    bool complete;
+    bool hasLength = false;
+
+    while (readLine(line, sizeof(line), complete) && line[0] != '\0') {
+        char* value = strchr(line, ':');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        while (*value == ' ')
+            value++;
+
+        if (strcasecmp_P(line, PSTR("Content-Length")) == 0) {
+            contentLeft = atol(value);
+            hasLength = true;
+        }
+        else if (strcasecmp_P(line, PSTR("Connection")) == 0) {
+            if (strncasecmp_P(value, PSTR("close"), 5) == 0)
+                keepAlive = false;
+            else if (strncasecmp_P(value, PSTR("keep-alive"), 10) == 0)
+                keepAlive = true;
+        }
+        else if (strcasecmp_P(line, PSTR("Accept-Encoding")) == 0) {
+            gzipAccepted = (strstr_P(value, PSTR("gzip")) != NULL);
+        }
+        else if (strcasecmp_P(line, PSTR("If-None-Match")) == 0) {
+            if (strlen(value) <= HTTP_ETAG_LENGTH)
+                strcpy(ifNoneMatch, value);
+        }
+    }
+
+    // Without a length, the body lasts until the client closes.
+    if (!hasLength && (requestType == POST || requestType == PUT || requestType == PATCH)) {
+        contentLeft = 0x7FFFFFFFL;
+        lengthKnown = false;
+        keepAlive = false;
+    }
+}
+
+/*
+* Reads a line of the request, without the line ending. Characters that
+* don't fit are dropped, which complete tells. Returns false if the line
+* stops arriving for HTTP_READ_TIMEOUT_MS.
+*/
+bool HttpServer::readLine(char* line, uint8_t size, bool& complete) {
+    uint8_t length = 0;
+    unsigned long start = millis();
+    complete = true;
+
+    for (;;) {
+        int ch = client->read();
+        if (ch < 0) {
+            if (!client->connected() || (millis() - start > HTTP_READ_TIMEOUT_MS))
+                return false;
+            continue;
+        }
+        start = millis();
+        if (ch == '\n')
+            break;
+        if (ch == '\r')
+            continue;
+        if (length < size - 1)
+            line[length++] = ch;
+        else
+            complete = false;
+    }
+    line[length] = '\0';
+    return true;
+}
+
+/*
+* Runs the command for the path of the request: the default command for
+* "/", a command added with addCommand() for "/<name>", and the URL path
+* command, with the path split into its segments, for anything else.
+*/
+void HttpServer::dispatch(ConnectionType type, char* url) {
+    size_t prefixLength = strlen(urlPrefix);
+    if (strncmp(url, urlPrefix, prefixLength) != 0 || url[prefixLength] != '/') {
+        if (failureCommand)
+            failureCommand(*this, type, (char*)"", true);
+        return;
+    }
+    url += prefixLength + 1;
+
+    char* tail = strchr(url, '?');
+    if (tail != NULL)
+        *tail++ = '\0';
+    else
+        tail = url + strlen(url);
+
+    if (*url == '\0') {
+        if (defaultCommand)
+            defaultCommand(*this, type, tail, true);
+        return;
+    }
+
+    for (uint8_t i=0; i < commandCount; i++) {
+        if (strcmp(url, commandNames[i]) == 0) {
+            commands[i](*this, type, tail, true);
+            return;
+        }
+    }
+
+    if (urlPathCommand) {
+        char* path[HTTP_MAX_PATH_SEGMENTS + 1];
+        uint8_t count = 0;
+        path[count++] = url;
+        for (char* p = url; *p && count < HTTP_MAX_PATH_SEGMENTS; p++) {
+            if (*p == '/') {
+                *p = '\0';
+                path[count++] = p + 1;
+            }
+        }
+        path[count] = NULL;
+        urlPathCommand(*this, type, path, tail, true);
+    }
+    else if (failureCommand) {
+        failureCommand(*this, type, tail, true);
+    }
+}
+
+/*
+* Gets the next name=value pair of the URL parameters, URL decoded. Names
+* and values that are too long are cut and flagged.
+*/
+URLPARAM_RESULT HttpServer::nextURLparam(char** tail, char* name, int nameLength, char* value, int valueLength) {
+    char* s = *tail;
+    if (*s == '\0')
+        return URLPARAM_EOS;
+
+    bool nameOverflow = false;
+    bool valueOverflow = false;
+    s = decode(s, name, nameLength, '=', nameOverflow);
+    if (*s == '=')
+        s++;
+    s = decode(s, value, valueLength, '&', valueOverflow);
+    if (*s == '&')
+        s++;
+    *tail = s;
+
+    if (nameOverflow && valueOverflow)
+        return URLPARAM_BOTH_OFLO;
+    if (nameOverflow)
+        return URLPARAM_NAME_OFLO;
+    if (valueOverflow)
+        return URLPARAM_VALUE_OFLO;
+    return URLPARAM_OK;
+}
+
+/*
+* URL decodes from s into out, up to stop, '&' or the end of s. Returns
+* where it stopped.
+*/
+char* HttpServer::decode(char* s, char* out, int size, char stop, bool& overflow) {
+    int length = 0;
+    while (*s != '\0' && *s != stop && *s != '&') {
+        char ch = *s++;
+        if (ch == '+') {
+            ch = ' ';
+        }
+        else if (ch == '%' && isxdigit(s[0]) && isxdigit(s[1])) {
+            char hex[3] = { s[0], s[1], '\0' };
+            ch = (char)strtol(hex, NULL, 16);
+            s += 2;
+        }
+        if (length < size - 1)
+            out[length++] = ch;
+        else
+            overflow = true;
+    }
+    out[length] = '\0';
+    return s;
+}
+
+/*
+* Returns the next byte of the request body, or -1 at its end (or if it
+* doesn't arrive in time).
+*/
+int HttpServer::read() {
+    if (contentLeft <= 0)
+        return -1;
+
+    unsigned long start = millis();
+    while (!client->available()) {
+        if (!client->connected() || (millis() - start > HTTP_READ_TIMEOUT_MS)) {
+            // The rest of the request is lost, and the connection with it.
+            // Closing is how a body without a length ends, though.
+            bodyLost = lengthKnown || client->connected();
+            contentLeft = 0;
+            keepAlive = false;
+            return -1;
+        }
+    }
+    contentLeft--;
+    return client->read();
+}
+
+/*
+* Reads as much of the body as is waiting, up to length bytes, after
+* waiting for the first like read() does. Returns the number of bytes read,
+* 0 at the end of the body.
+*/
+int HttpServer::read(uint8_t* buffer, size_t length) {
+    if (length == 0)
+        return 0;
+    int c = read();
+    if (c < 0)
+        return 0;
+    buffer[0] = c;
+
+    long more = client->available();
+    if (more > contentLeft)
+        more = contentLeft;
+    if (more > (long)length - 1)
+        more = length - 1;
+    if (more > 0) {
+        more = client->read(buffer + 1, more);
+        if (more < 0)
+            more = 0;
+        contentLeft -= more;
+    }
+    return more + 1;
+}
+
+bool HttpServer::bodyComplete() const {
+    return !bodyLost && contentLeft <= 0;
+}
+
+bool HttpServer::available() {
+    return (contentLeft > 0) && client->available();
+}
+
+/*
+* Checks if the client already has the version of the resource with the
+* specified entity tag (quotes included), in which case it can be told so
+* with httpNotModified().
+*/
+bool HttpServer::etagMatches(const char* etag) const {
+    return (ifNoneMatch[0] != '\0') && (strstr(ifNoneMatch, etag) != NULL);
+}
+
+/*
+* Starts a response. The status line and headers are sent with the first
+* block of the body, or when the command is done.
+*/
+void HttpServer::sendStatus(const __FlashStringHelper* text, const char* type, const char* headers) {
+    status = text;
+    contentType = type;
+    extraHeaders[0] = '\0';
+    if (headers != NULL && strlen(headers) < sizeof(extraHeaders))
+        strcpy(extraHeaders, headers);
+}
+
+void HttpServer::httpSuccess(const char* type, const char* headers) {
+    sendStatus(F("200 OK"), type, headers);
+}
+
+void HttpServer::httpFail() {
+    sendStatus(F("400 Bad Request"), "text/html; charset=utf-8", NULL);
+}
+
+void HttpServer::httpNotModified(const char* headers) {
+    sendStatus(F("304 Not Modified"), NULL, headers);
+    noBody = true;
+}
+
+/*
+* Sets the length of the body that's about to be written. It is then sent
+* as it is written, without going through the buffer.
+*/
+void HttpServer::setContentLength(unsigned long length) {
+    contentLength = length;
+}
+
+void HttpServer::printP(const unsigned char* text) {
+    uint8_t ch;
+    while ((ch = pgm_read_byte(text++)) != 0)
+        write(ch);
+}
+
+void HttpServer::printCRLF() {
+    write('\r');
+    write('\n');
+}
+
+size_t HttpServer::write(uint8_t ch) {
+    // HEAD requests get the headers only, with the length the body would have.
+    if (noBody)
+        return 1;
+    if (requestType == HEAD) {
+        headLength++;
+        return 1;
+    }
+    txBuffer[HTTP_CHUNK_HEAD + txLength++] = ch;
+    if (txLength == HTTP_TX_BUFFER_SIZE)
+        flushBuffer();
+    return 1;
+}
+
+size_t HttpServer::write(const uint8_t* data, size_t length) {
+    if (noBody)
+        return length;
+    if (requestType == HEAD) {
+        headLength += length;
+        return length;
+    }
+    if (contentLength >= 0) {
+        flushBuffer();
+        return client->write(data, length);
+    }
+    for (size_t i=0; i < length; i++)
+        write(data[i]);
+    return length;
+}
+
+/*
+* Sends the status line and headers. A final response (one that's all in
+* the buffer) gets a Content-Length. Otherwise the body is chunked, or the
+* connection closed after it for an HTTP/1.0 client. A HEAD response is
+* always final, and gets the length of the body it left out.
+*/
+void HttpServer::sendHeaders(bool final) {
+    char buffer[HTTP_HEAD_LENGTH];
+    JsonBuffer head(buffer, sizeof(buffer));
+
+    if (status == NULL)
+        status = F("200 OK");
+    if (contentType == NULL)
+        contentType = "text/html; charset=utf-8";
+
+    head.print(http11 ? F("HTTP/1.1 ") : F("HTTP/1.0 "));
+    head.print(status);
+    head.print(F("\r\nAccess-Control-Allow-Origin: *\r\n"));
+    if (!noBody) {
+        head.print(F("Content-Type: "));
+        head.print(contentType);
+        head.print(F("\r\n"));
+    }
+    head.print(extraHeaders);
+
+    if (noBody) {
+        // Nothing about the body.
+    }
+    else if (contentLength >= 0) {
+        head.print(F("Content-Length: "));
+        head.print(contentLength);
+        head.print(F("\r\n"));
+    }
+    else if (final) {
+        head.print(F("Content-Length: "));
+        if (requestType == HEAD)
+            head.print(headLength);
+        else
+            head.print(txLength);
+        head.print(F("\r\n"));
+    }
+    else if (http11 && keepAlive) {
+        head.print(F("Transfer-Encoding: chunked\r\n"));
+        chunked = true;
+    }
+    else {
+        keepAlive = false;
+    }
+    if (!keepAlive)
+        head.print(F("Connection: close\r\n"));
+    else if (!http11)
+        head.print(F("Connection: keep-alive\r\n"));
+    head.print(F("\r\n"));
+
+    client->write((const uint8_t*)head.c_str(), head.length());
+    headersSent = true;
+}
+
+/*
+* Sends the buffered part of the body. A chunk gets its size line and line
+* ending around the data in the buffer, so that it goes out in one write.
+*/
+void HttpServer::flushBuffer() {
+    if (!headersSent)
+        sendHeaders(false);
+    if (txLength == 0)
+        return;
+
+    uint8_t* block = txBuffer + HTTP_CHUNK_HEAD;
+    size_t length = txLength;
+    if (chunked) {
+        static const char hex[] = "0123456789ABCDEF";
+        block[length++] = '\r';
+        block[length++] = '\n';
+        *--block = '\n';
+        *--block = '\r';
+        *--block = hex[txLength & 0x0F];
+        length += 3;
+        if (txLength > 0x0F) {
+            *--block = hex[txLength >> 4];
+            length++;
+        }
+    }
+    client->write(block, length);
+    txLength = 0;
+}
+
+/*
+* Sends what's left of the response once the command is done.
+*/
+void HttpServer::finishResponse() {
+    if (!headersSent) {
+        sendHeaders(true);
+        if (txLength)
+            client->write(txBuffer + HTTP_CHUNK_HEAD, txLength);
+        txLength = 0;
+        return;
+    }
+    flushBuffer();
+    if (chunked)
+        client->write((const uint8_t*)"0\r\n\r\n", 5);
+}
@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef HTTPSERVER_H_
+#define HTTPSERVER_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+// The sockets of the Ethernet chip are shared by the HTTP and websocket
+// servers: one for each listener, the rest for open HTTP connections and
+// websocket clients together (see WS_MAX_CLIENTS). The W5100 of the
+// Ethernet Shield has 4, a W5500 has 8.
+#ifndef ETHERNET_SOCKETS
+#define ETHERNET_SOCKETS 4
+#endif
+#if ETHERNET_SOCKETS > MAX_SOCK_NUM
+#error "ETHERNET_SOCKETS is more than the Ethernet library supports"
+#endif
+#define HTTP_MAX_CONNECTIONS ((ETHERNET_SOCKETS > 4) ? 2 : 1) // Open connections, each one holds a socket.
+#define HTTP_MAX_COMMANDS 8 // Max number of commands added with addCommand().
+#define HTTP_REQUEST_LINE_LENGTH 160 // Longer request lines are refused.
+#define HTTP_HEADER_LINE_LENGTH 64 // Only the start of longer header lines is looked at.
+#define HTTP_EXTRA_HEADERS_LENGTH 128 // Room for the extra headers of a response.
+#define HTTP_ETAG_LENGTH 24 // Longer If-None-Match values never match.
+#define HTTP_TX_BUFFER_SIZE 128 // Responses are sent in blocks of this size (at most 255).
+#define HTTP_MAX_PATH_SEGMENTS 4 // Path segments passed to the URL path command.
+#define HTTP_KEEPALIVE_TIMEOUT_MS 5000 // Idle connections are closed after this long.
+#define HTTP_MAX_PIPELINED 8 // Max requests served per connection and call of processConnection().
+
+// Max wait for the next byte of a request that has started arriving. The
+// main loop stands still meanwhile, so it is kept short. It is counted from
+// the last byte, so larger config files still arrive in full.
+#define HTTP_READ_TIMEOUT_MS 250
+
+// Declares a string in flash, for printP().
+#define P(name) static const unsigned char name[] PROGMEM
+
+enum URLPARAM_RESULT { URLPARAM_OK, URLPARAM_NAME_OFLO, URLPARAM_VALUE_OFLO, URLPARAM_BOTH_OFLO, URLPARAM_EOS };
+
+/*
+* An HTTP/1.1 server with the same interface as Webduino, which keeps
+* connections open between requests and serves pipelined requests in
+* order. 
+*
+* Responses are buffered. One that fits the buffer is sent with a 
+* Content-Length, a longer one is sent in chunks (or, to an HTTP/1.0
+* client, followed by closing the connection). A body whose length is set
+* up front is written straight to the connection instead. Any part of a request body
+* that the command didn't read is skipped, so the next request on the
+* connection is read from its start.
+*/
+class HttpServer : public Print {
+    public:
+        enum ConnectionType { INVALID, GET, HEAD, POST, PUT, DELETE, PATCH };
+
+        typedef void Command(HttpServer&, ConnectionType, char*, bool);
+        typedef void UrlPathCommand(HttpServer&, ConnectionType, char**, char*, bool);
+
+        HttpServer(const char*, uint16_t);
+
+        void begin();
+        void processConnection(); // Accept connections and serve the requests that have arrived.
+        uint8_t connectionCount() const; // Open connections.
+        bool closeIdle(); // Close an open connection with no request waiting, to free its socket.
+
+        void setDefaultCommand(Command*); // For "/".
+        void setFailureCommand(Command*); // For requests that can't be served.
+        void addCommand(const char*, Command*); // For "/<name>".
+        void setUrlPathCommand(UrlPathCommand*); // For all other paths.
+
+        // Responses.
+        void httpSuccess(const char* = "text/html; charset=utf-8", const char* = NULL);
+        void httpFail();
+        void httpNotModified(const char* = NULL); // 304, no body.
+        void setContentLength(unsigned long); // Body length, for writing the body unbuffered.
+        void printP(const unsigned char*);
+        void printCRLF();
+        virtual size_t write(uint8_t);
+        virtual size_t write(const uint8_t*, size_t);
+        using Print::write;
+
+        // Requests.
+        URLPARAM_RESULT nextURLparam(char**, char*, int, char*, int);
+        int read(); // Next byte of the request body, -1 at the end.
+        int read(uint8_t*, size_t); // Next block of the request body, 0 at the end.
+        bool bodyComplete() const; // Was all of the announced body read?
+        bool available(); // Is more of the body waiting?
+        bool acceptsGzip() const { return gzipAccepted; } // Accept-Encoding includes gzip?
+        bool etagMatches(const char*) const; // Is the tag in If-None-Match?
+
+    private:
+        // An open connection.
+        typedef struct {
+            EthernetClient client;
+            bool open;
+            unsigned long lastActive; // millis() of the last request.
+        } Connection_t;
+
+        bool serveRequest(Connection_t&);
+        bool readLine(char*, uint8_t, bool&);
+        void readHeaders();
+        void dispatch(ConnectionType, char*);
+        void sendStatus(const __FlashStringHelper*, const char*, const char*);
+        void sendHeaders(bool);
+        static char* decode(char*, char*, int, char, bool&);
+        void flushBuffer();
+        void finishResponse();
+        void close(Connection_t&);
+
+        EthernetServer server;
+        Connection_t connections[HTTP_MAX_CONNECTIONS];
+        const char* urlPrefix;
+
+        Command* defaultCommand;
+        Command* failureCommand;
+        UrlPathCommand* urlPathCommand;
+        const char* commandNames[HTTP_MAX_COMMANDS];
+        Command* commands[HTTP_MAX_COMMANDS];
+        uint8_t commandCount;
+
+        // The request being served.
+        EthernetClient* client;
+        ConnectionType requestType;
+        bool http11; // Did the client speak HTTP/1.1?
+        bool keepAlive; // Can the connection be kept after the response?
+        long contentLeft; // Bytes of the body that haven't been read.
+        bool lengthKnown; // Did the request have a Content-Length?
+        bool bodyLost; // Did the client stop before sending all of the body?
+        bool gzipAccepted;
+        char ifNoneMatch[HTTP_ETAG_LENGTH + 1];
+
+        // The response being sent.
+        const __FlashStringHelper* status;
+        char extraHeaders[HTTP_EXTRA_HEADERS_LENGTH];
+        const char* contentType;
+        bool headersSent;
+        bool chunked;
+        bool noBody; // For 304 responses.
+        long contentLength; // Set up front, or -1.
+        uint8_t txBuffer[4 + HTTP_TX_BUFFER_SIZE + 2]; // Room for the chunk size and line ending.
+        uint8_t txLength;
+        unsigned long headLength; // Body bytes left out of a HEAD response.
+
+        static char requestLine[HTTP_REQUEST_LINE_LENGTH + 1];
+};
+
+#endif
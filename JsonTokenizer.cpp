@@ -0,0 +1,203 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "JsonTokenizer.h"
+
+JsonTokenizer::JsonTokenizer(Stream& s, char* b, uint8_t l) :
+    stream(s), buffer(b), length(l), objects(0), level(0), keyNext(false),
+    valueNext(false), separatorNext(false), started(false), failed(false) {
+    buffer[0] = '\0';
+}
+
+/*
+* Reads the next token. After an error, keeps returning JSON_ERROR.
+*/
+JsonToken_t JsonTokenizer::next() {
+    if (failed)
+        return JSON_ERROR;
+
+    // Config files can be put on the SD card by hand, so nothing is taken
+    // for granted: a value is followed by a comma or a closing bracket,
+    // and a comma by another value.
+    int c = nextNonSpace();
+    bool comma = false;
+    if (separatorNext) {
+        separatorNext = false;
+        if (c == ',') {
+            comma = true;
+            c = nextNonSpace();
+        }
+        else if (c != '}' && c != ']') {
+            return fail();
+        }
+    }
+    if (c == ',')
+        return fail();
+
+    if (c < 0)
+        return (started && level == 0) ? JSON_END : fail();
+    if (started && level == 0)
+        return fail(); // Something after the top level value.
+
+    switch (c) {
+        case '{':
+        case '[':
+            if (level == JSON_TOKENIZER_MAX_DEPTH)
+                return fail();
+            if (c == '{')
+                objects |= (1UL << level);
+            else
+                objects &= ~(1UL << level);
+            level++;
+            started = true;
+            valueNext = false;
+            keyNext = (c == '{');
+            return (c == '{') ? JSON_BEGIN_OBJECT : JSON_BEGIN_ARRAY;
+
+        case '}':
+        case ']':
+            if (level == 0 || inObject() != (c == '}') || comma || valueNext)
+                return fail();
+            level--;
+            return valueDone((c == '}') ? JSON_END_OBJECT : JSON_END_ARRAY);
+
+        case '"':
+            return readString();
+
+        default:
+            return readScalar(c);
+    }
+}
+
+/*
+* Skips the value after a key, with everything nested in it. Returns false
+* if the document ends or is broken first.
+*/
+bool JsonTokenizer::skip() {
+    uint8_t target = level;
+    do {
+        JsonToken_t token = next();
+        if (token == JSON_ERROR || token == JSON_END || level < target)
+            return false;
+    } while (level > target);
+    return true;
+}
+
+JsonToken_t JsonTokenizer::fail() {
+    failed = true;
+    buffer[0] = '\0';
+    return JSON_ERROR;
+}
+
+/*
+* Reads a string, the opening quote already read. Escapes are resolved,
+* except \u, which becomes a '?'.
+*/
+JsonToken_t JsonTokenizer::readString() {
+    uint8_t n = 0;
+    bool key = keyNext && inObject();
+
+    while (true) {
+        int c = stream.read();
+        if (c < 0)
+            return fail();
+        if (c == '"')
+            break;
+        if (c == '\\') {
+            c = stream.read();
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u':
+                    for (uint8_t i=0; i < 4; i++)
+                        stream.read();
+                    c = '?';
+                    break;
+                case -1:
+                    return fail();
+            }
+        }
+        if (n < length - 1)
+            buffer[n++] = c;
+    }
+    buffer[n] = '\0';
+
+    if (!started)
+        return fail(); // A document is an object or an array.
+    if (key) {
+        if (nextNonSpace() != ':')
+            return fail();
+        keyNext = false;
+        valueNext = true;
+        return JSON_KEY;
+    }
+    return valueDone(JSON_STRING);
+}
+
+/*
+* Reads a number or literal, up to the character that ends it.
+*/
+JsonToken_t JsonTokenizer::readScalar(char first) {
+    uint8_t n = 0;
+    int c = first;
+
+    if (!started || (keyNext && inObject()))
+        return fail();
+    while (true) {
+        if (n < length - 1)
+            buffer[n++] = c;
+        c = stream.peek();
+        if (c < 0 || c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            break;
+        stream.read();
+    }
+    buffer[n] = '\0';
+
+    if (first == '-' || (first >= '0' && first <= '9'))
+        return valueDone(JSON_NUMBER);
+    if (strcmp_P(buffer, PSTR("true")) == 0 || strcmp_P(buffer, PSTR("false")) == 0 ||
+        strcmp_P(buffer, PSTR("null")) == 0)
+        return valueDone(JSON_LITERAL);
+    return fail();
+}
+
+/*
+* A value has been read, so a separator comes next, and in an object a key
+* after it.
+*/
+JsonToken_t JsonTokenizer::valueDone(JsonToken_t token) {
+    keyNext = (level > 0) && inObject();
+    valueNext = false;
+    separatorNext = (level > 0);
+    return token;
+}
+
+int JsonTokenizer::nextNonSpace() {
+    int c;
+    do {
+        c = stream.read();
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    return c;
+}
+
+bool JsonTokenizer::inObject() const {
+    return (level > 0) && (objects & (1UL << (level - 1)));
+}
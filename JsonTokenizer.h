@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef JSONTOKENIZER_H_
+#define JSONTOKENIZER_H_
+
+#include <Arduino.h>
+
+#define JSON_TOKENIZER_MAX_DEPTH 32 // Deeper nesting is an error.
+
+typedef enum {
+    JSON_BEGIN_OBJECT,
+    JSON_END_OBJECT,
+    JSON_BEGIN_ARRAY,
+    JSON_END_ARRAY,
+    JSON_KEY, // A member name, the colon after it is consumed.
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_LITERAL, // true, false or null.
+    JSON_END, // The top level value is complete and the stream is done.
+    JSON_ERROR
+} JsonToken_t;
+
+/*
+* Splits a JSON document into tokens as it is read from a stream, in a
+* single pass and without waiting for data: a stream that runs dry is the
+* end of the document. Strings and numbers are copied to a buffer supplied
+* by the caller, truncated if they don't fit, so the memory used doesn't
+* depend on the size of the document. Nesting is tracked, so a reader can
+* skip values it isn't interested in, and mismatched brackets and
+* missing or extra commas are errors.
+*/
+class JsonTokenizer {
+    public:
+        JsonTokenizer(Stream&, char*, uint8_t);
+
+        JsonToken_t next(); // Read the next token.
+        bool skip(); // Skip the value after a key, nested values and all.
+        const char* text() const { return buffer; } // Text of the last key, string, number or literal.
+        uint8_t depth() const { return level; } // Number of open objects and arrays.
+
+    private:
+        JsonToken_t fail();
+        JsonToken_t readString();
+        JsonToken_t readScalar(char);
+        JsonToken_t valueDone(JsonToken_t);
+        int nextNonSpace();
+        bool inObject() const;
+
+        Stream& stream;
+        char* buffer;
+        uint8_t length; // Size of the buffer, including the terminator.
+        uint32_t objects; // Bit per level, set for objects and clear for arrays.
+        uint8_t level;
+        bool keyNext; // Is the next string a member name?
+        bool valueNext; // Has a key been read, so that a value must come next?
+        bool separatorNext; // Has a value been read, so that a comma or a bracket must come next?
+        bool started; // Has the top level value begun?
+        bool failed;
+};
+
+#endif
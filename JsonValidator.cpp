@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "JsonValidator.h"
+
+JsonValidator::JsonValidator() {
+    reset();
+}
+
+void JsonValidator::reset() {
+    objects = 0;
+    depth = 0;
+    inString = false;
+    escaped = false;
+    started = false;
+    invalid = false;
+}
+
+bool JsonValidator::feed(char c) {
+    if (invalid)
+        return false;
+
+    if (inString) {
+        if (escaped)
+            escaped = false;
+        else if (c == '\\')
+            escaped = true;
+        else if (c == '"')
+            inString = false;
+        else if ((uint8_t)c < 0x20)
+            invalid = true;
+        return !invalid;
+    }
+
+    switch (c) {
+        case ' ': case '\t': case '\r': case '\n':
+            break;
+
+        case '{':
+        case '[':
+            if ((started && depth == 0) || depth == JSON_VALIDATOR_MAX_DEPTH) {
+                invalid = true;
+                break;
+            }
+            if (c == '{')
+                objects |= (1UL << depth);
+            else
+                objects &= ~(1UL << depth);
+            depth++;
+            started = true;
+            break;
+
+        case '}':
+        case ']':
+            if (depth == 0 || ((objects & (1UL << (depth - 1))) != 0) != (c == '}'))
+                invalid = true;
+            else
+                depth--;
+            break;
+
+        default:
+            // Scalars, separators and keys, only allowed inside the top
+            // level object or array.
+            if (depth == 0)
+                invalid = true;
+            else if (c == '"')
+                inString = true;
+    }
+    return !invalid;
+}
+
+bool JsonValidator::feed(const uint8_t* data, size_t length) {
+    while (length--) {
+        if (!feed((char)*data++))
+            return false;
+    }
+    return true;
+}
+
+bool JsonValidator::isComplete() const {
+    return started && !invalid && depth == 0 && !inString;
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef JSONVALIDATOR_H_
+#define JSONVALIDATOR_H_
+
+#include <Arduino.h>
+
+#define JSON_VALIDATOR_MAX_DEPTH 32 // Deeper nesting is rejected.
+
+/*
+* Checks the structure of a JSON document as it streams in, a character at
+* a time: that brackets and braces match, that strings are closed and free
+* of control characters, and that nothing but whitespace follows the top
+* level value. Values themselves are not checked, the config parsers do
+* that. Takes a few bytes of RAM, however large the document is.
+*/
+class JsonValidator {
+    public:
+        JsonValidator();
+
+        void reset();
+        bool feed(char); // Check the next character. False once the document is invalid.
+        bool feed(const uint8_t*, size_t);
+        bool isComplete() const; // Has a whole, valid document been seen?
+
+    private:
+        uint32_t objects; // Bit per level, set for objects and clear for arrays.
+        uint8_t depth;
+        bool inString;
+        bool escaped;
+        bool started; // Has the top level value begun?
+        bool invalid;
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "JsonWriter.h"
+
+JsonBuffer::JsonBuffer(char* pBuffer, size_t pSize) : buffer(pBuffer), size(pSize) {
+    clear();
+}
+
+size_t JsonBuffer::write(uint8_t c) {
+    // Keep room for the terminating null.
+    if (len + 1 >= size) {
+        overflow = true;
+        return 0;
+    }
+    buffer[len++] = c;
+    buffer[len] = '\0';
+    return 1;
+}
+
+void JsonBuffer::clear() {
+    truncate(0);
+}
+
+void JsonBuffer::truncate(size_t length) {
+    if (length < size) {
+        len = length;
+        buffer[len] = '\0';
+        overflow = false;
+    }
+}
+
+JsonWriter::JsonWriter(Print& pOut) : out(pOut), depth(0), firstItem(1), afterKey(false) {}
+
+void JsonWriter::separate() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (firstItem & (1 << depth))
+        firstItem &= ~(1 << depth);
+    else
+        out.write(',');
+}
+
+void JsonWriter::open(char c) {
+    separate();
+    out.write(c);
+    if (depth < JSON_MAX_DEPTH - 1)
+        depth++;
+    firstItem |= (1 << depth);
+}
+
+void JsonWriter::close(char c) {
+    out.write(c);
+    if (depth > 0)
+        depth--;
+}
+
+void JsonWriter::beginObject() { open('{'); }
+void JsonWriter::endObject() { close('}'); }
+void JsonWriter::beginArray() { open('['); }
+void JsonWriter::endArray() { close(']'); }
+
+void JsonWriter::key(const char* k) {
+    separate();
+    string(k);
+    out.write(':');
+    afterKey = true;
+}
+
+/*
+* Keys are usually literals, which are kept in flash with F().
+*/
+void JsonWriter::key(const __FlashStringHelper* k) {
+    separate();
+    string(k);
+    out.write(':');
+    afterKey = true;
+}
+
+void JsonWriter::value(const char* v) {
+    separate();
+    if (v == NULL)
+        out.print(F("null"));
+    else
+        string(v);
+}
+
+void JsonWriter::value(const __FlashStringHelper* v) {
+    separate();
+    string(v);
+}
+
+void JsonWriter::value(bool v) {
+    separate();
+    out.print(v ? F("true") : F("false"));
+}
+
+void JsonWriter::value(int v) {
+    value((long)v);
+}
+
+void JsonWriter::value(unsigned int v) {
+    value((unsigned long)v);
+}
+
+void JsonWriter::value(long v) {
+    separate();
+    out.print(v);
+}
+
+void JsonWriter::value(unsigned long v) {
+    separate();
+    out.print(v);
+}
+
+void JsonWriter::value(double v, uint8_t digits) {
+    separate();
+    out.print(v, digits);
+}
+
+void JsonWriter::null() {
+    separate();
+    out.print(F("null"));
+}
+
+void JsonWriter::string(const char* s) {
+    out.write('"');
+    while (*s)
+        escape(*s++);
+    out.write('"');
+}
+
+void JsonWriter::string(const __FlashStringHelper* s) {
+    out.write('"');
+    const char* p = (const char*)s;
+    char c;
+    while ((c = pgm_read_byte(p++)) != '\0')
+        escape(c);
+    out.write('"');
+}
+
+void JsonWriter::escape(char c) {
+    switch (c) {
+        case '"': out.print(F("\\\"")); break;
+        case '\\': out.print(F("\\\\")); break;
+        case '\n': out.print(F("\\n")); break;
+        case '\r': out.print(F("\\r")); break;
+        case '\t': out.print(F("\\t")); break;
+        default:
+            if ((uint8_t)c < 0x20) {
+                // Other control characters aren't expected in ids, drop them.
+                return;
+            }
+            out.write(c);
+    }
+}
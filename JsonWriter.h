@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef JSONWRITER_H_
+#define JSONWRITER_H_
+
+#include <Arduino.h>
+
+#define JSON_MAX_DEPTH 16 // Max nesting of objects and arrays.
+
+/*
+* A Print that collects its output in a fixed buffer, for sending JSON as
+* one websocket frame. Output that doesn't fit is dropped and flagged.
+*/
+class JsonBuffer : public Print {
+    public:
+        JsonBuffer(char*, size_t);
+
+        virtual size_t write(uint8_t);
+        using Print::write;
+
+        void clear(); // Start over from an empty buffer.
+        void truncate(size_t); // Drop everything after the specified length.
+        size_t length() const { return len; }
+        char* c_str() { return buffer; } // The buffer, always null terminated.
+        bool overflowed() const { return overflow; }
+
+    private:
+        char* buffer;
+        size_t size;
+        size_t len;
+        bool overflow;
+};
+
+/*
+* Writes JSON straight to a Print (a JsonBuffer, the WebServer, a file...)
+* without building a tree on the heap first. Commas are inserted as needed,
+* strings are escaped.
+*
+*   JsonWriter json(out);
+*   json.beginObject();
+*   json.member(F("Id"), "rdrIn");
+*   json.key(F("IP"));
+*   json.beginArray(); json.value(192); ... json.endArray();
+*   json.endObject();
+*/
+class JsonWriter {
+    public:
+        JsonWriter(Print&);
+
+        void beginObject();
+        void endObject();
+        void beginArray();
+        void endArray();
+        void key(const char*);
+        void key(const __FlashStringHelper*);
+
+        void value(const char*);
+        void value(const __FlashStringHelper*);
+        void value(bool);
+        void value(int);
+        void value(unsigned int);
+        void value(long);
+        void value(unsigned long);
+        void value(double, uint8_t = 2);
+        void null();
+
+        // A key and its value.
+        template <typename T> void member(const __FlashStringHelper* k, T v) {
+            key(k);
+            value(v);
+        }
+        void member(const __FlashStringHelper* k, double v, uint8_t digits) {
+            key(k);
+            value(v, digits);
+        }
+
+    private:
+        void separate(); // Write a comma if this isn't the first item on its level.
+        void open(char);
+        void close(char);
+        void string(const char*);
+        void string(const __FlashStringHelper*);
+        void escape(char);
+
+        Print& out;
+        uint8_t depth;
+        uint16_t firstItem; // Bit per level, set until the level has an item.
+        bool afterKey; // Was the last thing written a key?
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "LatencyHistogram.h"
+
+#define FIRST_OCTAVE 9 // Bucket 0 is everything below 2^9 us.
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::reset() {
+    count = timeouts = 0;
+    shortest = longest = 0;
+    memset(buckets, 0, sizeof(buckets));
+}
+
+/*
+* Counts a latency. Counters saturate instead of wrapping.
+*/
+void LatencyHistogram::add(unsigned long latency) {
+    if (count == 0xFFFF)
+        return;
+    if (count == 0 || latency < shortest) shortest = latency;
+    if (count == 0 || latency > longest) longest = latency;
+    count++;
+    buckets[bucketOf(latency)]++;
+}
+
+void LatencyHistogram::addTimeout() {
+    if (timeouts != 0xFFFF)
+        timeouts++;
+}
+
+/*
+* Returns the upper limit of the bucket that holds the specified
+* percentile, clamped to the measured extremes. 0 if nothing is counted.
+*/
+unsigned long LatencyHistogram::percentile(uint8_t pct) {
+    if (count == 0)
+        return 0;
+
+    unsigned long target = ((unsigned long)count * pct + 99) / 100;
+    unsigned long sum = 0;
+    uint8_t b = 0;
+    for (; b < LATENCY_BUCKETS - 1; b++) {
+        sum += buckets[b];
+        if (sum >= target)
+            break;
+    }
+    unsigned long limit = bucketLimit(b);
+    if (limit > longest) limit = longest;
+    if (limit < shortest) limit = shortest;
+    return limit;
+}
+
+/*
+* The bucket of a latency: 0 below 2^9 us, then two buckets per power of
+* two, split by the bit below the highest one.
+*/
+uint8_t LatencyHistogram::bucketOf(unsigned long latency) {
+    if (latency < (1UL << FIRST_OCTAVE))
+        return 0;
+    uint8_t octave = FIRST_OCTAVE;
+    while (latency >> (octave + 1))
+        octave++;
+    uint8_t b = 2 * (octave - FIRST_OCTAVE) + ((latency >> (octave - 1)) & 1) + 1;
+    return (b < LATENCY_BUCKETS) ? b : LATENCY_BUCKETS - 1;
+}
+
+/*
+* The first latency above the specified bucket.
+*/
+unsigned long LatencyHistogram::bucketLimit(uint8_t b) {
+    if (b == 0)
+        return 1UL << FIRST_OCTAVE;
+    uint8_t octave = FIRST_OCTAVE + (b - 1) / 2;
+    return (1UL << octave) + (((b - 1) % 2) + 1) * (1UL << (octave - 1));
+}
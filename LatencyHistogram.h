@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef LATENCYHISTOGRAM_H_
+#define LATENCYHISTOGRAM_H_
+
+#include <Arduino.h>
+
+#define LATENCY_BUCKETS 27 // Buckets of half an octave from 512 us, the last one ends at ~4.2 s.
+#define LATENCY_TIMEOUT_MS 4000 // Max time from a stimulus to a controller response.
+
+/*
+* Histogram of response latencies in microseconds. Buckets are half an
+* octave wide, so percentiles come out with at most ~41% error in a few
+* bytes per bucket. Responses that never came are counted as timeouts.
+*/
+class LatencyHistogram {
+    public:
+        LatencyHistogram();
+
+        void reset(); // Clear all counts.
+        void add(unsigned long); // Count a response latency.
+        void addTimeout(); // Count a stimulus without response.
+        unsigned long percentile(uint8_t); // Latency below which the specified percentage falls.
+
+        uint16_t count; // Number of responses.
+        uint16_t timeouts; // Number of stimuli without response.
+        unsigned long shortest; // Shortest latency.
+        unsigned long longest; // Longest latency.
+
+    private:
+        static uint8_t bucketOf(unsigned long);
+        static unsigned long bucketLimit(uint8_t);
+
+        uint16_t buckets[LATENCY_BUCKETS];
+};
+
+#endif
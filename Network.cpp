@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "Network.h"
 #include "aJSON.h"
+#include "JsonWriter.h"
 #include <StandardCplusplus.h>
 #include <serstream>
 #include <EEPROM.h>
@@ -209,32 +210,31 @@ bool Network::parseNetworkConfiguration(Stream& stream) {
 }
 
 void Network::saveNetworkConfiguration(Stream& stream) {
-  aJsonObject *root = aJson.createObject();
+  JsonWriter json(stream);
+  json.beginObject();
   
-  aJson.addBooleanToObject(root, "DHCPEnabled",  use_dhcp);
+  json.member(F("DHCPEnabled"), use_dhcp);
 
   char buff[32];
   sprintf(buff, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  aJson.addStringToObject(root, "MAC", buff);
+  json.member(F("MAC"), buff);
   
   IPAddressToString(buff, ip);
-  aJson.addStringToObject(root, "IP", buff);
+  json.member(F("IP"), buff);
   
   IPAddressToString(buff, gateway);
-  aJson.addStringToObject(root, "Gateway", buff);
+  json.member(F("Gateway"), buff);
   
   IPAddressToString(buff, subnet);
-  aJson.addStringToObject(root, "Subnet", buff);
+  json.member(F("Subnet"), buff);
   
   IPAddressToString(buff, dns);
-  aJson.addStringToObject(root, "DNS", buff);
+  json.member(F("DNS"), buff);
 
-  aJson.addNumberToObject(root, "HTTPPort",     httpPort);
-  aJson.addNumberToObject(root, "WebsocketPort", websocketPort);
+  json.member(F("HTTPPort"), httpPort);
+  json.member(F("WebsocketPort"), websocketPort);
   
-  aJson.print(root, &aJsonStream(&stream));
-  
-  aJson.deleteItem(root);
+  json.endObject();
 }
 
 /*
@@ -351,24 +351,22 @@ void Network::printConfiguration() {
   cout << F("\n");
 }
 
-void Network::addArrayToObject(aJsonObject* object, const char *string, uint8_t* items, int count) {
-  aJsonObject *array, *item;
-  array = aJson.createArray();
-  aJson.addItemToObject(object, string, array);
+void Network::addArray(JsonWriter &json, const __FlashStringHelper *key, uint8_t* items, int count) {
+  json.key(key);
+  json.beginArray();
   for (int i = 0; i < count; i++) {
-    item = aJson.createItem(items[i]);
-    aJson.addItemToArray(array, item);
+    json.value(items[i]);
   }
+  json.endArray();
 }
 
-void Network::addArrayToObject(aJsonObject* object, const char *string, IPAddress ip) {
-  aJsonObject *array, *item;
-  array = aJson.createArray();
-  aJson.addItemToObject(object, string, array);
+void Network::addArray(JsonWriter &json, const __FlashStringHelper *key, IPAddress ip) {
+  json.key(key);
+  json.beginArray();
   for (int i = 0; i < 4; i++) {
-    item = aJson.createItem(ip[i]);
-    aJson.addItemToArray(array, item);
+    json.value(ip[i]);
   }
+  json.endArray();
 }
 
 void Network::objectToArray(aJsonObject* object, uint8_t* items) {
@@ -388,38 +386,42 @@ void Network::objectToArray(aJsonObject* object, IPAddress* ip) {
 }
 
 /*
-* Builds aJson object for the current Network Settings for editing
+* Writes the current Network Settings as JSON for editing
 */
-void Network::settingsToJSON(aJsonObject *root)
+void Network::settingsToJSON(JsonWriter &json)
 {
   char buff[20];
-  aJsonObject *ethernet;
   
-  aJson.addBooleanToObject(root, "EEPROM", !SD.exists((char*) configFilename));
-  aJson.addBooleanToObject(root, "DHCPEnabled",  use_dhcp);
+  json.beginObject();
+  json.member(F("EEPROM"), !SD.exists((char*) configFilename));
+  json.member(F("DHCPEnabled"), use_dhcp);
 
-  addArrayToObject(root, "MAC", mac, 6);
-  addArrayToObject(root, "IP", ip);
-  addArrayToObject(root, "Gateway", gateway);
-  addArrayToObject(root, "Subnet", subnet);
-  addArrayToObject(root, "DNS", dns);
+  addArray(json, F("MAC"), mac, 6);
+  addArray(json, F("IP"), ip);
+  addArray(json, F("Gateway"), gateway);
+  addArray(json, F("Subnet"), subnet);
+  addArray(json, F("DNS"), dns);
 
-  aJson.addNumberToObject(root, "HTTPPort",     httpPort);
-  aJson.addNumberToObject(root, "WebsocketPort", websocketPort);
+  json.member(F("HTTPPort"), httpPort);
+  json.member(F("WebsocketPort"), websocketPort);
 
-  aJson.addItemToObject(root, "Ethernet", ethernet = aJson.createObject());    
+  json.key(F("Ethernet"));
+  json.beginObject();
   
   IPAddressToString(buff, Ethernet.localIP());
-  aJson.addStringToObject(ethernet, "IP",       buff);
+  json.member(F("IP"), buff);
   
   IPAddressToString(buff, Ethernet.gatewayIP());
-  aJson.addStringToObject(ethernet, "Gateway",  buff);
+  json.member(F("Gateway"), buff);
   
   IPAddressToString(buff, Ethernet.subnetMask());
-  aJson.addStringToObject(ethernet, "Subnet",   buff);
+  json.member(F("Subnet"), buff);
   
   IPAddressToString(buff, Ethernet.dnsServerIP());
-  aJson.addStringToObject(ethernet, "DNS",      buff);
+  json.member(F("DNS"), buff);
+
+  json.endObject();
+  json.endObject();
 }
 
 /*
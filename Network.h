@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <Ethernet.h>
 
 class aJsonObject;
+class JsonWriter;
 
 using namespace std;
 
@@ -31,7 +32,7 @@ class Network {
     void Initialize();
 
     void printConfiguration();
-    void settingsToJSON(aJsonObject *root);
+    void settingsToJSON(JsonWriter &json);
     void settingsFromJSON(aJsonObject *root); 
 
     bool setup();
@@ -51,8 +52,8 @@ class Network {
     int writeEEPROM(void* buf, int offset, int len);
     int writeEEPROM(IPAddress* address, int offset);
     
-    void addArrayToObject(aJsonObject* object, const char *string, uint8_t* items, int count);
-    void addArrayToObject(aJsonObject* object, const char *string, IPAddress ip);
+    void addArray(JsonWriter &json, const __FlashStringHelper *key, uint8_t* items, int count);
+    void addArray(JsonWriter &json, const __FlashStringHelper *key, IPAddress ip);
     void objectToArray(aJsonObject* object, uint8_t* items);
     void objectToArray(aJsonObject* object, IPAddress* ip);
     
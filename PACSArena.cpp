@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "PACSArena.h"
+
+/*
+* Constructor. The arena starts out empty.
+*/
+PACSArena::PACSArena() {
+    low = 0;
+    high = PACS_ARENA_SIZE;
+}
+
+/*
+* Takes memory from the bottom of the free space. Returns NULL if there
+* is not enough of it.
+*/
+void* PACSArena::allocate(size_t size) {
+    size = aligned(size);
+    if (size > high - low)
+        return NULL;
+    void* p = pool + low;
+    low += size;
+    return p;
+}
+
+/*
+* Frees everything allocated from the bottom since mark() returned offset.
+*/
+void PACSArena::release(size_t offset) {
+    if (offset < low)
+        low = offset;
+}
+
+/*
+* Takes memory from the top of the free space. Returns NULL if there is
+* not enough of it.
+*/
+void* PACSArena::push(size_t size) {
+    size = aligned(size);
+    if (size > high - low)
+        return NULL;
+    high -= size;
+    return pool + high;
+}
+
+/*
+* Frees everything taken from the top.
+*/
+void PACSArena::dropPushed() {
+    high = PACS_ARENA_SIZE;
+}
@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PACSARENA_H_
+#define PACSARENA_H_
+
+#include <Arduino.h>
+
+// On the Mega the shipped doors.cfg (4 doors, 6 readers and 27 peripherals)
+// takes 2.1 KB of tables, and 2.8 KB while it is built at boot with its
+// records staged on top. Most of the rest of the SRAM goes to the static
+// buffers, about 4 KB, and the stack.
+#ifndef PACS_ARENA_SIZE
+#define PACS_ARENA_SIZE 3072 // Bytes for the door tables and the staged records.
+#endif
+#define PACS_ARENA_ALIGN __alignof__(uint64_t) // Alignment of all allocations, 1 on the AVR.
+
+/*
+* A fixed number of items in the arena. Unlike a vector it never grows, so
+* pointers to its items stay valid for as long as the table it is part of.
+*/
+template <class T> struct PACSRange {
+    T* items;
+    uint16_t count;
+
+    unsigned size() const { return count; }
+    T& operator[](unsigned i) { return items[i]; }
+    const T& operator[](unsigned i) const { return items[i]; }
+};
+
+/*
+* Static storage for the door tables, so that they don't fragment the heap.
+* Tables are taken from the bottom, and freed by releasing everything above
+* a mark. Records waiting to be built into tables are pushed on the top,
+* and dropped all at once.
+*/
+class PACSArena {
+    public:
+        PACSArena();
+
+        void* allocate(size_t); // Take memory from the bottom, NULL if full.
+        size_t mark() const { return low; } // Where the next allocation goes.
+        void release(size_t); // Free everything allocated after a mark.
+        void* push(size_t); // Take memory from the top, NULL if full.
+        void dropPushed(); // Free everything pushed.
+        uint8_t* at(size_t offset) { return pool + offset; }
+        uint8_t* end() { return pool + PACS_ARENA_SIZE; }
+        size_t used() const { return low + (PACS_ARENA_SIZE - high); }
+        size_t available() const { return high - low; } // Free space between the bottom and the top.
+
+        // The space an allocation of the specified size takes.
+        static size_t aligned(size_t size) { return (size + PACS_ARENA_ALIGN - 1) & ~(size_t)(PACS_ARENA_ALIGN - 1); }
+
+    private:
+
+        uint8_t pool[PACS_ARENA_SIZE] __attribute__((__aligned__(PACS_ARENA_ALIGN)));
+        size_t low; // Offset of the free space.
+        size_t high; // Offset of the end of the free space.
+};
+
+#endif
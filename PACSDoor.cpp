@@ -19,29 +19,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "PACSDoor.h"
 #include "PACSReader.h"
 #include "PACSPeripheral.h"
+#include "JsonWriter.h"
 /*
 * Constructor. 
 */
 PACSDoor::PACSDoor(char* doorId)
 {
     strcpy(id, doorId);
+    readers.items = NULL;
+    readers.count = 0;
+    peripherals.items = NULL;
+    peripherals.count = 0;
     onStateChangeCallback = NULL;
-}
-
-/*
-* Adds a new reader to the door.
-*/
-void PACSDoor::addReader(char* id, uint8_t pin0, uint8_t pin1) {
-    
-    readers.push_back(PACSReader(id, pin0, pin1));
-}
-
-/*
-* Adds a new peripheral to the door.
-*/
-void PACSDoor::addPeripheral(char* id, PACSPeripheralType_t type, uint8_t pin, uint8_t activeLevel) {
-
-    peripherals.push_back(PACSPeripheral(id, type, pin, activeLevel));
+    onTransmitCompleteCallback = NULL;
+    responsePending = false;
+    stimulusMicros = 0;
 }
 
 /*
@@ -51,7 +43,7 @@ void PACSDoor::addPeripheral(char* id, PACSPeripheralType_t type, uint8_t pin, u
 PACSPeripheral* PACSDoor::findPeripheral(char* someId, PACSPeripheralType_t someType) {
     
     for (unsigned i=0; i < peripherals.size(); i++) {
-        if ((strcmp(peripherals[i].id, someId) == 0) && (peripherals[i].type == someType))
+        if ((strcmp(peripherals[i].id(), someId) == 0) && (peripherals[i].type == someType))
             return &peripherals[i];
     }
     return NULL;
@@ -63,7 +55,7 @@ PACSPeripheral* PACSDoor::findPeripheral(char* someId, PACSPeripheralType_t some
 */
 PACSPeripheral* PACSDoor::findPeripheralById(char* someId) {
     for (unsigned i=0; i < peripherals.size(); i++) {
-        if ((strcmp(peripherals[i].id, someId) == 0))
+        if ((strcmp(peripherals[i].id(), someId) == 0))
             return &peripherals[i];
     }
     return NULL;
@@ -95,16 +87,17 @@ void PACSDoor::initialize() {
 }
 
 /*
-* Swipe a 26bit Wiegand card at the specified reader. 
-* Facility code can have a value of 0-255, and the card number 0-65535.
+* Swipe a Wiegand card at the specified reader. The card is encoded in the
+* specified format, or in the reader's default format if format is negative.
+* Codes that are too large for the format are masked to the field widths.
+* The frame is queued on the reader and sent in the background, false is
+* returned if there is no such reader or its queue is full.
 */
-bool PACSDoor::swipeCard(char* readerId, unsigned long facilityCode, unsigned long cardNumber) {  
+bool PACSDoor::swipeCard(unsigned readerIndex, unsigned long facilityCode, unsigned long cardNumber, int8_t format) {  
     
-  PACSReader* r = findReaderById(readerId);  
-  
-  if (r != NULL) {
-    assembleWiegandData(facilityCode, cardNumber, r->pin0, r->pin1);        
-    return true;
+  if (readerIndex < readers.size()) {
+    PACSReader* r = &readers[readerIndex];
+    return assembleWiegandData(facilityCode, cardNumber, (format < 0) ? r->format : format, r);
   } 
   return false;
 }
@@ -112,13 +105,10 @@ bool PACSDoor::swipeCard(char* readerId, unsigned long facilityCode, unsigned lo
 /*
 * Enter a pin number at the specified reader.
 */
-bool PACSDoor::enterPIN(char* readerId, char* code) {
+bool PACSDoor::enterPIN(unsigned readerIndex, char* code) {
 
-    PACSReader* r = findReaderById(readerId);
-
-    if (r != NULL) {
-        sendPIN(code, r->pin0, r->pin1);       
-        return true;
+    if (readerIndex < readers.size()) {
+        return sendPIN(code, &readers[readerIndex]);
     }
     return false;
 }
@@ -126,11 +116,12 @@ bool PACSDoor::enterPIN(char* readerId, char* code) {
 /*
 * Open the specified door monitor.
 */
-bool PACSDoor::openDoor(char* doorMonitorId) {        
+bool PACSDoor::openDoor(unsigned index) {        
 
-    PACSPeripheral* p = findPeripheralById(doorMonitorId);
+    PACSPeripheral* p = (index < peripherals.size()) ? &peripherals[index] : NULL;
     if ((p != NULL) && (p->type == DOORMONITOR)) {
-        setPinActive(p->pin, p->activeLevel);       
+        p->setActive();       
+        Trace::record(TRACE_DOOR_OPEN, p->handle);
         return true;        
     }
     return false;    
@@ -139,11 +130,12 @@ bool PACSDoor::openDoor(char* doorMonitorId) {
 /*
 * Close the specified door monitor.
 */
-bool PACSDoor::closeDoor(char* doorMonitorId) {
+bool PACSDoor::closeDoor(unsigned index) {
     
-    PACSPeripheral* p = findPeripheralById(doorMonitorId);
+    PACSPeripheral* p = (index < peripherals.size()) ? &peripherals[index] : NULL;
     if ((p != NULL) && (p->type == DOORMONITOR)) {
-        setPinInactive(p->pin, p->activeLevel);       
+        p->setInactive();       
+        Trace::record(TRACE_DOOR_CLOSE, p->handle);
         return true;        
     }
     return false;    
@@ -152,13 +144,16 @@ bool PACSDoor::closeDoor(char* doorMonitorId) {
 /*
 * Pushes the specified REX button.
 */
-bool PACSDoor::pushREX(char* rexId) {
+bool PACSDoor::pushREX(unsigned index) {
 
-    PACSPeripheral* p = findPeripheralById(rexId);
+    PACSPeripheral* p = (index < peripherals.size()) ? &peripherals[index] : NULL;
     if ((p != NULL) && (p->type == REX)) {
-        setPinActive(p->pin, p->activeLevel);      
+        p->setActive();      
+        Trace::record(TRACE_REX_PUSH, p->handle);
         delay(10);
-        setPinInactive(p->pin, p->activeLevel);        
+        p->setInactive();        
+        Trace::record(TRACE_REX_RELEASE, p->handle);
+        startLatency(micros());
         return true;        
     }
     return false;    
@@ -167,11 +162,12 @@ bool PACSDoor::pushREX(char* rexId) {
 /*
 *
 */
-bool PACSDoor::activateInput(char* inputId) {        
+bool PACSDoor::activateInput(unsigned index) {        
 
-    PACSPeripheral* p = findPeripheralById(inputId);
+    PACSPeripheral* p = (index < peripherals.size()) ? &peripherals[index] : NULL;
     if ((p != NULL) && (p->type == DIGITAL_INPUT)) {
-        setPinActive(p->pin, p->activeLevel);       
+        p->setActive();       
+        Trace::record(TRACE_INPUT_ACTIVATE, p->handle);
         return true;        
     }
     return false;    
@@ -180,119 +176,224 @@ bool PACSDoor::activateInput(char* inputId) {
 /*
 *
 */
-bool PACSDoor::deactivateInput(char* inputId) {
+bool PACSDoor::deactivateInput(unsigned index) {
     
-    PACSPeripheral* p = findPeripheralById(inputId);
+    PACSPeripheral* p = (index < peripherals.size()) ? &peripherals[index] : NULL;
     if ((p != NULL) && (p->type == DIGITAL_INPUT)) {
-        setPinInactive(p->pin, p->activeLevel);       
+        p->setInactive();       
+        Trace::record(TRACE_INPUT_DEACTIVATE, p->handle);
         return true;        
     }
     return false;    
 }
 
 /*
-* Check if there has been any change in pin-states and if so, call the registered callback.
+* Reports frames that the readers have finished transmitting. The end of a
+* frame is the stimulus that the controller's response latency is measured
+* from.
+*/
+void PACSDoor::updateReaders() {
+    for (unsigned i=0; i < readers.size(); i++) {
+        unsigned long sentMicros;
+        uint16_t sent = readers[i].getLastSentFrame(&sentMicros);
+        if (sent != readers[i].lastReportedFrame) {
+            readers[i].lastReportedFrame = sent;
+            startLatency(sentMicros);
+            if (onTransmitCompleteCallback) {
+                onTransmitCompleteCallback(*this, readers[i]);
+            }
+        }
+    }
+}
+
+/*
+* Reports filtered peripherals whose level or pulse train has settled, and
+* counts a timeout if the controller hasn't responded to the last stimulus
+* in time. Peripheral levels are scanned by PACSDoorManager, except for 
+* captured pins which are only read here when resync is set (after captured
+* changes were lost).
 */
-void PACSDoor::updateLevels() {  
+void PACSDoor::updateLevels(bool resync) {  
+
+    unsigned long now = micros();
+
+    // Settle debounced levels and pulse trains.
+    for (unsigned i=0; i < peripherals.size(); i++) {
+        if (!peripherals[i].isFiltered())
+            continue;
+        peripherals[i].updateFilter(now);
+        if (peripherals[i].levelChanged()) {
+            notifyStateChange(peripherals[i]);
+        }
+    }
+
+    if (responsePending && (now - stimulusMicros > LATENCY_TIMEOUT_MS * 1000UL)) {
+        responsePending = false;
+        latency.addTimeout();
+    }
+
+    if (!resync)
+        return;
 
-    // Update the levels for all registered peripherals and if there has 
-    // been a change  in the different pin states, call the registered callback.
+    // Reread the captured pins and if there has been a change in the 
+    // different pin states, call the registered callback.
     for (unsigned i=0; i < peripherals.size(); i++) {        
+        if (!peripherals[i].captured)
+            continue;
         peripherals[i].updateLevels();        
-        if (onStateChangeCallback) {
-            if (peripherals[i].levelChanged) {
-                onStateChangeCallback(*this, peripherals[i]);
-            }                
-        }    
+        if (peripherals[i].levelChanged()) {
+            notifyStateChange(peripherals[i]);
+        }
     }
 }
 
 /*
-* Registers a function to be called when a pin changes state.
+* Applies a captured level change to the peripherals on its pin, and calls
+* the registered callback if their state changed. Returns false if no
+* peripheral of this door is on the pin.
 */
-void PACSDoor::registerStateChangeCallback(StateChangeCallback *callback) {
-    onStateChangeCallback = callback;
+bool PACSDoor::applyEdge(const EdgeEvent_t& edge) {
+    bool found = false;
+    for (unsigned i=0; i < peripherals.size(); i++) {
+        if (!peripherals[i].captured || peripherals[i].pin() != edge.pin)
+            continue;
+        found = true;
+        setPeripheralLevel(i, edge.level, edge.micros);
+    }
+    return found;
 }
+
 /*
-* Set the pin to active state.
+* Sets the level of the peripheral with the specified index, and calls the
+* registered callback if its state changed.
 */
-void PACSDoor::setPinActive(uint8_t pin, uint8_t activeLevel) {    
-    digitalWrite(pin, (activeLevel == HIGH) ? HIGH : LOW);
+void PACSDoor::setPeripheralLevel(unsigned index, uint8_t level, unsigned long timestamp) {
+    peripherals[index].applyEdge(level, timestamp);
+    if (peripherals[index].levelChanged()) {
+        notifyStateChange(peripherals[index]);
+    }
 }
+
 /*
-* Set the pin to inactive state.
+* Traces a state change of a controller output, and calls the registered
+* callback. Our own outputs (door monitors, REX buttons and inputs) are
+* traced when they are commanded instead.
 */
-void PACSDoor::setPinInactive(uint8_t pin, uint8_t activeLevel) {
-    digitalWrite(pin, (activeLevel == HIGH) ? LOW : HIGH);
+void PACSDoor::notifyStateChange(PACSPeripheral& p) {
+    switch (p.type) {
+        case GREENLED:
+        case LOCK:
+            // An activation (or pulse train) after the end of the last 
+            // stimulus is the controller's response to it.
+            if (responsePending && (p.isActive() || p.pulses() != 0) && 
+                (long)(p.changedMicros - stimulusMicros) >= 0) {
+                responsePending = false;
+                latency.add(p.changedMicros - stimulusMicros);
+            }
+            // Fall through.
+        case BEEPER:
+        case DIGITAL_OUTPUT:
+            if (p.pulses() != 0) {
+                Trace::record(TRACE_OUTPUT_ACTIVE, p.handle, p.changedMicros);
+                Trace::record(TRACE_OUTPUT_INACTIVE, p.handle, p.changedMicros + p.pulseDurationMicros());
+            }
+            else {
+                Trace::record(p.isActive() ? TRACE_OUTPUT_ACTIVE : TRACE_OUTPUT_INACTIVE, 
+                              p.handle, p.changedMicros);
+            }
+            break;
+
+        default:
+            break;
+    }
+    if (onStateChangeCallback) {
+        onStateChangeCallback(*this, p);
+    }
 }
 
 /*
-* Calculate the wiegand binary to be sent.
+* Writes the state update that is sent to the websocket clients when one of
+* our peripherals changes: the peripheral, and its level or the pulse train
+* it reported.
 */
-void PACSDoor::assembleWiegandData(unsigned long facilityCode, unsigned long cardNumber, uint8_t pin0, uint8_t pin1)
-{
-  // Wiegand 26bit format:
-  //
-  //        Fac.Code     CardNo
-  //        |------||--------------|
-  //       P000000000000000000000000P
-  //       |                        |
-  //       |                        |
-  // Even parity bit         Odd parity bit
-  //  (for the 12 bits         (for the 12 bits
-  //  (to the right)            to the left)
-  //
-  
-  // Mask out the 2 byte fac.code value and shift it to the left, 
-  // making room for the cardnumber.
-  facilityCode = (facilityCode & 0xFF) << 17; 
-  // Mask out the 4 byte card value and shift it to the left,
-  // making room for the odd parity bit.
-  cardNumber = (cardNumber & 0xFFFF) << 1;
-  // Combine the two.
-  unsigned long wiegandData = facilityCode | cardNumber;
-  //Mask the low part and count 1:s.
-   // 0001 1111 1111 1110
-  unsigned int low = wiegandData & 8190;
-
-  boolean parity = false;
-  while (low) {
-    parity = !parity;
-    low = low & (low - 1);
-  }
+void PACSDoor::stateToJSON(JsonWriter &json, PACSPeripheral &p) {
+    json.beginObject();
+    json.member(F("Handle"), p.handle);
+    json.member(F("DoorId"), id);
+    json.member(F("Id"), p.id());
+    json.member(F("IsActive"), p.isActive());
+    if (p.pulses() != 0) {
+        json.member(F("Pulses"), p.pulses());
+        json.member(F("PulseWidth"), p.pulseWidthMicros() / 1000.0, 1);
+        json.member(F("Duration"), p.pulseDurationMicros() / 1000.0, 1);
+    }
+    json.endObject();
+}
 
-  if (!parity) {
-    bitSet(wiegandData, 0);
-  }
-  else {
-    bitClear(wiegandData, 0);
-  }
+/*
+* Starts waiting for the controller to respond to a stimulus that ended at
+* the specified time. A stimulus that is still waiting is forgotten, as the
+* response can't be told apart.
+*/
+void PACSDoor::startLatency(unsigned long timestamp) {
+    stimulusMicros = timestamp;
+    responsePending = true;
+}
 
-  //Mask the high part and count 1s:
-  unsigned long high = wiegandData & 33546240; // 0000 0001 1111 1111 1110 0000 0000 0000
-  parity = false;
-  while (high) {
-    parity = !parity;
-    high = high & (high - 1);
-  }
+/*
+* Registers a function to be called when a pin changes state.
+*/
+void PACSDoor::registerStateChangeCallback(StateChangeCallback *callback) {
+    onStateChangeCallback = callback;
+}
+
+/*
+* Registers a function to be called when a reader has finished transmitting a frame.
+*/
+void PACSDoor::registerTransmitCompleteCallback(TransmitCompleteCallback *callback) {
+    onTransmitCompleteCallback = callback;
+}
 
-  if (parity) {
-    bitSet(wiegandData, 25);
-  } else {
-    bitClear(wiegandData, 25);
+/*
+* Calculate the wiegand binary to be sent. The layout and parity masks of 
+* each format are found in the format table, see WiegandFormat.cpp.
+*
+* Wiegand 26bit format (H10301) for example:
+*
+*        Fac.Code     CardNo
+*        |------||--------------|
+*       P000000000000000000000000P
+*       |                        |
+*       |                        |
+* Even parity bit         Odd parity bit
+*  (for the 12 bits         (for the 12 bits
+*  (to the right)            to the left)
+*/
+bool PACSDoor::assembleWiegandData(unsigned long facilityCode, unsigned long cardNumber, uint8_t format, 
+                                   PACSReader* reader)
+{
+  uint64_t wiegandData;
+  uint8_t length = WiegandFormats::encode(format, facilityCode, cardNumber, wiegandData);
+  if (length == 0) {
+    cout << "[" << id << "|" << reader->id << "]" << F(": Unknown card format.") << endl;
+    return false;
   }
-  
-  transmitWiegandData(wiegandData, 26, pin0, pin1);
+  return transmitWiegandData(reader, wiegandData, length, 0);
 }
 
 /*
 * Do the actual encoding of the keypad presses, and send it for output.
+* Keys are packed into frames of up to 16 keys, which the transmitter
+* sends as separate 4 bit bursts.
 */
-void PACSDoor::sendPIN(char* keySequence, uint8_t pin0, uint8_t pin1)
+bool PACSDoor::sendPIN(char* keySequence, PACSReader* reader)
 {
   // Keys are sent as 4bit values. To convert a character to it's
   // correct decimal value, we subtract 48, which is the ASCII value
   // of '0'. The asterisk is given the value 10, and the hash 11.
+  const uint8_t maxKeysPerFrame = (sizeof(uint64_t) * 8) / 4;
+  uint64_t keys = 0;
+  uint8_t keyCount = 0;
   int i = 0;  
   while(keySequence[i] != '\0') {    
     byte key = 255;
@@ -303,34 +404,35 @@ void PACSDoor::sendPIN(char* keySequence, uint8_t pin0, uint8_t pin1)
     } else if (keySequence[i] == '#') {
         key = 0xB;
     }    
-    // Now output the key (if it's a valid key, i.e. a value between
-    // 0 and 11. We are only sending 4 bits of information, so we mask 
-    // these out first.
+    // Now add the key to the frame (if it's a valid key, i.e. a value 
+    // between 0 and 11).
     if (key <= 11) {
-      transmitWiegandData(key, 4, pin0, pin1);
-      delay(50);
+      keys = (keys << 4) | key;
+      keyCount++;
+      if (keyCount == maxKeysPerFrame) {
+        if (!transmitWiegandData(reader, keys, keyCount * 4, 4))
+          return false;
+        keys = 0;
+        keyCount = 0;
+      }
     }
     i++;        
   }
+  if (keyCount > 0) {
+    return transmitWiegandData(reader, keys, keyCount * 4, 4);
+  }
+  return true;
 }
 
 /*
-* This is where the actual physical transmission  of the Wiegand data 
-* takes place.
- */
-void PACSDoor::transmitWiegandData(unsigned long data, int length, int pin0, int pin1)
+* Queues the Wiegand data on the reader. The actual physical transmission
+* takes place in the background, see WiegandTransmitter.
+*/
+bool PACSDoor::transmitWiegandData(PACSReader* reader, uint64_t data, uint8_t length, uint8_t groupLength)
 {
-  int i = length;
-  int output_pin;
-
-  noInterrupts();
-  while (i > 0) {
-    i--;           
-    output_pin = (bitRead(data, i)) ? pin1 : pin0;
-    digitalWrite(output_pin, LOW);
-    delayMicroseconds(50);
-    digitalWrite(output_pin, HIGH);    
-    delayMicroseconds(950);
+  if (!reader->queueFrame(data, length, groupLength)) {
+    cout << "[" << id << "|" << reader->id << "]" << F(": Wiegand queue full.") << endl;
+    return false;
   }
-  interrupts();
+  return true;
 }
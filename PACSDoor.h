@@ -21,58 +21,76 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <Arduino.h>
 #include <StandardCplusplus.h>
-#include <vector>
 #include <serstream>
 
+#include "PACSArena.h"
 #include "PACSReader.h"
 #include "PACSPeripheral.h"
+#include "EdgeCapture.h"
+#include "LatencyHistogram.h"
 
 #define DOOR_ID_MAX_LENGTH 16 // The max number of characters for the ID.
 
 using namespace std;
 
+class JsonWriter;
+
 class PACSDoor {
 
     public:
         PACSDoor(char*);
 
-        void addReader(char*, uint8_t, uint8_t);
-        void addPeripheral(char*, PACSPeripheralType_t, uint8_t, uint8_t);                
         PACSPeripheral* findPeripheral(char*, PACSPeripheralType_t);        
         PACSPeripheral* findPeripheralById(char*);        
         PACSReader* findReaderById(char*);                
         void initialize(); // Initialize all readers/peripherals.
-        void updateLevels(); // Update the current pin levels of all peripherals.                
+        void updateReaders(); // Report frames that have been sent.
+        void updateLevels(bool = false); // Settle filtered levels, check timeouts, reread captured pins if asked to.
+        bool applyEdge(const EdgeEvent_t&); // Apply a captured change to the peripherals on its pin.
+        void setPeripheralLevel(unsigned, uint8_t, unsigned long); // Apply a level to a peripheral.
+        void stateToJSON(JsonWriter&, PACSPeripheral&); // Write the state update of a peripheral.
         
-        // Commands
-        bool swipeCard(char*, unsigned long, unsigned long);
-        bool enterPIN(char*, char*);
-        bool openDoor(char*);
-        bool closeDoor(char*);
-        bool pushREX(char*);    
-        bool activateInput(char*);
-        bool deactivateInput(char*);
+        // Commands, by reader or peripheral index.
+        bool swipeCard(unsigned, unsigned long, unsigned long, int8_t = -1);
+        bool enterPIN(unsigned, char*);
+        bool openDoor(unsigned);
+        bool closeDoor(unsigned);
+        bool pushREX(unsigned);    
+        bool activateInput(unsigned);
+        bool deactivateInput(unsigned);
         
         // Callback called when pin state changes.
         typedef void StateChangeCallback(PACSDoor&, PACSPeripheral&);
         void registerStateChangeCallback(StateChangeCallback*);        
 
+        // Callback called when a reader has finished transmitting a frame.
+        typedef void TransmitCompleteCallback(PACSDoor&, PACSReader&);
+        void registerTransmitCompleteCallback(TransmitCompleteCallback*);
+
         char id[DOOR_ID_MAX_LENGTH + 1]; // Door id, to match commands against.
+
+        // Latencies from the end of a card swipe, PIN entry or REX push to
+        // the next activation of the lock or green LED.
+        LatencyHistogram latency;
     
-        // Our vectors of readers and peripherals.
-        std::vector<PACSReader> readers;
-        std::vector<PACSPeripheral> peripherals;
+        // Our readers and peripherals, ranges of PACSDoorManager's tables.
+        PACSRange<PACSReader> readers;
+        PACSRange<PACSPeripheral> peripherals;
 
     private:                
-        void setPinActive(uint8_t, uint8_t);
-        void setPinInactive(uint8_t, uint8_t);
         void initPins();        
-        void sendPIN(char*, uint8_t, uint8_t);
-        void assembleWiegandData(unsigned long, unsigned long, uint8_t, uint8_t);
-        void transmitWiegandData(unsigned long, int, int, int);
+        bool sendPIN(char*, PACSReader*);
+        bool assembleWiegandData(unsigned long, unsigned long, uint8_t, PACSReader*);
+        bool transmitWiegandData(PACSReader*, uint64_t, uint8_t, uint8_t);
+        void notifyStateChange(PACSPeripheral&);
+        void startLatency(unsigned long);
 
         // Pointer to the callback functions provided.
         StateChangeCallback *onStateChangeCallback;
+        TransmitCompleteCallback *onTransmitCompleteCallback;
+
+        bool responsePending; // Is the controller's response to a stimulus awaited?
+        unsigned long stimulusMicros; // When the last stimulus ended.
 
     };
 
@@ -17,6 +17,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include "PACSDoorManager.h"
+#include "WiegandTransmitter.h"
 #include <serstream>
 
 using namespace std;
@@ -24,15 +25,55 @@ using namespace std;
 /*
 * Constructor. 
 */
-PACSDoorManager::PACSDoorManager() {}
+PACSDoorManager::PACSDoorManager() {
+    scanPortCount = 0;
+    indexed = false;
+    recordCount = 0;
+    overLimit = false;
+    stateChangeCallback = NULL;
+    transmitCompleteCallback = NULL;
+    doors.items = NULL;
+    doors.count = 0;
+    readers.items = NULL;
+    readers.count = 0;
+    peripherals.items = NULL;
+    peripherals.count = 0;
+    handles.count = doorIndex.count = handleIndex.count = scanEntries.count = 0;
+}
 
 /*
-* Creates a new door and pushes it to the doors vector.
+* Adds a door, or a reader or peripheral of the last door added, to the
+* configuration being loaded. The records are kept on top of the arena
+* until the tables are built, and a door's id can be changed through the
+* returned pointer until then. Returns NULL if the arena is full, or if the
+* record isn't a door and there is no door before it.
 */
-PACSDoor* PACSDoorManager::createDoor(char* doorId) {
-    
-    doors.push_back(PACSDoor(doorId));
-    return findDoorById(doorId);
+ConfigRecord_t* PACSDoorManager::addRecord(const ConfigRecord_t& r) {
+    if (recordCount == 0 && r.kind != CONFIG_DOOR)
+        return NULL;
+    ConfigRecord_t* staged = (ConfigRecord_t*)arena.push(sizeof(ConfigRecord_t));
+    if (staged == NULL)
+        return NULL;
+    *staged = r;
+    staged->id[CONFIG_ID_MAX_LENGTH] = '\0';
+    recordCount++;
+    return staged;
+}
+
+/*
+* Throws away the records added since the tables were last built.
+*/
+void PACSDoorManager::discardRecords() {
+    arena.dropPushed();
+    recordCount = 0;
+}
+
+/*
+* Returns the record added in the specified order. Records are pushed on
+* the top of the arena, so the first one is at the very end.
+*/
+ConfigRecord_t& PACSDoorManager::record(uint16_t index) {
+    return *(ConfigRecord_t*)(arena.end() - (index + 1) * PACSArena::aligned(sizeof(ConfigRecord_t)));
 }
 
 /*
@@ -42,169 +83,806 @@ void PACSDoorManager::setDoorId(char* oldId, char* newId) {
     PACSDoor* d = findDoorById(oldId);
     if (d != NULL) {
         strcpy(d->id, newId);
+        indexed = false;
     }
 }
 
 /*
-* Initializes all the doors in the doors vector.
+* Builds the door tables from the records added since boot, and initializes
+* all the doors. Only done once, reconfigurations are committed instead.
+* Returns false if there are more objects than the limits allow, or the
+* tables don't fit in the arena.
 */
-void PACSDoorManager::initializeDoors() {
+bool PACSDoorManager::initializeDoors() {
+    if (!checkLimits()) {
+        discardRecords();
+        return false;
+    }
+
+    PACSTables_t tables;
+    size_t start = arena.mark();
+    bool built = buildTables(tables);
+    discardRecords();
+    if (!built) {
+        arena.release(start);
+        return false;
+    }
+    moveTables(tables, start);
+
     for (unsigned i=0; i < doors.size(); i++) {
         doors[i].initialize();
     }    
+    assignHandles();
+    buildIdIndex();
+    buildScanIndex();
+    return true;
 }
 
 /*
-* Swipes a standard 26bit Wiegand card at the specified door and
+* Starts loading a new configuration with addRecord(). The current doors
+* keep running until it is committed.
 */
-bool PACSDoorManager::swipeCard(char* doorId, char* readerId, unsigned long facilityCode, unsigned long cardNumber) {  
-    
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->swipeCard(readerId, facilityCode, cardNumber)) {
-            cout << "[" << doorId << "|" << readerId << "]"<< F(": Card swiped. Facility code: ") 
-                 << facilityCode << F(". Card number: ") << cardNumber << endl;        
-             return true;
+void PACSDoorManager::beginReconfiguration() {
+    discardRecords();
+    overLimit = false;
+}
+
+/*
+* Throws away the records added since beginReconfiguration(), leaving the
+* current doors as they are.
+*/
+void PACSDoorManager::abortReconfiguration() {
+    discardRecords();
+}
+
+/*
+* Replaces the current doors with the ones added since
+* beginReconfiguration(). A reader or peripheral with the same door, id and
+* configuration as before is carried over with its state, and its pins are
+* left alone. The rest are initialized, and pins that are no longer used 
+* are set back to inputs. Handles are assigned again, door by door.
+*
+* The new tables are built above the current ones, which are freed once
+* the state has been carried over, and then moved down to the bottom of
+* the arena. If there's only room for them in place of the current ones,
+* the current doors are released first and nothing is carried over. If 
+* they don't fit at all, or exceed the limits, the current doors are kept
+* and false is returned.
+*/
+bool PACSDoorManager::commitReconfiguration(ReconfigurationResult_t& result) {
+    result.kept = result.initialized = result.released = 0;
+    if (!checkLimits()) {
+        discardRecords();
+        return false;
+    }
+
+    size_t size = tablesSize();
+    if (size > arena.available() + arena.mark()) {
+        discardRecords();
+        return false;
+    }
+    if (size > arena.available())
+        releaseTables(result);
+
+    PACSTables_t next;
+    size_t start = arena.mark();
+    bool built = buildTables(next);
+    discardRecords();
+    if (!built) {
+        arena.release(start);
+        return false;
+    }
+    detachReaders();
+
+    // Carry over what didn't change, and mark it with NO_HANDLE until the
+    // handles are assigned. Latencies carry over with the door.
+    for (unsigned i=0; i < next.doors.size(); i++) {
+        PACSDoor& d = next.doors[i];
+        PACSDoor* current = findDoorById(d.id);
+        if (current != NULL)
+            d.latency = current->latency;
+        for (unsigned j=0; j < d.readers.size(); j++) {
+            PACSReader* previous = findPrevious(d.id, d.readers[j]);
+            if (previous != NULL) {
+                d.readers[j] = *previous;
+                d.readers[j].handle = NO_HANDLE;
+                result.kept++;
+            }
+            else {
+                d.readers[j].handle = 0;
+            }
         }
-        else {
-            cout << "Reader not found: " << readerId << endl;
-            return false;
+        for (unsigned j=0; j < d.peripherals.size(); j++) {
+            uint8_t index = d.peripherals[j].index;
+            uint8_t filter = d.peripherals[j].filter;
+            PACSPeripheral* previous = findPrevious(d.id, next, index);
+            if (previous != NULL) {
+                if (previous->isFiltered())
+                    next.columns.filters[filter] = PACSPeripheral::columns.filters[previous->filter];
+                d.peripherals[j] = *previous;
+                d.peripherals[j].index = index;
+                d.peripherals[j].filter = filter;
+                d.peripherals[j].handle = NO_HANDLE;
+                setBit(next.columns.levels, index, previous->currentLevel() == HIGH);
+                result.kept++;
+            }
+            else {
+                d.peripherals[j].handle = 0;
+            }
         }
     }
-    cout << "Door not found: " << doorId << endl;
-    return false;
+
+    // Release the pins that nothing kept uses, before they are set up for
+    // something else.
+    for (unsigned i=0; i < readers.size(); i++) {
+        releasePin(readers[i].pin0, next, result);
+        releasePin(readers[i].pin1, next, result);
+    }
+    for (unsigned i=0; i < peripherals.size(); i++) {
+        releasePin(peripherals[i].pin(), next, result);
+    }
+
+    // The current tables and their indices go, and the new ones take their place.
+    moveTables(next, start);
+
+    // Set up what's new, and hand all readers to the transmitter again.
+    for (unsigned i=0; i < doors.size(); i++) {
+        PACSDoor& d = doors[i];
+        for (unsigned j=0; j < d.peripherals.size(); j++) {
+            if (d.peripherals[j].handle != NO_HANDLE) {
+                d.peripherals[j].initialize();
+                result.initialized++;
+            }
+        }
+        for (unsigned j=0; j < d.readers.size(); j++) {
+            PACSReader& r = d.readers[j];
+            if (r.handle != NO_HANDLE) {
+                r.initialize();
+                result.initialized++;
+            }
+            else {
+                // Idle the data lines, a frame that was cut short may have
+                // left one low.
+                r.data0.write<HIGH>();
+                r.data1.write<HIGH>();
+                WiegandTransmitter::attach(&r);
+            }
+        }
+        d.registerStateChangeCallback(stateChangeCallback);
+        d.registerTransmitCompleteCallback(transmitCompleteCallback);
+    }
+
+    assignHandles();
+    buildIdIndex();
+    buildScanIndex();
+    return true;
 }
 
 /*
-* Enters a pin digit/sequence at the specified door and reader.
+* Takes the current readers from the transmitter and drops their queued
+* frames. A frame in transmission is cut short, rather than holding up the
+* request that reconfigures until it is out.
 */
-bool PACSDoorManager::enterPIN(char* doorId, char* readerId, char* code) {
-        
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->enterPIN(readerId, code)) {
-            cout << "[" << doorId << "|" << readerId << "]" << F(": Entered PIN digit(s): ") 
-                 << code << endl;        
-            return true;
+void PACSDoorManager::detachReaders() {
+    WiegandTransmitter::detachAll();
+    for (unsigned i=0; i < readers.size(); i++) {
+        readers[i].queueHead = readers[i].queueTail;
+        readers[i].txState = WIEGAND_IDLE;
+    }
+}
+
+/*
+* Sets the pins of all current readers and peripherals back to inputs, and
+* frees the current tables and their indices. Leaves no doors.
+*/
+void PACSDoorManager::releaseTables(ReconfigurationResult_t& result) {
+    detachReaders();
+    PACSTables_t none;
+    none.readers.count = none.peripherals.count = 0;
+    for (unsigned i=0; i < readers.size(); i++) {
+        releasePin(readers[i].pin0, none, result);
+        releasePin(readers[i].pin1, none, result);
+    }
+    for (unsigned i=0; i < peripherals.size(); i++) {
+        releasePin(peripherals[i].pin(), none, result);
+    }
+    doors.count = readers.count = peripherals.count = 0;
+    handles.count = doorIndex.count = handleIndex.count = scanEntries.count = 0;
+    scanPortCount = 0;
+    indexed = false;
+    arena.release(0);
+}
+
+/*
+* Counts the added records of each kind, and the filtered peripherals.
+*/
+void PACSDoorManager::countRecords(unsigned* counts, unsigned& filters) {
+    counts[CONFIG_DOOR] = counts[CONFIG_READER] = counts[CONFIG_PERIPHERAL] = 0;
+    filters = 0;
+    for (uint16_t i=0; i < recordCount; i++) {
+        ConfigRecord_t& r = record(i);
+        counts[r.kind]++;
+        if (r.kind == CONFIG_PERIPHERAL && (r.debounceMs != 0 || r.pulseGapMs != 0))
+            filters++;
+    }
+}
+
+/*
+* Checks that the added records stay within MAX_DOORS and MAX_OBJECTS.
+* If not, limitsExceeded() tells until the next load.
+*/
+bool PACSDoorManager::checkLimits() {
+    unsigned counts[3];
+    unsigned filters;
+    countRecords(counts, filters);
+    overLimit = (counts[CONFIG_DOOR] > MAX_DOORS ||
+                 counts[CONFIG_READER] + counts[CONFIG_PERIPHERAL] > MAX_OBJECTS);
+    return !overLimit;
+}
+
+/*
+* The arena space that buildTables() takes for the added records.
+*/
+size_t PACSDoorManager::tablesSize() {
+    unsigned counts[3];
+    unsigned filters;
+    countRecords(counts, filters);
+    unsigned n = counts[CONFIG_PERIPHERAL];
+    return PACSArena::aligned(counts[CONFIG_DOOR] * sizeof(PACSDoor)) +
+           PACSArena::aligned(counts[CONFIG_READER] * sizeof(PACSReader)) +
+           PACSArena::aligned(n * sizeof(PACSPeripheral)) +
+           PACSArena::aligned(n * (PERIPHERAL_ID_MAX_LENGTH + 1)) + PACSArena::aligned(n) +
+           3 * PACSArena::aligned(PERIPHERAL_BITSET_SIZE(n)) +
+           PACSArena::aligned(filters * sizeof(PACSPeripheralFilter_t));
+}
+
+/*
+* Takes a range of count items from the bottom of the arena. The range is
+* left empty, to be filled up to count. Returns false if there's no room.
+*/
+template <class T> bool PACSDoorManager::allocateRange(PACSRange<T>& range, unsigned count) {
+    range.items = (T*)arena.allocate(count * sizeof(T));
+    range.count = 0;
+    return (range.items != NULL);
+}
+
+/*
+* Sizes the tables for the added records, takes them from the bottom of the
+* arena, and fills them in. The records are left as they are, and must be
+* within the limits (see checkLimits()). Returns false if the tables don't fit.
+*/
+bool PACSDoorManager::buildTables(PACSTables_t& t) {
+    unsigned counts[3];
+    unsigned filters;
+    countRecords(counts, filters);
+
+    unsigned n = counts[CONFIG_PERIPHERAL];
+    if (!allocateRange(t.doors, counts[CONFIG_DOOR]) || !allocateRange(t.readers, counts[CONFIG_READER]) ||
+        !allocateRange(t.peripherals, n))
+        return false;
+    t.columns.ids = (char (*)[PERIPHERAL_ID_MAX_LENGTH + 1])arena.allocate(n * (PERIPHERAL_ID_MAX_LENGTH + 1));
+    t.columns.pins = (uint8_t*)arena.allocate(n);
+    t.columns.activeLevels = (uint8_t*)arena.allocate(PERIPHERAL_BITSET_SIZE(n));
+    t.columns.levels = (uint8_t*)arena.allocate(PERIPHERAL_BITSET_SIZE(n));
+    t.columns.changed = (uint8_t*)arena.allocate(PERIPHERAL_BITSET_SIZE(n));
+    t.columns.filters = (PACSPeripheralFilter_t*)arena.allocate(filters * sizeof(PACSPeripheralFilter_t));
+    if (t.columns.ids == NULL || t.columns.pins == NULL || t.columns.activeLevels == NULL ||
+        t.columns.levels == NULL || t.columns.changed == NULL || t.columns.filters == NULL)
+        return false;
+
+    // The records of a door come right after it, so its readers and
+    // peripherals end up next to each other in the tables.
+    PACSDoor* d = NULL;
+    uint8_t f = 0;
+    for (uint16_t i=0; i < recordCount; i++) {
+        ConfigRecord_t& r = record(i);
+        switch (r.kind) {
+            case CONFIG_DOOR:
+                d = &t.doors.items[t.doors.count++];
+                *d = PACSDoor(r.id);
+                d->readers.items = t.readers.items + t.readers.count;
+                d->peripherals.items = t.peripherals.items + t.peripherals.count;
+                break;
+
+            case CONFIG_READER:
+                t.readers.items[t.readers.count++] = PACSReader(r.id, r.pin, r.pin1, r.level);
+                d->readers.count++;
+                break;
+
+            case CONFIG_PERIPHERAL:
+                uint8_t p = t.peripherals.count++;
+                bool filtered = (r.debounceMs != 0 || r.pulseGapMs != 0);
+                t.peripherals.items[p] = PACSPeripheral(p, (PACSPeripheralType_t)r.type, filtered ? f : NO_FILTER);
+                if (filtered) {
+                    t.columns.filters[f].debounceMs = r.debounceMs;
+                    t.columns.filters[f++].pulseGapMs = r.pulseGapMs;
+                }
+                strcpy(t.columns.ids[p], r.id);
+                t.columns.pins[p] = r.pin;
+                setBit(t.columns.activeLevels, p, r.level == HIGH);
+                setBit(t.columns.levels, p, r.level != HIGH);
+                setBit(t.columns.changed, p, false);
+                d->peripherals.count++;
+                break;
         }
-        else {
-            cout << "Reader not found: " << readerId << endl;
-            return false;
+    }
+    return true;
+}
+
+/*
+* Moves a set of tables, which start at the specified offset and end at
+* the mark, to the bottom of the arena, and makes them the current tables.
+* Everything below them must have been released.
+*/
+void PACSDoorManager::moveTables(PACSTables_t& t, size_t start) {
+    // The items are moved as bytes, which is only safe for types that
+    // can be copied that way.
+    static_assert(__is_trivially_copyable(PACSDoor) && __is_trivially_copyable(PACSReader) &&
+                  __is_trivially_copyable(PACSPeripheral) && __is_trivially_copyable(PACSPeripheralFilter_t),
+                  "The door tables are moved with memmove()");
+
+    size_t size = arena.mark() - start;
+    if (start != 0) {
+        memmove(arena.at(0), arena.at(start), size);
+        t.doors.items = (PACSDoor*)((uint8_t*)t.doors.items - start);
+        t.readers.items = (PACSReader*)((uint8_t*)t.readers.items - start);
+        t.peripherals.items = (PACSPeripheral*)((uint8_t*)t.peripherals.items - start);
+        t.columns.ids = (char (*)[PERIPHERAL_ID_MAX_LENGTH + 1])((uint8_t*)t.columns.ids - start);
+        t.columns.pins -= start;
+        t.columns.activeLevels -= start;
+        t.columns.levels -= start;
+        t.columns.changed -= start;
+        t.columns.filters = (PACSPeripheralFilter_t*)((uint8_t*)t.columns.filters - start);
+        for (unsigned i=0; i < t.doors.size(); i++) {
+            PACSDoor& d = t.doors[i];
+            d.readers.items = (PACSReader*)((uint8_t*)d.readers.items - start);
+            d.peripherals.items = (PACSPeripheral*)((uint8_t*)d.peripherals.items - start);
         }
     }
-    cout << "Door not found: " << doorId << endl;
-    return false;    
+    arena.release(size);
+
+    doors = t.doors;
+    readers = t.readers;
+    peripherals = t.peripherals;
+    PACSPeripheral::columns = t.columns;
+    indexed = false;
 }
 
 /*
-* Opens the specified door monitor att the specified door.
+* Returns the current reader with the same door, id and configuration as
+* the specified one, or NULL if there is none.
 */
-bool PACSDoorManager::openDoor(char* doorId, char* doorMonitorId) {        
+PACSReader* PACSDoorManager::findPrevious(char* doorId, PACSReader& r) {
+    PACSDoor* d = findDoorById(doorId);
+    if (d == NULL)
+        return NULL;
+    PACSReader* previous = d->findReaderById(r.id);
+    if (previous != NULL && previous->pin0 == r.pin0 && previous->pin1 == r.pin1 &&
+        previous->format == r.format)
+        return previous;
+    return NULL;
+}
 
+/*
+* Returns the current peripheral with the same door, id and configuration
+* as the peripheral with the specified index in the new tables, or NULL if
+* there is none.
+*/
+PACSPeripheral* PACSDoorManager::findPrevious(char* doorId, PACSTables_t& next, unsigned index) {
     PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->openDoor(doorMonitorId)) {
-            cout << "[" << doorId << "|" << doorMonitorId << "]" << F(": Door opened.") << endl;        
+    if (d == NULL)
+        return NULL;
+    PACSPeripheral* previous = d->findPeripheralById(next.columns.ids[index]);
+    PACSPeripheral& p = next.peripherals[index];
+    if (previous == NULL || previous->isFiltered() != p.isFiltered())
+        return NULL;
+    if (p.isFiltered() && (previous->debounceMs() != next.columns.filters[p.filter].debounceMs ||
+                           previous->pulseGapMs() != next.columns.filters[p.filter].pulseGapMs))
+        return NULL;
+    if (previous->type == p.type && previous->pin() == next.columns.pins[index] && 
+        previous->activeLevel() == (getBit(next.columns.activeLevels, index) ? HIGH : LOW))
+        return previous;
+    return NULL;
+}
+
+/*
+* Checks if a kept reader or peripheral of the new tables uses a pin.
+*/
+bool PACSDoorManager::isPinUsed(uint8_t pin, PACSTables_t& next) {
+    for (unsigned i=0; i < next.readers.size(); i++) {
+        PACSReader& r = next.readers[i];
+        if (r.handle == NO_HANDLE && (r.pin0 == pin || r.pin1 == pin))
+            return true;
+    }
+    for (unsigned i=0; i < next.peripherals.size(); i++) {
+        if (next.peripherals[i].handle == NO_HANDLE && next.columns.pins[i] == pin)
             return true;
+    }
+    return false;
+}
+
+/*
+* Sets a pin of a current reader or peripheral back to an input, unless a
+* kept one uses it. Each pin is only released once.
+*/
+void PACSDoorManager::releasePin(uint8_t pin, PACSTables_t& next, ReconfigurationResult_t& result) {
+    if (pin == 255 || isPinUsed(pin, next))
+        return;
+    EdgeCapture::detach(pin);
+    pinMode(pin, INPUT);
+    result.released++;
+
+    // Mark it, so that other current objects on the pin don't count it again.
+    for (unsigned i=0; i < readers.size(); i++) {
+        if (readers[i].pin0 == pin) readers[i].pin0 = 255;
+        if (readers[i].pin1 == pin) readers[i].pin1 = 255;
+    }
+    for (unsigned i=0; i < peripherals.size(); i++) {
+        if (PACSPeripheral::columns.pins[i] == pin) PACSPeripheral::columns.pins[i] = 255;
+    }
+}
+
+/*
+* Numbers all readers and peripherals, door by door. The number is the
+* handle that the object is referred to by in commands, state updates and
+* the trace. checkLimits() keeps the objects within MAX_OBJECTS, so each
+* gets a handle, and the handles take less room than the records that were
+* dropped before the tables were moved into place.
+*/
+void PACSDoorManager::assignHandles() {
+    if (!allocateRange(handles, readers.size() + peripherals.size()))
+        return;
+    for (unsigned i=0; i < doors.size(); i++) {
+        for (unsigned j=0; j < doors[i].readers.size(); j++) {
+            HandleEntry_t entry = { (uint8_t)i, (uint8_t)j, true };
+            doors[i].readers[j].handle = handles.count;
+            handles.items[handles.count++] = entry;
+        }
+        for (unsigned j=0; j < doors[i].peripherals.size(); j++) {
+            HandleEntry_t entry = { (uint8_t)i, (uint8_t)j, false };
+            doors[i].peripherals[j].handle = handles.count;
+            handles.items[handles.count++] = entry;
         }
-        else {
-            cout << "Peripheral not found: " << doorMonitorId << endl;
-            return false;
-        }        
     }
-    cout << "Door not found: " << doorId << endl;
-    return false;    
 }
 
 /*
-* Closes the specified door monitor att the specified door.
+* Hashes an id (djb2, folded to 16 bits). An object's hash is its id hashed
+* on top of its door's hash.
 */
-bool PACSDoorManager::closeDoor(char* doorId, char* doorMonitorId) {
-    
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->closeDoor(doorMonitorId)) {
-            cout << "[" << doorId << "|" << doorMonitorId << "]" << F(": Door closed.") << endl;        
-            return true;
+uint16_t PACSDoorManager::hashId(const char* id, uint16_t hash) {
+    while (*id) {
+        hash = ((hash << 5) + hash) ^ (uint8_t)*id++;
+    }
+    return hash;
+}
+
+/*
+* Returns the position of the first entry with a hash that is not less
+* than the specified one.
+*/
+unsigned PACSDoorManager::lowerBound(PACSRange<IdIndexEntry_t>& index, uint16_t hash) {
+    unsigned low = 0;
+    unsigned high = index.size();
+    while (low < high) {
+        unsigned middle = (low + high) / 2;
+        if (index[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/*
+* Adds an entry to an index, keeping it sorted by hash. The index must
+* have room for it.
+*/
+void PACSDoorManager::insertId(PACSRange<IdIndexEntry_t>& index, uint16_t hash, uint8_t value) {
+    unsigned k = lowerBound(index, hash);
+    memmove(&index.items[k + 1], &index.items[k], (index.count - k) * sizeof(IdIndexEntry_t));
+    index.items[k].hash = hash;
+    index.items[k].value = value;
+    index.count++;
+}
+
+/*
+* Builds the indices that doors and handles are found by id with. Done once
+* when the doors are initialized, so that commands don't have to compare 
+* their ids against every door and object. If the arena has no room for
+* them, ids are compared one by one instead.
+*/
+void PACSDoorManager::buildIdIndex() {
+    if (!allocateRange(doorIndex, doors.size()) || !allocateRange(handleIndex, handles.size())) {
+        doorIndex.count = handleIndex.count = 0;
+        indexed = false;
+        return;
+    }
+    for (unsigned i=0; i < doors.size(); i++) {
+        insertId(doorIndex, hashId(doors[i].id), i);
+    }
+    for (unsigned h=0; h < handles.size(); h++) {
+        PACSDoor& d = doors[handles[h].door];
+        char* id = handles[h].reader ? d.readers[handles[h].index].id : d.peripherals[handles[h].index].id();
+        insertId(handleIndex, hashId(id, hashId(d.id)), h);
+    }
+    indexed = true;
+}
+
+/*
+* Returns the handle of the reader or peripheral with the specified id at
+* the specified door, or NO_HANDLE if there is no such object.
+*/
+uint8_t PACSDoorManager::findHandle(char* doorId, char* id) {
+    char* objectDoorId;
+    char* objectId;
+    if (!indexed) {
+        for (unsigned h=0; h < handles.size(); h++) {
+            if (findObject(h, objectDoorId, objectId) &&
+                (strcmp(objectId, id) == 0) && (strcmp(objectDoorId, doorId) == 0))
+                return h;
         }
-        else {
-            cout << "Peripheral not found: " << doorMonitorId << endl;
-            return false;
-        }                
+        return NO_HANDLE;
     }
-    cout << "Door not found: " << doorId << endl;
-    return false;    
+
+    uint16_t hash = hashId(id, hashId(doorId));
+    for (unsigned k=lowerBound(handleIndex, hash); k < handleIndex.size() && handleIndex[k].hash == hash; k++) {
+        if (findObject(handleIndex[k].value, objectDoorId, objectId) &&
+            (strcmp(objectId, id) == 0) && (strcmp(objectDoorId, doorId) == 0))
+            return handleIndex[k].value;
+    }
+    return NO_HANDLE;
 }
 
 /*
-* Pushes the specified REX device att the specified door.
+* Finds the door and id of the reader or peripheral with the specified
+* handle. Returns false if there is no such object.
 */
-bool PACSDoorManager::pushREX(char* doorId, char* rexId) {
+bool PACSDoorManager::findObject(uint8_t handle, char*& doorId, char*& id) {
+    if (handle >= handles.size())
+        return false;
+    PACSDoor& d = doors[handles[handle].door];
+    doorId = d.id;
+    id = handles[handle].reader ? d.readers[handles[handle].index].id : d.peripherals[handles[handle].index].id();
+    return true;
+}
 
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->pushREX(rexId)) {
-            cout << "[" << doorId << "|" << rexId << "]" << F(": REX pushed.") << endl;        
-            return true;
+/*
+* Groups the pins of all polled peripherals by their I/O port, so that a
+* scan reads every port once instead of every pin. Captured pins and pins
+* that can't be read are left out (and so is everything, if the arena has
+* no room for the index).
+*/
+void PACSDoorManager::buildScanIndex() {
+    scanPortCount = 0;
+    if (!allocateRange(scanEntries, peripherals.size()))
+        return;
+
+    // Find the ports first, then add the peripherals of one port at a time.
+    for (unsigned i=0; i < doors.size(); i++) {
+        for (unsigned j=0; j < doors[i].peripherals.size(); j++) {
+            PACSPeripheral& p = doors[i].peripherals[j];
+            if (p.captured || p.io.bitMask() == 0)
+                continue;
+            uint8_t k = 0;
+            while (k < scanPortCount && scanPorts[k].in != p.io.inputRegister())
+                k++;
+            if (k == scanPortCount) {
+                if (scanPortCount == SCAN_MAX_PORTS)
+                    continue;
+                scanPorts[k].in = p.io.inputRegister();
+                scanPorts[k].mask = 0;
+                scanPorts[k].snapshot = 0;
+                scanPortCount++;
+            }
+        }
+    }
+
+    for (uint8_t k=0; k < scanPortCount; k++) {
+        scanPorts[k].first = scanEntries.size();
+        for (unsigned i=0; i < doors.size(); i++) {
+            for (unsigned j=0; j < doors[i].peripherals.size(); j++) {
+                PACSPeripheral& p = doors[i].peripherals[j];
+                if (p.captured || p.io.inputRegister() != scanPorts[k].in)
+                    continue;
+                ScanEntry_t entry = { p.io.bitMask(), (uint8_t)i, (uint8_t)j };
+                scanEntries.items[scanEntries.count++] = entry;
+                // Start from the level the peripheral assumes, so that a pin
+                // that is already at another level is reported on the first scan.
+                scanPorts[k].mask |= entry.mask;
+                if (p.currentLevel() == HIGH)
+                    scanPorts[k].snapshot |= entry.mask;
+            }
         }
-        else {
-            cout << "Peripheral not found: " << rexId << endl;
-            return false;
-        }                
-    }        
-    cout << "Door not found: " << doorId << endl;
+        scanPorts[k].count = scanEntries.size() - scanPorts[k].first;
+    }
+}
+
+/*
+* Reads all scanned ports, and applies the bits that changed since the last
+* scan to their peripherals.
+*/
+void PACSDoorManager::scan() {
+    // Read all ports before handling any change, so the pins are sampled
+    // as close together as possible.
+    uint8_t values[SCAN_MAX_PORTS];
+    for (uint8_t k=0; k < scanPortCount; k++) {
+        values[k] = *scanPorts[k].in;
+    }
+    unsigned long now = micros();
+
+    for (uint8_t k=0; k < scanPortCount; k++) {
+        uint8_t changed = (values[k] ^ scanPorts[k].snapshot) & scanPorts[k].mask;
+        if (!changed)
+            continue;
+        scanPorts[k].snapshot = values[k];
+        for (unsigned e=scanPorts[k].first; e < scanPorts[k].first + scanPorts[k].count; e++) {
+            ScanEntry_t& entry = scanEntries[e];
+            if (entry.mask & changed) {
+                doors[entry.door].setPeripheralLevel(entry.peripheral, 
+                                                     (values[k] & entry.mask) ? HIGH : LOW, now);
+            }
+        }
+    }
+}
+
+/*
+* Swipes a Wiegand card at the specified reader, in the specified format or
+* the reader's default one if format is negative. The card is queued for
+* transmission, and if frame is not NULL it receives the number of the 
+* queued frame.
+*/
+bool PACSDoorManager::swipeCard(uint8_t handle, unsigned long facilityCode, unsigned long cardNumber,
+                                int8_t format, uint16_t* frame) {  
+    
+    PACSDoor* d;
+    PACSReader* r = getReader(handle, &d);
+    if (r == NULL) {
+        cout << "Reader not found: " << (int)handle << endl;
+        return false;
+    }
+    if (d->swipeCard(r - &d->readers[0], facilityCode, cardNumber, format)) {
+        cout << "[" << d->id << "|" << r->id << "]"<< F(": Card swiped. Facility code: ") 
+             << facilityCode << F(". Card number: ") << cardNumber << endl;        
+        if (frame != NULL)
+            *frame = r->lastQueuedFrame;
+        return true;
+    }
+    return false;
+}
+
+/*
+* Enters a pin digit/sequence at the specified reader. If frame is not NULL
+* it receives the number of the last queued frame.
+*/
+bool PACSDoorManager::enterPIN(uint8_t handle, char* code, uint16_t* frame) {
+        
+    PACSDoor* d;
+    PACSReader* r = getReader(handle, &d);
+    if (r == NULL) {
+        cout << "Reader not found: " << (int)handle << endl;
+        return false;
+    }
+    if (d->enterPIN(r - &d->readers[0], code)) {
+        cout << "[" << d->id << "|" << r->id << "]" << F(": Entered PIN digit(s): ") 
+             << code << endl;        
+        if (frame != NULL)
+            *frame = r->lastQueuedFrame;
+        return true;
+    }
     return false;    
 }
 
+/*
+* Opens the specified door monitor.
+*/
+bool PACSDoorManager::openDoor(uint8_t handle) {        
+
+    PACSDoor* d;
+    PACSPeripheral* p = getPeripheral(handle, &d);
+    if (p != NULL && d->openDoor(p - &d->peripherals[0])) {
+        cout << "[" << d->id << "|" << p->id() << "]" << F(": Door opened.") << endl;        
+        return true;
+    }
+    cout << "Peripheral not found: " << (int)handle << endl;
+    return false;    
+}
 
 /*
-* 
+* Closes the specified door monitor.
 */
-bool PACSDoorManager::activateInput(char* doorId, char* inputId) {        
+bool PACSDoorManager::closeDoor(uint8_t handle) {        
 
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->activateInput(inputId)) {
-            cout << "[" << doorId << "|" << inputId << "]" << F(": Input activated.") << endl;        
-            return true;
-        }
-        else {
-            cout << "Peripheral not found: " << inputId << endl;
-            return false;
-        }        
+    PACSDoor* d;
+    PACSPeripheral* p = getPeripheral(handle, &d);
+    if (p != NULL && d->closeDoor(p - &d->peripherals[0])) {
+        cout << "[" << d->id << "|" << p->id() << "]" << F(": Door closed.") << endl;        
+        return true;
     }
-    cout << "Door not found: " << doorId << endl;
+    cout << "Peripheral not found: " << (int)handle << endl;
     return false;    
 }
 
 /*
-* 
+* Pushes the specified REX device.
 */
-bool PACSDoorManager::deactivateInput(char* doorId, char* inputId) {
-    
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        if (d->deactivateInput(inputId)) {
-            cout << "[" << doorId << "|" << inputId << "]" << F(": Input deactivated.") << endl;        
-            return true;
-        }
-        else {
-            cout << "Peripheral not found: " << inputId << endl;
-            return false;
-        }                
+bool PACSDoorManager::pushREX(uint8_t handle) {        
+
+    PACSDoor* d;
+    PACSPeripheral* p = getPeripheral(handle, &d);
+    if (p != NULL && d->pushREX(p - &d->peripherals[0])) {
+        cout << "[" << d->id << "|" << p->id() << "]" << F(": REX pushed.") << endl;        
+        return true;
+    }
+    cout << "Peripheral not found: " << (int)handle << endl;
+    return false;    
+}
+
+/*
+* Activates the specified digital input.
+*/
+bool PACSDoorManager::activateInput(uint8_t handle) {        
+
+    PACSDoor* d;
+    PACSPeripheral* p = getPeripheral(handle, &d);
+    if (p != NULL && d->activateInput(p - &d->peripherals[0])) {
+        cout << "[" << d->id << "|" << p->id() << "]" << F(": Input activated.") << endl;        
+        return true;
+    }
+    cout << "Peripheral not found: " << (int)handle << endl;
+    return false;    
+}
+
+/*
+* Deactivates the specified digital input.
+*/
+bool PACSDoorManager::deactivateInput(uint8_t handle) {        
+
+    PACSDoor* d;
+    PACSPeripheral* p = getPeripheral(handle, &d);
+    if (p != NULL && d->deactivateInput(p - &d->peripherals[0])) {
+        cout << "[" << d->id << "|" << p->id() << "]" << F(": Input deactivated.") << endl;        
+        return true;
     }
-    cout << "Door not found: " << doorId << endl;
+    cout << "Peripheral not found: " << (int)handle << endl;
     return false;    
 }
 
 /*
-* Calls the updateLevels function for all the doors in the doors vector.
-* This will read the current levels of all the peripherals connected to the Arduino, 
-* and if they have changed, the registered callback will be called.
+* Reads the current levels of all the peripherals connected to the Arduino,
+* and if they have changed, the registered callback will be called. Readers
+* that have finished transmitting a frame are reported the same way.
+*
+* Pins captured by interrupt are reported first, one callback per change
+* and in the order they happened, however long ago that was. The other pins
+* are scanned one I/O port at a time.
 */
 void PACSDoorManager::updateLevels() {  
+    // Readers go first, so that a response that comes right after a frame
+    // is seen after the frame.
+    for (unsigned i=0; i < doors.size(); i++) {
+        doors[i].updateReaders();
+    }
+
+    EdgeEvent_t edge;
+    while (EdgeCapture::read(edge)) {
+        for (unsigned i=0; i < doors.size(); i++) {
+            doors[i].applyEdge(edge);
+        }
+    }
+
+    // If changes were lost, the captured levels can't be trusted any more
+    // and are read again.
+    bool resync = false;
+    if (EdgeCapture::takeOverflows()) {
+        cout << F("Edge queue overflow, level changes were lost.") << endl;
+        resync = true;
+    }
+
+    scan();
+
     for (unsigned i=0; i < doors.size(); i++) {
-        doors[i].updateLevels();        
+        doors[i].updateLevels(resync);        
     }
 }
 
@@ -212,8 +890,8 @@ void PACSDoorManager::updateLevels() {
 * Check if the specified peripheral is active (depends on the current state and
 * the peripherals configured ActiveLevel in the doors.cfg file).
 */
-int PACSDoorManager::isPeripheralActive(char* doorId, char* peripheralId) {
-    PACSPeripheral* p = findPeripheralById(doorId, peripheralId);
+int PACSDoorManager::isPeripheralActive(uint8_t handle) {
+    PACSPeripheral* p = getPeripheral(handle);
     if (p != NULL) {
         return (p->isActive() ? 1 : 0);
     }    
@@ -221,48 +899,124 @@ int PACSDoorManager::isPeripheralActive(char* doorId, char* peripheralId) {
 }
 
 /*
-* For the specified id, we search the doors vector and if we find a match,
-* return a pointer to the door (and NULL if no match is found.)
+* Writes whether each peripheral is active to a bitset by handle, which
+* must have room for PERIPHERAL_BITSET_SIZE(NO_HANDLE) bytes. The bit of
+* handle h is bit h % 8 of byte h / 8, and the bits of readers are clear.
+* Returns the number of handles.
 */
-PACSDoor* PACSDoorManager::findDoorById(char* doorId) {
-    for (unsigned i=0; i < doors.size(); i++) {
-        if ((strcmp(doors[i].id, doorId) == 0))
-            return &doors[i];
+uint8_t PACSDoorManager::getActiveStates(uint8_t* bits) {
+    memset(bits, 0, PERIPHERAL_BITSET_SIZE(handles.size()));
+    for (unsigned h=0; h < handles.size(); h++) {
+        if (handles[h].reader)
+            continue;
+        PACSPeripheral& p = doors[handles[h].door].peripherals[handles[h].index];
+        // Active if the level bit equals the active level bit.
+        if (getBit(PACSPeripheral::columns.levels, p.index) == getBit(PACSPeripheral::columns.activeLevels, p.index))
+            setBit(bits, h, true);
     }
-    return NULL;
+    return handles.size();
 }
 
 /*
-* For the specified door id and reader id, we search the doors vector and its 
-* associated readers and if we find a match, return a pointer to the reader
-* (and NULL if no match is found.)
+* Returns the default card format of the specified reader, or -1 if the 
+* reader is not found.
 */
-PACSReader* PACSDoorManager::findReaderById(char* doorId, char* readerId) {
+int PACSDoorManager::getReaderFormat(uint8_t handle) {
+    PACSReader* r = getReader(handle);
+    if (r != NULL) {
+        return r->format;
+    }
+    return -1;
+}
+
+/*
+* Check if the specified frame has been transmitted by the reader. Returns 
+* 1 if it has, 0 if it is still queued and -1 if the reader is not found.
+*/
+int PACSDoorManager::isFrameTransmitted(uint8_t handle, uint16_t frame) {
+    PACSReader* r = getReader(handle);
+    if (r != NULL) {
+        return (r->isFrameTransmitted(frame) ? 1 : 0);
+    }
+    return -1;
+}
+
+/*
+* Returns the response latency histogram of the specified door, or NULL if
+* the door is not found.
+*/
+LatencyHistogram* PACSDoorManager::getLatency(char* doorId) {
     PACSDoor* d = findDoorById(doorId);
     if (d != NULL) {
-        return d->findReaderById(readerId);
-    } 
+        return &d->latency;
+    }
     return NULL;
 }
 
 /*
-* For the specified door id and peripheral id, we search the doors vector and its 
-* associated peripherals and if we find a match, return a pointer to the peripheral
-* (and NULL if no match is found.)
+* Returns the door with the specified id, or NULL if there is none. Doors
+* are looked up in the index once it's built, and searched before that 
+* (while the config is loaded).
 */
-PACSPeripheral* PACSDoorManager::findPeripheralById(char* doorId, char* peripheralId) {
-    PACSDoor* d = findDoorById(doorId);
-    if (d != NULL) {
-        return d->findPeripheralById(peripheralId);
-    } 
+PACSDoor* PACSDoorManager::findDoorById(char* doorId) {
+    if (!indexed) {
+        for (unsigned i=0; i < doors.size(); i++) {
+            if ((strcmp(doors[i].id, doorId) == 0))
+                return &doors[i];
+        }
+        return NULL;
+    }
+
+    uint16_t hash = hashId(doorId);
+    for (unsigned k=lowerBound(doorIndex, hash); k < doorIndex.size() && doorIndex[k].hash == hash; k++) {
+        if (strcmp(doors[doorIndex[k].value].id, doorId) == 0)
+            return &doors[doorIndex[k].value];
+    }
     return NULL;
 }
 
+/*
+* Returns the reader with the specified handle, and if door is not NULL, 
+* its door. Returns NULL if the handle is not a reader's.
+*/
+PACSReader* PACSDoorManager::getReader(uint8_t handle, PACSDoor** door) {
+    if (handle >= handles.size() || !handles[handle].reader)
+        return NULL;
+    PACSDoor* d = &doors[handles[handle].door];
+    if (door != NULL)
+        *door = d;
+    return &d->readers[handles[handle].index];
+}
+
+/*
+* Returns the peripheral with the specified handle, and if door is not 
+* NULL, its door. Returns NULL if the handle is not a peripheral's.
+*/
+PACSPeripheral* PACSDoorManager::getPeripheral(uint8_t handle, PACSDoor** door) {
+    if (handle >= handles.size() || handles[handle].reader)
+        return NULL;
+    PACSDoor* d = &doors[handles[handle].door];
+    if (door != NULL)
+        *door = d;
+    return &d->peripherals[handles[handle].index];
+}
+
 /*
 * Registers a function to be called when a pin changes state.
 */
 void PACSDoorManager::registerStateChangeCallback(StateChangeCallback *callback) {
+    stateChangeCallback = callback;
     for (unsigned i=0; i < doors.size(); i++) {
         doors[i].registerStateChangeCallback(callback);
     }      
 }
+
+/*
+* Registers a function to be called when a reader has finished transmitting a frame.
+*/
+void PACSDoorManager::registerTransmitCompleteCallback(TransmitCompleteCallback *callback) {
+    transmitCompleteCallback = callback;
+    for (unsigned i=0; i < doors.size(); i++) {
+        doors[i].registerTransmitCompleteCallback(callback);
+    }      
+}
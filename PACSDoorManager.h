@@ -20,41 +20,183 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define PACSDOORMANAGER_H_
 
 #include "PACSDoor.h"
+#include "PACSArena.h"
 #include <StandardCplusplus.h>
-#include <vector>
 #include <serstream>
 
+#ifndef SCAN_MAX_PORTS
+#define SCAN_MAX_PORTS 12 // Max number of I/O ports with scanned pins (A-L on the Mega).
+#endif
+
+// An I/O port with scanned pins. Its peripherals are entries first...first+count-1
+// of the scan index.
+typedef struct {
+    volatile uint8_t* in; // The port input register.
+    uint8_t mask; // The scanned bits.
+    uint8_t snapshot; // The value of the scanned bits at the last scan.
+    uint16_t first;
+    uint16_t count;
+} ScanPort_t;
+
+// A scanned peripheral, by its bit in the port and its door/peripheral index.
+typedef struct {
+    uint8_t mask;
+    uint8_t door;
+    uint8_t peripheral;
+} ScanEntry_t;
+
+#define NO_HANDLE TRACE_NO_OBJECT // Not a handle, e.g. what findHandle() returns for an unknown id.
+
+// Doors are indexed with a uint8_t, and every reader and peripheral needs
+// a handle, which limits their number regardless of memory.
+#define MAX_DOORS 255
+#define MAX_OBJECTS NO_HANDLE // Readers and peripherals of all doors together.
+
+// What a handle refers to: a reader or peripheral of a door.
+typedef struct {
+    uint8_t door;
+    uint8_t index; // Index in the door's readers or peripherals.
+    bool reader;
+} HandleEntry_t;
+
+// A hashed id, for finding doors and handles by id with a binary search.
+typedef struct {
+    uint16_t hash;
+    uint8_t value; // The door index or handle.
+} IdIndexEntry_t;
+
+#define CONFIG_ID_MAX_LENGTH 16 // Room for door, reader and peripheral ids.
+
+typedef enum {CONFIG_DOOR, CONFIG_READER, CONFIG_PERIPHERAL} ConfigRecordKind_t;
+
+// A door, or a reader or peripheral of the last door before it.
+typedef struct {
+    uint8_t kind; // A ConfigRecordKind_t.
+    char id[CONFIG_ID_MAX_LENGTH + 1];
+    uint8_t type; // Peripheral type.
+    uint8_t pin; // Pin of a peripheral, data0 pin of a reader.
+    uint8_t pin1; // Data1 pin of a reader.
+    uint8_t level; // Active level of a peripheral, default format of a reader.
+    uint16_t debounceMs;
+    uint16_t pulseGapMs;
+} ConfigRecord_t;
+
+// A set of door tables. The readers and peripherals of a door are a range
+// of the reader and peripheral tables.
+typedef struct {
+    PACSRange<PACSDoor> doors;
+    PACSRange<PACSReader> readers;
+    PACSRange<PACSPeripheral> peripherals;
+    PACSPeripheralColumns_t columns;
+} PACSTables_t;
+
+// What a reconfiguration did, see commitReconfiguration().
+typedef struct {
+    uint8_t kept; // Readers and peripherals carried over as they were.
+    uint8_t initialized; // New or changed readers and peripherals, whose pins were set up.
+    uint8_t released; // Pins no longer in use, set back to inputs.
+} ReconfigurationResult_t;
+
 class PACSDoorManager {
     public:
         PACSDoorManager();
 
-        PACSDoor* createDoor(char*);
+        // The configuration is added a record at a time, and the door tables
+        // are built from the records all at once by initializeDoors() or
+        // commitReconfiguration().
+        ConfigRecord_t* addRecord(const ConfigRecord_t&); // NULL if out of memory.
+        void discardRecords();
         void setDoorId(char* oldId, char* newId);
-        void initializeDoors();
+        bool initializeDoors();
+
+        // The doors added between begin and commit replace the current
+        // ones, without a reset. Abort keeps the current ones.
+        void beginReconfiguration();
+        void abortReconfiguration();
+        bool commitReconfiguration(ReconfigurationResult_t&);
+        size_t memoryUsed() const { return arena.used(); } // Bytes of the arena in use.
+        bool limitsExceeded() const { return overLimit; } // Did the last load fail on MAX_DOORS or MAX_OBJECTS, rather than memory?
+
+        // Readers and peripherals are referred to by handle, see findHandle().
+        uint8_t findHandle(char*, char*);
+        bool findObject(uint8_t, char*&, char*&);
 
         // Door actions
-        bool swipeCard(char*, char*, unsigned long, unsigned long);
-        bool enterPIN(char*, char*, char*);
-        bool openDoor(char*, char*);
-        bool closeDoor(char*, char*);
-        bool pushREX(char*, char*);   
-        bool activateInput(char*, char*);
-        bool deactivateInput(char*, char*);
+        bool swipeCard(uint8_t, unsigned long, unsigned long, int8_t = -1, uint16_t* = NULL);
+        bool enterPIN(uint8_t, char*, uint16_t* = NULL);
+        bool openDoor(uint8_t);
+        bool closeDoor(uint8_t);
+        bool pushREX(uint8_t);   
+        bool activateInput(uint8_t);
+        bool deactivateInput(uint8_t);
         
         void updateLevels();        
-        int isPeripheralActive(char*, char*);
+        int isPeripheralActive(uint8_t);
+        uint8_t getActiveStates(uint8_t*); // All peripheral states at once, as a bitset by handle.
+        int isFrameTransmitted(uint8_t, uint16_t);
+        int getReaderFormat(uint8_t);
+        LatencyHistogram* getLatency(char*);
 
         // Callback for peripheral state changes.
         typedef void StateChangeCallback(PACSDoor&, PACSPeripheral&);
         void registerStateChangeCallback(StateChangeCallback*);                
 
-        // A vector to hold all our doors.
-        std::vector<PACSDoor> doors;
+        // Callback for readers that have finished transmitting a frame.
+        typedef void TransmitCompleteCallback(PACSDoor&, PACSReader&);
+        void registerTransmitCompleteCallback(TransmitCompleteCallback*);
+
+        // All our doors.
+        PACSRange<PACSDoor> doors;
     
     private:        
         PACSDoor* findDoorById(char*);
-        PACSReader* findReaderById(char*, char*);
-        PACSPeripheral* findPeripheralById(char*, char*);              
+        PACSReader* getReader(uint8_t, PACSDoor** = NULL);
+        PACSPeripheral* getPeripheral(uint8_t, PACSDoor** = NULL);
+        ConfigRecord_t& record(uint16_t);
+        void countRecords(unsigned*, unsigned&);
+        bool checkLimits();
+        size_t tablesSize();
+        bool buildTables(PACSTables_t&);
+        void moveTables(PACSTables_t&, size_t);
+        void releaseTables(ReconfigurationResult_t&);
+        void detachReaders();
+        void assignHandles();
+        void buildIdIndex();
+        void buildScanIndex();
+        void scan();
+        PACSReader* findPrevious(char*, PACSReader&);
+        PACSPeripheral* findPrevious(char*, PACSTables_t&, unsigned);
+        bool isPinUsed(uint8_t, PACSTables_t&);
+        void releasePin(uint8_t, PACSTables_t&, ReconfigurationResult_t&);
+        template <class T> bool allocateRange(PACSRange<T>&, unsigned);
+
+        static uint16_t hashId(const char*, uint16_t = 5381);
+        static void insertId(PACSRange<IdIndexEntry_t>&, uint16_t, uint8_t);
+        static unsigned lowerBound(PACSRange<IdIndexEntry_t>&, uint16_t);
+
+        // The tables, and the records of the configuration being added.
+        PACSArena arena;
+        uint16_t recordCount;
+        bool overLimit; // Did the added records exceed the limits?
+
+        // The readers and peripherals of all doors.
+        PACSRange<PACSReader> readers;
+        PACSRange<PACSPeripheral> peripherals;
+
+        // Handle -> object, and the ids of doors and objects, sorted by hash.
+        PACSRange<HandleEntry_t> handles;
+        PACSRange<IdIndexEntry_t> doorIndex;
+        PACSRange<IdIndexEntry_t> handleIndex;
+        bool indexed; // Is the id index up to date with the doors?
+
+        // The ports to scan and the peripherals on their bits, grouped by port.
+        ScanPort_t scanPorts[SCAN_MAX_PORTS];
+        uint8_t scanPortCount;
+        PACSRange<ScanEntry_t> scanEntries;
+
+        // Callbacks, for registering them with new doors.
+        StateChangeCallback* stateChangeCallback;
+        TransmitCompleteCallback* transmitCompleteCallback;
     };
 
 #endif
@@ -17,17 +17,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include "PACSPeripheral.h"
+#include "EdgeCapture.h"
+
+PACSPeripheralColumns_t PACSPeripheral::columns;
 
 /*
-* Constructors. 
+* Constructors. The id, pin and active level go in the columns, at index,
+* and the filtering in the filter table, at filter.
 */
 PACSPeripheral::PACSPeripheral() {}
-PACSPeripheral::PACSPeripheral(char* pId, PACSPeripheralType_t pType, uint8_t pPin, 
-                               uint8_t pActiveLevel) {
-    strcpy(id, pId);
-    pin = pPin;
+PACSPeripheral::PACSPeripheral(uint8_t pIndex, PACSPeripheralType_t pType, uint8_t pFilter) {
+    index = pIndex;
     type = pType;
-    activeLevel = pActiveLevel;
+    filter = pFilter;
+    handle = TRACE_NO_OBJECT;
 
 }
 
@@ -43,9 +46,22 @@ void PACSPeripheral::initialize() {
     * is not actually connected to anything.    
     */    
     
-    int initialLevel = ((activeLevel == HIGH) ? LOW : HIGH);
-    currentLevel = previousLevel = initialLevel;
-    levelChanged = false;
+    uint8_t pin = columns.pins[index];
+    int initialLevel = ((activeLevel() == HIGH) ? LOW : HIGH);
+    setBit(columns.levels, index, initialLevel == HIGH);
+    setBit(columns.changed, index, false);
+    changedMicros = 0;
+    captured = false;
+    if (isFiltered()) {
+        PACSPeripheralFilter_t& f = columns.filters[filter];
+        f.rawLevel = f.stableLevel = initialLevel;
+        f.rawMicros = f.burstMicros = 0;
+        f.pulses = f.pulseCount = 0;
+        f.pulseWidthMicros = f.pulseDurationMicros = 0;
+        f.pulseStartMicros = f.pulseActiveMicros = f.pulseEndMicros = f.pulseTotalMicros = 0;
+        f.held = false;
+    }
+    io.attach(pin);
 
     switch (type) {
         case DOORMONITOR:
@@ -53,13 +69,17 @@ void PACSPeripheral::initialize() {
         case DIGITAL_INPUT:
         case DIGITAL_OUTPUT:
             pinMode(pin, OUTPUT);
-            digitalWrite(pin, initialLevel);    
+            io.write(initialLevel);    
             break;                        
 
         case GREENLED:
         case BEEPER:
         case LOCK:
             pinMode(pin, INPUT);
+            // Short chirps and blinks can come and go between two polls,
+            // so the controller outputs are captured by interrupt if the
+            // pin has one.
+            captured = EdgeCapture::attach(pin, initialLevel);
             break;
         
         default:
@@ -68,40 +88,144 @@ void PACSPeripheral::initialize() {
 }
 
 /*
-* Checks the current level of the peripheral against its previous value,
-* and determines if a state change has occured.
+* Reads the pin on its own and applies its level. In the main loop levels
+* come from the port scan in PACSDoorManager or from captured edges instead.
 */
 void PACSPeripheral::updateLevels() {
-    float voltage;
+    applyEdge(io.read(), micros());
+}
 
-    switch (type) {
-        case DOORMONITOR:
-        case REX:
-        case GREENLED:
-        case BEEPER:
-        case LOCK:   
-        case DIGITAL_INPUT:
-        case DIGITAL_OUTPUT:
-            currentLevel = digitalRead(pin);
-            break;
+/*
+* Applies a level seen on the pin at the specified time. Without filtering
+* it is reported right away (levelChanged()), otherwise updateFilter() reports
+* it when it has settled.
+*/
+void PACSPeripheral::applyEdge(uint8_t level, unsigned long timestamp) {
+    setBit(columns.changed, index, false);
+    if (!isFiltered()) {
+        setLevel(level, timestamp);
+        return;
+    }
 
-        default:
-            break;
+    PACSPeripheralFilter_t& f = columns.filters[filter];
+    f.pulses = 0;
+    if (level == f.rawLevel)
+        return;
+    if (f.rawLevel == f.stableLevel)
+        f.burstMicros = timestamp;
+    f.rawLevel = level;
+    f.rawMicros = timestamp;
+    if (f.debounceMs == 0)
+        acceptLevel(level, timestamp);
+}
+
+/*
+* Reports a debounced level once it has been stable long enough, and a pulse
+* train once the pin has been inactive for the pulse gap. An activation that
+* is still going on after the pulse gap is no pulse, and is reported as a
+* level, after the pulses before it. Called every loop for filtered
+* peripherals.
+*/
+void PACSPeripheral::updateFilter(unsigned long now) {
+    PACSPeripheralFilter_t& f = columns.filters[filter];
+    setBit(columns.changed, index, false);
+    f.pulses = 0;
+
+    if ((f.debounceMs != 0) && (f.rawLevel != f.stableLevel) && 
+        ((long)(now - f.rawMicros) >= (long)f.debounceMs * 1000L)) {
+        // Report the level from when the bouncing started.
+        acceptLevel(f.rawLevel, f.burstMicros);
+        if (levelChanged())
+            return;
     }
 
-    if (currentLevel != previousLevel) {
-        levelChanged = true;
+    if (f.pulseGapMs == 0)
+        return;
+    long gap = (long)f.pulseGapMs * 1000L;
+    bool active = (f.stableLevel == activeLevel());
+    bool longActive = active && !f.held && ((long)(now - f.pulseActiveMicros) >= gap);
+
+    if ((f.pulseCount != 0) && (longActive || (!active && (long)(now - f.pulseEndMicros) >= gap))) {
+        f.pulses = f.pulseCount;
+        f.pulseWidthMicros = f.pulseTotalMicros / f.pulseCount;
+        f.pulseDurationMicros = f.pulseEndMicros - f.pulseStartMicros;
+        changedMicros = f.pulseStartMicros;
+        setBit(columns.changed, index, true);
+        f.pulseCount = 0;
     }
-    else {
-        levelChanged = false;
+    else if (longActive) {
+        f.held = true;
+        changedMicros = f.pulseActiveMicros;
+        setBit(columns.changed, index, true);
+    }
+}
+
+/*
+* Takes a level that has passed the debounce. In pulse mode the level is
+* kept, but it is added to the current pulse train instead of being
+* reported, unless it ends an activation that was reported as a level.
+*/
+void PACSPeripheral::acceptLevel(uint8_t level, unsigned long timestamp) {
+    PACSPeripheralFilter_t& f = columns.filters[filter];
+    uint8_t active = activeLevel();
+    bool wasActive = (f.stableLevel == active);
+    f.stableLevel = level;
+    if (f.pulseGapMs == 0) {
+        setLevel(level, timestamp);
+        return;
     }
 
-    previousLevel = currentLevel;
+    setBit(columns.levels, index, level == HIGH);
+    if (level == active) {
+        if (f.pulseCount == 0) {
+            f.pulseStartMicros = timestamp;
+            f.pulseTotalMicros = 0;
+        }
+        f.pulseActiveMicros = timestamp;
+    }
+    else if (wasActive && f.held) {
+        f.held = false;
+        changedMicros = timestamp;
+        setBit(columns.changed, index, true);
+    }
+    else if (wasActive) {
+        // Saturate the count rather than wrapping it.
+        if (f.pulseCount != 0xFF)
+            f.pulseCount++;
+        f.pulseTotalMicros += timestamp - f.pulseActiveMicros;
+        f.pulseEndMicros = timestamp;
+    }
+}
+
+/*
+* Sets the current level, and determines if it is a state change.
+*/
+void PACSPeripheral::setLevel(uint8_t level, unsigned long timestamp) {
+    bool changed = (level != currentLevel());
+    setBit(columns.changed, index, changed);
+    if (changed) {
+        changedMicros = timestamp;
+        setBit(columns.levels, index, level == HIGH);
+    }
 }
 
 /* 
 * Checks if the peripheral is currently active or not.
 */
 bool PACSPeripheral::isActive() {
-    return (currentLevel == activeLevel) ? true : false;
+    return (currentLevel() == activeLevel()) ? true : false;
+}
+
+/*
+* Drives the pin to the peripheral's active level.
+*/
+void PACSPeripheral::setActive() {
+    io.write(activeLevel() == HIGH ? HIGH : LOW);
+}
+
+/*
+* Drives the pin to the peripheral's inactive level.
+*/
+void PACSPeripheral::setInactive() {
+    io.write(activeLevel() == HIGH ? LOW : HIGH);
 }
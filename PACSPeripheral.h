@@ -20,27 +20,108 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define PACSPERIPHERAL_H_
 
 #include <Arduino.h>
+#include "FastPin.h"
+#include "Trace.h"
 
 #define PERIPHERAL_ID_MAX_LENGTH 16 // The max number of characters for the ID.
+#define NO_FILTER 255 // Filter index of a peripheral that reports every change.
 
 typedef enum {GREENLED, BEEPER, DOORMONITOR, REX, LOCK, DIGITAL_INPUT, DIGITAL_OUTPUT} PACSPeripheralType_t;
 
+// Filtering, configured in doors.cfg. A level has to be stable for
+// debounceMs before it is reported. In pulse mode the level still follows
+// the pin, but active pulses are counted and reported as one change when
+// the pin has been inactive for pulseGapMs. An activation that lasts longer
+// than pulseGapMs is reported as a level instead, when it starts and when
+// it ends. Few peripherals are filtered, so the filter state is kept in a
+// table of its own rather than in every peripheral.
+typedef struct {
+    uint16_t debounceMs; // Debounce time, 0 to report every change.
+    uint16_t pulseGapMs; // Gap that ends a pulse train, 0 to report levels.
+    uint8_t pulses; // Number of pulses in the reported train, 0 if a level was reported.
+    unsigned long pulseWidthMicros; // Average width of the reported pulses.
+    unsigned long pulseDurationMicros; // From the start of the first pulse to the end of the last.
+    uint8_t rawLevel; // The last level seen on the pin.
+    uint8_t stableLevel; // The last level that passed the debounce.
+    unsigned long rawMicros; // When the pin changed to rawLevel.
+    unsigned long burstMicros; // When the pin first left stableLevel.
+    uint8_t pulseCount; // Pulses in the current train.
+    unsigned long pulseStartMicros; // Start of the first pulse in the current train.
+    unsigned long pulseActiveMicros; // Start of the current pulse.
+    unsigned long pulseEndMicros; // End of the last pulse.
+    unsigned long pulseTotalMicros; // Sum of the pulse widths in the current train.
+    bool held; // Has the current activation been reported as a level?
+} PACSPeripheralFilter_t;
+
+// The fields of all peripherals that every scan and level change touches,
+// as one packed array per field, indexed by PACSPeripheral::index. The ids,
+// only needed for lookups and output, are kept apart as well. Levels are
+// bitsets, one bit per peripheral, so the peripherals of a door (which are
+// next to each other) take a bit each in a run of bits.
+typedef struct {
+    char (*ids)[PERIPHERAL_ID_MAX_LENGTH + 1];
+    uint8_t* pins; // Associated hardware-pins.
+    uint8_t* activeLevels; // Set if HIGH is considered "active", clear if LOW.
+    uint8_t* levels; // Set if the current level is HIGH.
+    uint8_t* changed; // Set if the level changed at the last update.
+    PACSPeripheralFilter_t* filters; // Indexed by PACSPeripheral::filter instead.
+} PACSPeripheralColumns_t;
+
+#define PERIPHERAL_BITSET_SIZE(n) (((n) + 7) / 8) // Bytes for a bitset of n peripherals.
+
+inline bool getBit(const uint8_t* bits, uint8_t i) {
+    return bits[i >> 3] & _BV(i & 7);
+}
+
+inline void setBit(uint8_t* bits, uint8_t i, bool value) {
+    if (value)
+        bits[i >> 3] |= _BV(i & 7);
+    else
+        bits[i >> 3] &= ~_BV(i & 7);
+}
+
 class PACSPeripheral {    
     public:
         PACSPeripheral();
-        PACSPeripheral(char*, PACSPeripheralType_t, uint8_t, uint8_t);
+        PACSPeripheral(uint8_t, PACSPeripheralType_t, uint8_t = NO_FILTER);
         
         void initialize(); // Initialize the peripheral. Set pin to input/output and to default level.       
-        void updateLevels(); // Update the current pin levels.                
+        void updateLevels(); // Read the pin and update the current level.
+        void applyEdge(uint8_t, unsigned long); // Update the level from a scanned or captured change.
+        void updateFilter(unsigned long); // Settle debounced levels and finished pulse trains.
+        bool isFiltered() const { return filter != NO_FILTER; } // Are changes debounced or decoded as pulses?
         bool isActive();  // Check if peripheral is in active state.
-        
-        char id[PERIPHERAL_ID_MAX_LENGTH + 1]; // Id of the peripheral.        
+        void setActive(); // Drive the pin to its active level.
+        void setInactive(); // Drive the pin to its inactive level.
+
+        // The peripheral's fields in the columns.
+        char* id() const { return columns.ids[index]; }
+        uint8_t pin() const { return columns.pins[index]; }
+        uint8_t activeLevel() const { return getBit(columns.activeLevels, index) ? HIGH : LOW; }
+        uint8_t currentLevel() const { return getBit(columns.levels, index) ? HIGH : LOW; }
+        bool levelChanged() const { return getBit(columns.changed, index); } // Did the last update change the level?
+
+        // The filtering, and the pulse train reported at the last update. All 0 if not filtered.
+        uint16_t debounceMs() const { return isFiltered() ? columns.filters[filter].debounceMs : 0; }
+        uint16_t pulseGapMs() const { return isFiltered() ? columns.filters[filter].pulseGapMs : 0; }
+        uint8_t pulses() const { return isFiltered() ? columns.filters[filter].pulses : 0; }
+        unsigned long pulseWidthMicros() const { return isFiltered() ? columns.filters[filter].pulseWidthMicros : 0; }
+        unsigned long pulseDurationMicros() const { return isFiltered() ? columns.filters[filter].pulseDurationMicros : 0; }
+
+        // The columns of the current door tables, set up by PACSDoorManager.
+        static PACSPeripheralColumns_t columns;
+
+        uint8_t index; // Index of the peripheral in the columns.
         PACSPeripheralType_t type; // Peripheral type. LED, Beeper, REX, etc.        
-        uint8_t pin; // Associated hardware-pin.                
-        uint8_t activeLevel; // The level (HIGH/LOW) which is considered "active".
-        uint8_t currentLevel; // Current pin level.
-        uint8_t previousLevel; // The pin level of the last update.
-        bool levelChanged; // Has the pin level changes since last update?
+        FastPin io; // Port access to the pin, resolved in initialize().
+        uint8_t handle; // Identifies the peripheral in the API and the trace, see PACSDoorManager.
+        unsigned long changedMicros; // micros() of the last level change.
+        bool captured; // Are level changes captured by interrupt instead of polled?
+        uint8_t filter; // Index of the filter state in the columns, NO_FILTER if not filtered.
+
+    private:
+        void setLevel(uint8_t, unsigned long);
+        void acceptLevel(uint8_t, unsigned long);
 };
 
 #endif
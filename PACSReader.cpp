@@ -17,15 +17,23 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include "PACSReader.h"
+#include "WiegandTransmitter.h"
 
 /* 
 * Constructors
 */
 PACSReader::PACSReader() {}
-PACSReader::PACSReader(char* rId, uint8_t rPin0, uint8_t rPin1) {
+PACSReader::PACSReader(char* rId, uint8_t rPin0, uint8_t rPin1, uint8_t rFormat) {
     strcpy(id, rId);
     pin0 = rPin0;
     pin1 = rPin1; 
+    format = rFormat;
+    handle = TRACE_NO_OBJECT;
+    lastQueuedFrame = lastSentFrame = lastReportedFrame = 0;
+    lastSentMicros = 0;
+    queueHead = queueTail = 0;
+    txState = bitsLeft = groupBitsLeft = 0;
+    ticksLeft = 0;
 }
 
 /* 
@@ -36,6 +44,63 @@ void PACSReader::initialize() {
     // active state for the reader pins, as they should always be high.    
     pinMode(pin0, OUTPUT);    
     pinMode(pin1, OUTPUT);   
-    digitalWrite(pin0, HIGH); 
-    digitalWrite(pin1, HIGH);    
-}
\ No newline at end of file
+    data0.attach(pin0);
+    data1.attach(pin1);
+    data0.write<HIGH>(); 
+    data1.write<HIGH>();    
+
+    // Hand the reader over to the transmitter.
+    WiegandTransmitter::attach(this);
+}
+
+/*
+* Queues a frame for transmission. The call returns immediately, the bits
+* are clocked out by the transmitter in the background. Returns false if
+* the queue is full.
+*/
+bool PACSReader::queueFrame(uint64_t data, uint8_t length, uint8_t groupLength) {
+    uint8_t next = (queueTail + 1) & (WIEGAND_QUEUE_LENGTH - 1);
+    if (next == queueHead) {
+        return false;
+    }
+
+    frames[queueTail].data = data;
+    frames[queueTail].length = length;
+    frames[queueTail].groupLength = groupLength;
+    lastQueuedFrame++;
+    // Publishing the new tail is what makes the frame visible to the ISR.
+    queueTail = next;
+
+    WiegandTransmitter::start();
+    return true;
+}
+
+/*
+* Checks if the reader has frames queued or in transmission.
+*/
+bool PACSReader::isTransmitting() {
+    return (queueHead != queueTail);
+}
+
+/*
+* Checks if the frame with the specified number has been transmitted.
+*/
+bool PACSReader::isFrameTransmitted(uint16_t frame) {
+    return ((int16_t)(getLastSentFrame() - frame) >= 0);
+}
+
+/*
+* Returns the number of the last transmitted frame, and optionally when 
+* it was completed. The values are updated from interrupt context, so 
+* they are read with interrupts disabled.
+*/
+uint16_t PACSReader::getLastSentFrame(unsigned long* sentMicros) {
+    uint16_t sent;
+    uint8_t oldSREG = SREG;
+    cli();
+    sent = lastSentFrame;
+    if (sentMicros != NULL)
+        *sentMicros = lastSentMicros;
+    SREG = oldSREG;
+    return sent;
+}
@@ -20,19 +20,58 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define PACSREADER_H_
 
 #include <Arduino.h>
+#include "FastPin.h"
+#include "WiegandFormat.h"
+#include "Trace.h"
 
 #define READER_ID_MAX_LENGTH 16 // The max number of characters for the ID.
+#define WIEGAND_QUEUE_LENGTH 4 // Size of the frame queue (power of two, one slot is always kept free).
 
-class PACSReader {    
+// A Wiegand frame waiting to be transmitted. If groupLength is non-zero,
+// the frame is sent as groups of that many bits with a pause in between
+// (used for keypad presses, where every key is its own 4 bit burst).
+typedef struct {
+    uint64_t data;
+    uint8_t length;
+    uint8_t groupLength;
+} WiegandFrame;
+
+class PACSReader {
     public:
         PACSReader();
-        PACSReader(char*, uint8_t, uint8_t);
-        
+        PACSReader(char*, uint8_t, uint8_t, uint8_t = WIEGAND_DEFAULT_FORMAT);
+
         void initialize(); // Initialize the reader.
+        bool queueFrame(uint64_t, uint8_t, uint8_t); // Queue a frame for transmission.
+        bool isTransmitting(); // Check if there are frames queued or in transmission.
+        bool isFrameTransmitted(uint16_t); // Check if the frame with the specified number is sent.
+        uint16_t getLastSentFrame(unsigned long* = NULL); // Number (and time) of the last sent frame.
 
         char id[READER_ID_MAX_LENGTH + 1]; // Id of the reader
         uint8_t pin0; // Wiegand data0 hardware-pin.
-        uint8_t pin1; // Wiegand data1 hardware-pin.       
+        uint8_t pin1; // Wiegand data1 hardware-pin.
+        uint8_t format; // Default card format, index into WiegandFormats.
+        FastPin data0; // Port access to pin0, resolved in initialize().
+        FastPin data1; // Port access to pin1, resolved in initialize().
+        uint8_t handle; // Identifies the reader in the API and the trace, see PACSDoorManager.
+
+        // Frame numbering. A frame gets its number when queued, and the
+        // transmitter updates lastSentFrame when its last bit is out.
+        volatile uint16_t lastQueuedFrame; // Number of the last queued frame.
+        volatile uint16_t lastSentFrame; // Number of the last fully transmitted frame.
+        volatile unsigned long lastSentMicros; // micros() when lastSentFrame was completed.
+        uint16_t lastReportedFrame; // Last frame reported to the transmit callback.
+
+        // The frame queue. Written by queueFrame() and consumed by the transmitter.
+        WiegandFrame frames[WIEGAND_QUEUE_LENGTH];
+        volatile uint8_t queueHead; // Index of the frame being transmitted.
+        volatile uint8_t queueTail; // Index where the next frame will be queued.
+
+        // Transmitter state for the frame at queueHead (only touched by the ISR).
+        uint8_t txState; // Idle, pulse, space or gap, see WiegandTransmitter.h.
+        uint8_t bitsLeft; // Number of bits left to send in the current frame.
+        uint8_t groupBitsLeft; // Number of bits left in the current group.
+        uint16_t ticksLeft; // Timer ticks left in the current state.
 };
 
-#endif
\ No newline at end of file
+#endif
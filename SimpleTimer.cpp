@@ -63,7 +63,7 @@ void SimpleTimer::run() {
             // is it time to process this timer ?
             // see http://arduino.cc/forum/index.php/topic,124048.msg932592.html#msg932592
 
-            if (current_millis - prev_millis[i] >= delays[i]) {
+            if (current_millis - prev_millis[i] >= (unsigned long)delays[i]) {
 
                 // update time
                 //prev_millis[i] = current_millis;
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Trace.h"
+
+TraceRecord_t Trace::records[TRACE_LENGTH];
+volatile uint32_t Trace::count = 0;
+
+static const char frameStart[] PROGMEM = "frame_start";
+static const char frameEnd[] PROGMEM = "frame_end";
+static const char rexPush[] PROGMEM = "rex_push";
+static const char rexRelease[] PROGMEM = "rex_release";
+static const char doorOpen[] PROGMEM = "door_open";
+static const char doorClose[] PROGMEM = "door_close";
+static const char inputActivate[] PROGMEM = "input_activate";
+static const char inputDeactivate[] PROGMEM = "input_deactivate";
+static const char outputActive[] PROGMEM = "output_active";
+static const char outputInactive[] PROGMEM = "output_inactive";
+
+static const char* const eventNames[TRACE_EVENT_COUNT] PROGMEM = {
+    frameStart, frameEnd, rexPush, rexRelease, doorOpen, doorClose,
+    inputActivate, inputDeactivate, outputActive, outputInactive
+};
+
+void Trace::record(uint8_t event, uint8_t object) {
+    record(event, object, micros());
+}
+
+/*
+* Adds a record, overwriting the oldest one if the trace is full.
+*/
+void Trace::record(uint8_t event, uint8_t object, unsigned long timestamp) {
+    if (object == TRACE_NO_OBJECT)
+        return;
+
+    uint8_t oldSREG = SREG;
+    cli();
+    TraceRecord_t& r = records[count & (TRACE_LENGTH - 1)];
+    r.micros = timestamp;
+    r.event = event;
+    r.object = object;
+    count++;
+    SREG = oldSREG;
+}
+
+/*
+* Copies the record with the specified sequence number. Returns false if it
+* has not been made yet, or has already been overwritten.
+*/
+bool Trace::read(uint32_t seq, TraceRecord_t& record) {
+    bool kept;
+    uint8_t oldSREG = SREG;
+    cli();
+    kept = (seq < count) && (count - seq <= TRACE_LENGTH);
+    if (kept)
+        record = records[seq & (TRACE_LENGTH - 1)];
+    SREG = oldSREG;
+    return kept;
+}
+
+uint32_t Trace::first() {
+    uint32_t n = next();
+    return (n > TRACE_LENGTH) ? n - TRACE_LENGTH : 0;
+}
+
+uint32_t Trace::next() {
+    uint8_t oldSREG = SREG;
+    cli();
+    uint32_t n = count;
+    SREG = oldSREG;
+    return n;
+}
+
+const __FlashStringHelper* Trace::eventName(uint8_t event) {
+    if (event >= TRACE_EVENT_COUNT)
+        return F("unknown");
+    return (const __FlashStringHelper*)pgm_read_ptr(&eventNames[event]);
+}
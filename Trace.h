@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <Arduino.h>
+
+#define TRACE_LENGTH 64 // Number of records kept (power of two).
+#define TRACE_NO_OBJECT 255 // Trace id of objects that are not traced.
+
+// Traced events. Stimuli are what we do to the controller, the rest is
+// what we see the controller do. Events come in begin/end pairs, with the
+// end being the begin + 1.
+typedef enum {
+    TRACE_FRAME_START, TRACE_FRAME_END, // A Wiegand frame is being sent.
+    TRACE_REX_PUSH, TRACE_REX_RELEASE, // A REX button is held.
+    TRACE_DOOR_OPEN, TRACE_DOOR_CLOSE, // A door is open.
+    TRACE_INPUT_ACTIVATE, TRACE_INPUT_DEACTIVATE, // A digital input is active.
+    TRACE_OUTPUT_ACTIVE, TRACE_OUTPUT_INACTIVE, // A lock, LED, beeper or digital output is active.
+    TRACE_EVENT_COUNT
+} TraceEvent_t;
+
+typedef struct {
+    unsigned long micros; // When the event happened.
+    uint8_t event; // A TraceEvent_t.
+    uint8_t object; // Trace id of the reader or peripheral.
+} TraceRecord_t;
+
+/*
+* Always on, fixed size trace of stimuli and observed output changes. Every
+* record gets a sequence number, so a client can fetch the trace a piece at
+* a time and tell if records were overwritten in between. Records can be
+* added from interrupt context.
+*/
+class Trace {
+    public:
+        static void record(uint8_t, uint8_t); // Record an event that happens now.
+        static void record(uint8_t, uint8_t, unsigned long); // Record an event that happened at the specified time.
+        static bool read(uint32_t, TraceRecord_t&); // Get a record by sequence number, if it's still kept.
+        static uint32_t first(); // Sequence number of the oldest record kept.
+        static uint32_t next(); // Sequence number the next record will get.
+        static const __FlashStringHelper* eventName(uint8_t); // Name of an event.
+
+    private:
+        static TraceRecord_t records[TRACE_LENGTH];
+        static volatile uint32_t count; // Number of records ever made.
+};
+
+#endif
@@ -0,0 +1,524 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "WebSocketServer.h"
+#include <avr/pgmspace.h>
+#include <StandardCplusplus.h>
+#include <serstream>
+
+using namespace std;
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+#define WS_KEY_LENGTH 24 // Length of a base64 encoded 16 byte key.
+#define WS_ACCEPT_LENGTH 28 // Length of a base64 encoded SHA-1 digest.
+
+static const char websocketGUID[] PROGMEM = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char base64Chars[] PROGMEM =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+char WebSocketServer::buffer[WS_BUFFER_SIZE + 1];
+
+static uint32_t rotateLeft(uint32_t value, uint8_t bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+/*
+* Runs one 64 byte block through SHA-1. The message schedule is kept as a
+* ring of 16 words instead of 80 to save RAM.
+*/
+static void sha1Block(uint32_t* h, const uint8_t* block) {
+    uint32_t w[16];
+    for (uint8_t i=0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4 + 1] << 16) |
+               ((uint32_t)block[i*4 + 2] << 8) | block[i*4 + 3];
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (uint8_t i=0; i < 80; i++) {
+        if (i >= 16) {
+            w[i & 15] = rotateLeft(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+        }
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rotateLeft(a, 5) + f + e + k + w[i & 15];
+        e = d;
+        d = c;
+        c = rotateLeft(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+/*
+* Calculates the Sec-WebSocket-Accept value for a key, i.e. the base64
+* encoded SHA-1 digest of the key and the websocket GUID. Key and GUID are
+* always 60 bytes, so the padded message is always two blocks.
+*/
+static void acceptKey(const char* key, char* accept) {
+    uint8_t message[128];
+    memset(message, 0, sizeof(message));
+    memcpy(message, key, WS_KEY_LENGTH);
+    memcpy_P(message + WS_KEY_LENGTH, websocketGUID, sizeof(websocketGUID) - 1);
+    message[60] = 0x80;
+    message[126] = (60 * 8) >> 8; // Message length in bits.
+    message[127] = (60 * 8) & 0xFF;
+
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    sha1Block(h, message);
+    sha1Block(h, message + 64);
+
+    uint8_t digest[20];
+    for (uint8_t i=0; i < 20; i++) {
+        digest[i] = h[i >> 2] >> (24 - (i & 3) * 8);
+    }
+
+    for (uint8_t i=0, j=0; i < 20; i += 3) {
+        uint32_t v = ((uint32_t)digest[i] << 16) | ((uint32_t)digest[i + 1] << 8);
+        if (i + 2 < 20)
+            v |= digest[i + 2];
+        accept[j++] = pgm_read_byte(&base64Chars[(v >> 18) & 63]);
+        accept[j++] = pgm_read_byte(&base64Chars[(v >> 12) & 63]);
+        accept[j++] = pgm_read_byte(&base64Chars[(v >> 6) & 63]);
+        accept[j++] = (i + 2 < 20) ? pgm_read_byte(&base64Chars[v & 63]) : '=';
+    }
+    accept[WS_ACCEPT_LENGTH] = '\0';
+}
+
+WebSocketClient::WebSocketClient()
+    : id(0), connected(false), binary(false), dropped(0), lastSeen(0), lastPing(0) {
+}
+
+WebSocketServer::WebSocketServer(uint16_t port)
+    : server(port), connectedCount(0), http(NULL), heartbeatInterval(0), heartbeatTimeout(0), subprotocol(NULL),
+      onConnect(NULL), onDisconnect(NULL), onData(NULL), onBinary(NULL) {
+    for (uint8_t i=0; i < WS_MAX_CLIENTS; i++) {
+        clients[i].id = i;
+    }
+}
+
+void WebSocketServer::begin() {
+    server.begin();
+}
+
+void WebSocketServer::shareSockets(HttpServer* httpServer) {
+    http = httpServer;
+}
+
+void WebSocketServer::setHeartbeat(unsigned long interval, unsigned long timeout) {
+    heartbeatInterval = interval;
+    heartbeatTimeout = timeout;
+}
+
+/*
+* Sets the subprotocol that clients can ask for in the handshake to talk in
+* binary frames. Clients that don't ask for it talk in text frames.
+*/
+void WebSocketServer::setSubprotocol(const char* name) {
+    subprotocol = name;
+}
+
+void WebSocketServer::registerConnectCallback(Callback* callback) {
+    onConnect = callback;
+}
+
+void WebSocketServer::registerDisconnectCallback(Callback* callback) {
+    onDisconnect = callback;
+}
+
+void WebSocketServer::registerDataCallback(DataCallback* callback) {
+    onData = callback;
+}
+
+void WebSocketServer::registerBinaryCallback(BinaryCallback* callback) {
+    onBinary = callback;
+}
+
+uint8_t WebSocketServer::connections(bool binary) const {
+    uint8_t count = 0;
+    for (uint8_t i=0; i < WS_MAX_CLIENTS; i++) {
+        if (clients[i].connected && clients[i].binary == binary)
+            count++;
+    }
+    return count;
+}
+
+/*
+* Accepts new connections, reads the frames that have arrived and keeps the
+* heartbeats going. Only clients with data waiting are read, so an idle
+* client costs nothing.
+*/
+void WebSocketServer::listen() {
+    EthernetClient incoming = server.accept();
+    if (incoming) {
+        accept(incoming);
+    }
+
+    unsigned long now = millis();
+    for (uint8_t i=0; i < WS_MAX_CLIENTS; i++) {
+        WebSocketClient& c = clients[i];
+        if (!c.connected)
+            continue;
+
+        if (!c.client.connected()) {
+            disconnect(c);
+            continue;
+        }
+
+        if (c.client.available() >= 2) {
+            readFrame(c);
+            if (!c.connected)
+                continue;
+        }
+
+        if (heartbeatTimeout && (now - c.lastSeen > heartbeatTimeout)) {
+            cout << F("Websocket ") << (int)c.id << F(": Heartbeat timeout. Closing connection.\n");
+            close(c, WS_POLICY_VIOLATION, "Heartbeat timeout.");
+        }
+        else if (heartbeatInterval && (now - c.lastPing >= heartbeatInterval)) {
+            sendFrame(c, WS_OPCODE_PING, NULL, 0);
+            c.lastPing = now;
+        }
+    }
+}
+
+/*
+* Does the opening handshake with a new connection and gives it a slot.
+*/
+void WebSocketServer::accept(EthernetClient& incoming) {
+    WebSocketClient* c = NULL;
+    for (uint8_t i=0; i < WS_MAX_CLIENTS; i++) {
+        if (!clients[i].connected) {
+            c = &clients[i];
+            break;
+        }
+    }
+
+    // The sockets of open HTTP connections count too. An idle one is
+    // closed to make room, one that is serving a request is left alone.
+    if (c != NULL && http != NULL && connectedCount + http->connectionCount() >= WS_MAX_CLIENTS && !http->closeIdle())
+        c = NULL;
+
+    incoming.setTimeout(WS_READ_TIMEOUT_MS);
+    incoming.setConnectionTimeout(WS_READ_TIMEOUT_MS);
+
+    if (c == NULL) {
+        cout << F("Websocket connection refused, all sockets are in use.\n");
+        incoming.print(F("HTTP/1.1 503 Service Unavailable\r\n\r\n"));
+        incoming.stop();
+        return;
+    }
+    bool binary = false;
+    if (!handshake(incoming, binary)) {
+        cout << F("Websocket handshake failed.\n");
+        incoming.print(F("HTTP/1.1 400 Bad Request\r\n\r\n"));
+        incoming.stop();
+        return;
+    }
+
+    c->client = incoming;
+    c->connected = true;
+    c->binary = binary;
+    c->dropped = 0;
+    c->lastSeen = c->lastPing = millis();
+    connectedCount++;
+
+    if (onConnect)
+        onConnect(*c);
+}
+
+/*
+* Reads the upgrade request and sends the response. Only the key and
+* subprotocol headers are needed, everything else is skipped.
+*/
+bool WebSocketServer::handshake(EthernetClient& client, bool& binary) {
+    char line[WS_LINE_LENGTH + 1];
+    char key[WS_KEY_LENGTH + 1];
+    key[0] = '\0';
+
+    if (!readLine(client, line, sizeof(line)) || strncmp_P(line, PSTR("GET "), 4) != 0)
+        return false;
+
+    while (readLine(client, line, sizeof(line))) {
+        if (line[0] == '\0') {
+            if (strlen(key) != WS_KEY_LENGTH)
+                return false;
+
+            char accept[WS_ACCEPT_LENGTH + 1];
+            acceptKey(key, accept);
+            client.print(F("HTTP/1.1 101 Switching Protocols\r\n"
+                           "Upgrade: websocket\r\n"
+                           "Connection: Upgrade\r\n"
+                           "Sec-WebSocket-Accept: "));
+            client.print(accept);
+            if (binary) {
+                client.print(F("\r\nSec-WebSocket-Protocol: "));
+                client.print(subprotocol);
+            }
+            client.print(F("\r\n\r\n"));
+            return true;
+        }
+        if (strncasecmp_P(line, PSTR("Sec-WebSocket-Key:"), 18) == 0) {
+            char* value = line + 18;
+            while (*value == ' ')
+                value++;
+            strncpy(key, value, WS_KEY_LENGTH);
+            key[WS_KEY_LENGTH] = '\0';
+        }
+        else if ((subprotocol != NULL) && (strncasecmp_P(line, PSTR("Sec-WebSocket-Protocol:"), 23) == 0)) {
+            // A comma separated list, in order of preference.
+            binary = (strstr(line + 23, subprotocol) != NULL);
+        }
+    }
+    return false;
+}
+
+/*
+* Reads a line without the line ending. Characters that don't fit are
+* dropped. Returns false if the line doesn't end in time.
+*/
+bool WebSocketServer::readLine(EthernetClient& client, char* line, uint8_t size) {
+    uint8_t length = 0;
+    unsigned long start = millis();
+
+    for (;;) {
+        int ch = client.read();
+        if (ch < 0) {
+            if (millis() - start > WS_READ_TIMEOUT_MS)
+                return false;
+            continue;
+        }
+        if (ch == '\n')
+            break;
+        if (ch != '\r' && length < size - 1)
+            line[length++] = ch;
+    }
+    line[length] = '\0';
+    return true;
+}
+
+/*
+* Reads one frame. Client frames are small and arrive in one piece, so the
+* rest of the frame is waited for (up to WS_READ_TIMEOUT_MS) rather than
+* keeping partial frames around for every client.
+*/
+void WebSocketServer::readFrame(WebSocketClient& c) {
+    uint8_t header[2];
+    uint8_t mask[4];
+
+    if (c.client.readBytes(header, 2) != 2) {
+        close(c, WS_PROTOCOL_ERROR, "Incomplete frame.");
+        return;
+    }
+
+    bool fin = header[0] & 0x80;
+    uint8_t opcode = header[0] & 0x0F;
+    unsigned short length = header[1] & 0x7F;
+
+    if (length == 127) {
+        close(c, WS_MESSAGE_TOO_BIG, "Message too big.");
+        return;
+    }
+    if (length == 126) {
+        uint8_t extended[2];
+        if (c.client.readBytes(extended, 2) != 2) {
+            close(c, WS_PROTOCOL_ERROR, "Incomplete frame.");
+            return;
+        }
+        length = ((unsigned short)extended[0] << 8) | extended[1];
+    }
+    if (!(header[1] & 0x80)) {
+        // Client frames must be masked.
+        close(c, WS_PROTOCOL_ERROR, "Frame not masked.");
+        return;
+    }
+    if (length > WS_BUFFER_SIZE) {
+        close(c, WS_MESSAGE_TOO_BIG, "Message too big.");
+        return;
+    }
+    if ((c.client.readBytes(mask, 4) != 4) || (c.client.readBytes((uint8_t*)buffer, length) != length)) {
+        close(c, WS_PROTOCOL_ERROR, "Incomplete frame.");
+        return;
+    }
+    for (unsigned short i=0; i < length; i++) {
+        buffer[i] ^= mask[i & 3];
+    }
+    buffer[length] = '\0';
+    c.lastSeen = millis();
+
+    switch (opcode) {
+        case WS_OPCODE_TEXT:
+        case WS_OPCODE_BINARY:
+            if (!fin) {
+                close(c, WS_UNSUPPORTED_DATA, "Fragmented message.");
+                return;
+            }
+            if ((opcode == WS_OPCODE_BINARY) != c.binary) {
+                close(c, WS_UNSUPPORTED_DATA, c.binary ? "Expected binary." : "Expected text.");
+                return;
+            }
+            if (c.binary && onBinary)
+                onBinary(c, (uint8_t*)buffer, length);
+            else if (!c.binary && onData)
+                onData(c, buffer, length);
+            break;
+
+        case WS_OPCODE_PING:
+            sendFrame(c, WS_OPCODE_PONG, buffer, length);
+            break;
+
+        case WS_OPCODE_PONG:
+            break;
+
+        case WS_OPCODE_CLOSE:
+            // Echo the status code back and hang up.
+            sendFrame(c, WS_OPCODE_CLOSE, buffer, (length < 2) ? length : 2);
+            disconnect(c);
+            break;
+
+        default:
+            close(c, WS_UNSUPPORTED_DATA, "Unsupported frame.");
+            break;
+    }
+}
+
+/*
+* Writes a frame, if it fits in the socket's send buffer. Writing more than
+* that would wait for the client to acknowledge, which a slow or dead client
+* never does in time.
+*/
+bool WebSocketServer::sendFrame(WebSocketClient& c, uint8_t opcode, const char* data, unsigned short length) {
+    uint8_t header[4];
+    uint8_t headerLength;
+
+    header[0] = 0x80 | opcode;
+    if (length < 126) {
+        header[1] = length;
+        headerLength = 2;
+    }
+    else {
+        header[1] = 126;
+        header[2] = length >> 8;
+        header[3] = length & 0xFF;
+        headerLength = 4;
+    }
+
+    if (c.client.availableForWrite() < headerLength + length)
+        return false;
+
+    c.client.write(header, headerLength);
+    if (length)
+        c.client.write((const uint8_t*)data, length);
+    return true;
+}
+
+/*
+* Sends a message to one client. A client that misses WS_MAX_DROPPED
+* messages in a row is too far behind to be of use, and is closed so it can
+* reconnect and request the current state.
+*/
+bool WebSocketServer::send(WebSocketClient& c, uint8_t opcode, const char* data, unsigned short length) {
+    if (!c.connected)
+        return false;
+
+    if (sendFrame(c, opcode, data, length)) {
+        c.dropped = 0;
+        return true;
+    }
+    if (++c.dropped == WS_MAX_DROPPED) {
+        cout << F("Websocket ") << (int)c.id << F(": Client too slow. Closing connection.\n");
+        close(c, WS_POLICY_VIOLATION, "Too slow.");
+    }
+    return false;
+}
+
+bool WebSocketServer::sendMessage(WebSocketClient& c, const char* data, unsigned short length) {
+    return send(c, WS_OPCODE_TEXT, data, length);
+}
+
+bool WebSocketServer::sendBinary(WebSocketClient& c, const uint8_t* data, unsigned short length) {
+    return send(c, WS_OPCODE_BINARY, (const char*)data, length);
+}
+
+void WebSocketServer::broadcast(const char* data, unsigned short length) {
+    for (uint8_t i=0; i < WS_MAX_CLIENTS; i++) {
+        if (clients[i].connected && !clients[i].binary)
+            send(clients[i], WS_OPCODE_TEXT, data, length);
+    }
+}
+
+void WebSocketServer::broadcastBinary(const uint8_t* data, unsigned short length) {
+    for (uint8_t i=0; i < WS_MAX_CLIENTS; i++) {
+        if (clients[i].connected && clients[i].binary)
+            send(clients[i], WS_OPCODE_BINARY, (const char*)data, length);
+    }
+}
+
+/*
+* Sends a close frame with a status code and reason, and closes the
+* connection without waiting for the client's reply.
+*/
+void WebSocketServer::close(WebSocketClient& c, uint16_t code, const char* reason) {
+    if (!c.connected)
+        return;
+
+    char payload[2 + 32];
+    uint8_t length = strlen(reason);
+    if (length > sizeof(payload) - 2)
+        length = sizeof(payload) - 2;
+    payload[0] = code >> 8;
+    payload[1] = code & 0xFF;
+    memcpy(payload + 2, reason, length);
+
+    sendFrame(c, WS_OPCODE_CLOSE, payload, length + 2);
+    disconnect(c);
+}
+
+void WebSocketServer::disconnect(WebSocketClient& c) {
+    c.client.stop();
+    c.connected = false;
+    connectedCount--;
+
+    if (onDisconnect)
+        onDisconnect(c);
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef WEBSOCKETSERVER_H_
+#define WEBSOCKETSERVER_H_
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "HttpServer.h"
+
+// The sockets left after the two listeners, see ETHERNET_SOCKETS. They are
+// shared with the open HTTP connections when shareSockets() is used.
+#define WS_MAX_CLIENTS (ETHERNET_SOCKETS - 2)
+#if WS_MAX_CLIENTS < 1
+#error "No sockets left for websocket clients"
+#endif
+#define WS_BUFFER_SIZE 256 // Max length of a received message.
+#define WS_LINE_LENGTH 80 // Max length of a handshake header line, longer lines are ignored.
+#define WS_READ_TIMEOUT_MS 100 // Max wait for the rest of a handshake or frame.
+#define WS_MAX_DROPPED 8 // Messages in a row that a client may miss before it's closed.
+
+// Close status codes.
+#define WS_NORMAL_CLOSURE 1000
+#define WS_GOING_AWAY 1001
+#define WS_PROTOCOL_ERROR 1002
+#define WS_UNSUPPORTED_DATA 1003
+#define WS_POLICY_VIOLATION 1008
+#define WS_MESSAGE_TOO_BIG 1009
+
+/*
+* A websocket connection, and the heartbeat state of it.
+*/
+class WebSocketClient {
+    public:
+        WebSocketClient();
+
+        uint8_t id; // Slot number, for log output.
+        bool isConnected() const { return connected; }
+        bool isBinary() const { return binary; } // Did the client choose the subprotocol?
+
+    private:
+        friend class WebSocketServer;
+
+        EthernetClient client;
+        bool connected;
+        bool binary;
+        uint8_t dropped; // Messages in a row that didn't fit the socket's send buffer.
+        unsigned long lastSeen; // millis() of the last frame from the client.
+        unsigned long lastPing; // millis() of the last heartbeat sent.
+};
+
+/*
+* A websocket server (RFC 6455) for several clients at the same time.
+* Messages are text frames of up to WS_BUFFER_SIZE bytes. A client that
+* asks for the subprotocol (see setSubprotocol()) talks in binary frames
+* instead, which go to the binary callback. Clients that
+* don't answer heartbeats are closed, and a client whose send buffer is full
+* misses the message rather than holding up the loop and the other clients.
+*/
+class WebSocketServer {
+    public:
+        typedef void Callback(WebSocketClient&);
+        typedef void DataCallback(WebSocketClient&, char*, unsigned short);
+        typedef void BinaryCallback(WebSocketClient&, uint8_t*, unsigned short);
+
+        WebSocketServer(uint16_t);
+
+        void begin();
+        void listen(); // Accept connections, read messages and send heartbeats.
+        void setHeartbeat(unsigned long, unsigned long); // Interval and timeout in ms, 0 to disable.
+        void setSubprotocol(const char*); // Name of the binary subprotocol, NULL for none.
+        void shareSockets(HttpServer*); // Count its open connections against WS_MAX_CLIENTS.
+
+        bool isConnected() const { return connectedCount != 0; }
+        uint8_t connections() const { return connectedCount; }
+        uint8_t connections(bool) const; // Binary or text clients.
+
+        bool sendMessage(WebSocketClient&, const char*, unsigned short);
+        bool sendBinary(WebSocketClient&, const uint8_t*, unsigned short);
+        void broadcast(const char*, unsigned short); // Send the same message to all text clients.
+        void broadcastBinary(const uint8_t*, unsigned short); // ...and to all binary clients.
+        void close(WebSocketClient&, uint16_t, const char*);
+
+        void registerConnectCallback(Callback*);
+        void registerDisconnectCallback(Callback*);
+        void registerDataCallback(DataCallback*);
+        void registerBinaryCallback(BinaryCallback*);
+
+    private:
+        void accept(EthernetClient&);
+        bool handshake(EthernetClient&, bool&);
+        bool readLine(EthernetClient&, char*, uint8_t);
+        void readFrame(WebSocketClient&);
+        bool sendFrame(WebSocketClient&, uint8_t, const char*, unsigned short);
+        bool send(WebSocketClient&, uint8_t, const char*, unsigned short);
+        void disconnect(WebSocketClient&);
+
+        EthernetServer server;
+        WebSocketClient clients[WS_MAX_CLIENTS];
+        uint8_t connectedCount;
+        HttpServer* http; // Server whose connections use the same sockets, or NULL.
+        unsigned long heartbeatInterval;
+        unsigned long heartbeatTimeout;
+        const char* subprotocol;
+
+        Callback* onConnect;
+        Callback* onDisconnect;
+        DataCallback* onData;
+        BinaryCallback* onBinary;
+
+        static char buffer[WS_BUFFER_SIZE + 1]; // Received message, shared by all clients.
+};
+
+#endif
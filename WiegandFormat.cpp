@@ -0,0 +1,149 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "WiegandFormat.h"
+#include <avr/pgmspace.h>
+
+// Format specifications number the bits from 1 (the first bit on the
+// wire) to the frame length. These helpers convert such positions to
+// bit indices and masks at compile time.
+
+// Index of bit position pos in a frame of len bits.
+constexpr uint8_t wiegandIndex(uint8_t len, uint8_t pos) {
+    return len - pos;
+}
+
+// Mask of bit positions from..to.
+constexpr uint64_t wiegandRange(uint8_t len, uint8_t from, uint8_t to) {
+    return (from > to) ? 0 : ((1ULL << wiegandIndex(len, from)) | wiegandRange(len, from + 1, to));
+}
+
+// Mask of bit positions from..to, skipping every third position, as
+// used by the Corporate 1000 formats (e.g. 3, 4, 6, 7, 9, 10...).
+constexpr uint64_t wiegandPattern(uint8_t len, uint8_t from, uint8_t to, uint8_t step = 0) {
+    return (from > to) ? 0 : (((step == 2) ? 0 : (1ULL << wiegandIndex(len, from))) |
+                              wiegandPattern(len, from + 1, to, (step + 1) % 3));
+}
+
+#define EVEN 0
+#define ODD 1
+
+static const WiegandFormat_t formats[] PROGMEM = {
+    // HID H10301, standard 26 bit. 8 bit facility code, 16 bit card number.
+    { "H10301", 26, 17, 8, 1, 16, 2, {
+        { wiegandIndex(26, 1), EVEN, wiegandRange(26, 2, 13) },
+        { wiegandIndex(26, 26), ODD, wiegandRange(26, 14, 25) } } },
+
+    // HID H10306, 34 bit. 16 bit facility code, 16 bit card number.
+    { "H10306", 34, 17, 16, 1, 16, 2, {
+        { wiegandIndex(34, 1), EVEN, wiegandRange(34, 2, 17) },
+        { wiegandIndex(34, 34), ODD, wiegandRange(34, 18, 33) } } },
+
+    // HID Corporate 1000, 35 bit. 12 bit company code, 20 bit card number.
+    // The leading parity bit covers all other bits, so it goes last.
+    { "C1K35", 35, 21, 12, 1, 20, 3, {
+        { wiegandIndex(35, 2), EVEN, wiegandPattern(35, 3, 34) },
+        { wiegandIndex(35, 35), ODD, wiegandPattern(35, 2, 34) },
+        { wiegandIndex(35, 1), ODD, wiegandRange(35, 2, 35) } } },
+
+    // HID H10304, 37 bit. 16 bit facility code, 19 bit card number.
+    { "H10304", 37, 20, 16, 1, 19, 2, {
+        { wiegandIndex(37, 1), EVEN, wiegandRange(37, 2, 19) },
+        { wiegandIndex(37, 37), ODD, wiegandRange(37, 19, 36) } } },
+
+    // HID Corporate 1000, 48 bit. 22 bit company code, 23 bit card number.
+    { "C1K48", 48, 24, 22, 1, 23, 3, {
+        { wiegandIndex(48, 2), EVEN, wiegandPattern(48, 3, 47) },
+        { wiegandIndex(48, 48), ODD, wiegandPattern(48, 2, 47) },
+        { wiegandIndex(48, 1), ODD, wiegandRange(48, 2, 48) } } },
+};
+
+/*
+* Returns the number of formats in the table.
+*/
+uint8_t WiegandFormats::count() {
+    return sizeof(formats) / sizeof(formats[0]);
+}
+
+/*
+* Returns the index of the format with the specified name, or -1 if there
+* is no such format.
+*/
+int8_t WiegandFormats::find(const char* name) {
+    for (uint8_t i=0; i < count(); i++) {
+        if (strcmp_P(name, formats[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+* Copies the format with the specified index from flash.
+*/
+bool WiegandFormats::get(uint8_t index, WiegandFormat_t& format) {
+    if (index >= count())
+        return false;
+    memcpy_P(&format, &formats[index], sizeof(WiegandFormat_t));
+    return true;
+}
+
+/*
+* Checks that the facility code and card number fit in the format's fields.
+*/
+bool WiegandFormats::fits(uint8_t index, unsigned long facilityCode, unsigned long cardNumber) {
+    WiegandFormat_t f;
+    if (!get(index, f))
+        return false;
+    return ((facilityCode >> f.facilityWidth) == 0) && ((cardNumber >> f.cardWidth) == 0);
+}
+
+/*
+* Assembles a frame in the specified format. Codes are masked to their field
+* widths. Returns the frame length in bits, or 0 if the format is unknown.
+*/
+uint8_t WiegandFormats::encode(uint8_t index, unsigned long facilityCode, unsigned long cardNumber,
+                               uint64_t& frame) {
+    WiegandFormat_t f;
+    if (!get(index, f))
+        return 0;
+
+    frame = ((uint64_t)(facilityCode & ((1UL << f.facilityWidth) - 1)) << f.facilityOffset) |
+            ((uint64_t)(cardNumber & ((1UL << f.cardWidth) - 1)) << f.cardOffset);
+
+    // Even parity bits make the number of ones they cover (including
+    // themselves) even, odd parity bits make it odd.
+    for (uint8_t i=0; i < f.parityCount; i++) {
+        if (parity(frame & f.parity[i].mask) != f.parity[i].odd)
+            frame |= (1ULL << f.parity[i].position);
+    }
+    return f.length;
+}
+
+/*
+* Returns 1 if an odd number of bits is set, by folding the value onto
+* itself instead of counting bit by bit.
+*/
+uint8_t WiegandFormats::parity(uint64_t value) {
+    uint32_t v = (uint32_t)value ^ (uint32_t)(value >> 32);
+    v ^= v >> 16;
+    uint8_t b = (uint8_t)v ^ (uint8_t)(v >> 8);
+    b ^= b >> 4;
+    b ^= b >> 2;
+    b ^= b >> 1;
+    return b & 1;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef WIEGANDFORMAT_H_
+#define WIEGANDFORMAT_H_
+
+#include <Arduino.h>
+
+#define WIEGAND_FORMAT_NAME_MAX_LENGTH 7 // The max number of characters for a format name.
+#define WIEGAND_MAX_PARITY_BITS 3 // The max number of parity bits in a format.
+#define WIEGAND_DEFAULT_FORMAT 0 // Index of the format used when none is configured (H10301).
+
+// A parity bit and the frame bits it covers. Bit indices count from
+// the LSB, i.e. the last bit on the wire has index 0.
+typedef struct {
+    uint8_t position; // Index of the parity bit.
+    uint8_t odd; // 1 for odd parity, 0 for even parity.
+    uint64_t mask; // The bits covered by the parity bit.
+} WiegandParity_t;
+
+// Layout of a Wiegand card format.
+typedef struct {
+    char name[WIEGAND_FORMAT_NAME_MAX_LENGTH + 1];
+    uint8_t length; // Total number of bits.
+    uint8_t facilityOffset; // Index of the facility code LSB.
+    uint8_t facilityWidth; // Number of facility code bits.
+    uint8_t cardOffset; // Index of the card number LSB.
+    uint8_t cardWidth; // Number of card number bits.
+    uint8_t parityCount; // Number of parity bits, calculated in order.
+    WiegandParity_t parity[WIEGAND_MAX_PARITY_BITS];
+} WiegandFormat_t;
+
+/*
+* The card format table. Formats are referenced by their index in the
+* table, which is what readers store as their default format.
+*/
+class WiegandFormats {
+    public:
+        static uint8_t count(); // Number of formats in the table.
+        static int8_t find(const char*); // Index of the named format, -1 if unknown.
+        static bool get(uint8_t, WiegandFormat_t&); // Copy a format out of flash.
+        static bool fits(uint8_t, unsigned long, unsigned long); // Do the codes fit the format?
+        static uint8_t encode(uint8_t, unsigned long, unsigned long, uint64_t&); // Build a frame.
+
+    private:
+        static uint8_t parity(uint64_t);
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "WiegandTransmitter.h"
+
+#define PULSE_TICKS 1
+#define SPACE_TICKS ((WIEGAND_BIT_INTERVAL_US / WIEGAND_TICK_US) - PULSE_TICKS)
+#define GAP_TICKS ((WIEGAND_GAP_MS * 1000UL) / WIEGAND_TICK_US)
+
+PACSReader* WiegandTransmitter::readers[WIEGAND_MAX_READERS];
+uint8_t WiegandTransmitter::readerCount = 0;
+
+/*
+* Registers a reader with the transmitter. Registering the same reader
+* twice has no effect.
+*/
+void WiegandTransmitter::attach(PACSReader* reader) {
+    for (uint8_t i=0; i < readerCount; i++) {
+        if (readers[i] == reader)
+            return;
+    }
+    if (readerCount == WIEGAND_MAX_READERS)
+        return;
+
+    uint8_t oldSREG = SREG;
+    cli();
+    readers[readerCount++] = reader;
+    SREG = oldSREG;
+}
+
+/*
+* Stops the timer interrupt and forgets all readers, before the readers are
+* replaced. Frames in transmission are cut short.
+*/
+void WiegandTransmitter::detachAll() {
+    uint8_t oldSREG = SREG;
+    cli();
+    TIMSK3 &= ~_BV(OCIE3A);
+    readerCount = 0;
+    SREG = oldSREG;
+}
+
+/*
+* Starts the timer interrupt, if it is not already running. Timer3 is set
+* up in CTC mode with a prescaler of 8, i.e. 2 counts per microsecond.
+*/
+void WiegandTransmitter::start() {
+    uint8_t oldSREG = SREG;
+    cli();
+    if (!(TIMSK3 & _BV(OCIE3A))) {
+        TCCR3A = 0;
+        TCCR3B = _BV(WGM32) | _BV(CS31);
+        OCR3A = (WIEGAND_TICK_US * (F_CPU / 8000000UL)) - 1;
+        TCNT3 = 0;
+        TIMSK3 |= _BV(OCIE3A);
+    }
+    SREG = oldSREG;
+}
+
+/*
+* Pulls the data line for the next bit low. Bits are sent MSB first.
+*/
+void WiegandTransmitter::startBit(PACSReader* r) {
+    // Shifting a 64 bit value by a variable amount is a loop on the AVR,
+    // so the bit is picked out of its (little endian) byte instead.
+    const uint8_t* data = (const uint8_t*)&r->frames[r->queueHead].data;
+
+    r->bitsLeft--;
+    if (r->groupBitsLeft)
+        r->groupBitsLeft--;
+    if (data[r->bitsLeft >> 3] & _BV(r->bitsLeft & 7))
+        r->data1.writeFromISR<LOW>();
+    else
+        r->data0.writeFromISR<LOW>();
+    r->txState = WIEGAND_PULSE;
+    r->ticksLeft = PULSE_TICKS;
+}
+
+/*
+* Advances all readers one tick. Runs in interrupt context, and stops the
+* timer when there is nothing left to send.
+*/
+void WiegandTransmitter::tick() {
+    bool busy = false;
+
+    for (uint8_t i=0; i < readerCount; i++) {
+        PACSReader* r = readers[i];
+
+        switch (r->txState) {
+            case WIEGAND_IDLE:
+                if (r->queueHead == r->queueTail)
+                    continue;
+                r->bitsLeft = r->frames[r->queueHead].length;
+                r->groupBitsLeft = r->frames[r->queueHead].groupLength;
+                Trace::record(TRACE_FRAME_START, r->handle);
+                startBit(r);
+                break;
+
+            case WIEGAND_PULSE:
+                if (--r->ticksLeft)
+                    break;
+                // Release the data line. We don't need to know which one
+                // was pulled, as both are idle high.
+                r->data0.writeFromISR<HIGH>();
+                r->data1.writeFromISR<HIGH>();
+                r->txState = WIEGAND_SPACE;
+                r->ticksLeft = SPACE_TICKS;
+                break;
+
+            case WIEGAND_SPACE:
+                if (--r->ticksLeft)
+                    break;
+                if (r->bitsLeft == 0) {
+                    // The frame is done. Publish it as sent and give the
+                    // controller some time before the next one.
+                    r->lastSentFrame++;
+                    r->lastSentMicros = micros();
+                    Trace::record(TRACE_FRAME_END, r->handle, r->lastSentMicros);
+                    r->queueHead = (r->queueHead + 1) & (WIEGAND_QUEUE_LENGTH - 1);
+                    r->txState = WIEGAND_GAP;
+                    r->ticksLeft = GAP_TICKS;
+                }
+                else if (r->frames[r->queueHead].groupLength && r->groupBitsLeft == 0) {
+                    r->groupBitsLeft = r->frames[r->queueHead].groupLength;
+                    r->txState = WIEGAND_GAP;
+                    r->ticksLeft = GAP_TICKS;
+                }
+                else {
+                    startBit(r);
+                }
+                break;
+
+            case WIEGAND_GAP:
+                if (--r->ticksLeft)
+                    break;
+                if (r->bitsLeft)
+                    startBit(r); // Next group of the current frame.
+                else
+                    r->txState = WIEGAND_IDLE;
+                break;
+        }
+        busy = true;
+    }
+
+    if (!busy) {
+        TIMSK3 &= ~_BV(OCIE3A);
+    }
+}
+
+ISR(TIMER3_COMPA_vect) {
+    WiegandTransmitter::tick();
+}
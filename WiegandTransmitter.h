@@ -0,0 +1,59 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef WIEGANDTRANSMITTER_H_
+#define WIEGANDTRANSMITTER_H_
+
+#include <Arduino.h>
+#include "PACSReader.h"
+
+// The transmitter runs off Timer3 in CTC mode, which means that PWM
+// (analogWrite) is not available on pins 2, 3 and 5.
+#define WIEGAND_TICK_US 50 // Timer tick, also the width of a data pulse.
+#define WIEGAND_BIT_INTERVAL_US 1000 // Time from the start of one bit to the next.
+#define WIEGAND_GAP_MS 50 // Pause between frames and between keypad presses.
+#ifndef WIEGAND_MAX_READERS
+#define WIEGAND_MAX_READERS 32 // Max number of readers the transmitter can drive.
+#endif
+
+// Transmitter states of a reader (PACSReader::txState).
+#define WIEGAND_IDLE 0 // Nothing in transmission.
+#define WIEGAND_PULSE 1 // A data line is pulled low.
+#define WIEGAND_SPACE 2 // Both lines are high, waiting for the next bit.
+#define WIEGAND_GAP 3 // Pause after a frame or a keypad group.
+
+/*
+* Timer interrupt driven Wiegand transmitter. Frames are queued on the
+* readers, and the transmitter clocks them out in the background so that
+* the main loop never has to wait for a transmission to finish.
+*/
+class WiegandTransmitter {
+    public:
+        static void attach(PACSReader*); // Register a reader to be serviced.
+        static void detachAll(); // Stop, and forget all readers.
+        static void start(); // Make sure the timer is running.
+        static void tick(); // Called from the timer interrupt.
+
+    private:
+        static void startBit(PACSReader*);
+
+        static PACSReader* readers[WIEGAND_MAX_READERS];
+        static uint8_t readerCount;
+};
+
+#endif
@@ -18,15 +18,30 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 // Serial baudrate of the Arduino.
 #define SERIAL_BAUD 57600
 
-// Websocket heartbeats.
+// Websocket heartbeats, per client.
 #define HEARTBEAT_INTERVAL 5
 #define HEARTBEAT_TIMEOUT 15
 
-// Webserver fail message.
-#define WEBDUINO_FAIL_MESSAGE ""
+// State updates are held back for up to this many milliseconds (0 = until
+// the end of the loop), and sent together as one websocket frame.
+#define UPDATE_COALESCE_MS 5
+#define UPDATE_MAX_BATCH 8
+#define UPDATE_BUFFER_SIZE 512 // Holds a whole batch.
+#define UPDATE_MAX_LENGTH 160 // Longest single update.
+#define UPDATE_PREFIX_LENGTH 12 // Length of {"Updates":[
 
-// Buffer for sending files to client.
-#define FILE_TX_BUFFER_SIZE 64
+// Buffer for other websocket messages, which are built on the stack.
+#define MESSAGE_BUFFER_SIZE 160
+
+// Commands POSTed to the api route are read one at a time into a buffer of
+// this size. Delays between them are capped.
+#define BATCH_COMMAND_LENGTH 128
+#define BATCH_MAX_DELAY_MS 10000
+
+// Files are read, sent and written a block at a time, through one static
+// buffer (fileBuffer) rather than one on the stack of every file function.
+#define FILE_TX_BUFFER_SIZE 256
+#define UPLOAD_FILENAME_LENGTH 32 // Room for a config filename with the upload extension.
 
 // Reserved pins.
 #define ETHERNET_SELECT_PIN 10
@@ -34,23 +49,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define SS_HARDWARE_PIN 53
 #define RESET_PIN 40
 
-// Favicon
-#define WEBDUINO_FAVICON_DATA ""
-
-//#define WEBDUINO_SERIAL_DEBUGGING 1
-
-// Receiving larger door configuration files requires
-// a longer timeout, 5 seconds has so far worked well
-#define WEBDUINO_READ_TIMEOUT_IN_MS 5000
-
 // Toggle bonjour/zeroconf functionality.
 #undef BONJOUR_ENABLED
 
 #include "SPI.h"
 #include "avr/pgmspace.h"
 #include "Ethernet.h"
-#include "WebSocket.h"
-#include "WebServer.h"
+#include "HttpServer.h"
 
 #include <EEPROM.h>
 
@@ -69,6 +74,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "PACSReader.h"
 #include "PACSPeripheral.h"
 #include "PACSDoorManager.h"
+#include "ConfigImage.h"
+#include "DoorConfig.h"
+#include "WiegandFormat.h"
+#include "Trace.h"
+#include "JsonWriter.h"
+#include "JsonValidator.h"
+#include "JsonTokenizer.h"
+#include "WebSocketServer.h"
+#include "BinaryProtocol.h"
 #include "Network.h"
 
 // For freemem.
@@ -86,30 +100,73 @@ namespace std {
 }
 
 System sys;
-WebServer* webserver;
-WebSocket websocketServer;
+HttpServer* webserver;
+WebSocketServer websocketServer(8888);
 PACSDoorManager doorManager;
 Network network;
 
-// Pin mappings. Index is pin number.
-char digitalPins[54][4];
-char analogPins[16][4];
-
 // Webserver filenames.
 char* indexFilename = "index.htm";
 
+// A web GUI file and its content type.
+typedef struct {
+  const char* name;
+  const char* type;
+} WebAsset_t;
+
+// The web GUI files, served from web/ on the SD card. A gzipped copy of a
+// file can be put in web/gz/ under the same name (8.3 names leave no room
+// for a .gz suffix), and is sent to the clients that accept it.
+const WebAsset_t webAssets[] = {
+  { "index.htm", "text/html; charset=utf-8" },
+  { "app.js", "text/javascript; charset=utf-8" },
+  { "keypad.mp3", "audio/mpeg" },
+  { "favicon.ico", "image/x-icon" },
+};
+#define WEB_ASSET_COUNT (sizeof(webAssets) / sizeof(webAssets[0]))
+
+// Entity tags of the web files, plain and gzipped, worked out the first time
+// they are requested (0 = not yet). The files can only change along with
+// the SD card, i.e. across a reset. Bit n of the masks tells if web/gz/ has
+// been checked for file n, and if it was there.
+uint32_t webAssetTags[WEB_ASSET_COUNT][2];
+uint8_t webAssetsChecked = 0;
+uint8_t webAssetsGzipped = 0;
+
 // Configuration filenames.
 const char* pinsConfigFilename = "config/pins.cfg";
 const char* doorsConfigFilename = "config/doors.cfg";
+const char* configImageFilename = "config/config.bin"; // The two above, compiled.
 
 int last_free_ram = 0;
 
+// State updates waiting to be sent, see onStateChange(). They are written
+// after room for the frame prefix, with room for the suffix kept at the end.
+char updateBuffer[UPDATE_BUFFER_SIZE];
+JsonBuffer pendingUpdates(updateBuffer + UPDATE_PREFIX_LENGTH, UPDATE_BUFFER_SIZE - UPDATE_PREFIX_LENGTH - 2);
+uint8_t pendingUpdateCount = 0;
+unsigned long pendingUpdatesSince = 0;
+WebSocketClient* updateTarget = NULL;
+
+// Event records waiting to be sent to the binary clients, see queueEvent().
+BinaryRecord_t binaryUpdates[UPDATE_MAX_BATCH];
+uint8_t binaryUpdateCount = 0;
+uint16_t eventSequence = 0;
+
+// Counts the peripheral state changes and reconfigurations, so that a
+// client can tell whether the states have changed between two snapshots.
+uint16_t stateSequence = 0;
+
+// The block buffer of sendFile(), fileTag(), isJsonFile(), receiveFile()
+// and replaceFile(), which never run at the same time.
+byte fileBuffer[FILE_TX_BUFFER_SIZE];
+
 /*
-* Helper class for reading/writing aJSON to/from the WebServer
+* Helper class for reading/writing aJSON to/from the HttpServer
 */
-class WebServeraJsonStream : public aJsonStream {
+class HttpServeraJsonStream : public aJsonStream {
 public:
-  WebServeraJsonStream(WebServer* webserver_): aJsonStream(NULL), webserver(webserver_) {}
+  HttpServeraJsonStream(HttpServer* webserver_): aJsonStream(NULL), webserver(webserver_) {}
   
   virtual bool available()  { 
     if (bucket != EOF)
@@ -132,7 +189,7 @@ private:
     return retVal; 
   }
 
-  WebServer* webserver;
+  HttpServer* webserver;
 };
 
 // API commands
@@ -146,9 +203,28 @@ typedef enum Command
     ACTIVATEINPUT,
     DEACTIVATEINPUT,
     GETPERIPHERALSTATE,  
+    GETALLSTATES,
+    GETFRAMESTATE,
+    TRACE,
+    GETLATENCY,
+    RESETLATENCY,
+    GETHANDLE,
     UNDEFINED,
 };
 
+// Results of the door commands of the websocket API, which are also run in
+// batches through the api route.
+typedef enum CommandResult
+{
+    COMMAND_OK,
+    COMMAND_NOT_FOUND,
+    COMMAND_MISSING_PARAMETER,
+    COMMAND_UNKNOWN_FORMAT,
+    COMMAND_INVALID,
+    COMMAND_UNKNOWN,
+    COMMAND_WEBSOCKET_ONLY,
+};
+
 /*
 * Mounts the SD card.
 */
@@ -181,12 +257,14 @@ void freeMem() {
 
 
 /*
-* Sends a file on the SD card to the client.
+* Sends a file on the SD card to the client. The length is known up front,
+* so the file goes from the SD card to the connection a block at a time,
+* without going through the server's buffer.
 */
-void sendFile(WebServer &server, const char* type, const char* filename)
+void sendFile(HttpServer &server, const char* type, const char* filename, const char* headers)
 {
   
-  byte txBuffer[FILE_TX_BUFFER_SIZE];
+  byte* txBuffer = fileBuffer;
   int bytesRead = 0;
   P(could_not_open_file) = "Could not open file: ";
 
@@ -197,119 +275,248 @@ void sendFile(WebServer &server, const char* type, const char* filename)
     server.print(filename);
     return;
   }
-  // Opening of file was successful, so send correct content 
-  // type and start sending the file in "chunks".
-  server.httpSuccess(type);
-  while (fileStream.available()) 
-  {
-    txBuffer[bytesRead] = fileStream.read();
-    bytesRead++;
-
-    if(bytesRead == FILE_TX_BUFFER_SIZE)
-    {
-      server.write(txBuffer, FILE_TX_BUFFER_SIZE);
-      bytesRead = 0;
-    }                
-  }    
-  if(bytesRead > 0) {
-    server.write(txBuffer, bytesRead); 
-  }    
-  server.printCRLF();        
+  server.httpSuccess(type, headers);
+  server.setContentLength(fileStream.size());
+  while ((bytesRead = fileStream.read(txBuffer, FILE_TX_BUFFER_SIZE)) > 0) {
+    server.write(txBuffer, bytesRead);
+  }
   fileStream.close();  
 }
 
 /*
-* Saves a file on the SD card from the client
+* Works out an entity tag for a file, a Fletcher-32 checksum of its
+* contents. Returns 0 if the file can't be read.
+*/
+uint32_t fileTag(const char* filename) {
+  byte* buffer = fileBuffer;
+  uint32_t sum1 = 0xFFFF;
+  uint32_t sum2 = 0xFFFF;
+  int bytesRead;
+
+  File fileStream = SD.open(filename);
+  if (!fileStream) {
+    return 0;
+  }
+  while ((bytesRead = fileStream.read(buffer, FILE_TX_BUFFER_SIZE)) > 0) {
+    for (int i=0; i < bytesRead; i++) {
+      sum1 += buffer[i];
+      sum2 += sum1;
+    }
+    // A block can't overflow the sums, so they are only reduced once per block.
+    sum1 %= 65535;
+    sum2 %= 65535;
+  }
+  fileStream.close();
+  return ((sum2 << 16) | sum1) | 1;
+}
+
+/*
+* Sends one of the web GUI files, gzipped if there is a gzipped copy and the
+* client accepts it. The browser is told to check back every time, and gets
+* a 304 with no body if its copy is current, so reloading the GUI costs
+* little more than a request per file.
+*/
+void sendWebAsset(HttpServer &server, uint8_t index) {
+  char filename[32];
+  char etag[12];
+  char headers[HTTP_EXTRA_HEADERS_LENGTH];
+  bool gzip = false;
+
+  if (server.acceptsGzip()) {
+    sprintf(filename, "web/gz/%s", webAssets[index].name);
+    if (!(webAssetsChecked & _BV(index))) {
+      if (SD.exists(filename))
+        webAssetsGzipped |= _BV(index);
+      webAssetsChecked |= _BV(index);
+    }
+    gzip = (webAssetsGzipped & _BV(index));
+  }
+  if (!gzip) {
+    sprintf(filename, "web/%s", webAssets[index].name);
+  }
+
+  uint32_t &tag = webAssetTags[index][gzip ? 1 : 0];
+  if (tag == 0) {
+    tag = fileTag(filename);
+  }
+  sprintf(etag, "\"%08lx\"", tag);
+  sprintf(headers, "ETag: %s\r\nCache-Control: no-cache\r\nVary: Accept-Encoding\r\n%s", etag,
+          gzip ? "Content-Encoding: gzip\r\n" : "");
+
+  if (server.etagMatches(etag)) {
+    server.httpNotModified(headers);
+    return;
+  }
+  cout << F("Client is requesting file: ") << filename << endl;
+  sendFile(server, webAssets[index].type, filename, headers);
+}
+
+/*
+* Works out the name an upload of a file is stored under until it has been
+* applied, the same name with the extension .new. The SD library only does
+* 8.3 names, so the extension is all that can change.
+*/
+void uploadFilename(const char* filename, char* upload) {
+  strcpy(upload, filename);
+  char* dot = strrchr(upload, '.');
+  if (dot == NULL || strchr(dot, '/') != NULL)
+    dot = upload + strlen(upload);
+  strcpy(dot, ".new");
+}
+
+/*
+* Checks that a file on the SD card holds a whole JSON document.
+*/
+bool isJsonFile(const char* filename) {
+  byte* buffer = fileBuffer;
+  JsonValidator validator;
+  int bytesRead;
+
+  File fileStream = SD.open(filename);
+  if (!fileStream)
+    return false;
+  while ((bytesRead = fileStream.read(buffer, FILE_TX_BUFFER_SIZE)) > 0) {
+    if (!validator.feed(buffer, bytesRead))
+      break;
+  }
+  fileStream.close();
+  return validator.isComplete();
+}
+
+/*
+* Saves a file on the SD card from the client. The body goes to the upload
+* file (see uploadFilename) a block at a time, and is checked as it comes
+* in. The file itself is left alone, replaceFile() puts the upload in its
+* place once it has been applied. Fails, and answers the client, if the
+* body is cut short or isn't a JSON document.
 */
-void receiveFile(WebServer &server, const char* filename)
+bool receiveFile(HttpServer &server, const char* filename)
 {
-  byte txBuffer[FILE_TX_BUFFER_SIZE];
+  byte* buffer = fileBuffer;
+  char upload[UPLOAD_FILENAME_LENGTH];
+  JsonValidator validator;
   int bytesRead = 0;
+  int buffered = 0;
+  bool valid = true;
+  bool written = true;
   P(could_not_open_file) = "Could not open file: ";
-  
-  if (SD.exists((char*) filename))
-    SD.remove((char*) filename);
+  P(invalid_upload) = "Upload incomplete or not JSON: ";
 
-  File fileStream = SD.open(filename, FILE_WRITE);
+  uploadFilename(filename, upload);
+  if (SD.exists(upload))
+    SD.remove(upload);
+
+  File fileStream = SD.open(upload, FILE_WRITE);
   if (!fileStream) {
     server.httpFail();
     server.printP(could_not_open_file);
+    server.print(upload);
+    return false;
+  }
+
+  // The buffer is filled before writing, so the SD library gets half a
+  // 512-byte sector per write instead of whatever arrived in one read; its
+  // block cache writes the sector once both halves are in. Once the body is
+  // known to be bad, the rest is only read.
+  while ((bytesRead = server.read(buffer + buffered, FILE_TX_BUFFER_SIZE - buffered)) > 0) {
+    if (!valid)
+      continue;
+    valid = validator.feed(buffer + buffered, bytesRead);
+    buffered += bytesRead;
+    if (buffered == FILE_TX_BUFFER_SIZE) {
+      written = written && (fileStream.write(buffer, buffered) == (size_t)buffered);
+      buffered = 0;
+    }
+  }
+  if (valid && buffered > 0)
+    written = written && (fileStream.write(buffer, buffered) == (size_t)buffered);
+  fileStream.close();
+
+  if (!valid || !validator.isComplete() || !server.bodyComplete() || !written) {
+    SD.remove(upload);
+    cout << F("Discarded the upload of ") << filename << endl;
+    server.httpFail();
+    server.printP(invalid_upload);
     server.print(filename);
-    return;
+    return false;
   }
-  
-  int c = server.read();
-  // Opening of file was successful
-  while (c != -1) 
-  {
-    fileStream.write(c);
-    c = server.read();
-  }    
-  
-  fileStream.close();  
+  return true;
 }
 
-/* *****************************************************************************************************
-* 
-* Configuration Section
-* 
-***************************************************************************************************** */
-
 /*
-* Used by the functions that load the pin and door configuration. Waits for
-* data to appear in the stream or timeout to occur, then returns.
+* Puts the upload of a file in its place. The SD library can't rename
+* files, so the upload is copied over the file and then removed. Should
+* the copy be cut short, recoverFile() finishes it at the next start.
 */
-void waitForData(Stream& stream, int timeout) {
-  unsigned long i = millis() + timeout;
-  while ((!stream.available()) && (millis() < i)) /* spin with a timeout*/;
+bool replaceFile(const char* filename) {
+  byte* buffer = fileBuffer;
+  char upload[UPLOAD_FILENAME_LENGTH];
+  int bytesRead;
+  bool written = true;
+
+  uploadFilename(filename, upload);
+  File source = SD.open(upload);
+  if (!source)
+    return false;
+  if (SD.exists((char*) filename))
+    SD.remove((char*) filename);
+  File target = SD.open(filename, FILE_WRITE);
+  if (!target) {
+    source.close();
+    return false;
+  }
+  while ((bytesRead = source.read(buffer, FILE_TX_BUFFER_SIZE)) > 0) {
+    if (target.write(buffer, bytesRead) != (size_t)bytesRead) {
+      written = false;
+      break;
+    }
+  }
+  target.close();
+  source.close();
+  if (written)
+    SD.remove(upload);
+  return written;
 }
 
 /*
-* Find the next quotation-mark, and read all bytes until quotation-mark 
-* after that.
-*/   
-bool getNextToken(Stream& stream, char* tokenBuffer, uint8_t length) {
-
-  stream.find("\"");
-  uint8_t bytesRead = stream.readBytesUntil('"', tokenBuffer, length);
-  tokenBuffer[bytesRead] = '\0';
+* Cleans up after an upload that was interrupted by a reset. An upload is
+* only copied over its file once it has been applied, so if the file is
+* missing or cut short, the copy was interrupted and is done again. Any
+* other upload left behind was never applied, and is removed.
+*/
+void recoverFile(const char* filename) {
+  char upload[UPLOAD_FILENAME_LENGTH];
 
-  if (bytesRead > 0)
-    return true;
-  else
-    return false;
+  uploadFilename(filename, upload);
+  if (!SD.exists(upload))
+    return;
+  if (!isJsonFile(filename) && isJsonFile(upload)) {
+    cout << F("Recovering ") << filename << F(" from an interrupted upload.\n");
+    if (!replaceFile(filename))
+      cout << F("Could not recover ") << filename << endl;
+  }
+  else {
+    SD.remove(upload);
+  }
 }
 
-// An enum to keep track of what we are parsing, when loading 
-// the door configuration file.
-// We put the enum in its oown namespace to prevent poluting
-// the global one.
-namespace Cfg {
-  enum Pos {
-            NONE, DOOR, READER, DOOR_MONITOR, REX, LOCK, DIGITAL_INPUT, DIGITAL_OUTPUT, //Container
-            WIEGAND, GREEN_LED, BEEPER, //Subcontainer
-            ID, PIN, PIN_ZERO, PIN_ONE, ACTIVE //Property
-            };
-  enum PinType {DIGITAL, ANALOG};
-};
+/* *****************************************************************************************************
+* 
+* Configuration Section
+* 
+***************************************************************************************************** */
 
 /*
 * This function is used to load the pin mappings from the configuration-
-* file on the SD card. Each pin has a 3 character long id, which is stored 
-* in an array. This array is needed for lookup as the door configuration 
-* file references these id:s, instead of the actual pin numbers.
-*
-* A custom parser is needed as there is not enough memory to load the entire 
-* config file into memory.
+* file on the SD card. Each pin has a 3 character long id, which DoorConfig
+* keeps for lookup, as the door configuration file references these id:s,
+* instead of the actual pin numbers. A default file is written if there is
+* none.
 */
 bool loadPinMappingsFromFile(const char* filename) {
 
-  Cfg::PinType cfgPinType = Cfg::DIGITAL;
-  const uint8_t tokenBufferLength = 4;
-  char tokenBuffer[tokenBufferLength] = "";  
   bool parsingSucceeded = false;
   int i = 0;    
-  uint8_t pin;
 
   File fileStream;
   if (!SD.exists((char*) filename))  {
@@ -356,429 +563,23 @@ bool loadPinMappingsFromFile(const char* filename) {
     cout << F("Error opening ") << filename << endl;
     return false;
   }  
-  
-  while (true) {           
-
-    if (cfgPinType == Cfg::DIGITAL) {
-      // Get the digital pin number.
-      getNextToken(fileStream, tokenBuffer, tokenBufferLength); 
-      pin = (uint8_t)atoi(tokenBuffer);
 
-      // Make sure that the parsed pin is "correct", i.e. in numerical order.
-      if (pin != i) {
-        cout << F("Expected pin number ") << (int)i << ", got " << (int)pin << endl;
-        break;
-      }
-      // Get the pin id and save to array.
-      getNextToken(fileStream, tokenBuffer, tokenBufferLength);            
-      strcpy(digitalPins[i], tokenBuffer);  
-      digitalPins[i][3] = '\0';
-    }   
-    else if (cfgPinType == Cfg::ANALOG) { 
-      // Get the analog pin number.
-      getNextToken(fileStream, tokenBuffer, tokenBufferLength); 
-
-      // Convert it to the actual analog pin number.
-      uint8_t parsedPin;
-      if (strcmp(tokenBuffer, "A0") == 0) parsedPin = A0;
-      else if (strcmp(tokenBuffer, "A1") == 0) parsedPin = A1;
-      else if (strcmp(tokenBuffer, "A2") == 0) parsedPin = A2;
-      else if (strcmp(tokenBuffer, "A3") == 0) parsedPin = A3;      
-      else if (strcmp(tokenBuffer, "A4") == 0) parsedPin = A4;
-      else if (strcmp(tokenBuffer, "A5") == 0) parsedPin = A5;
-      else if (strcmp(tokenBuffer, "A6") == 0) parsedPin = A6;
-      else if (strcmp(tokenBuffer, "A7") == 0) parsedPin = A7;
-      else if (strcmp(tokenBuffer, "A8") == 0) parsedPin = A8;
-      else if (strcmp(tokenBuffer, "A9") == 0) parsedPin = A9;
-      else if (strcmp(tokenBuffer, "A10") == 0) parsedPin = A10;
-      else if (strcmp(tokenBuffer, "A11") == 0) parsedPin = A11;
-      else if (strcmp(tokenBuffer, "A12") == 0) parsedPin = A12;
-      else if (strcmp(tokenBuffer, "A13") == 0) parsedPin = A13;
-      else if (strcmp(tokenBuffer, "A14") == 0) parsedPin = A14;
-      else if (strcmp(tokenBuffer, "A15") == 0) parsedPin = A15;
-      else {
-        cout << F("Expected analog pin number, got ") << tokenBuffer << endl;
-        break;
-      }
-
-      // Get the pin id and save to array.
-      getNextToken(fileStream, tokenBuffer, tokenBufferLength);      
-      strcpy(analogPins[i], tokenBuffer);
-      analogPins[i][3] = '\0';
-    } 
-    
-    // If we have parsed the last analog pin, we are finished!
-    if ((cfgPinType == Cfg::ANALOG) && (i == 15))  {
-      fileStream.close();
-      parsingSucceeded = true;
-      break;
-    }      
-    // If we have parsed the last digital pin, switch to parsing the analog ones.
-    else if (i == 53) {
-      cfgPinType = Cfg::ANALOG;
-      i = 0;
-    }
-    // Otherwise, we are not finished. So just do the next one.
-    else {
-      i++;
-    }
+  parsingSucceeded = DoorConfig::parsePins(fileStream);
+  if (!parsingSucceeded) {
+    cout << F("Error parsing ") << filename << endl;
   }
-  
+
   // Close the file and return if we succeeded or not.
   fileStream.close();
-  return (parsingSucceeded ? true : false);
-}
-
-/*
-* Returns a pin number given the passed pin id.
-*/
-uint8_t getPinNumber(char* pinId) {
-  // Check for a match in the digital pins lookup table.
-  for (int i=0;i<=53;i++) {
-      if (strcmp(digitalPins[i], pinId) == 0) {
-        return i;
-      }      
-  }
-  
-  // If we didn't find a match there, we check the analog
-  // pins.
-  for (int i=0;i<=15;i++) {
-      if (strcmp(analogPins[i], pinId) == 0) {
-        switch (i) {
-          case 0: return A0;
-          case 1: return A1;
-          case 2: return A2;
-          case 3: return A3;
-          case 4: return A4;
-          case 5: return A5;
-          case 6: return A6;
-          case 7: return A7;
-          case 8: return A8;
-          case 9: return A9;
-          case 10: return A10;
-          case 11: return A11;
-          case 12: return A12;
-          case 13: return A13;
-          case 14: return A14;
-          case 15: return A15;
-        }
-      }      
-  }
-  // If we find nothing...
-  cout << F("No matching pin number found for pin id ") << pinId << endl;
-  return 255;
-}
-
-/*
-* Returns a pin number given the passed pin id.
-*/
-uint8_t isValidPin(int pinId) {
-  return (pinId != 255 ? true : false);
-}
-
-/*
-* Parses a door "chunk" and using DoorManager, adds the doors and peripherals.
-* This method is pretty brutal. Could be done much nicer.
-*/
-int parseDoor(Stream& stream, char* startToken, char* stopToken) {
-
-  // The passed stream points at the character after the door token,
-  // e.g. "DOOR2": { "blah": "blah" }
-  //             ^---- points here
-  const uint8_t tokenLength = 16;
-  char token[tokenLength] = "";
-  uint8_t openBraces = 0;
-  Cfg::Pos cfgPos = Cfg::DOOR;
-  Cfg::Pos cfgParent = Cfg::NONE;
-    
-  // Create temporary PACS-objects with rubbish values. 
-  // These will receive proper values during parsing.  
-  PACSDoor* tempDoor = doorManager.createDoor("temp");  
-  PACSReader tempReader("temprdr", 255, 255);
-  PACSPeripheral tempPeripheral("tempper", GREENLED, 255, LOW);
-  
-  // Keep parsing while there are more tokens in stream.
-  while(getNextToken(stream, token, tokenLength)) {
-    
-    // Check if we've parsed the entire door.
-    if (strcmp(token, stopToken) == 0) {
-      // We return false to specify that there are more doors.
-      return 1;
-    }
-   
-    // 
-    // "CONTAINERS"
-    //  
-    else if (strcmp(token, "Reader") == 0) {
-      cfgPos = Cfg::READER;
-      cfgParent = Cfg::DOOR;  
-      openBraces = 0;
-    }     
-    else if (strcmp(token, "REX") == 0) {         
-      cfgPos = Cfg::REX;
-      cfgParent = Cfg::DOOR;  
-      openBraces = 0;
-    }     
-    else if (strcmp(token, "DoorMonitor") == 0) {   
-      cfgPos = Cfg::DOOR_MONITOR;
-      cfgParent = Cfg::DOOR;  
-      openBraces = 0;
-    }     
-    else if (strcmp(token, "Lock") == 0) {   
-      cfgPos = Cfg::LOCK;
-      cfgParent = Cfg::DOOR;  
-      openBraces = 0;
-    }     
-    else if (strcmp(token, "Input") == 0) {   
-      cfgPos = Cfg::DIGITAL_INPUT;
-      cfgParent = Cfg::DOOR;  
-      openBraces = 0;
-    }     
-    else if (strcmp(token, "Output") == 0) {   
-      cfgPos = Cfg::DIGITAL_OUTPUT;
-      cfgParent = Cfg::DOOR;  
-      openBraces = 0;
-    }         
-    //     
-    //  "SUB-CONTAINERS"
-    //
-    else if (strcmp(token, "Wiegand") == 0) {   
-      cfgPos = Cfg::WIEGAND;
-      cfgParent = Cfg::READER;  
-    }     
-    else if (strcmp(token, "GreenLED") == 0) {   
-      cfgPos = Cfg::GREEN_LED;
-      cfgParent = Cfg::READER;  
-    }     
-    else if (strcmp(token, "Beeper") == 0) {   
-      cfgPos = Cfg::BEEPER;
-      cfgParent = Cfg::READER;  
-    }     
-    // 
-    // STRING/INT OBJECTS
-    //  
-    else if (strcmp(token, "Id") == 0) {   
-      getNextToken(stream, token, tokenLength);
-      switch (cfgPos) {      
-        case Cfg::DOOR:
-          strcpy(tempDoor->id, token);
-          break;
-        case Cfg::WIEGAND:
-          strcpy(tempReader.id, token);
-          break;
-        case Cfg::GREEN_LED:
-        case Cfg::BEEPER:
-        case Cfg::DOOR_MONITOR:
-        case Cfg::REX:
-        case Cfg::LOCK:
-        case Cfg::DIGITAL_INPUT:
-        case Cfg::DIGITAL_OUTPUT:
-          strcpy(tempPeripheral.id, token);
-      } 
-    } 
-    else if (strcmp(token, "Pin") == 0) {
-      getNextToken(stream, token, tokenLength);          
-      switch (cfgPos) {      
-        case Cfg::GREEN_LED:
-        case Cfg::BEEPER:
-        case Cfg::DOOR_MONITOR:
-        case Cfg::REX:
-        case Cfg::LOCK:
-        case Cfg::DIGITAL_INPUT:
-        case Cfg::DIGITAL_OUTPUT:
-          tempPeripheral.pin = getPinNumber(token);
-          if (!isValidPin) {
-            return -1;
-          }
-      } 
-    }
-    else if (strcmp(token, "Pin0") == 0) {
-      getNextToken(stream, token, tokenLength);    
-      switch (cfgPos) {          
-        case Cfg::WIEGAND:                             
-          tempReader.pin0 = getPinNumber(token);
-          if (!isValidPin) {
-            return -1;
-          }
-      } 
-    }
-    else if (strcmp(token, "Pin1") == 0) {
-      getNextToken(stream, token, tokenLength);      
-      switch (cfgPos) {      
-        case Cfg::WIEGAND:                 
-          tempReader.pin1 = getPinNumber(token);
-          if (!isValidPin) {
-            return -1;
-          }
-      } 
-    }
-    else if (strcmp(token, "ActiveLevel") == 0) {
-      getNextToken(stream, token, tokenLength);
-      switch (cfgPos) {      
-        case Cfg::DOOR_MONITOR:
-        case Cfg::REX:
-        case Cfg::LOCK:
-        case Cfg::DIGITAL_INPUT:
-        case Cfg::DIGITAL_OUTPUT:
-        case Cfg::GREEN_LED:
-        case Cfg::BEEPER:
-          if (strcmp(token, "HIGH") == 0) {
-            tempPeripheral.activeLevel = HIGH;
-          }
-          else if (strcmp(token, "LOW") == 0) {
-            tempPeripheral.activeLevel = LOW;
-          }
-      }
-    }
-
-    // Token is parsed. Now we need to traverse the container.
-    while ((stream.available()) && (stream.peek() != '"')) {
-      
-      switch (stream.read()) {
-        case ']':
-          cfgPos = Cfg::DOOR;
-          cfgParent = Cfg::NONE;
-          break;
-        case '{':
-          openBraces++;
-          break;
-        case '}':
-          openBraces--;
-
-          // Closing Curly brace means an object has "ended", which
-          // means we can save something.                  
-          if (cfgParent == Cfg::READER) {
-            switch (cfgPos) {              
-              case Cfg::WIEGAND:
-                tempDoor->addReader(tempReader.id, 
-                                    tempReader.pin0, 
-                                    tempReader.pin1);                                     
-                break;
-              case Cfg::GREEN_LED:
-                tempDoor->addPeripheral(tempPeripheral.id, 
-                                        GREENLED, 
-                                        tempPeripheral.pin, 
-                                        tempPeripheral.activeLevel);                
-
-                break;
-              case Cfg::BEEPER:
-                tempDoor->addPeripheral(tempPeripheral.id, 
-                                        BEEPER, 
-                                        tempPeripheral.pin, 
-                                        tempPeripheral.activeLevel);                   
-                break;
-            }
-            // Move the parse position up a level.
-            cfgPos = Cfg::READER;
-            cfgParent = Cfg::DOOR;                        
-          }
-          else if (cfgParent == Cfg::DOOR) {
-            switch (cfgPos) {
-              case Cfg::DOOR_MONITOR:
-                tempDoor->addPeripheral(tempPeripheral.id, 
-                                        DOORMONITOR, 
-                                        tempPeripheral.pin, 
-                                        tempPeripheral.activeLevel);
-                break;
-              case Cfg::REX:
-                tempDoor->addPeripheral(tempPeripheral.id, 
-                                        REX, 
-                                        tempPeripheral.pin, 
-                                        tempPeripheral.activeLevel);
-
-                break;
-              case Cfg::LOCK:
-                tempDoor->addPeripheral(tempPeripheral.id, 
-                                        LOCK, 
-                                        tempPeripheral.pin, 
-                                        tempPeripheral.activeLevel);
-                break;
-              case Cfg::DIGITAL_INPUT:
-                tempDoor->addPeripheral(tempPeripheral.id,
-                                        DIGITAL_INPUT,
-                                        tempPeripheral.pin,
-                                        tempPeripheral.activeLevel);
-                break;
-              case Cfg::DIGITAL_OUTPUT:
-                tempDoor->addPeripheral(tempPeripheral.id,
-                                        DIGITAL_OUTPUT,
-                                        tempPeripheral.pin,
-                                        tempPeripheral.activeLevel);
-                break;
-            }
-
-          }
-          else if (cfgParent == Cfg::NONE) {
-            //Do nothing
-          }
-      }
-    }
-  }
-  // If we got to this point, it means there was no stop token found, i.e.
-  // we have parsed the last door.
-  return 0;
-}
-
-/*
-* Opens the door config file for reading and sends the doors it is comprised of
-* for parsing, one at a time.
-*/ 
-bool parsDoorConfiguration(Stream& stream) {
-
-  const uint8_t MAX_NO_OF_DOORS = 16;  
-  uint8_t currentDoor = 1;    
-  char conversionBuffer[3];
-  bool doorsAvailable = true;
-  
-  cout << F("Parsing door: ");
-
-  // Parse the door objects (as many as we can find, up
-  // to the defined maximum).  
-  while(doorsAvailable == 1) {  
-
-    // Construct the start/stop door-number string, e.g. "DOOR3", "DOOR4"
-    char currentDoorToken[10] = "DOOR";    
-    char nextDoorToken[10] = "DOOR";    
-    itoa(currentDoor, conversionBuffer, 10);
-    strcat(currentDoorToken, conversionBuffer);
-    itoa(currentDoor+1, conversionBuffer, 10);
-    strcat(nextDoorToken, conversionBuffer);
-
-    cout << (int)currentDoor << F(" ");
-
-    // Check if there's a door config entry for this door number.
-    // If there is, we create a door and start parsing it.
-    waitForData(stream, 1000);              
-
-    // Do the actual parsing of the door.
-    doorsAvailable = parseDoor(stream, currentDoorToken, nextDoorToken);        
-    
-    // Check if there was an error while parsing.
-    if (doorsAvailable == -1) {
-      return false;
-    }
-    // Check if we have reached our door limit.
-    else if (currentDoor == MAX_NO_OF_DOORS) {
-      cout << F("Maximum number of doors reached.\n");
-      return false;
-    }
-    else {
-      currentDoor++;      
-    }    
-  }
-
-  cout << endl;
-  return true;
-
+  return parsingSucceeded;
 }
 
 /*
 * This function loads the door configuration, which should be in 
 * JSON format. 
 * 
-* It must be structured in a certain way, specified in the documentation. 
-* A custom parser is needed as there is not enough memory to load the entire 
-* config file into memory.
+* It must be structured in a certain way, specified in the documentation,
+* and is parsed by DoorConfig against the pin mappings loaded before.
 */
 bool loadDoorConfigurationFromFile(const char* filename) {
 
@@ -792,7 +593,8 @@ bool loadDoorConfigurationFromFile(const char* filename) {
     return false;
   }         
 
-  parsingSucceeded = parsDoorConfiguration(doorCfgFile);
+  cout << F("Parsing ") << filename << endl;
+  parsingSucceeded = DoorConfig::parseDoors(doorCfgFile, doorManager);
   doorCfgFile.close();
 
   return (parsingSucceeded ? true : false);
@@ -808,23 +610,115 @@ void printDoorConfiguration() {
         
         std::cout << "Wiegand:\n";
         for (unsigned j=0; j < doorManager.doors[i].readers.size(); j++) {
+          WiegandFormat_t format;
+          WiegandFormats::get(doorManager.doors[i].readers[j].format, format);
           std::cout << "  Id: " << doorManager.doors[i].readers[j].id << 
                        " Pin0: " << (int)doorManager.doors[i].readers[j].pin0 <<
-                       " Pin1: " << (int)doorManager.doors[i].readers[j].pin1 
+                       " Pin1: " << (int)doorManager.doors[i].readers[j].pin1 <<
+                       " Format: " << format.name
                     << std::endl;
         } 
 
         std::cout << "Peripherals:\n";
         for (unsigned j=0; j < doorManager.doors[i].peripherals.size(); j++) {
-          std::cout << "  Id: " << doorManager.doors[i].peripherals[j].id << 
-                       " Pin: " << (int)doorManager.doors[i].peripherals[j].pin <<
-                       " ActiveLevel: " << (int)doorManager.doors[i].peripherals[j].activeLevel 
+          std::cout << "  Id: " << doorManager.doors[i].peripherals[j].id() << 
+                       " Pin: " << (int)doorManager.doors[i].peripherals[j].pin() <<
+                       " ActiveLevel: " << (int)doorManager.doors[i].peripherals[j].activeLevel() <<
+                       " Debounce: " << doorManager.doors[i].peripherals[j].debounceMs() <<
+                       " PulseGap: " << doorManager.doors[i].peripherals[j].pulseGapMs()
                     << std::endl;
         }
         std::cout << std::endl;
     }
 }
 
+/*
+* Writes the result of applying the door configuration.
+*/
+void reconfigurationToJSON(JsonWriter &json, bool applied, ReconfigurationResult_t &result) {
+  json.beginObject();
+  if (applied)
+    json.member(F("Result"), F("OK"));
+  else if (doorManager.limitsExceeded())
+    json.member(F("Result"), F("Too many doors, readers or peripherals."));
+  else
+    json.member(F("Result"), F("Door configuration could not be loaded."));
+  if (applied) {
+    json.member(F("Doors"), (unsigned int)doorManager.doors.size());
+    json.member(F("Kept"), result.kept);
+    json.member(F("Initialized"), result.initialized);
+    json.member(F("Released"), result.released);
+  }
+  json.endObject();
+}
+
+/*
+* Applies the pin and door config files to the running doors, without a
+* reset. Readers and peripherals that are configured as before keep their
+* state, and their pins are left alone. uploaded is one of the config files
+* (or NULL), which is read from its upload instead, and replaced by it if
+* it can be loaded. If the files can't be loaded, the doors and the files
+* stay as they were. The result is written to json, and sent to the
+* websocket clients as a Reconfigured message, after which their handles
+* have to be looked up again.
+*/
+bool applyDoorConfiguration(JsonWriter &json, const char* uploaded) {
+  ReconfigurationResult_t result;
+  char upload[UPLOAD_FILENAME_LENGTH];
+  const char* pinsFilename = pinsConfigFilename;
+  const char* doorsFilename = doorsConfigFilename;
+  bool applied;
+
+  if (uploaded != NULL) {
+    uploadFilename(uploaded, upload);
+    if (uploaded == pinsConfigFilename)
+      pinsFilename = upload;
+    else
+      doorsFilename = upload;
+  }
+
+  // The queued updates refer to the current handles.
+  flushUpdates(true);
+
+  cout << F("Applying door configuration.\n");
+  doorManager.beginReconfiguration();
+  applied = loadPinMappingsFromFile(pinsFilename) && loadDoorConfigurationFromFile(doorsFilename) &&
+            doorManager.commitReconfiguration(result);
+  if (applied) {
+    stateSequence++;
+    if (uploaded != NULL && !replaceFile(uploaded))
+      cout << F("Could not replace ") << uploaded << endl;
+    cout << F("Readers and peripherals kept: ") << (int)result.kept << F(", initialized: ") 
+         << (int)result.initialized << F(". Pins released: ") << (int)result.released << endl;
+    printDoorConfiguration();
+    if (!ConfigImage::save(configImageFilename, ConfigImage::stamp(pinsConfigFilename, doorsConfigFilename), doorManager))
+      cout << F("Could not save the compiled configuration.\n");
+  }
+  else {
+    doorManager.abortReconfiguration();
+    if (uploaded != NULL)
+      SD.remove(upload);
+    // The pin table has been filled from the rejected upload, which later
+    // door configs would be read against.
+    if (pinsFilename != pinsConfigFilename && !loadPinMappingsFromFile(pinsConfigFilename))
+      cout << F("Could not reload ") << pinsConfigFilename << endl;
+    if (doorManager.limitsExceeded())
+      cout << F("Too many doors, readers or peripherals.\n");
+    cout << F("Door configuration could not be loaded, keeping the current one.\n");
+  }
+  reconfigurationToJSON(json, applied, result);
+
+  char buffer[MESSAGE_BUFFER_SIZE];
+  JsonBuffer message(buffer, sizeof(buffer));
+  JsonWriter notice(message);
+  notice.beginObject();
+  notice.key(F("Reconfigured"));
+  reconfigurationToJSON(notice, applied, result);
+  notice.endObject();
+  sendMessage(message, NULL);
+  return applied;
+}
+
 /* *****************************************************************************************************
 * 
 * Webserver Section 
@@ -834,11 +728,11 @@ void printDoorConfiguration() {
 /*
 * Called whenever a non extisting page is called.
 */
-void errorHTML(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+void errorHTML(HttpServer &server, HttpServer::ConnectionType type, char *url_tail, bool tail_complete)
 {
   server.httpFail();
 
-  if (type == WebServer::HEAD)
+  if (type == HttpServer::HEAD)
     return;
   
   server.print(F("<html><head><title>HTTP 400</title></head><body>\n"));
@@ -850,12 +744,12 @@ void errorHTML(WebServer &server, WebServer::ConnectionType type, char *url_tail
 /*
 * Called for default JSON extension file requests
 */
-void webAppJsonFile(WebServer &server, WebServer::ConnectionType type, char **url_path, char *url_tail, bool tail_complete)
+void webAppJsonFile(HttpServer &server, HttpServer::ConnectionType type, char **url_path, char *url_tail, bool tail_complete)
 {
   
-  if (type == WebServer::GET) 
+  if (type == HttpServer::GET) 
     cout << F("Client is GETting file: ");
-  else if (type == WebServer::POST)
+  else if (type == HttpServer::POST)
     cout << F("Client is POSTting file: ");
   else  
     cout << F("Client is ???ing file: ");
@@ -864,22 +758,20 @@ void webAppJsonFile(WebServer &server, WebServer::ConnectionType type, char **ur
   if (strcmp(*url_path, "networksettings.json") == 0)
   {
     aJsonObject *root = NULL;
-    WebServeraJsonStream webstream(&server);  
+    HttpServeraJsonStream webstream(&server);  
   
     //doors.json
     //pins.json
     
-    if (type == WebServer::GET) {
+    if (type == HttpServer::GET) {
         
-      root = aJson.createObject();
-      network.settingsToJSON(root);
-    
       // send correct content type
       server.httpSuccess("application/json");
-      aJson.print(root, &webstream);            
+      JsonWriter json(server);
+      network.settingsToJSON(json);
       server.printCRLF(); 
     }
-    else if (type == WebServer::POST) {
+    else if (type == HttpServer::POST) {
   
       root = aJson.parse(&webstream);
       network.settingsFromJSON(root);
@@ -893,18 +785,24 @@ void webAppJsonFile(WebServer &server, WebServer::ConnectionType type, char **ur
   }
   else if (strcmp(*url_path, "doors.json") == 0)
   {
-    if (type == WebServer::GET) {
-      sendFile(server, "application/json", doorsConfigFilename);
-    } else if (type == WebServer::POST) {
-      receiveFile(server, doorsConfigFilename);
+    if (type == HttpServer::GET) {
+      sendFile(server, "application/json", doorsConfigFilename, NULL);
+    } else if (type == HttpServer::POST && receiveFile(server, doorsConfigFilename)) {
+      server.httpSuccess("application/json");
+      JsonWriter json(server);
+      applyDoorConfiguration(json, doorsConfigFilename);
+      server.printCRLF();
     }
   }
   else if (strcmp(*url_path, "pins.json") == 0)
   {
-    if (type == WebServer::GET) {
-      sendFile(server, "application/json", pinsConfigFilename);
-    } else if (type == WebServer::POST) {
-      receiveFile(server, pinsConfigFilename);
+    if (type == HttpServer::GET) {
+      sendFile(server, "application/json", pinsConfigFilename, NULL);
+    } else if (type == HttpServer::POST && receiveFile(server, pinsConfigFilename)) {
+      server.httpSuccess("application/json");
+      JsonWriter json(server);
+      applyDoorConfiguration(json, pinsConfigFilename);
+      server.printCRLF();
     }
   }
   else
@@ -921,38 +819,24 @@ void webAppJsonFile(WebServer &server, WebServer::ConnectionType type, char **ur
 * Called for all the remaining cases. We need to check if the requested file is one we are servering,
 * and if so, send it to the client.
 */
-void webAppFile(WebServer &server, WebServer::ConnectionType type, char **url_path, char *url_tail, bool tail_complete)
+void webAppFile(HttpServer &server, HttpServer::ConnectionType type, char **url_path, char *url_tail, bool tail_complete)
 {
   // For a HEAD request, we just stop after outputting headers.
-  if (type == WebServer::HEAD)
+  if (type == HttpServer::HEAD)
     return;  
 
   // Check if requested file is one we are serving on SD card.
-  if (strcmp(*url_path, "index.htm") == 0 || strcmp(*url_path, "app.js") == 0 ||
-    strcmp(*url_path, "keypad.mp3") == 0 || strcmp(*url_path, "favicon.ico") == 0) 
-  {  
-    cout << F("Client is requesting file: ") << *url_path << endl;      
-    
-    // Create a full filename path. 32 characters should be 
-    // enough for 8+3 filenames and the folder structure we have.
-    char fullFilename[32];
-    sprintf(fullFilename, "web/%s", *url_path);
-
-    // It was successfully opened, so send the client a http 200 with correct
-    // content type depending on the file.
-    if (strcmp(*url_path, "app.js") == 0) {      
-      sendFile(server, "text/javascript; charset=utf-8", fullFilename);
-    }
-    else if (strcmp(*url_path, "keypad.mp3") == 0) {    
-      sendFile(server, "audio/mpeg", fullFilename);
-    }
-    else if (strcmp(*url_path, "favicon.ico") == 0) {    
-      sendFile(server, "image/x-icon", fullFilename);
+  int8_t asset = -1;
+  for (uint8_t i=0; i < WEB_ASSET_COUNT; i++) {
+    if (strcmp(*url_path, webAssets[i].name) == 0) {
+      asset = i;
+      break;
     }
-    else {
-      sendFile(server, "text/html; charset=utf-8", fullFilename);
-    }    
+  }
 
+  if (asset >= 0)
+  {  
+    sendWebAsset(server, asset);
   }
   else if ((*url_path, ".json") != 0)
   {
@@ -971,7 +855,7 @@ void webAppFile(WebServer &server, WebServer::ConnectionType type, char **url_pa
 * Called when client requests the root url. We just redirect to our url-path function
 * which handles all our web files (including the index.htm).
 */
-void defaultHTML(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+void defaultHTML(HttpServer &server, HttpServer::ConnectionType type, char *url_tail, bool tail_complete)
 {
   webAppFile(server, type, &indexFilename, url_tail, tail_complete);
 }
@@ -990,15 +874,63 @@ void apiResponse(bool requestSuccessful, const unsigned char* message) {
   webserver->printCRLF();           
 }
 
+/*
+* Sends the trace records from sequence number since and on, one line per
+* record: "<seq> <micros> <event> <door id> <id>". Records that have been
+* overwritten are skipped, which shows as a gap in the sequence numbers. 
+* The X-Trace-Next header tells where the next request should start.
+*/
+void apiTrace(HttpServer &server, unsigned long since) {
+  char header[32];
+  char line[24];
+  char *doorId, *id;
+  TraceRecord_t record;
+
+  uint32_t next = Trace::next();
+  uint32_t seq = Trace::first();
+  if (since > seq)
+    seq = since;
+  sprintf(header, "X-Trace-Next: %lu\r\n", next);
+  server.httpSuccess("text/plain", header);
+
+  for (; seq < next; seq++) {
+    if (!Trace::read(seq, record) || !doorManager.findObject(record.object, doorId, id))
+      continue;
+    sprintf(line, "%lu %lu ", seq, record.micros);
+    server.print(line);
+    server.print(Trace::eventName(record.event));
+    server.print(' ');
+    server.print(doorId);
+    server.print(' ');
+    server.print(id);
+    server.printCRLF();
+  }
+}
+
+/*
+* Writes the states of all peripherals as a hex string, two digits per
+* byte of the bitset from PACSDoorManager::getActiveStates(). The bit of
+* handle h is bit h % 8 of byte h / 8, and is set if the peripheral is
+* active.
+*/
+void activeStatesToHex(char* hex) {
+  uint8_t bits[PERIPHERAL_BITSET_SIZE(NO_HANDLE)];
+  uint8_t count = doorManager.getActiveStates(bits);
+  for (uint8_t i=0; i < PERIPHERAL_BITSET_SIZE(count); i++) {
+    sprintf(hex + 2 * i, "%02x", bits[i]);
+  }
+  hex[2 * PERIPHERAL_BITSET_SIZE(count)] = '\0';
+}
+
 /*
  * This is the api route for sending http commands. 
  * Three post parameters need to be specified: 
  *    cmd (the action to be performed, must come first!)
  *    doorId (id of the target door)
  *    id (id of the target peripheral)
- * Alternatively, you can send in a json structure.
+ * Alternatively, you can POST a json array of commands, see apiBatch().
  */
-void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+void apiCMD(HttpServer &server, HttpServer::ConnectionType type, char *url_tail, bool tail_complete)
 {
 
   URLPARAM_RESULT urlParamResult;
@@ -1007,27 +939,41 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
   bool postParamsAvailable;
   char id[16] = {'\0'};
   char doorId[16] = {'\0'};
-  int facilityCode = -1;
+  int handle = -1;
+  long facilityCode = -1;
   long cardNumber = -1;
+  int format = -1;
+  bool formatSpecified = false;
   char pin[16] = {'\0'};
+  long frame = -1;
+  unsigned long since = 0;
+  uint16_t queuedFrame = 0;
+  char frameHeader[32] = {'\0'};
 
    P(out_of_bounds) = "Card or facility-code is out of bounds.\n";
+   P(unknown_format) = "Unknown card format.\n";
    P(card_not_specified) = "Card or facility-code not specified.\n";
    P(id_not_found) = "Request failed. No door and/or reader/peripheral found with specified id(s).\n";
    P(unknown_command) = "Unknown command.\n";
    P(could_not_open_door_config_file) = "Could not open door config file for reading.";
    P(peripheral_is_active) = "Peripheral is ACTIVE.";
    P(peripheral_is_inactive) = "Peripheral is INACTIVE.";
+   P(frame_not_specified) = "Frame not specified.\n";
+   P(frame_is_transmitted) = "Frame is TRANSMITTED.";
+   P(frame_is_pending) = "Frame is PENDING.";
    P(ok) = "OK";
 
-  if (type == WebServer::HEAD)
+  if (type == HttpServer::HEAD)
     return;
 
   // If we receive a http-post, we assume the request is sent with json-data.
-  if (type == WebServer::POST) {  }
+  if (type == HttpServer::POST) {
+    apiBatch(server);
+    return;
+  }
   
   // If we receive a http-get, we assume the request was issued with URL parameters.
-  if (type == WebServer::GET) {    
+  if (type == HttpServer::GET) {    
     
     // Parse the URL parameters.
     do {
@@ -1044,12 +990,24 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
           else if (strcmp(value, "activateinput") == 0) cmd = ACTIVATEINPUT;
           else if (strcmp(value, "deactivateinput") == 0) cmd = DEACTIVATEINPUT;          
           else if (strcmp(value, "getperipheralstate") == 0) cmd = GETPERIPHERALSTATE;
+          else if (strcmp(value, "getallstates") == 0) cmd = GETALLSTATES;
+          else if (strcmp(value, "getframestate") == 0) cmd = GETFRAMESTATE;
+          else if (strcmp(value, "trace") == 0) cmd = TRACE;
+          else if (strcmp(value, "getlatency") == 0) cmd = GETLATENCY;
+          else if (strcmp(value, "resetlatency") == 0) cmd = RESETLATENCY;
+          else if (strcmp(value, "gethandle") == 0) cmd = GETHANDLE;
           else cmd = UNDEFINED;
         }
         // 
         else if (strcmp(name, "facilitycode") == 0) {
           if (value && (cmd == SWIPECARD)) {
-            facilityCode = atoi(value);
+            facilityCode = atol(value);
+          }
+        }
+        else if (strcmp(name, "format") == 0) {
+          if (value && (cmd == SWIPECARD)) {
+            format = WiegandFormats::find(value);
+            formatSpecified = true;
           }
         }
         else if (strcmp(name, "cardnumber") == 0) {
@@ -1062,6 +1020,16 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
             strcpy(pin, value);             
           }
         }
+        else if (strcmp(name, "frame") == 0) {
+          if (value && (cmd == GETFRAMESTATE)) {
+            frame = atol(value);
+          }
+        }
+        else if (strcmp(name, "since") == 0) {
+          if (value && (cmd == TRACE)) {
+            since = strtoul(value, NULL, 10);
+          }
+        }
         else if (strcmp(name, "doorid") == 0) {
           if (value) {
             strcpy(doorId, value);
@@ -1072,8 +1040,20 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
             strcpy(id, value);
           }
         }
+        else if (strcmp(name, "handle") == 0) {
+          // A handle that isn't a number in range refers to nothing,
+          // rather than to handle 0.
+          char* end = NULL;
+          long number = (value && *value) ? strtol(value, &end, 10) : -1;
+          handle = (end != NULL && *end == '\0' && number >= 0 && number < NO_HANDLE) ? (int)number : NO_HANDLE;
+        }
       }
     } while (urlParamResult != URLPARAM_EOS);
+
+    // Readers and peripherals are given by handle, or by door and id.
+    if (handle == -1) {
+      handle = doorManager.findHandle(doorId, id);
+    }
       
     // Now we see what command was issued, find the door and 
     // reader/peripheral and perform it.
@@ -1085,29 +1065,45 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
             apiResponse(false, card_not_specified);
             return;
           }          
-          // Then check that the input parameters are valid.
-          else if (!((facilityCode>=0) && (facilityCode<=255) && (cardNumber>=0) && (cardNumber<=65535))) {            
+          // Then check that the format is known, and if none was given, use
+          // the reader's default format.
+          else if (formatSpecified && (format < 0)) {
+            apiResponse(false, unknown_format);
+            return;
+          }
+          if (!formatSpecified) {
+            format = doorManager.getReaderFormat(handle);
+            if (format < 0) {
+              apiResponse(false, id_not_found);
+              return;
+            }
+          }
+          // Then check that the input parameters are valid for the format.
+          if ((facilityCode < 0) || (cardNumber < 0) || 
+              !WiegandFormats::fits(format, facilityCode, cardNumber)) {            
             apiResponse(false, out_of_bounds);
             return;
           }
           // And if so, execute the command and tell user if it successful or not.
-          else if(!doorManager.swipeCard(doorId, id, facilityCode, cardNumber)) {        
+          else if(!doorManager.swipeCard(handle, facilityCode, cardNumber, format, &queuedFrame)) {        
             apiResponse(false, id_not_found);
             return;
           }
+          sprintf(frameHeader, "X-Wiegand-Frame: %u\r\n", queuedFrame);
         break;
      
       // Enter pin command
       case ENTERPIN:
-        if (!doorManager.enterPIN(doorId, id, pin)) {        
+        if (!doorManager.enterPIN(handle, pin, &queuedFrame)) {        
           apiResponse(false, id_not_found);
           return;
         } 
+        sprintf(frameHeader, "X-Wiegand-Frame: %u\r\n", queuedFrame);
         break;
      
       // Open door command
       case OPENDOOR:
-        if (!doorManager.openDoor(doorId, id)) {        
+        if (!doorManager.openDoor(handle)) {        
           apiResponse(false, id_not_found);
           return;        
         } 
@@ -1115,7 +1111,7 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
      
      // Close door command
       case CLOSEDOOR:
-        if (!doorManager.closeDoor(doorId, id)) {        
+        if (!doorManager.closeDoor(handle)) {        
           apiResponse(false, id_not_found);
           return;        
         }
@@ -1123,7 +1119,7 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
      
       // Push REX command
       case PUSHREX:
-        if (!doorManager.pushREX(doorId, id)) {        
+        if (!doorManager.pushREX(handle)) {        
           apiResponse(false, id_not_found);
           return;
         }        
@@ -1131,7 +1127,7 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
       
       // Activate Input command
       case ACTIVATEINPUT:
-        if (!doorManager.activateInput(doorId, id)) {        
+        if (!doorManager.activateInput(handle)) {        
           apiResponse(false, id_not_found);
           return;
         }        
@@ -1139,7 +1135,7 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
       
       // Deactivate Input command
       case DEACTIVATEINPUT:
-        if (!doorManager.deactivateInput(doorId, id)) {        
+        if (!doorManager.deactivateInput(handle)) {        
           apiResponse(false, id_not_found);
           return;
         }        
@@ -1148,7 +1144,7 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
       // Get peripheral state command
       case GETPERIPHERALSTATE:
         {
-          int isActive = doorManager.isPeripheralActive(doorId, id);
+          int isActive = doorManager.isPeripheralActive(handle);
           if (isActive == -1) {        
             apiResponse(false, id_not_found);          
           }
@@ -1161,16 +1157,95 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
           return;  
         }
 
-      case UNDEFINED:
-      default:
-        server.httpFail();
-        server.printP(unknown_command);
-        return;
-    }
+      // Get all states command, the state of every peripheral in one response.
+      case GETALLSTATES:
+        {
+          char states[2 * PERIPHERAL_BITSET_SIZE(NO_HANDLE) + 1];
+          activeStatesToHex(states);
+          sprintf(frameHeader, "X-State-Sequence: %u\r\n", stateSequence);
+          server.httpSuccess("text/plain", frameHeader);
+          server.print(states);
+          server.printCRLF();
+          return;
+        }
 
-    server.httpSuccess("text/html", NULL);
-    server.printP(ok);
-    server.printCRLF();
+      // Get frame state command
+      case GETFRAMESTATE:
+        {
+          if (frame < 0) {
+            apiResponse(false, frame_not_specified);
+            return;
+          }
+          int isTransmitted = doorManager.isFrameTransmitted(handle, (uint16_t)frame);
+          if (isTransmitted == -1) {        
+            apiResponse(false, id_not_found);          
+          }
+          else if (isTransmitted) {
+            apiResponse(true, frame_is_transmitted);          
+          }
+          else {
+            apiResponse(true, frame_is_pending);          
+          }
+          return;  
+        }
+
+      // Trace command
+      case TRACE:
+        apiTrace(server, since);
+        return;
+
+      // Get latency command
+      case GETLATENCY:
+        {
+          LatencyHistogram* h = doorManager.getLatency(doorId);
+          if (h == NULL) {
+            apiResponse(false, id_not_found);
+            return;
+          }
+          char line[112];
+          sprintf(line, "Count: %u Timeouts: %u Min: %lu P50: %lu P99: %lu Max: %lu (us)", 
+                  h->count, h->timeouts, h->shortest, h->percentile(50), h->percentile(99), h->longest);
+          server.httpSuccess("text/plain");
+          server.print(line);
+          server.printCRLF();
+          return;
+        }
+
+      // Get handle command, for using handle= instead of doorid= and id=.
+      case GETHANDLE:
+        {
+          if (handle == NO_HANDLE) {
+            apiResponse(false, id_not_found);
+            return;
+          }
+          server.httpSuccess("text/plain");
+          server.print(handle);
+          server.printCRLF();
+          return;
+        }
+
+      // Reset latency command
+      case RESETLATENCY:
+        {
+          LatencyHistogram* h = doorManager.getLatency(doorId);
+          if (h == NULL) {
+            apiResponse(false, id_not_found);
+            return;
+          }
+          h->reset();
+        }
+        break;
+
+      case UNDEFINED:
+      default:
+        server.httpFail();
+        server.printP(unknown_command);
+        return;
+    }
+
+    server.httpSuccess("text/html", (frameHeader[0] != '\0') ? frameHeader : NULL);
+    server.printP(ok);
+    server.printCRLF();
 
   }
 }
@@ -1193,18 +1268,105 @@ void apiCMD(WebServer &server, WebServer::ConnectionType type, char *url_tail, b
 * 
 ***************************************************************************************************** */
 
+/*
+* Sends the queued state updates once they are UPDATE_COALESCE_MS old, or
+* right away if forced. The frames are built once and sent to all clients, or
+* only to updateTarget if set. A single update is sent as {"Update": {...}}, more
+* as {"Updates": [{...}, ...]}. The updates are already in place in the
+* buffer, so only the wrapping around them is added. Binary clients get the
+* event records instead.
+*/
+void flushUpdates(bool force) {
+  if (pendingUpdateCount == 0 && binaryUpdateCount == 0)
+    return;
+  if (!force && (millis() - pendingUpdatesSince < UPDATE_COALESCE_MS))
+    return;
+
+  if (binaryUpdateCount != 0) {
+    unsigned short length = binaryUpdateCount * sizeof(BinaryRecord_t);
+    if (updateTarget != NULL) {
+      websocketServer.sendBinary(*updateTarget, (uint8_t*)binaryUpdates, length);
+    }
+    else {
+      websocketServer.broadcastBinary((uint8_t*)binaryUpdates, length);
+    }
+    binaryUpdateCount = 0;
+  }
+  if (pendingUpdateCount == 0)
+    return;
+
+  char* frame;
+  char* end = updateBuffer + UPDATE_PREFIX_LENGTH + pendingUpdates.length();
+  if (pendingUpdateCount == 1) {
+    frame = updateBuffer + UPDATE_PREFIX_LENGTH - 10;
+    memcpy_P(frame, PSTR("{\"Update\":"), 10);
+    *end++ = '}';
+  }
+  else {
+    frame = updateBuffer;
+    memcpy_P(frame, PSTR("{\"Updates\":["), UPDATE_PREFIX_LENGTH);
+    *end++ = ']';
+    *end++ = '}';
+  }
+
+  if (updateTarget != NULL) {
+    websocketServer.sendMessage(*updateTarget, frame, end - frame);
+  }
+  else {
+    websocketServer.broadcast(frame, end - frame);
+  }
+  pendingUpdates.clear();
+  pendingUpdateCount = 0;
+}
+
+/*
+* Queues an event record for the binary clients, see BinaryProtocol.h.
+*/
+void queueEvent(uint8_t opcode, uint8_t handle, unsigned long timestamp, uint32_t value, uint32_t extra) {
+  if (pendingUpdateCount == 0 && binaryUpdateCount == 0) {
+    pendingUpdatesSince = millis();
+  }
+  BinaryRecord_t &r = binaryUpdates[binaryUpdateCount];
+  r.opcode = opcode;
+  r.handle = handle;
+  // Events sent to one client only (a snapshot for requestUpdate()) don't
+  // take a number, or the other clients would see a gap.
+  r.sequence = (updateTarget != NULL) ? eventSequence - 1 : eventSequence++;
+  r.micros = timestamp;
+  r.value = value;
+  r.extra = extra;
+
+  if (++binaryUpdateCount == UPDATE_MAX_BATCH) {
+    flushUpdates(true);
+  }
+}
+
+/*
+* Do the text or the binary clients get updates? Only the updateTarget does,
+* when it's set.
+*/
+bool updatesWanted(bool binary) {
+  if (updateTarget != NULL)
+    return updateTarget->isBinary() == binary;
+  return websocketServer.connections(binary) != 0;
+}
+
 /*
 * onStateChange()
-* Called whenever a peripheral has changed pin levels.
+* Called whenever a peripheral has changed pin levels. The update is queued
+* to be sent with the others of the same loop, so that e.g. a door event 
+* that changes lock, LED and beeper costs one frame.
 */
 void onStateChange(PACSDoor &door, PACSPeripheral &p) {
   
-  aJsonObject *root, *update;
-
-  root = aJson.createObject();  
-  aJson.addItemToObject(root, "Update", update = aJson.createObject());    
-  aJson.addStringToObject(update, "DoorId", door.id);
-  aJson.addStringToObject(update, "Id", p.id);
+  // The snapshot of requestUpdate() passes every peripheral through here,
+  // changed or not.
+  if (updateTarget == NULL)
+    stateSequence++;
+  if (updatesWanted(true)) {
+    queueEvent(BIN_EVT_STATE, p.handle, p.changedMicros, 
+               (p.isActive() ? 1 : 0) | ((uint32_t)p.pulses() << 8), p.pulses() ? p.pulseWidthMicros() : 0);
+  }
 
   switch (p.type) {        
     case GREENLED:
@@ -1215,38 +1377,101 @@ void onStateChange(PACSDoor &door, PACSPeripheral &p) {
     case DIGITAL_INPUT:
     case DIGITAL_OUTPUT:  
   
-      cout << "[" << door.id << "|" << p.id << "]: ";
+      cout << "[" << door.id << "|" << p.id() << "]: ";
 
-      if (p.isActive()) {
+      if (p.pulses() != 0) {
+        // A decoded pulse train, e.g. a beeper sounding 3 times.
+        cout << (int)p.pulses() << F(" pulses of ") << p.pulseWidthMicros() / 1000 << F(" ms\n");
+      }
+      else if (p.isActive()) {
         cout << F("is ACTIVE\n");
-        aJson.addBooleanToObject(update, "IsActive", true);
       }
       else {
         cout << F("is INACTIVE\n");
-        aJson.addBooleanToObject(update, "IsActive", false);
       }
   
       break;
     
     default:
-      cout << "[" << door.id << "|" << p.id << "]: Unknown periperhal";
+      cout << "[" << door.id << "|" << p.id() << "]: Unknown periperhal";
       break;
   }  
   
-  // Render the JSON string. 
-  char *json_string = aJson.print(root);
+  if (!updatesWanted(false))
+    return;
 
-  // Send the update over websocket connection.  
-  if (websocketServer.isConnected()) { 
-    websocketServer.sendMessage(json_string, strlen(json_string));
+  // Make sure there's room for one more update.
+  if (pendingUpdates.length() + UPDATE_MAX_LENGTH > UPDATE_BUFFER_SIZE - UPDATE_PREFIX_LENGTH - 2)
+    flushUpdates(true);
+  size_t mark = pendingUpdates.length();
+  if (pendingUpdateCount == 0) {
+    if (binaryUpdateCount == 0)
+      pendingUpdatesSince = millis();
   }
+  else {
+    pendingUpdates.write(',');
+  }
+  JsonWriter json(pendingUpdates);
+  door.stateToJSON(json, p);
+  if (pendingUpdates.overflowed()) {
+    // Can't happen with a sane UPDATE_MAX_LENGTH, but never send broken JSON.
+    cout << F("Update too long, dropped.\n");
+    pendingUpdates.truncate(mark);
+    return;
+  }
+  if (++pendingUpdateCount == UPDATE_MAX_BATCH) {
+    flushUpdates(true);
+  }
+}
 
-  // Free allocated memory.
-  free(json_string);
-  aJson.deleteItem(root);
-
+/*
+* Sends a small JSON message, written into a buffer on the stack, to a
+* websocket client, or to all of them if the client is NULL.
+*/
+void sendMessage(JsonBuffer &message, WebSocketClient* client) {
+  if (message.overflowed()) {
+    cout << F("Message too long, dropped.\n");
+    return;
+  }
+  if (client != NULL) {
+    websocketServer.sendMessage(*client, message.c_str(), message.length());
+  }
+  else {
+    websocketServer.broadcast(message.c_str(), message.length());
+  }
 }
 
+/*
+* onTransmitComplete()
+* Called whenever a reader has finished transmitting a queued Wiegand frame.
+*/
+void onTransmitComplete(PACSDoor &door, PACSReader &r) {
+
+  cout << "[" << door.id << "|" << r.id << "]: " << F("Frame ") << r.lastReportedFrame 
+       << F(" transmitted.\n");
+
+  if (updatesWanted(true)) {
+    queueEvent(BIN_EVT_TRANSMITTED, r.handle, r.lastSentMicros, r.lastReportedFrame, 0);
+  }
+  if (!updatesWanted(false))
+    return;
+
+  char buffer[MESSAGE_BUFFER_SIZE];
+  JsonBuffer message(buffer, sizeof(buffer));
+  JsonWriter json(message);
+
+  json.beginObject();
+  json.key(F("Transmitted"));
+  json.beginObject();
+  json.member(F("Handle"), r.handle);
+  json.member(F("DoorId"), door.id);
+  json.member(F("Id"), r.id);
+  json.member(F("Frame"), r.lastReportedFrame);
+  json.endObject();
+  json.endObject();
+
+  sendMessage(message, NULL);
+}
 
 /*
 * Renew the DHCP relase in a given interval.
@@ -1270,131 +1495,263 @@ SimpleTimer timer;
 
 int bonjourTimer = -1;
 int dhcpRenewalTimer = -1;
-int sendHeartbeatTimer = -1;
-int heartbeatTimeoutTimer = -1;
-bool heartbeatAcknowledged = true;
 
 /*
-* onHeartbeatTimeout()
-* Is called if we have not received a heartbeat PONG reply from the client in the defined
-* amount of time.
+* onConnect()
+* Is called whenever there is a new websocket connection. There can be as
+* many as there are free sockets, see WS_MAX_CLIENTS.
 */
-void onHeartbeatTimeout() {
-  if (websocketServer.isConnected()) {
-    cout << F("Heartbeat timeout. Closing connection.\n");
-    websocketServer.gracelessClose(WS_POLICY_VIOLATION, "Heartbeat timeout.");
+void onConnect(WebSocketClient &socket) {  
+  cout << F("Websocket connection ") << (int)socket.id << F(" (") 
+       << (int)websocketServer.connections() << F(" connected).\n");
+}
+
+/*
+* onDisconnect()
+* Is called when a websocket connection is disconnected. 
+*/
+void onDisconnect(WebSocketClient &socket) {
+  if (updateTarget == &socket) {
+    updateTarget = NULL;
+  }
+  if (!websocketServer.connections(false)) {
+    // Drop the updates that were meant for the last text connection.
+    pendingUpdates.clear();
+    pendingUpdateCount = 0;
   }
-  timer.deleteTimer(heartbeatTimeoutTimer);
-  heartbeatTimeoutTimer = -1;
+  if (!websocketServer.connections(true)) {
+    binaryUpdateCount = 0;
+  }
+  cout << F("Websocket ") << (int)socket.id << F(" was disconnected.\n");
 }
 
 /*
-* onHeartbeat()
-* Is called whenever there is a reply to the hearbeat PING frame sent out by our websocket server.
+* Sends the response latency statistics of a door to a websocket client.
+* Latencies are in milliseconds.
 */
-void onHeartbeatResponse(WebSocket &socket) {
-  // Reset the timeout timer.
-  timer.restartTimer(heartbeatTimeoutTimer);
-  heartbeatAcknowledged = true;
+void sendLatency(char* doorId, LatencyHistogram &h, WebSocketClient &socket) {
+  char buffer[MESSAGE_BUFFER_SIZE];
+  JsonBuffer message(buffer, sizeof(buffer));
+  JsonWriter json(message);
+
+  json.beginObject();
+  json.key(F("Latency"));
+  json.beginObject();
+  json.member(F("DoorId"), doorId);
+  json.member(F("Count"), h.count);
+  json.member(F("Timeouts"), h.timeouts);
+  json.member(F("Min"), h.shortest / 1000.0, 3);
+  json.member(F("P50"), h.percentile(50) / 1000.0, 3);
+  json.member(F("P99"), h.percentile(99) / 1000.0, 3);
+  json.member(F("Max"), h.longest / 1000.0, 3);
+  json.endObject();
+  json.endObject();
+
+  sendMessage(message, &socket);
 }
 
 /*
-* sendHeartbeat()
-* Check that the connected client is still alive by sending a heartbeat (websocket ping) and
-* wait for a pong reply. 
+* Sends the state of all peripherals to a client as one States message,
+* see activeStatesToHex(). What's queued for everyone is sent first, so
+* that the updates before the snapshot arrive before it.
 */
-void sendHeartbeat() {
+void sendStates(WebSocketClient &socket) {
+  char buffer[MESSAGE_BUFFER_SIZE];
+  char states[2 * PERIPHERAL_BITSET_SIZE(NO_HANDLE) + 1];
+  JsonBuffer message(buffer, sizeof(buffer));
+  JsonWriter json(message);
+
+  flushUpdates(true);
+  activeStatesToHex(states);
+  json.beginObject();
+  json.key(F("States"));
+  json.beginObject();
+  json.member(F("Sequence"), stateSequence);
+  json.member(F("Active"), states);
+  json.endObject();
+  json.endObject();
+
+  sendMessage(message, &socket);
+}
 
-  if (websocketServer.isConnected()) {     
-    if (!heartbeatAcknowledged) {
-      cout << F("No heartbeat acknowledgedment received.\n");
-    }
-    websocketServer.sendHeartbeat();      
-    // Start the timeout timer, if not started. 
-    if (heartbeatTimeoutTimer == -1) {
-      heartbeatTimeoutTimer = timer.setTimeout(HEARTBEAT_TIMEOUT*1000, onHeartbeatTimeout);
+/*
+* Sends the state of all peripherals to a client. Only the requesting client
+* needs the full state. What's queued for everyone is sent first, to keep 
+* the order of the updates.
+*/
+void requestUpdate(WebSocketClient &socket) {
+  flushUpdates(true);
+  updateTarget = &socket;
+  for (unsigned i=0; i < doorManager.doors.size(); i++) {        
+    for (unsigned j=0; j < doorManager.doors[i].peripherals.size(); j++) {
+      onStateChange(doorManager.doors[i], doorManager.doors[i].peripherals[j]);
     }
-    heartbeatAcknowledged = false;
   }
+  flushUpdates(true);
+  updateTarget = NULL;
 }
 
 /*
-* onConnect()
-* Is called whenever there is a new websocket connection (there can be only 
-* one connection at any given time.)
+* onBinaryData()
+* Is called with the records of a binary frame from a client that chose
+* the binary protocol. Each command is run, and replaced by its ACK in the
+* buffer, which is then sent back.
 */
-void onConnect(WebSocket &socket) {  
-  cout << F("Websocket connection.\n");
-  
-  if (sendHeartbeatTimer != -1) {
-   timer.deleteTimer(sendHeartbeatTimer);
-   sendHeartbeatTimer = -1;
- } 
- sendHeartbeatTimer = timer.setInterval(HEARTBEAT_INTERVAL*1000, sendHeartbeat);
+void onBinaryData(WebSocketClient &socket, uint8_t* data, unsigned short length) {
+
+  if (length % sizeof(BinaryRecord_t) != 0) {
+    cout << F("Binary message is not a whole number of records.\n");
+    return;
+  }
+
+  BinaryRecord_t* records = (BinaryRecord_t*)data;
+  for (unsigned i=0; i < length / sizeof(BinaryRecord_t); i++) {
+    BinaryRecord_t &r = records[i];
+    uint16_t frame = 0;
+    bool ok;
+
+    switch (r.opcode) {
+      case BIN_CMD_REQUEST_UPDATE:
+        requestUpdate(socket);
+        ok = true;
+        break;
+
+      case BIN_CMD_SWIPE_CARD:
+        {
+          uint8_t format = r.extra >> 24;
+          ok = doorManager.swipeCard(r.handle, r.extra & 0xFFFFFFUL, r.value, 
+                                     (format == BIN_FORMAT_DEFAULT) ? -1 : format, &frame);
+        }
+        break;
+
+      case BIN_CMD_ENTER_PIN:
+        {
+          char pin[9];
+          memcpy(pin, &r.value, 8);
+          pin[8] = '\0';
+          ok = doorManager.enterPIN(r.handle, pin, &frame);
+        }
+        break;
+
+      case BIN_CMD_OPEN_DOOR:
+        ok = doorManager.openDoor(r.handle);
+        break;
+
+      case BIN_CMD_CLOSE_DOOR:
+        ok = doorManager.closeDoor(r.handle);
+        break;
+
+      case BIN_CMD_PUSH_REX:
+        ok = doorManager.pushREX(r.handle);
+        break;
+
+      case BIN_CMD_ACTIVATE_INPUT:
+        ok = doorManager.activateInput(r.handle);
+        break;
+
+      case BIN_CMD_DEACTIVATE_INPUT:
+        ok = doorManager.deactivateInput(r.handle);
+        break;
+
+      default:
+        cout << F("Unknown binary command: ") << (int)r.opcode << endl;
+        ok = false;
+        break;
+    }
+
+    // The handle and sequence number are left as they were.
+    r.opcode = BIN_EVT_ACK;
+    r.micros = micros();
+    r.value = ok ? 1 : 0;
+    r.extra = frame;
+  }
+
+  websocketServer.sendBinary(socket, data, length);
 }
 
 /*
-* onDisconnect()
-* Is called when the websocket connection is disconnected. 
+* Returns the value of a JSON number or numeric string. The GUI sends card
+* data as strings, which also keeps large card numbers from overflowing.
 */
-void onDisconnect(WebSocket &socket) {
-  timer.deleteTimer(heartbeatTimeoutTimer);
-  timer.deleteTimer(sendHeartbeatTimer);
-  sendHeartbeatTimer = -1;
-  heartbeatTimeoutTimer = -1;
-  cout << F("Websocket was disconnected.\n");
+unsigned long jsonToULong(aJsonObject* item) {
+  switch (item->type) {
+    case aJson_String:
+      return strtoul(item->valuestring, NULL, 10);
+    case aJson_Float:
+      return (unsigned long)item->valuefloat;
+    default:
+      return (unsigned long)item->valueint;
+  }
 }
 
 /*
-* onData()
-* Is called whenever there is a new data available in the websocket pipe. 
+* Returns a description of a command result.
 */
-void onData(WebSocket &socket, char* dataString, unsigned short frameLength) {
-
-  // Parse the JSON data into an object tree.
-  aJsonObject* root = aJson.parse(dataString);  
-
-  if (root == NULL) {
-    cout << F("Data is not valid JSON.\n");
-    return;
+const __FlashStringHelper* commandResultText(CommandResult result) {
+  switch (result) {
+    case COMMAND_OK: return F("OK");
+    case COMMAND_NOT_FOUND: return F("Handle or door-id and id not present, or not found.");
+    case COMMAND_MISSING_PARAMETER: return F("Parameter missing.");
+    case COMMAND_UNKNOWN_FORMAT: return F("Unknown card format.");
+    case COMMAND_INVALID: return F("Not a valid JSON command.");
+    case COMMAND_WEBSOCKET_ONLY: return F("Only available over the websocket.");
+    default: return F("Unknown command.");
   }
+}
 
-  // Get the command
-  aJsonObject* cmd = root->child;
+/*
+* Is name one of the door commands that runCommand() runs?
+*/
+bool isDoorCommand(const char* name) {
+  static const char* const names[] = { "SwipeCard", "EnterPIN", "OpenDoor", "CloseDoor", "PushREX", "ActivateInput", "DeactivateInput" };
+  for (uint8_t i=0; i < sizeof(names)/sizeof(names[0]); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  //
-  // RequestUpdate command
-  //
-  if (strcmp(cmd->name, "RequestUpdate") == 0) {
-    for (unsigned i=0; i < doorManager.doors.size(); i++) {        
-      for (unsigned j=0; j < doorManager.doors[i].peripherals.size(); j++) {
-        onStateChange(doorManager.doors[i], doorManager.doors[i].peripherals[j]);
-      }
+/*
+* Is name one of the commands that onData() answers on the websocket
+* itself, and so can't be part of a batch?
+*/
+bool isWebsocketCommand(const char* name) {
+  static const char* const names[] = { "RequestUpdate", "GetAllStates", "UpdateNetworkSettings", "GetLatency", "ResetLatency" };
+  for (uint8_t i=0; i < sizeof(names)/sizeof(names[0]); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return true;
     }
-    aJson.deleteItem(root);
-    return; 
   }
-  
-  //
-  // UpdateNetworkSettings
-  //
-  if (strcmp(cmd->name, "UpdateNetworkSettings") == 0) {
-    
-    network.settingsFromJSON(cmd->child);
-    network.printConfiguration();
-    //The new configuration will not take effect until next reset.
-    aJson.deleteItem(root);
-    return;
+  return false;
+}
+
+/*
+* Runs a door command in the JSON format of the websocket API, e.g.
+* "SwipeCard": {"Handle": 3, "FacilityCode": "12", "CardNumber": "3456"}.
+* The commands that send a Wiegand frame store its number in frame, if
+* given.
+*/
+CommandResult runCommand(aJsonObject* cmd, long* frame) {
+  if (!isDoorCommand(cmd->name)) {
+    return COMMAND_UNKNOWN;
   }
 
-  // The rest of the commands require a door- and peripheral id.
+  // All of them require a handle, or a door- and peripheral id.
+  aJsonObject* handleItem = aJson.getObjectItem(cmd, "Handle");
   aJsonObject* doorId = aJson.getObjectItem(cmd, "DoorId");
   aJsonObject* id = aJson.getObjectItem(cmd, "Id");
-  if (cmd == NULL || doorId == NULL || id == NULL) {
-    cout << F("Command, door-id and/or id not present in JSON structure.") << endl;
-    aJson.deleteItem(root);
-    return;
-  }        
+  uint8_t handle = NO_HANDLE;
+  uint16_t queuedFrame;
+  if (handleItem != NULL && handleItem->type == aJson_Int && handleItem->valueint >= 0 && handleItem->valueint < NO_HANDLE) {
+    handle = handleItem->valueint;
+  }
+  else if (doorId != NULL && id != NULL) {
+    handle = doorManager.findHandle(doorId->valuestring, id->valuestring);
+  }
+  if (handle == NO_HANDLE) {
+    return COMMAND_NOT_FOUND;
+  }
 
   //
   // SwipeCard command
@@ -1402,14 +1759,21 @@ void onData(WebSocket &socket, char* dataString, unsigned short frameLength) {
   if (strcmp(cmd->name, "SwipeCard") == 0) {
     aJsonObject* facilityCode = aJson.getObjectItem(cmd, "FacilityCode");
     aJsonObject* cardNumber = aJson.getObjectItem(cmd, "CardNumber");  
-    
     if (facilityCode == NULL || cardNumber == NULL) {
-      cout << F("Facility Code and/or cardNumber not present in JSON structure.") << endl;
-      aJson.deleteItem(root);
-      return;
+      return COMMAND_MISSING_PARAMETER;
     }        
-    doorManager.swipeCard(doorId->valuestring, id->valuestring, 
-                          atoi(facilityCode->valuestring), atoi(cardNumber->valuestring));
+    // An optional format name overrides the reader's default format.
+    int8_t format = -1;
+    aJsonObject* formatName = aJson.getObjectItem(cmd, "Format");
+    if (formatName != NULL) {
+      format = WiegandFormats::find(formatName->valuestring);
+      if (format < 0) {
+        return COMMAND_UNKNOWN_FORMAT;
+      }
+    }
+    if (!doorManager.swipeCard(handle, jsonToULong(facilityCode), jsonToULong(cardNumber), format, &queuedFrame)) {
+      return COMMAND_NOT_FOUND;
+    }
   }
   
   //
@@ -1418,53 +1782,216 @@ void onData(WebSocket &socket, char* dataString, unsigned short frameLength) {
   else if (strcmp(cmd->name, "EnterPIN") == 0) {
     aJsonObject* pin = aJson.getObjectItem(cmd, "PIN");  
     if (pin == NULL) {
-      cout << F("PIN not present in JSON structure.") << endl;
-      aJson.deleteItem(root);
-      return;
+      return COMMAND_MISSING_PARAMETER;
     }        
-    doorManager.enterPIN(doorId->valuestring, id->valuestring, pin->valuestring);
+    if (!doorManager.enterPIN(handle, pin->valuestring, &queuedFrame)) {
+      return COMMAND_NOT_FOUND;
+    }
   }  
 
   //
-  // OpenDoor command
+  // Commands without parameters.
   //
-  else if (strcmp(cmd->name, "OpenDoor") == 0) {
-    doorManager.openDoor(doorId->valuestring, id->valuestring);
+  else {
+    bool found;
+    if (strcmp(cmd->name, "OpenDoor") == 0) found = doorManager.openDoor(handle);
+    else if (strcmp(cmd->name, "CloseDoor") == 0) found = doorManager.closeDoor(handle);
+    else if (strcmp(cmd->name, "PushREX") == 0) found = doorManager.pushREX(handle);
+    else if (strcmp(cmd->name, "ActivateInput") == 0) found = doorManager.activateInput(handle);
+    else if (strcmp(cmd->name, "DeactivateInput") == 0) found = doorManager.deactivateInput(handle);
+    else return COMMAND_UNKNOWN;
+    return found ? COMMAND_OK : COMMAND_NOT_FOUND;
   }
 
-  //
-  // CloseDoor command
-  //
-  else if (strcmp(cmd->name, "CloseDoor") == 0) {
-    doorManager.closeDoor(doorId->valuestring, id->valuestring);
+  if (frame != NULL) {
+    *frame = queuedFrame;
   }
+  return COMMAND_OK;
+}
+
+/*
+* Waits until ms milliseconds have passed since start, while keeping the
+* websocket clients served and the state updates flowing.
+*/
+void waitAndServe(unsigned long start, unsigned long ms) {
+  if (ms > BATCH_MAX_DELAY_MS) {
+    ms = BATCH_MAX_DELAY_MS;
+  }
+  while (millis() - start < ms) {
+    websocketServer.listen();
+    doorManager.updateLevels();
+    flushUpdates(false);
+  }
+}
+
+/*
+* Reads the next command object of a batch into buffer. Returns false at
+* the end of the array. complete tells if the whole object fit.
+*/
+bool readBatchCommand(HttpServer &server, char* buffer, size_t size, bool &complete) {
+  int ch;
+  do {
+    ch = server.read();
+  } while (ch == ' ' || ch == ',' || ch == '\r' || ch == '\n' || ch == '\t');
+  if (ch != '{') {
+    return false;
+  }
+
+  size_t length = 0;
+  uint8_t depth = 0;
+  bool inString = false;
+  bool escaped = false;
+  complete = true;
+  for (; ch != -1; ch = server.read()) {
+    if (length < size - 1) {
+      buffer[length++] = ch;
+    }
+    else {
+      complete = false;
+    }
+    if (inString) {
+      if (escaped) escaped = false;
+      else if (ch == '\\') escaped = true;
+      else if (ch == '"') inString = false;
+    }
+    else if (ch == '"') inString = true;
+    else if (ch == '{') depth++;
+    else if (ch == '}' && --depth == 0) break;
+  }
+  buffer[length] = '\0';
+  if (ch == -1) {
+    complete = false;
+  }
+  return true;
+}
+
+/*
+* Runs a batch of door commands POSTed to the api route as a JSON array of
+* websocket API commands. An optional Delay waits that many milliseconds
+* after the previous command:
+*   [{"SwipeCard": {"Handle": 3, "FacilityCode": "12", "CardNumber": "3456"}},
+*    {"OpenDoor": {"DoorId": "door1", "Id": "door", "Delay": 500}}]
+* The commands are read and run one at a time, and the response has a
+* result per command. The commands that answer on the websocket, like
+* RequestUpdate or GetLatency, are refused:
+*   [{"Command": "SwipeCard", "Result": "OK", "Frame": 7}, {"Command": "OpenDoor", "Result": "OK"}]
+*/
+void apiBatch(HttpServer &server) {
+  char item[BATCH_COMMAND_LENGTH];
+  bool complete;
+  unsigned long last = millis();
+
+  server.httpSuccess("application/json");
+  JsonWriter json(server);
+  json.beginArray();
+
+  int ch;
+  do {
+    ch = server.read();
+  } while (ch != '[' && ch != -1);
+
+  while (readBatchCommand(server, item, sizeof(item), complete)) {
+    aJsonObject* root = complete ? aJson.parse(item) : NULL;
+    json.beginObject();
+    if (root == NULL || root->child == NULL) {
+      json.member(F("Result"), commandResultText(COMMAND_INVALID));
+    }
+    else {
+      aJsonObject* cmd = root->child;
+      aJsonObject* delay = aJson.getObjectItem(cmd, "Delay");
+      if (delay != NULL) {
+        waitAndServe(last, jsonToULong(delay));
+      }
+      long frame = -1;
+      CommandResult result = isWebsocketCommand(cmd->name) ? COMMAND_WEBSOCKET_ONLY : runCommand(cmd, &frame);
+      last = millis();
+
+      json.member(F("Command"), cmd->name);
+      json.member(F("Result"), commandResultText(result));
+      if (frame >= 0) {
+        json.member(F("Frame"), frame);
+      }
+    }
+    if (root != NULL) {
+      aJson.deleteItem(root);
+    }
+    json.endObject();
+  }
+
+  json.endArray();
+  server.printCRLF();
+}
+
+/*
+* onData()
+* Is called whenever there is a new data available in the websocket pipe. 
+*/
+void onData(WebSocketClient &socket, char* dataString, unsigned short frameLength) {
+
+  // Parse the JSON data into an object tree.
+  aJsonObject* root = aJson.parse(dataString);  
+
+  if (root == NULL) {
+    cout << F("Data is not valid JSON.\n");
+    return;
+  }
+
+  // Get the command
+  aJsonObject* cmd = root->child;
 
   //
-  // PushREX command
+  // RequestUpdate command
   //
-  else if (strcmp(cmd->name, "PushREX") == 0) {
-    doorManager.pushREX(doorId->valuestring, id->valuestring);
+  if (strcmp(cmd->name, "RequestUpdate") == 0) {
+    requestUpdate(socket);
+    aJson.deleteItem(root);
+    return; 
   }
-
+  
   //
-  // ActivateInput command
+  // GetAllStates command
   //
-  else if (strcmp(cmd->name, "ActivateInput") == 0) {
-    doorManager.activateInput(doorId->valuestring, id->valuestring);
+  if (strcmp(cmd->name, "GetAllStates") == 0) {
+    sendStates(socket);
+    aJson.deleteItem(root);
+    return; 
   }
 
   //
-  // DeactivateInput command
+  // UpdateNetworkSettings
   //
-  else if (strcmp(cmd->name, "DeactivateInput") == 0) {
-    doorManager.deactivateInput(doorId->valuestring, id->valuestring);
+  if (strcmp(cmd->name, "UpdateNetworkSettings") == 0) {
+    
+    network.settingsFromJSON(cmd->child);
+    network.printConfiguration();
+    //The new configuration will not take effect until next reset.
+    aJson.deleteItem(root);
+    return;
   }
 
   //
-  // Not a recognized command.
+  // GetLatency and ResetLatency commands, which only need a door id.
   //
-  else {    
-    cout << F("Unkown command.") << cmd->name << endl;
+  if ((strcmp(cmd->name, "GetLatency") == 0) || (strcmp(cmd->name, "ResetLatency") == 0)) {
+    aJsonObject* latencyDoorId = aJson.getObjectItem(cmd, "DoorId");
+    LatencyHistogram* h = (latencyDoorId != NULL) ? doorManager.getLatency(latencyDoorId->valuestring) : NULL;
+    if (h == NULL) {
+      cout << F("Door-id not present in JSON structure or not found.") << endl;
+    }
+    else {
+      if (strcmp(cmd->name, "ResetLatency") == 0) {
+        h->reset();
+      }
+      sendLatency(latencyDoorId->valuestring, *h, socket);
+    }
+    aJson.deleteItem(root);
+    return;
+  }
+
+  // The rest are door commands.
+  CommandResult result = runCommand(cmd, NULL);
+  if (result != COMMAND_OK) {
+    cout << cmd->name << F(": ") << commandResultText(result) << endl;
   }
 
   aJson.deleteItem(root);
@@ -1489,19 +2016,47 @@ void setup()
   delay(200);
 
   //
-  // Load pin and door config from SD card.
+  // Load pin and door config from SD card. The compiled image is used if
+  // it was made from the current config files, otherwise they are parsed
+  // and compiled again. An upload that was cut short by a reset is
+  // finished or discarded first.
   //
-  cout << F("Loading pin configuration.\n");
-  if (!loadPinMappingsFromFile(pinsConfigFilename))
-    while (true) delay(100); 
-  cout << F("Loading door configuration.\n");
-  if (!loadDoorConfigurationFromFile(doorsConfigFilename))
-    while (true) delay(100); 
+  recoverFile(pinsConfigFilename);
+  recoverFile(doorsConfigFilename);
+  uint32_t configStamp = ConfigImage::stamp(pinsConfigFilename, doorsConfigFilename);
+  bool compiled = ConfigImage::load(configImageFilename, configStamp, doorManager);
+  if (compiled) {
+    cout << F("Loaded compiled configuration.\n");
+  }
+  else {
+    cout << F("Loading pin configuration.\n");
+    if (!loadPinMappingsFromFile(pinsConfigFilename))
+      while (true) delay(100); 
+    cout << F("Loading door configuration.\n");
+    if (!loadDoorConfigurationFromFile(doorsConfigFilename))
+      while (true) delay(100); 
+  }
   
-  // Door configuration is loaded! Now initialize all the doors and their
-  // peripherals/readers. This sets correct pinmode, active-level etc.
-  doorManager.initializeDoors();
+  // Door configuration is loaded! Now build the door tables and initialize
+  // all the doors and their peripherals/readers. This sets correct pinmode,
+  // active-level etc.
+  if (!doorManager.initializeDoors()) {
+    if (doorManager.limitsExceeded())
+      cout << F("The door configuration has too many doors, readers or peripherals.\n");
+    else
+      cout << F("The door configuration does not fit in memory.\n");
+    while (true) delay(100); 
+  }
+  cout << F("Door tables: ") << doorManager.memoryUsed() << F(" bytes.\n");
+
+  if (!compiled) {
+    // A default pins file may have been created, so stamp the files again.
+    configStamp = ConfigImage::stamp(pinsConfigFilename, doorsConfigFilename);
+    if (!ConfigImage::save(configImageFilename, configStamp, doorManager))
+      cout << F("Could not save the compiled configuration.\n");
+  }
   doorManager.registerStateChangeCallback(&onStateChange);  
+  doorManager.registerTransmitCompleteCallback(&onTransmitComplete);
   
   cout << F("\n*************************************\n");
   cout << F("*  DOOR CONFIGURATION\n");
@@ -1530,7 +2085,7 @@ void setup()
 #endif
 
   // Setup the server and the routes and begin listening for incoming connections.
-  webserver = new WebServer("", network.httpPort);  
+  webserver = new HttpServer("", network.httpPort);  
   webserver->setDefaultCommand(&defaultHTML); // Root url.
   webserver->setUrlPathCommand(&webAppFile); // All web files on SD card.
   webserver->setFailureCommand(&errorHTML); // HTTP 400.
@@ -1539,11 +2094,13 @@ void setup()
   webserver->begin();
 
   // Setup the websocket server and start listening for incoming connections.
-  websocketServer = WebSocket("/", 8888);
   websocketServer.registerConnectCallback(&onConnect);
   websocketServer.registerDisconnectCallback(&onDisconnect);
   websocketServer.registerDataCallback(&onData);
-  websocketServer.registerHeartbeatResponseCallback(&onHeartbeatResponse);
+  websocketServer.registerBinaryCallback(&onBinaryData);
+  websocketServer.setSubprotocol(BINARY_SUBPROTOCOL);
+  websocketServer.setHeartbeat(HEARTBEAT_INTERVAL*1000UL, HEARTBEAT_TIMEOUT*1000UL);
+  websocketServer.shareSockets(webserver);
   websocketServer.begin();
 
   // Register timed events.
@@ -1567,14 +2124,15 @@ void loop() {
   timer.run();
   
   // Process incoming web-server connections.
-  char buff[200];
-  int len = 200;
-  webserver->processConnection(buff, &len);
+  webserver->processConnection();
 
-  // Listen for data on websocket connection.
+  // Listen for data on the websocket connections.
   websocketServer.listen();
 
-  // Checks if any pins have altered states, and notifies 
-  // the registered callbacks.
+  // Checks if any pins have altered states or readers have finished 
+  // transmitting, and notifies the registered callbacks.
   doorManager.updateLevels();
+
+  // Send the state updates of this loop.
+  flushUpdates(false);
 }
@@ -0,0 +1,292 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Benchmarks.h"
+#include "PACSDoorManager.h"
+#include "DoorConfig.h"
+#include "WiegandFormat.h"
+#include "JsonTokenizer.h"
+#include "JsonWriter.h"
+#include "SimpleTimer.h"
+#include <stdio.h>
+
+// The doors take the pins from here on, which on the Mega leaves the
+// serial port alone.
+#define BENCH_FIRST_PIN 22
+#define BENCH_PINS_PER_DOOR 5 // Data0, data1, lock, beeper, REX.
+#define BENCH_DOOR_PINS ((NUM_DIGITAL_PINS - BENCH_FIRST_PIN) / BENCH_PINS_PER_DOOR)
+#define BENCH_MAX_DOORS (BENCH_DOOR_PINS < 64 ? BENCH_DOOR_PINS : 64)
+#define BENCH_JSON_BUFFER_SIZE 160 // Room for one update, like UPDATE_MAX_LENGTH in the sketch.
+
+volatile uint32_t benchSink;
+
+/*
+* A stream over a document in memory, for reading it over and over.
+*/
+class MemoryStream : public Stream {
+    public:
+        MemoryStream(const char* d, size_t s) : data(d), size(s), position(0) {}
+
+        void rewind() { position = 0; }
+        virtual int available() { return size - position; }
+        virtual int read() { return (position < size) ? (uint8_t)data[position++] : -1; }
+        virtual int peek() { return (position < size) ? (uint8_t)data[position] : -1; }
+        virtual size_t write(uint8_t) { return 0; }
+        using Print::write;
+
+    private:
+        const char* data;
+        size_t size;
+        size_t position;
+};
+
+/*
+* A frame in every card format, with the parity bits calculated.
+*/
+void benchWiegand() {
+    for (uint8_t i=0; i < WiegandFormats::count(); i++) {
+        WiegandFormat_t format;
+        WiegandFormats::get(i, format);
+        bench("wiegand_encode", format.name, [i](uint32_t n) {
+            uint64_t frame;
+            uint32_t bits = 0;
+            for (uint32_t k=0; k < n; k++) {
+                // Card numbers that fit the narrowest format.
+                bits += WiegandFormats::encode(i, 100, k & 0xFFFF, frame);
+                bits += (uint32_t)frame;
+            }
+            benchSink = bits;
+        });
+    }
+}
+
+static PACSDoorManager doorManager;
+static char doorIds[BENCH_MAX_DOORS][DOOR_ID_MAX_LENGTH + 1];
+
+/*
+* Every token of the doors config, like the parser reads it off the card,
+* and then the parser itself: the doors config read into records, against
+* the pin ids of the pins config. The records are thrown away after each
+* pass, the door tables aren't built.
+*/
+void benchConfig(const char* pins, size_t pinsLength, const char* doors, size_t doorsLength) {
+    char param[16];
+    snprintf(param, sizeof(param), "%u", (unsigned)doorsLength);
+    bench("config_tokenize", param, [doors, doorsLength](uint32_t n) {
+        MemoryStream stream(doors, doorsLength);
+        char token[CONFIG_TOKEN_LENGTH];
+        uint32_t tokens = 0;
+        for (uint32_t k=0; k < n; k++) {
+            stream.rewind();
+            JsonTokenizer json(stream, token, sizeof(token));
+            JsonToken_t t;
+            while ((t = json.next()) != JSON_END && t != JSON_ERROR)
+                tokens++;
+        }
+        benchSink = tokens;
+    });
+
+    MemoryStream pinStream(pins, pinsLength);
+    if (!DoorConfig::parsePins(pinStream)) {
+        printf("The pins config can't be parsed.\n");
+        return;
+    }
+    bench("config_parse", param, [doors, doorsLength](uint32_t n) {
+        MemoryStream stream(doors, doorsLength);
+        uint32_t parsed = 0;
+        for (uint32_t k=0; k < n; k++) {
+            stream.rewind();
+            parsed += DoorConfig::parseDoors(stream, doorManager);
+            doorManager.discardRecords();
+        }
+        benchSink = parsed;
+    });
+}
+
+/*
+* Adds the records of a door with a reader, a lock, a beeper in pulse mode
+* and a REX, on the pins from first.
+*/
+static bool addDoor(const char* id, uint8_t first) {
+    ConfigRecord_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.kind = CONFIG_DOOR;
+    strcpy(record.id, id);
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    record.kind = CONFIG_READER;
+    strcpy(record.id, "Reader");
+    record.pin = first;
+    record.pin1 = first + 1;
+    record.level = WIEGAND_DEFAULT_FORMAT;
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    record.kind = CONFIG_PERIPHERAL;
+    strcpy(record.id, "Lock");
+    record.type = LOCK;
+    record.pin = first + 2;
+    record.pin1 = 255;
+    record.level = HIGH;
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    strcpy(record.id, "Beeper");
+    record.type = BEEPER;
+    record.pin = first + 3;
+    record.pulseGapMs = 250;
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    strcpy(record.id, "REX");
+    record.type = REX;
+    record.pin = first + 4;
+    record.pulseGapMs = 0;
+    record.level = LOW;
+    return doorManager.addRecord(record) != NULL;
+}
+
+/*
+* Replaces the doors with count new ones.
+*/
+static bool configure(uint8_t count) {
+    static bool initialized = false;
+    ReconfigurationResult_t result;
+
+    if (initialized)
+        doorManager.beginReconfiguration();
+    for (uint8_t i=0; i < count; i++) {
+        snprintf(doorIds[i], sizeof(doorIds[i]), "Door%u", i);
+        if (!addDoor(doorIds[i], BENCH_FIRST_PIN + i * BENCH_PINS_PER_DOOR)) {
+            doorManager.discardRecords();
+            return false;
+        }
+    }
+    if (initialized)
+        return doorManager.commitReconfiguration(result);
+    initialized = true;
+    return doorManager.initializeDoors();
+}
+
+/*
+* Doors by id, readers and peripherals by door and id, and peripherals
+* within a door, going round all doors, for growing numbers of doors.
+*/
+bool benchLookups() {
+    uint8_t count = 1;
+    for (;;) {
+        if (!configure(count)) {
+            printf("%u doors do not fit.\n", count);
+            return false;
+        }
+        char param[8];
+        snprintf(param, sizeof(param), "%u", count);
+
+        bench("find_door", param, [count](uint32_t n) {
+            uint32_t found = 0;
+            for (uint32_t k=0; k < n; k++)
+                found += (doorManager.getLatency(doorIds[k % count]) != NULL);
+            benchSink = found;
+        });
+        bench("find_handle", param, [count](uint32_t n) {
+            char lock[] = "Lock";
+            uint32_t found = 0;
+            for (uint32_t k=0; k < n; k++)
+                found += doorManager.findHandle(doorIds[k % count], lock);
+            benchSink = found;
+        });
+        bench("find_peripheral", param, [count](uint32_t n) {
+            char rex[] = "REX";
+            uint32_t found = 0;
+            for (uint32_t k=0; k < n; k++)
+                found += (doorManager.doors[k % count].findPeripheralById(rex) != NULL);
+            benchSink = found;
+        });
+
+        // Powers of two, and the most there is room for.
+        if (count == BENCH_MAX_DOORS)
+            return true;
+        count = (count * 2 < BENCH_MAX_DOORS) ? count * 2 : BENCH_MAX_DOORS;
+    }
+}
+
+/*
+* The JSON update that onStateChange() queues for a peripheral, for a
+* level change and for a pulse train.
+*/
+void benchStateChange() {
+    PACSDoor& door = doorManager.doors[0];
+    char lock[] = "Lock";
+    char beeper[] = "Beeper";
+    PACSPeripheral& l = *door.findPeripheralById(lock);
+    PACSPeripheral& b = *door.findPeripheralById(beeper);
+
+    bench("state_change_json", "level", [&door, &l](uint32_t n) {
+        char buffer[BENCH_JSON_BUFFER_SIZE];
+        JsonBuffer out(buffer, sizeof(buffer));
+        uint32_t length = 0;
+        for (uint32_t k=0; k < n; k++) {
+            out.clear();
+            JsonWriter json(out);
+            door.stateToJSON(json, l);
+            length += out.length();
+        }
+        benchSink = length;
+    });
+
+    // A train as the beeper's filter reports it.
+    PACSPeripheralFilter_t& f = PACSPeripheral::columns.filters[b.filter];
+    f.pulses = 3;
+    f.pulseDurationMicros = 750000;
+    bench("state_change_json", "pulses", [&door, &b, &f](uint32_t n) {
+        char buffer[BENCH_JSON_BUFFER_SIZE];
+        JsonBuffer out(buffer, sizeof(buffer));
+        uint32_t length = 0;
+        for (uint32_t k=0; k < n; k++) {
+            out.clear();
+            f.pulseWidthMicros = 150000UL + k % 1000;
+            JsonWriter json(out);
+            door.stateToJSON(json, b);
+            length += out.length();
+        }
+        benchSink = length;
+    });
+}
+
+static void onTimer() {
+    benchSink = benchSink + 1;
+}
+
+/*
+* The timer bookkeeping of every main loop, with all timer slots in use
+* and none of them due.
+*/
+void benchTimers() {
+    static SimpleTimer timer;
+    for (int i=0; i < SimpleTimer::MAX_TIMERS; i++)
+        timer.setInterval(60000L + i, &onTimer);
+
+    char param[8];
+    snprintf(param, sizeof(param), "%d", SimpleTimer::MAX_TIMERS);
+    bench("timer_run", param, [](uint32_t n) {
+        for (uint32_t k=0; k < n; k++)
+            timer.run();
+    });
+}
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BENCHMARKS_H_
+#define BENCHMARKS_H_
+
+#include <Arduino.h>
+
+/*
+* The benchmarks of the firmware's hot paths, shared by the host build
+* (host/dctt_bench.cpp) and the bench sketch for the Mega (dctt_bench.ino).
+* The two differ in their clock and in how they print the results, which
+* they provide below.
+*
+* Every benchmark is run with twice the iterations until it has taken at
+* least benchMinimumTicks, and the last run is reported.
+*/
+
+uint64_t benchClock(); // Nanoseconds on the host, CPU cycles on the Mega.
+void benchReport(const char*, const char*, uint32_t, uint64_t); // Name, param, iterations and ticks taken.
+extern uint64_t benchMinimumTicks;
+extern const char* benchFilter; // Only run the benchmarks whose name contains it, NULL for all.
+
+// Results that are never used, so that the compiler can't drop the work.
+extern volatile uint32_t benchSink;
+
+/*
+* Runs body with as many iterations as it takes to fill the minimum time,
+* and reports the result.
+*/
+template <typename Body> void bench(const char* name, const char* param, Body body) {
+    if (benchFilter != NULL && strstr(name, benchFilter) == NULL)
+        return;
+
+    uint32_t iterations = 1;
+    uint64_t elapsed;
+    for (;;) {
+        uint64_t start = benchClock();
+        body(iterations);
+        elapsed = benchClock() - start;
+        if (elapsed >= benchMinimumTicks || iterations >= 0x80000000UL)
+            break;
+        iterations *= 2;
+    }
+    benchReport(name, param, iterations, elapsed);
+}
+
+void benchWiegand(); // Frame encoding, per card format.
+void benchConfig(const char*, size_t, const char*, size_t); // Tokenizing and parsing a pins and a doors config.
+bool benchLookups(); // Door and peripheral lookups, for growing numbers of doors.
+void benchStateChange(); // The JSON of a state update. Needs the doors of benchLookups().
+void benchTimers(); // The timers, with every slot in use.
+
+#endif
@@ -0,0 +1,112 @@
+/*
+Copyright (C) 2014 Axis Communications
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* The benchmarks of dctt_bench on the Mega, where the cost is counted in
+* CPU cycles with Timer1. The results go to the serial port, mixed with the
+* core's log, so only the lines starting with bench= are results:
+*
+*   bench=find_door param=8 iterations=16384 cycles_per_op=412
+*
+* avr-libc's printf has no floating point, so the cycles per operation are
+* rounded down to a whole number.
+*
+* The Arduino IDE only compiles the files in the sketch's folder, so run
+* utils/dctt_bench.sh to put the sketch together with the core sources it
+* needs, and open the result in the IDE.
+*/
+
+#define SERIAL_BAUD 57600
+
+#include <StandardCplusplus.h>
+#include <serstream>
+#include <stdio.h>
+#include "Benchmarks.h"
+
+// The core logs to cout.
+namespace std {
+  ohserialstream cout(Serial);
+}
+
+// The configs to parse, one door like those of sd_card/config. The pins are
+// the ones the lookup benchmarks start from, clear of the serial port.
+const char benchPins[] = "{\"22\": \"R01\", \"23\": \"R11\", \"24\": \"GL1\", \"25\": \"BP1\", "
+                         "\"26\": \"LK1\", \"27\": \"RX1\", \"28\": \"DM1\"}";
+const char benchDoors[] = "{\"DOOR1\": {\"Id\": \"Office\", "
+                          "\"Reader\": {\"Wiegand\": {\"Id\": \"rdrIn\", \"Pin0\": \"R01\", \"Pin1\": \"R11\"}, "
+                          "\"GreenLED\": {\"Id\": \"greenLedIn\", \"Pin\": \"GL1\", \"ActiveLevel\": \"LOW\"}, "
+                          "\"Beeper\": {\"Id\": \"beeperIn\", \"Pin\": \"BP1\", \"ActiveLevel\": \"LOW\", \"PulseGap\": 250}}, "
+                          "\"Lock\": {\"Id\": \"lock\", \"Pin\": \"LK1\", \"ActiveLevel\": \"HIGH\"}, "
+                          "\"REX\": {\"Id\": \"rex\", \"Pin\": \"RX1\", \"ActiveLevel\": \"LOW\"}, "
+                          "\"DoorMonitor\": {\"Id\": \"doorMonitor\", \"Pin\": \"DM1\", \"ActiveLevel\": \"LOW\", \"Debounce\": 20}}}";
+
+uint64_t benchMinimumTicks = F_CPU / 10;
+const char* benchFilter = NULL;
+
+// Overflows of Timer1, which counts the CPU clock.
+volatile uint32_t timerOverflows = 0;
+
+ISR(TIMER1_OVF_vect) {
+  timerOverflows++;
+}
+
+void startClock() {
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TIMSK1 = _BV(TOIE1);
+  sei();
+}
+
+/*
+* Cycles since the clock was started.
+*/
+uint64_t benchClock() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t overflows = timerOverflows;
+  uint16_t count = TCNT1;
+  // An overflow that hasn't been served yet.
+  if ((TIFR1 & _BV(TOV1)) && count < 0x8000)
+    overflows++;
+  SREG = oldSREG;
+  return ((uint64_t)overflows << 16) | count;
+}
+
+void benchReport(const char* name, const char* param, uint32_t iterations, uint64_t elapsed) {
+  printf("bench=%s param=%s iterations=%lu cycles_per_op=%lu\n", name, param,
+         (unsigned long)iterations, (unsigned long)(elapsed / iterations));
+}
+
+int serialPut(char c, FILE*) {
+  Serial.write(c);
+  return 0;
+}
+
+void setup() {
+  Serial.begin(SERIAL_BAUD);
+  fdevopen(&serialPut, NULL);
+  startClock();
+
+  benchWiegand();
+  benchConfig(benchPins, sizeof(benchPins) - 1, benchDoors, sizeof(benchDoors) - 1);
+  if (benchLookups())
+    benchStateChange();
+  benchTimers();
+  printf("done\n");
+}
+
+void loop() {}
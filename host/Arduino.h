@@ -0,0 +1,125 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+/*
+* The parts of the Arduino API that the door core uses, for building it on
+* a host (see CMakeLists.txt). Time is virtual and the pins are a simulated
+* pin bank, both run by the Simulator. 
+*
+* Pins are numbered like on the Mega, but there can be more of them, and
+* they are grouped in ports of 8 in pin order. Every pin has a pin change
+* interrupt, so all controller outputs are captured.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define F_CPU 16000000UL
+#define _BV(bit) (1 << (bit))
+
+#ifndef HOST_DIGITAL_PINS
+#define HOST_DIGITAL_PINS 70 // Pin 255 means no pin, so at most 255.
+#endif
+#define NUM_DIGITAL_PINS HOST_DIGITAL_PINS
+#define A0 54 // First analog pin, as on the Mega.
+#define HOST_PORTS ((HOST_DIGITAL_PINS + 7) / 8)
+
+#define NOT_A_PORT 0
+#define NOT_AN_INTERRUPT -1
+
+#define digitalPinToPort(p) ((uint8_t)(((p) < NUM_DIGITAL_PINS) ? ((p) / 8 + 1) : NOT_A_PORT))
+#define digitalPinToBitMask(p) ((uint8_t)_BV((p) % 8))
+#define digitalPinToInterrupt(p) NOT_AN_INTERRUPT
+
+// A port is one register, which is both its input (PINx) and output
+// (PORTx) register. What the core writes is what it reads back, like on
+// an output pin, and the simulator drives the inputs in the same place.
+extern volatile uint8_t hostPorts[HOST_PORTS + 1];
+#define portInputRegister(port) (&hostPorts[port])
+#define portOutputRegister(port) (&hostPorts[port])
+
+// Pin change interrupts, in three banks like on the Mega. Every port has a
+// mask register of its own, and its pins are in bank port % 3.
+extern volatile uint8_t hostPCICR;
+extern volatile uint8_t hostPCMSK[HOST_PORTS + 1];
+#define PCICR hostPCICR
+#define digitalPinToPCICR(p) (((p) < NUM_DIGITAL_PINS) ? &hostPCICR : (volatile uint8_t*)0)
+#define digitalPinToPCICRbit(p) (digitalPinToPort(p) % 3)
+#define digitalPinToPCMSK(p) (&hostPCMSK[digitalPinToPort(p)])
+#define digitalPinToPCMSKbit(p) ((p) % 8)
+
+// Interrupts are only raised by the simulator, never in the middle of the
+// core's code, so disabling them only needs to show in SREG.
+#define SREG_I 7
+extern volatile uint8_t SREG;
+inline void cli() { SREG &= ~_BV(SREG_I); }
+inline void sei() { SREG |= _BV(SREG_I); }
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+// Timer3, which the Wiegand transmitter runs off. The simulator only looks
+// at OCIE3A, and ticks the transmitter every WIEGAND_TICK_US while it's set.
+extern volatile uint8_t TCCR3A, TCCR3B, TIMSK3;
+extern volatile uint16_t OCR3A, TCNT3;
+#define WGM32 3
+#define CS31 1
+#define OCIE3A 1
+
+#define ISR(vector) extern "C" void vector(void)
+#define TIMER3_COMPA_vect hostTimer3Compare
+#define PCINT0_vect hostPinChange0
+#define PCINT1_vect hostPinChange1
+#define PCINT2_vect hostPinChange2
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+void attachInterrupt(uint8_t, void (*)(void), int);
+void detachInterrupt(uint8_t);
+
+inline boolean isDigit(int c) { return isdigit(c) != 0; }
+
+#include "Print.h"
+
+#endif
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef HOST_PRINT_H_
+#define HOST_PRINT_H_
+
+/*
+* The parts of the Arduino Print and Stream classes that the JSON writer
+* and tokenizer use. Numbers are formatted like Arduino does, in decimal
+* with a fixed number of digits for doubles.
+*/
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size) {
+            size_t n = 0;
+            while (size-- != 0)
+                n += write(*buffer++);
+            return n;
+        }
+        size_t write(const char* s) {
+            return (s == NULL) ? 0 : write((const uint8_t*)s, strlen(s));
+        }
+
+        size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+        size_t print(const char* s) { return write(s); }
+        size_t print(char c) { return write((uint8_t)c); }
+        size_t print(int n) { return print((long)n); }
+        size_t print(unsigned int n) { return print((unsigned long)n); }
+        size_t print(long n) { return format("%ld", n); }
+        size_t print(unsigned long n) { return format("%lu", n); }
+        size_t print(double n, int digits = 2) { return format("%.*f", digits, n); }
+
+    private:
+        template <typename T> size_t format(const char* f, T n) {
+            char s[24];
+            snprintf(s, sizeof(s), f, n);
+            return write(s);
+        }
+        size_t format(const char* f, int digits, double n) {
+            char s[48];
+            snprintf(s, sizeof(s), f, digits, n);
+            return write(s);
+        }
+};
+
+/*
+* A Print that can also be read from, like a file or a client connection.
+*/
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0; // The next byte, or -1 if there is none.
+        virtual int peek() = 0; // The next byte without reading it, or -1.
+};
+
+#endif
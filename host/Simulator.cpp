@@ -0,0 +1,204 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Simulator.h"
+
+volatile uint8_t hostPorts[HOST_PORTS + 1];
+volatile uint8_t hostPCICR;
+volatile uint8_t hostPCMSK[HOST_PORTS + 1];
+volatile uint8_t SREG = _BV(SREG_I);
+volatile uint8_t TCCR3A, TCCR3B, TIMSK3;
+volatile uint16_t OCR3A, TCNT3;
+
+// The interrupt handlers, defined with ISR() in the core.
+extern "C" void TIMER3_COMPA_vect(void);
+extern "C" void PCINT0_vect(void);
+extern "C" void PCINT1_vect(void);
+extern "C" void PCINT2_vect(void);
+
+uint64_t Simulator::clock = 0;
+uint64_t Simulator::nextTick = 0;
+bool Simulator::timerRunning = false;
+uint64_t Simulator::tickCount = 0;
+uint8_t Simulator::outputs[HOST_PORTS + 1];
+uint8_t Simulator::reported[HOST_PORTS + 1];
+SimulatorPinCallback* Simulator::watcher = NULL;
+
+/*
+* Starts over at time 0. The core's own state (the transmitter, edge
+* capture and trace) is not reset.
+*/
+void Simulator::reset() {
+    clock = nextTick = tickCount = 0;
+    timerRunning = false;
+    memset((void*)hostPorts, 0, sizeof(hostPorts));
+    memset((void*)hostPCMSK, 0, sizeof(hostPCMSK));
+    memset(outputs, 0, sizeof(outputs));
+    memset(reported, 0, sizeof(reported));
+    hostPCICR = 0;
+    TIMSK3 = 0;
+    SREG = _BV(SREG_I);
+}
+
+/*
+* Runs time forward. While the timer is running, its interrupt is raised
+* every period (OCR3A + 1 counts at F_CPU / 8), and output changes are
+* reported with the time of the tick they happened in.
+*/
+void Simulator::advance(uint64_t us) {
+    uint64_t end = clock + us;
+
+    // Report what the core has written since the last call.
+    checkOutputs();
+    while (true) {
+        bool running = (TIMSK3 & _BV(OCIE3A)) != 0;
+        uint64_t period = ((uint64_t)OCR3A + 1) * 8000000UL / F_CPU;
+        if (running && !timerRunning)
+            nextTick = clock + (period ? period : 1);
+        timerRunning = running;
+        if (!running || nextTick > end)
+            break;
+
+        clock = nextTick;
+        nextTick += (period ? period : 1);
+        if (SREG & _BV(SREG_I)) {
+            tickCount++;
+            TIMER3_COMPA_vect();
+        }
+        checkOutputs();
+    }
+    clock = end;
+}
+
+/*
+* Drives an input pin from the outside, and raises its pin change interrupt
+* if it is enabled and the level changed.
+*/
+void Simulator::drive(uint8_t pin, uint8_t value) {
+    if (pin >= NUM_DIGITAL_PINS || isOutput(pin))
+        return;
+    uint8_t port = digitalPinToPort(pin);
+    uint8_t mask = digitalPinToBitMask(pin);
+    uint8_t old = hostPorts[port];
+    hostPorts[port] = (value == LOW) ? (old & ~mask) : (old | mask);
+    if (hostPorts[port] == old)
+        return;
+
+    uint8_t bank = digitalPinToPCICRbit(pin);
+    if ((hostPCICR & _BV(bank)) && (hostPCMSK[port] & mask) && (SREG & _BV(SREG_I))) {
+        switch (bank) {
+            case 0: PCINT0_vect(); break;
+            case 1: PCINT1_vect(); break;
+            case 2: PCINT2_vect(); break;
+        }
+    }
+}
+
+uint8_t Simulator::level(uint8_t pin) {
+    if (pin >= NUM_DIGITAL_PINS)
+        return LOW;
+    return (hostPorts[digitalPinToPort(pin)] & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+bool Simulator::isOutput(uint8_t pin) {
+    if (pin >= NUM_DIGITAL_PINS)
+        return false;
+    return (outputs[digitalPinToPort(pin)] & digitalPinToBitMask(pin)) != 0;
+}
+
+/*
+* Sets the direction of a pin. An output starts out as reported at the
+* level it has, so only changes after this are reported.
+*/
+void Simulator::setDirection(uint8_t pin, bool output) {
+    if (pin >= NUM_DIGITAL_PINS)
+        return;
+    uint8_t port = digitalPinToPort(pin);
+    uint8_t mask = digitalPinToBitMask(pin);
+    if (output) {
+        outputs[port] |= mask;
+        reported[port] = (reported[port] & ~mask) | (hostPorts[port] & mask);
+    }
+    else {
+        outputs[port] &= ~mask;
+    }
+}
+
+void Simulator::watch(SimulatorPinCallback* callback) {
+    watcher = callback;
+}
+
+/*
+* Reports the output pins that changed since the last check to the watcher.
+*/
+void Simulator::checkOutputs() {
+    for (uint8_t port=1; port <= HOST_PORTS; port++) {
+        uint8_t changed = (hostPorts[port] ^ reported[port]) & outputs[port];
+        if (!changed)
+            continue;
+        reported[port] ^= changed;
+        for (uint8_t bit=0; bit < 8; bit++) {
+            if ((changed & _BV(bit)) && watcher != NULL)
+                watcher((port - 1) * 8 + bit, (hostPorts[port] & _BV(bit)) ? HIGH : LOW, clock);
+        }
+    }
+}
+
+/* *****************************************************************************************************
+* 
+* The Arduino API, on top of the simulator.
+* 
+***************************************************************************************************** */
+
+unsigned long millis() {
+    return Simulator::now() / 1000;
+}
+
+unsigned long micros() {
+    return Simulator::now();
+}
+
+void delay(unsigned long ms) {
+    Simulator::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    Simulator::advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    Simulator::setDirection(pin, mode == OUTPUT);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin >= NUM_DIGITAL_PINS)
+        return;
+    uint8_t port = digitalPinToPort(pin);
+    if (value == LOW)
+        hostPorts[port] &= ~digitalPinToBitMask(pin);
+    else
+        hostPorts[port] |= digitalPinToBitMask(pin);
+}
+
+int digitalRead(uint8_t pin) {
+    return Simulator::level(pin);
+}
+
+// No pin has an external interrupt on the host, see digitalPinToInterrupt().
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+void detachInterrupt(uint8_t) {}
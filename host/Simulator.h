@@ -0,0 +1,61 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <Arduino.h>
+
+// Called when the core changes the level of one of its output pins.
+typedef void SimulatorPinCallback(uint8_t pin, uint8_t level, uint64_t micros);
+
+/*
+* Virtual time and a simulated pin bank, for running the door core on a
+* host. Time only moves when the simulator is told to advance it, or when
+* the core calls delay(), and the timer interrupt is raised on the way. 
+* The outside world (the controller) drives the input pins, which raises
+* the pin change interrupts, and is told when the core changes an output.
+*
+* Nothing runs in the background, so code that busy-waits for an interrupt
+* waits forever.
+*/
+class Simulator {
+    public:
+        static void reset(); // Back to time 0, with all pins low inputs and all interrupts off.
+        static uint64_t now() { return clock; } // Simulated time, in microseconds.
+        static void advance(uint64_t); // Run time forward, raising interrupts on the way.
+        static void drive(uint8_t, uint8_t); // Drive an input pin from the outside.
+        static uint8_t level(uint8_t); // The level of a pin, as seen from the outside.
+        static bool isOutput(uint8_t); // Is the pin an output of the core?
+        static void setDirection(uint8_t, bool); // Make a pin an output of the core, or an input.
+        static void watch(SimulatorPinCallback*); // Be told of output changes.
+        static uint64_t ticks() { return tickCount; } // Number of timer interrupts raised.
+
+    private:
+        static void checkOutputs();
+
+        static uint64_t clock;
+        static uint64_t nextTick; // When the timer interrupt is raised next, if it is running.
+        static bool timerRunning; // Was the timer running at the last check?
+        static uint64_t tickCount;
+        static uint8_t outputs[HOST_PORTS + 1]; // Direction registers, set for outputs.
+        static uint8_t reported[HOST_PORTS + 1]; // Output levels last reported to the watcher.
+        static SimulatorPinCallback* watcher;
+};
+
+#endif
@@ -0,0 +1,323 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "VirtualController.h"
+#include "Simulator.h"
+#include "WiegandFormat.h"
+
+ControllerDoor_t VirtualController::doors[CONTROLLER_MAX_DOORS];
+uint8_t VirtualController::doorCount = 0;
+uint8_t VirtualController::doorOfPin[NUM_DIGITAL_PINS];
+ControllerCredential_t VirtualController::credentials[CONTROLLER_MAX_CREDENTIALS];
+uint16_t VirtualController::credentialCount = 0;
+ControllerTiming_t VirtualController::responseTiming;
+uint32_t VirtualController::randomState = 1;
+ControllerStats_t VirtualController::counters;
+ControllerDecisionCallback* VirtualController::decisionCallback = NULL;
+
+/*
+* Forgets all doors and credentials, and goes back to the default timing:
+* 50 ms to respond, give or take 10 ms, 1 s unlocked on a grant and two
+* beeps of 100 ms on a denial. Without jitter every latency would be the
+* same, and the latency statistics would tell nothing.
+*/
+void VirtualController::reset() {
+    doorCount = 0;
+    memset(doorOfPin, 255, sizeof(doorOfPin));
+    credentialCount = 0;
+    memset(&counters, 0, sizeof(counters));
+    decisionCallback = NULL;
+
+    ControllerTiming_t defaults = {50000, 10000, 1000000, 2, 100000, 1};
+    setTiming(defaults);
+}
+
+/*
+* Adds a door. The data lines are listened to from now on, and the outputs
+* are set to inactive.
+*/
+int8_t VirtualController::addDoor(const ControllerDoorPins_t& pins) {
+    if (doorCount == CONTROLLER_MAX_DOORS || pins.data0 >= NUM_DIGITAL_PINS || 
+        pins.data1 >= NUM_DIGITAL_PINS)
+        return -1;
+
+    ControllerDoor_t& d = doors[doorCount];
+    memset(&d, 0, sizeof(d));
+    d.pins = pins;
+    doorOfPin[pins.data0] = doorOfPin[pins.data1] = doorCount;
+
+    uint8_t inactive = (pins.activeLevel == HIGH) ? LOW : HIGH;
+    Simulator::drive(pins.lock, inactive);
+    Simulator::drive(pins.greenLed, inactive);
+    Simulator::drive(pins.beeper, inactive);
+    return doorCount++;
+}
+
+/*
+* Adds a card to the access list, by facility code and card number. The
+* card is allowed in any format.
+*/
+bool VirtualController::allowCard(unsigned long facilityCode, unsigned long cardNumber) {
+    if (credentialCount == CONTROLLER_MAX_CREDENTIALS)
+        return false;
+    ControllerCredential_t& c = credentials[credentialCount++];
+    memset(&c, 0, sizeof(c));
+    c.facilityCode = facilityCode;
+    c.cardNumber = cardNumber;
+    return true;
+}
+
+/*
+* Adds a PIN to the access list, as the digits entered before the enter key.
+*/
+bool VirtualController::allowPIN(const char* pin) {
+    if (credentialCount == CONTROLLER_MAX_CREDENTIALS || strlen(pin) > CONTROLLER_PIN_MAX_LENGTH)
+        return false;
+    ControllerCredential_t& c = credentials[credentialCount++];
+    memset(&c, 0, sizeof(c));
+    c.isPIN = true;
+    strcpy(c.pin, pin);
+    return true;
+}
+
+/*
+* Sets how the controller responds, and restarts the jitter from its seed.
+*/
+void VirtualController::setTiming(const ControllerTiming_t& t) {
+    responseTiming = t;
+    if (responseTiming.beeps > CONTROLLER_MAX_BEEPS)
+        responseTiming.beeps = CONTROLLER_MAX_BEEPS;
+    randomState = t.seed ? t.seed : 1;
+}
+
+void VirtualController::registerDecisionCallback(ControllerDecisionCallback* callback) {
+    decisionCallback = callback;
+}
+
+/*
+* Takes an output change of the core. A data line going low is the start of
+* a bit: a 0 on data0 and a 1 on data1.
+*/
+void VirtualController::onPinChange(uint8_t pin, uint8_t level, uint64_t micros) {
+    if (pin >= NUM_DIGITAL_PINS || doorOfPin[pin] == 255 || level != LOW)
+        return;
+
+    ControllerDoor_t& d = doors[doorOfPin[pin]];
+    d.bits = (d.bits << 1) | (pin == d.pins.data1 ? 1 : 0);
+    if (d.bitCount != 255)
+        d.bitCount++;
+    d.lastEdgeMicros = micros;
+}
+
+/*
+* Decodes the frames that have been silent for the frame timeout, and
+* drives the outputs that are due, as of the simulator's current time.
+*/
+void VirtualController::run() {
+    uint64_t now = Simulator::now();
+
+    for (uint8_t i=0; i < doorCount; i++) {
+        ControllerDoor_t& d = doors[i];
+        if (d.bitCount != 0 && now - d.lastEdgeMicros >= CONTROLLER_FRAME_TIMEOUT_US)
+            decode(i, d);
+
+        while (d.firstOutput < d.outputCount && d.outputs[d.firstOutput].micros <= now) {
+            ControllerOutput_t& o = d.outputs[d.firstOutput++];
+            Simulator::drive(o.pin, o.level);
+        }
+        if (d.firstOutput == d.outputCount)
+            d.firstOutput = d.outputCount = 0;
+    }
+}
+
+/*
+* The time of the next frame to decode or output to drive, over all doors.
+*/
+uint64_t VirtualController::nextEvent() {
+    uint64_t next = UINT64_MAX;
+
+    for (uint8_t i=0; i < doorCount; i++) {
+        ControllerDoor_t& d = doors[i];
+        if (d.bitCount != 0 && d.lastEdgeMicros + CONTROLLER_FRAME_TIMEOUT_US < next)
+            next = d.lastEdgeMicros + CONTROLLER_FRAME_TIMEOUT_US;
+        if (d.firstOutput < d.outputCount && d.outputs[d.firstOutput].micros < next)
+            next = d.outputs[d.firstOutput].micros;
+    }
+    return next;
+}
+
+bool VirtualController::isResponding(uint8_t door) {
+    return (door < doorCount) && (doors[door].firstOutput < doors[door].outputCount);
+}
+
+/*
+* Decodes a finished frame: a keypad press if it is 4 bits, otherwise a
+* card, which is looked up in the access list.
+*/
+void VirtualController::decode(uint8_t index, ControllerDoor_t& d) {
+    ControllerCredential_t card;
+
+    if (d.bitCount == 4) {
+        decodeKey(index, d);
+    }
+    else if (decodeCard(d, card)) {
+        counters.cards++;
+        respond(index, d, isAllowed(card));
+    }
+    else {
+        counters.badFrames++;
+    }
+    d.bits = 0;
+    d.bitCount = 0;
+}
+
+/*
+* Adds a key to the PIN being entered. The enter key looks the PIN up, the
+* clear key starts it over.
+*/
+void VirtualController::decodeKey(uint8_t index, ControllerDoor_t& d) {
+    uint8_t key = d.bits & 0xF;
+
+    counters.keys++;
+    if (key <= 9) {
+        if (d.keyCount < CONTROLLER_PIN_MAX_LENGTH) {
+            d.keys[d.keyCount++] = '0' + key;
+            d.keys[d.keyCount] = '\0';
+        }
+    }
+    else if (key == CONTROLLER_KEY_ENTER) {
+        ControllerCredential_t pin;
+        memset(&pin, 0, sizeof(pin));
+        pin.isPIN = true;
+        strcpy(pin.pin, d.keys);
+        counters.pins++;
+        respond(index, d, isAllowed(pin));
+        d.keyCount = 0;
+        d.keys[0] = '\0';
+    }
+    else if (key == CONTROLLER_KEY_CLEAR) {
+        d.keyCount = 0;
+        d.keys[0] = '\0';
+    }
+    else {
+        counters.badFrames++;
+    }
+}
+
+/*
+* Decodes a card frame in the format of its length. The parity bits must
+* be what the format gives for the codes.
+*/
+bool VirtualController::decodeCard(ControllerDoor_t& d, ControllerCredential_t& card) {
+    if (d.bitCount > 64)
+        return false;
+
+    for (uint8_t i=0; i < WiegandFormats::count(); i++) {
+        WiegandFormat_t format;
+        WiegandFormats::get(i, format);
+        if (format.length != d.bitCount)
+            continue;
+
+        memset(&card, 0, sizeof(card));
+        card.facilityCode = (d.bits >> format.facilityOffset) & ((1ULL << format.facilityWidth) - 1);
+        card.cardNumber = (d.bits >> format.cardOffset) & ((1ULL << format.cardWidth) - 1);
+        uint64_t expected;
+        if (WiegandFormats::encode(i, card.facilityCode, card.cardNumber, expected) == d.bitCount &&
+            expected == d.bits)
+            return true;
+    }
+    return false;
+}
+
+bool VirtualController::isAllowed(const ControllerCredential_t& c) {
+    for (uint16_t i=0; i < credentialCount; i++) {
+        const ControllerCredential_t& allowed = credentials[i];
+        if (allowed.isPIN != c.isPIN)
+            continue;
+        if (c.isPIN ? (strcmp(allowed.pin, c.pin) == 0) :
+            (allowed.facilityCode == c.facilityCode && allowed.cardNumber == c.cardNumber))
+            return true;
+    }
+    return false;
+}
+
+/*
+* Schedules the response to a decision, after the latency and jitter. A
+* response to an earlier decision that is still going on is let finish
+* first.
+*/
+void VirtualController::respond(uint8_t index, ControllerDoor_t& d, bool granted) {
+    uint64_t now = Simulator::now();
+    const ControllerTiming_t& t = responseTiming;
+
+    if (granted)
+        counters.granted++;
+    else
+        counters.denied++;
+    if (decisionCallback)
+        decisionCallback(index, granted, now);
+
+    long offset = t.jitterMicros ? (long)(nextRandom() % (2 * t.jitterMicros + 1)) - (long)t.jitterMicros : 0;
+    uint64_t at = now + (((long)t.latencyMicros + offset > 0) ? t.latencyMicros + offset : 0);
+    if (d.outputCount != 0 && d.outputs[d.outputCount - 1].micros > at)
+        at = d.outputs[d.outputCount - 1].micros;
+
+    // Make room at the end of the schedule.
+    uint8_t needed = granted ? 4 : 2 * t.beeps;
+    if (d.firstOutput != 0) {
+        memmove(d.outputs, &d.outputs[d.firstOutput], (d.outputCount - d.firstOutput) * sizeof(d.outputs[0]));
+        d.outputCount -= d.firstOutput;
+        d.firstOutput = 0;
+    }
+    if (d.outputCount + needed > CONTROLLER_MAX_OUTPUTS) {
+        counters.dropped++;
+        return;
+    }
+
+    uint8_t active = d.pins.activeLevel;
+    uint8_t inactive = (active == HIGH) ? LOW : HIGH;
+    if (granted) {
+        schedule(d, at, d.pins.lock, active);
+        schedule(d, at, d.pins.greenLed, active);
+        schedule(d, at + t.unlockMicros, d.pins.lock, inactive);
+        schedule(d, at + t.unlockMicros, d.pins.greenLed, inactive);
+        return;
+    }
+    for (uint8_t i=0; i < t.beeps; i++) {
+        schedule(d, at + 2 * i * t.beepMicros, d.pins.beeper, active);
+        schedule(d, at + (2 * i + 1) * t.beepMicros, d.pins.beeper, inactive);
+    }
+}
+
+void VirtualController::schedule(ControllerDoor_t& d, uint64_t micros, uint8_t pin, uint8_t level) {
+    ControllerOutput_t& o = d.outputs[d.outputCount++];
+    o.micros = micros;
+    o.pin = pin;
+    o.level = level;
+}
+
+/*
+* xorshift32, like the simulation, so that a seed gives the same jitter on
+* every host.
+*/
+uint32_t VirtualController::nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
@@ -0,0 +1,149 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef VIRTUALCONTROLLER_H_
+#define VIRTUALCONTROLLER_H_
+
+#include <Arduino.h>
+
+#define CONTROLLER_MAX_DOORS 64
+#define CONTROLLER_MAX_CREDENTIALS 256 // Cards and PINs on the access list.
+#define CONTROLLER_PIN_MAX_LENGTH 16 // The max number of keys in a PIN.
+#define CONTROLLER_MAX_OUTPUTS 32 // Output changes a door can have scheduled.
+#define CONTROLLER_MAX_BEEPS 8
+#define CONTROLLER_FRAME_TIMEOUT_US 20000 // Silence on the data lines that ends a frame.
+
+#define CONTROLLER_KEY_CLEAR 0xA // '*' starts the PIN over.
+#define CONTROLLER_KEY_ENTER 0xB // '#' ends the PIN.
+
+// The pins of a door, as seen from the controller: the reader data lines
+// it listens to, and the outputs it drives.
+typedef struct {
+    uint8_t data0;
+    uint8_t data1;
+    uint8_t lock;
+    uint8_t greenLed;
+    uint8_t beeper;
+    uint8_t activeLevel; // Level of the lock, green LED and beeper when active.
+} ControllerDoorPins_t;
+
+// A card or PIN on the access list.
+typedef struct {
+    bool isPIN;
+    unsigned long facilityCode;
+    unsigned long cardNumber;
+    char pin[CONTROLLER_PIN_MAX_LENGTH + 1];
+} ControllerCredential_t;
+
+// How the controller responds. A grant activates the lock and the green
+// LED for unlockMicros, a denial sounds the beeper.
+typedef struct {
+    unsigned long latencyMicros; // Mean time from a decoded credential to the response.
+    unsigned long jitterMicros; // Responses come up to this much earlier or later, at random.
+    unsigned long unlockMicros;
+    uint8_t beeps; // Beeper pulses on a denial, at most CONTROLLER_MAX_BEEPS.
+    unsigned long beepMicros; // Width of a beep, and of the pause after it.
+    uint32_t seed; // Seed for the jitter, not 0.
+} ControllerTiming_t;
+
+// A scheduled change of an output.
+typedef struct {
+    uint64_t micros;
+    uint8_t pin;
+    uint8_t level;
+} ControllerOutput_t;
+
+// A door: its pins, the frame being received, the keys entered so far and
+// the outputs waiting to be driven.
+typedef struct {
+    ControllerDoorPins_t pins;
+    uint64_t bits;
+    uint8_t bitCount;
+    uint64_t lastEdgeMicros;
+    char keys[CONTROLLER_PIN_MAX_LENGTH + 1];
+    uint8_t keyCount;
+    ControllerOutput_t outputs[CONTROLLER_MAX_OUTPUTS];
+    uint8_t firstOutput; // The next output to drive.
+    uint8_t outputCount;
+} ControllerDoor_t;
+
+// What the controller has seen and done.
+typedef struct {
+    unsigned long cards; // Card frames with a known format and good parity.
+    unsigned long keys;
+    unsigned long pins; // PINs ended with the enter key.
+    unsigned long granted;
+    unsigned long denied;
+    unsigned long badFrames; // Frames of unknown length, or with bad parity.
+    unsigned long dropped; // Responses that didn't fit the output schedule.
+} ControllerStats_t;
+
+// Called when the controller has decided on a credential.
+typedef void ControllerDecisionCallback(uint8_t door, bool granted, uint64_t micros);
+
+/*
+* A stand-in for the access controller the tool is wired to, on the
+* simulator's pin bank. It decodes the Wiegand frames and keypad presses
+* that the readers clock out, looks the cards and PINs up in its access
+* list, and answers by driving the lock, green LED and beeper inputs of
+* the door after a latency with some jitter.
+*
+* The controller is passive: its onPinChange() is fed the core's output
+* changes (see Simulator::watch()), and run() is called whenever time has
+* advanced, to decode finished frames and drive the outputs that are due.
+* nextEvent() tells how far time can be advanced before run() has
+* something to do, for responses on the exact microsecond. The jitter
+* comes from a seeded generator, so a run can be repeated exactly.
+*/
+class VirtualController {
+    public:
+        static void reset(); // No doors, an empty access list and the default timing.
+        static int8_t addDoor(const ControllerDoorPins_t&); // Index of the door, -1 if full.
+        static bool allowCard(unsigned long, unsigned long); // Add a card to the access list.
+        static bool allowPIN(const char*); // Add a PIN to the access list.
+        static void setTiming(const ControllerTiming_t&);
+        static const ControllerTiming_t& timing() { return responseTiming; }
+        static void registerDecisionCallback(ControllerDecisionCallback*);
+
+        static void onPinChange(uint8_t, uint8_t, uint64_t); // A simulator watch callback.
+        static void run(); // Decode finished frames, and drive the outputs that are due.
+        static uint64_t nextEvent(); // When run() has something to do next, UINT64_MAX if never.
+        static bool isResponding(uint8_t); // Does the door have outputs left to drive?
+        static const ControllerStats_t& stats() { return counters; }
+
+    private:
+        static void decode(uint8_t, ControllerDoor_t&);
+        static void decodeKey(uint8_t, ControllerDoor_t&);
+        static bool decodeCard(ControllerDoor_t&, ControllerCredential_t&);
+        static bool isAllowed(const ControllerCredential_t&);
+        static void respond(uint8_t, ControllerDoor_t&, bool);
+        static void schedule(ControllerDoor_t&, uint64_t, uint8_t, uint8_t);
+        static uint32_t nextRandom();
+
+        static ControllerDoor_t doors[CONTROLLER_MAX_DOORS];
+        static uint8_t doorCount;
+        static uint8_t doorOfPin[NUM_DIGITAL_PINS]; // Door index by data pin, 255 for none.
+        static ControllerCredential_t credentials[CONTROLLER_MAX_CREDENTIALS];
+        static uint16_t credentialCount;
+        static ControllerTiming_t responseTiming;
+        static uint32_t randomState;
+        static ControllerStats_t counters;
+        static ControllerDecisionCallback* decisionCallback;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Measures what the hot paths of the firmware cost on the host: building
+* Wiegand frames, tokenizing and parsing the door config, looking up doors
+* and peripherals as the number of doors grows, writing a state change
+* update as JSON, and running the timers with every slot in use. The
+* benchmarks are in dctt_bench/Benchmarks.cpp, which the bench sketch for
+* the Mega runs as well.
+*
+* Every result is one line of key=value pairs:
+*
+*   bench=find_door param=32 iterations=4194304 ns_per_op=21.47
+*
+* The times are the host's, so they only compare the paths with each other
+* and with earlier runs. The bench sketch counts the Mega's CPU cycles.
+*/
+
+#include "Benchmarks.h"
+#include <serstream>
+#include <getopt.h>
+#include <time.h>
+
+#ifndef BENCH_CONFIG_DIR
+#define BENCH_CONFIG_DIR "sd_card/config" // Where the pins and doors configs to parse are.
+#endif
+#define BENCH_CONFIG_MAX_SIZE 16384
+#define CLOCK_PER_SECOND 1000000000ULL
+
+uint64_t benchMinimumTicks = CLOCK_PER_SECOND / 10;
+const char* benchFilter = NULL;
+
+/*
+* Nanoseconds from the monotonic clock.
+*/
+uint64_t benchClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void benchReport(const char* name, const char* param, uint32_t iterations, uint64_t elapsed) {
+    printf("bench=%s param=%s iterations=%lu ns_per_op=%.2f\n", name, param,
+           (unsigned long)iterations, (double)elapsed / iterations);
+}
+
+/*
+* Reads a config file of the directory into buffer. Returns its length, or
+* 0 if it can't be read.
+*/
+static size_t readConfig(const char* directory, const char* name, char* buffer, size_t size) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening %s\n", path);
+        return 0;
+    }
+    size_t length = fread(buffer, 1, size, file);
+    fclose(file);
+    return length;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-c directory] [-t seconds] [-f filter]\n"
+                    "  -c  Directory of the pins.cfg and doors.cfg to parse (default %s)\n"
+                    "  -t  Minimum seconds per benchmark (default 0.1)\n"
+                    "  -f  Only run the benchmarks whose name contains filter\n", name, BENCH_CONFIG_DIR);
+}
+
+int main(int argc, char** argv) {
+    const char* directory = BENCH_CONFIG_DIR;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:t:f:h")) != -1) {
+        switch (option) {
+            case 'c': directory = optarg; break;
+            case 't': benchMinimumTicks = (uint64_t)(atof(optarg) * CLOCK_PER_SECOND); break;
+            case 'f': benchFilter = optarg; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    static char pins[BENCH_CONFIG_MAX_SIZE];
+    static char doors[BENCH_CONFIG_MAX_SIZE];
+    size_t pinsLength = readConfig(directory, "pins.cfg", pins, sizeof(pins));
+    size_t doorsLength = readConfig(directory, "doors.cfg", doors, sizeof(doors));
+    if (pinsLength == 0 || doorsLength == 0)
+        return 2;
+
+    // The core logs its reconfigurations, which isn't part of the results.
+    std::cout.rdbuf(NULL);
+
+    benchWiegand();
+    benchConfig(pins, pinsLength, doors, doorsLength);
+    if (!benchLookups())
+        return 2;
+    benchStateChange();
+    benchTimers();
+    return 0;
+}
@@ -0,0 +1,375 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Closed-loop runs of the door core against the virtual controller. Every
+* door presents cards and PINs, some on the controller's access list and
+* some not, one at a time: the next one comes when the controller has
+* answered the last one and its outputs have gone back to inactive, after
+* a think time.
+*
+* An answer is the first lock activation (a grant) or beeper activation (a
+* denial) that the core reports after the credential. It is checked
+* against the access list, and its latency is measured from the end of the
+* frame, as the core reports it, to the controller output as the core
+* timestamped it. Time is virtual and all randomness is seeded, so a run
+* gives the same numbers on every host.
+*
+* The results are printed as key=value lines, and the exit status is 1 if
+* an answer was wrong or missing or the controller couldn't decode a frame.
+*/
+
+#include "Simulator.h"
+#include "VirtualController.h"
+#include "PACSDoorManager.h"
+#include <getopt.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#define LOOP_PINS_PER_DOOR 5 // Data0, data1, lock, green LED, beeper.
+#define LOOP_MAX_DOORS (NUM_DIGITAL_PINS / LOOP_PINS_PER_DOOR < CONTROLLER_MAX_DOORS ? \
+                        NUM_DIGITAL_PINS / LOOP_PINS_PER_DOOR : CONTROLLER_MAX_DOORS)
+#define LOOP_CREDENTIALS 64 // Cards and PINs each on the access list.
+#define LOOP_FACILITY 10 // Facility code of the cards on the access list.
+#define LOOP_DENIED_FACILITY 11 // Facility code of the cards that aren't.
+
+// Pins of a door, relative to its first pin.
+#define LOOP_DATA0 0
+#define LOOP_DATA1 1
+#define LOOP_LOCK 2
+#define LOOP_GREENLED 3
+#define LOOP_BEEPER 4
+
+// A door, with the handle of its reader and the credential it waits for
+// an answer to.
+typedef struct {
+    char id[DOOR_ID_MAX_LENGTH + 1];
+    uint8_t reader;
+    unsigned long left; // Credentials still to present.
+    bool waiting;
+    bool expectGrant;
+    bool frameSent; // Has the core reported the end of the last frame?
+    uint64_t presentedMicros;
+    uint64_t frameEndMicros;
+    uint64_t nextMicros; // When the next credential is presented.
+} LoopDoor_t;
+
+// What happened, over all doors.
+typedef struct {
+    unsigned long presented;
+    unsigned long cards;
+    unsigned long pins;
+    unsigned long queueFull;
+    unsigned long granted; // Answers, as the core reported them.
+    unsigned long denied;
+    unsigned long wrong; // Answers that didn't match the access list.
+    unsigned long timeouts;
+    unsigned long early; // Answers before the core reported the frame sent.
+} LoopStats_t;
+
+static PACSDoorManager doorManager;
+static LoopDoor_t doors[LOOP_MAX_DOORS];
+static uint8_t doorCount = 0;
+static LoopStats_t stats;
+static std::vector<uint64_t> latencies; // Frame end to answer.
+static std::vector<uint64_t> transactions; // Credential presented to answer.
+static uint64_t thinkMicros = 100000;
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static uint8_t doorIndex(PACSDoor& door) {
+    return &door - &doorManager.doors[0];
+}
+
+static void onTransmitComplete(PACSDoor& door, PACSReader& reader) {
+    LoopDoor_t& d = doors[doorIndex(door)];
+    unsigned long sentMicros;
+    reader.getLastSentFrame(&sentMicros);
+    if (d.waiting && !d.frameSent) {
+        d.frameSent = true;
+        d.frameEndMicros = sentMicros;
+    }
+}
+
+/*
+* Takes the first lock or beeper activation after a credential as the
+* controller's answer.
+*/
+static void onStateChange(PACSDoor& door, PACSPeripheral& p) {
+    LoopDoor_t& d = doors[doorIndex(door)];
+    if (!d.waiting || !p.isActive() || (p.type != LOCK && p.type != BEEPER))
+        return;
+
+    bool granted = (p.type == LOCK);
+    d.waiting = false;
+    if (granted)
+        stats.granted++;
+    else
+        stats.denied++;
+    if (granted != d.expectGrant)
+        stats.wrong++;
+    if (d.frameSent)
+        latencies.push_back(p.changedMicros - d.frameEndMicros);
+    else
+        stats.early++;
+    transactions.push_back(p.changedMicros - d.presentedMicros);
+}
+
+/*
+* Sets up the doors of the core and the controller, the same pins seen from
+* both ends, and fills the access list.
+*/
+static bool configure(uint8_t count) {
+    static const struct { uint8_t type; const char* id; uint8_t pin; } peripherals[] = {
+        { LOCK, "Lock", LOOP_LOCK },
+        { GREENLED, "GreenLED", LOOP_GREENLED },
+        { BEEPER, "Beeper", LOOP_BEEPER },
+    };
+    ConfigRecord_t record;
+
+    for (uint8_t i=0; i < count; i++) {
+        uint8_t first = i * LOOP_PINS_PER_DOOR;
+        snprintf(doors[i].id, sizeof(doors[i].id), "D%u", i);
+
+        memset(&record, 0, sizeof(record));
+        record.kind = CONFIG_DOOR;
+        strcpy(record.id, doors[i].id);
+        if (doorManager.addRecord(record) == NULL)
+            return false;
+
+        record.kind = CONFIG_READER;
+        strcpy(record.id, "Reader");
+        record.pin = first + LOOP_DATA0;
+        record.pin1 = first + LOOP_DATA1;
+        record.level = WIEGAND_DEFAULT_FORMAT;
+        if (doorManager.addRecord(record) == NULL)
+            return false;
+
+        for (uint8_t j=0; j < sizeof(peripherals) / sizeof(peripherals[0]); j++) {
+            memset(&record, 0, sizeof(record));
+            record.kind = CONFIG_PERIPHERAL;
+            strcpy(record.id, peripherals[j].id);
+            record.type = peripherals[j].type;
+            record.pin = first + peripherals[j].pin;
+            record.pin1 = 255;
+            record.level = HIGH;
+            if (doorManager.addRecord(record) == NULL)
+                return false;
+        }
+
+        ControllerDoorPins_t pins = { (uint8_t)(first + LOOP_DATA0), (uint8_t)(first + LOOP_DATA1), 
+                                      (uint8_t)(first + LOOP_LOCK), (uint8_t)(first + LOOP_GREENLED),
+                                      (uint8_t)(first + LOOP_BEEPER), HIGH };
+        if (VirtualController::addDoor(pins) < 0)
+            return false;
+    }
+    if (!doorManager.initializeDoors())
+        return false;
+    doorManager.registerStateChangeCallback(&onStateChange);
+    doorManager.registerTransmitCompleteCallback(&onTransmitComplete);
+
+    for (uint8_t i=0; i < count; i++) {
+        char reader[] = "Reader";
+        doors[i].reader = doorManager.findHandle(doors[i].id, reader);
+    }
+    doorCount = count;
+
+    char pin[8];
+    for (unsigned i=0; i < LOOP_CREDENTIALS; i++) {
+        snprintf(pin, sizeof(pin), "%u", 1000 + i);
+        VirtualController::allowCard(LOOP_FACILITY, 1000 + i);
+        VirtualController::allowPIN(pin);
+    }
+    return true;
+}
+
+/*
+* Presents a card or a PIN at a door, on the access list or not.
+*/
+static void present(LoopDoor_t& d, unsigned grantPercent, unsigned cardPercent) {
+    bool grant = (nextRandom() % 100) < grantPercent;
+    unsigned number = 1000 + nextRandom() % LOOP_CREDENTIALS;
+    bool queued;
+
+    if ((nextRandom() % 100) < cardPercent) {
+        queued = doorManager.swipeCard(d.reader, grant ? LOOP_FACILITY : LOOP_DENIED_FACILITY, number);
+        stats.cards++;
+    }
+    else {
+        // PINs not on the list have a digit more.
+        char pin[8];
+        snprintf(pin, sizeof(pin), grant ? "%u#" : "9%u#", number);
+        queued = doorManager.enterPIN(d.reader, pin);
+        stats.pins++;
+    }
+    d.left--;
+    if (!queued) {
+        stats.queueFull++;
+        return;
+    }
+    stats.presented++;
+    d.waiting = true;
+    d.expectGrant = grant;
+    d.frameSent = false;
+    d.presentedMicros = Simulator::now();
+}
+
+static uint64_t percentile(std::vector<uint64_t>& values, unsigned p) {
+    if (values.empty())
+        return 0;
+    return values[(values.size() - 1) * p / 100];
+}
+
+static double mean(std::vector<uint64_t>& values) {
+    double sum = 0;
+    for (size_t i=0; i < values.size(); i++)
+        sum += values[i];
+    return values.empty() ? 0 : sum / values.size();
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-d doors] [-n count] [-g percent] [-c percent] [-l micros] [-j micros]\n"
+                    "          [-k micros] [-u micros] [-s seed] [-v]\n"
+                    "  -d  Doors (default and max %u)\n"
+                    "  -n  Credentials presented per door (default 100)\n"
+                    "  -g  Percentage of credentials on the access list (default 80)\n"
+                    "  -c  Percentage of cards, the rest are PINs (default 50)\n"
+                    "  -l  Controller response latency (default 50000)\n"
+                    "  -j  Controller response jitter, plus or minus (default 10000)\n"
+                    "  -k  Think time after an answer (default 100000)\n"
+                    "  -u  Simulated microseconds per main loop (default 1000)\n"
+                    "  -s  Random seed (default 1)\n"
+                    "  -v  Show the core's log\n", name, LOOP_MAX_DOORS);
+}
+
+int main(int argc, char** argv) {
+    unsigned count = LOOP_MAX_DOORS;
+    unsigned long perDoor = 100;
+    unsigned grantPercent = 80;
+    unsigned cardPercent = 50;
+    unsigned long loopMicros = 1000;
+    bool verbose = false;
+    int option;
+
+    VirtualController::reset();
+    ControllerTiming_t timing = VirtualController::timing();
+    while ((option = getopt(argc, argv, "d:n:g:c:l:j:k:u:s:vh")) != -1) {
+        switch (option) {
+            case 'd': count = strtoul(optarg, NULL, 10); break;
+            case 'n': perDoor = strtoul(optarg, NULL, 10); break;
+            case 'g': grantPercent = strtoul(optarg, NULL, 10); break;
+            case 'c': cardPercent = strtoul(optarg, NULL, 10); break;
+            case 'l': timing.latencyMicros = strtoul(optarg, NULL, 10); break;
+            case 'j': timing.jitterMicros = strtoul(optarg, NULL, 10); break;
+            case 'k': thinkMicros = strtoull(optarg, NULL, 10); break;
+            case 'u': loopMicros = strtoul(optarg, NULL, 10); break;
+            case 's': randomState = strtoul(optarg, NULL, 10); break;
+            case 'v': verbose = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (count == 0 || count > LOOP_MAX_DOORS || loopMicros == 0 || randomState == 0 ||
+        grantPercent > 100 || cardPercent > 100) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!verbose)
+        std::cout.rdbuf(NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Simulator::reset();
+    Simulator::watch(&VirtualController::onPinChange);
+    timing.seed = randomState;
+    VirtualController::setTiming(timing);
+    if (!configure(count)) {
+        fprintf(stderr, "The doors do not fit.\n");
+        return 2;
+    }
+
+    // Stagger the doors over the first think time.
+    for (uint8_t i=0; i < doorCount; i++) {
+        doors[i].left = perDoor;
+        doors[i].nextMicros = thinkMicros ? nextRandom() % thinkMicros : 0;
+    }
+
+    unsigned long loops = 0;
+    bool busy = true;
+    while (busy) {
+        // A loop, or less if the controller has something to do sooner.
+        uint64_t now = Simulator::now();
+        uint64_t next = VirtualController::nextEvent();
+        Simulator::advance((next > now && next - now < loopMicros) ? next - now : loopMicros);
+        VirtualController::run();
+        doorManager.updateLevels();
+        loops++;
+
+        now = Simulator::now();
+        busy = false;
+        for (uint8_t i=0; i < doorCount; i++) {
+            LoopDoor_t& d = doors[i];
+            if (d.waiting && now - d.presentedMicros > LATENCY_TIMEOUT_MS * 1000ULL) {
+                d.waiting = false;
+                stats.timeouts++;
+            }
+            if (d.waiting || VirtualController::isResponding(i)) {
+                d.nextMicros = now + thinkMicros;
+                busy = true;
+            }
+            else if (d.left != 0) {
+                if (now >= d.nextMicros)
+                    present(d, grantPercent, cardPercent);
+                busy = true;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(transactions.begin(), transactions.end());
+    const ControllerStats_t& controller = VirtualController::stats();
+    double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double simulated = Simulator::now() / 1e6;
+    bool ok = (stats.wrong == 0) && (stats.timeouts == 0) && (controller.badFrames == 0) && 
+              (controller.dropped == 0);
+
+    printf("doors=%u\nsimulated_s=%.3f\nwall_s=%.3f\nloops=%lu\n", count, simulated, wall, loops);
+    printf("presented=%lu\ncards=%lu\npins=%lu\nqueue_full=%lu\n",
+           stats.presented, stats.cards, stats.pins, stats.queueFull);
+    printf("controller_granted=%lu\ncontroller_denied=%lu\ncontroller_bad_frames=%lu\ncontroller_dropped=%lu\n",
+           controller.granted, controller.denied, controller.badFrames, controller.dropped);
+    printf("granted=%lu\ndenied=%lu\nwrong=%lu\ntimeouts=%lu\nearly=%lu\n",
+           stats.granted, stats.denied, stats.wrong, stats.timeouts, stats.early);
+    printf("answers_per_s=%.3f\n", simulated > 0 ? (stats.granted + stats.denied) / simulated : 0);
+    printf("latency_min_us=%llu\nlatency_mean_us=%.0f\nlatency_p50_us=%llu\nlatency_p99_us=%llu\nlatency_max_us=%llu\n",
+           (unsigned long long)percentile(latencies, 0), mean(latencies),
+           (unsigned long long)percentile(latencies, 50), (unsigned long long)percentile(latencies, 99),
+           (unsigned long long)percentile(latencies, 100));
+    printf("transaction_mean_us=%.0f\ntransaction_p99_us=%llu\n",
+           mean(transactions), (unsigned long long)percentile(transactions, 99));
+    printf("result=%s\n", ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
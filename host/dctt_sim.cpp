@@ -0,0 +1,393 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Runs the door core against the simulator, with scripted traffic: card
+* swipes, PIN entries, REX pushes and door openings on every door, and a
+* controller that toggles the lock, LED and beeper inputs at random. Time
+* is virtual, so an hour of traffic takes seconds.
+*
+* At the end of every rig, the simulation checks that every queued frame
+* was sent and clocked out bit by bit on the data lines, and that every
+* change of a controller output was reported once. The results are printed
+* as key=value lines, and the exit status is 1 if a check failed.
+*
+* Several rigs are run one after the other, each one a reconfiguration of
+* the last, to simulate more doors than the 8 bit handles and pins of one
+* rig allow.
+*/
+
+#include "Simulator.h"
+#include "PACSDoorManager.h"
+#include "WiegandTransmitter.h"
+#include <getopt.h>
+#include <time.h>
+
+#define SIM_PINS_PER_DOOR 7 // Data0, Data1, lock, green LED, beeper, door monitor, REX.
+#define SIM_MAX_DOORS (NUM_DIGITAL_PINS / SIM_PINS_PER_DOOR)
+
+// Pins of a door, relative to its first pin.
+#define SIM_DATA0 0
+#define SIM_DATA1 1
+#define SIM_LOCK 2
+#define SIM_GREENLED 3
+#define SIM_BEEPER 4
+#define SIM_MONITOR 5
+#define SIM_REX 6
+
+// A simulated door, with the handles of its reader and peripherals and 
+// when it is stimulated and the controller responds next.
+typedef struct {
+    char id[DOOR_ID_MAX_LENGTH + 1];
+    uint8_t firstPin;
+    uint8_t reader;
+    uint8_t monitor;
+    uint8_t rex;
+    bool open;
+    uint64_t nextStimulus;
+    uint64_t nextResponse;
+} SimDoor_t;
+
+// What happened, over all rigs.
+typedef struct {
+    unsigned long cards;
+    unsigned long pins;
+    unsigned long rexPushes;
+    unsigned long doorChanges;
+    unsigned long queueFull;
+    unsigned long framesQueued;
+    unsigned long framesSent;
+    unsigned long bitsQueued;
+    unsigned long pulses; // Pulses seen on the data lines.
+    unsigned long driven; // Controller output changes.
+    unsigned long reported; // Controller output changes reported by the core.
+    unsigned long latencies;
+    unsigned long timeouts;
+} SimStats_t;
+
+static PACSDoorManager doorManager;
+static SimDoor_t doors[SIM_MAX_DOORS];
+static uint8_t doorCount = 0;
+static SimStats_t stats;
+static uint32_t randomState = 1;
+
+/*
+* xorshift32, so that a seed gives the same traffic on every host.
+*/
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+/*
+* A time around mean from now, between half and one and a half mean.
+*/
+static uint64_t randomTime(uint64_t mean) {
+    return Simulator::now() + mean / 2 + (mean ? nextRandom() % mean : 0);
+}
+
+static void onPinChange(uint8_t pin, uint8_t level, uint64_t) {
+    uint8_t offset = pin % SIM_PINS_PER_DOOR;
+    if ((offset == SIM_DATA0 || offset == SIM_DATA1) && level == LOW)
+        stats.pulses++;
+}
+
+static void onStateChange(PACSDoor&, PACSPeripheral& p) {
+    if (p.type == LOCK || p.type == GREENLED || p.type == BEEPER)
+        stats.reported++;
+}
+
+/*
+* Adds the records of a door, with its pins starting at first.
+*/
+static bool addDoor(const char* id, uint8_t first) {
+    static const struct { uint8_t type; const char* id; uint8_t pin; uint8_t level; } peripherals[] = {
+        { LOCK, "Lock", SIM_LOCK, HIGH },
+        { GREENLED, "GreenLED", SIM_GREENLED, HIGH },
+        { BEEPER, "Beeper", SIM_BEEPER, HIGH },
+        { DOORMONITOR, "Monitor", SIM_MONITOR, HIGH },
+        { REX, "REX", SIM_REX, LOW },
+    };
+    ConfigRecord_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.kind = CONFIG_DOOR;
+    strcpy(record.id, id);
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    record.kind = CONFIG_READER;
+    strcpy(record.id, "Reader");
+    record.pin = first + SIM_DATA0;
+    record.pin1 = first + SIM_DATA1;
+    record.level = WIEGAND_DEFAULT_FORMAT;
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    for (uint8_t i=0; i < sizeof(peripherals) / sizeof(peripherals[0]); i++) {
+        memset(&record, 0, sizeof(record));
+        record.kind = CONFIG_PERIPHERAL;
+        strcpy(record.id, peripherals[i].id);
+        record.type = peripherals[i].type;
+        record.pin = first + peripherals[i].pin;
+        record.pin1 = 255;
+        record.level = peripherals[i].level;
+        if (doorManager.addRecord(record) == NULL)
+            return false;
+    }
+    return true;
+}
+
+/*
+* Sets up the doors of a rig. The first rig initializes the doors, the rest
+* replace the doors of the rig before.
+*/
+static bool configure(unsigned rig, uint8_t count, uint64_t meanInterval) {
+    if (rig > 0)
+        doorManager.beginReconfiguration();
+    for (uint8_t i=0; i < count; i++) {
+        SimDoor_t& d = doors[i];
+        snprintf(d.id, sizeof(d.id), "R%uD%u", rig, i);
+        d.firstPin = i * SIM_PINS_PER_DOOR;
+        if (!addDoor(d.id, d.firstPin)) {
+            doorManager.discardRecords();
+            return false;
+        }
+    }
+
+    ReconfigurationResult_t result;
+    if (rig == 0) {
+        if (!doorManager.initializeDoors())
+            return false;
+        doorManager.registerStateChangeCallback(&onStateChange);
+    }
+    else if (!doorManager.commitReconfiguration(result)) {
+        return false;
+    }
+
+    for (uint8_t i=0; i < count; i++) {
+        SimDoor_t& d = doors[i];
+        char reader[] = "Reader";
+        char monitor[] = "Monitor";
+        char rex[] = "REX";
+        d.reader = doorManager.findHandle(d.id, reader);
+        d.monitor = doorManager.findHandle(d.id, monitor);
+        d.rex = doorManager.findHandle(d.id, rex);
+        d.open = false;
+        d.nextStimulus = randomTime(meanInterval);
+        d.nextResponse = randomTime(meanInterval);
+    }
+    doorCount = count;
+    return true;
+}
+
+/*
+* Queues a frame's worth of bits, if the command queued one.
+*/
+static void countFrame(bool queued, uint8_t bits) {
+    if (!queued) {
+        stats.queueFull++;
+        return;
+    }
+    stats.framesQueued++;
+    stats.bitsQueued += bits;
+}
+
+/*
+* Does something random at a door: swipes a card, enters a PIN, pushes REX
+* or opens or closes the door.
+*/
+static void stimulate(SimDoor_t& d) {
+    WiegandFormat_t format;
+    char pin[5];
+
+    switch (nextRandom() % 4) {
+        case 0:
+            WiegandFormats::get(WIEGAND_DEFAULT_FORMAT, format);
+            countFrame(doorManager.swipeCard(d.reader, nextRandom() % 256, nextRandom() % 65536), format.length);
+            stats.cards++;
+            break;
+        case 1:
+            snprintf(pin, sizeof(pin), "%04u", (unsigned)(nextRandom() % 10000));
+            countFrame(doorManager.enterPIN(d.reader, pin), 4 * strlen(pin));
+            stats.pins++;
+            break;
+        case 2:
+            doorManager.pushREX(d.rex);
+            stats.rexPushes++;
+            break;
+        case 3:
+            d.open = !d.open;
+            if (d.open)
+                doorManager.openDoor(d.monitor);
+            else
+                doorManager.closeDoor(d.monitor);
+            stats.doorChanges++;
+            break;
+    }
+}
+
+/*
+* Drives a controller output of a door to a level, and counts it if that
+* changes it.
+*/
+static void driveOutput(SimDoor_t& d, uint8_t offset, uint8_t level) {
+    uint8_t pin = d.firstPin + offset;
+    if (Simulator::level(pin) != level) {
+        Simulator::drive(pin, level);
+        stats.driven++;
+    }
+}
+
+/*
+* Runs the main loop of the firmware once, after loopMicros of simulated
+* time.
+*/
+static void runLoop(uint64_t loopMicros) {
+    Simulator::advance(loopMicros);
+    doorManager.updateLevels();
+}
+
+/*
+* Lets the rig settle: the controller outputs go back to inactive, and all
+* queued frames are sent.
+*/
+static void settle(uint64_t loopMicros) {
+    for (uint8_t i=0; i < doorCount; i++) {
+        driveOutput(doors[i], SIM_LOCK, LOW);
+        driveOutput(doors[i], SIM_GREENLED, LOW);
+        driveOutput(doors[i], SIM_BEEPER, LOW);
+    }
+    bool transmitting = true;
+    while (transmitting) {
+        runLoop(loopMicros);
+        transmitting = false;
+        for (uint8_t i=0; i < doorCount; i++) {
+            if (doorManager.doors[i].readers[0].isTransmitting())
+                transmitting = true;
+        }
+    }
+    runLoop(loopMicros);
+}
+
+/*
+* Counts what the readers sent and the doors measured, once the rig has settled.
+*/
+static void collect() {
+    for (uint8_t i=0; i < doorCount; i++) {
+        PACSDoor& d = doorManager.doors[i];
+        stats.framesSent += d.readers[0].lastSentFrame;
+        stats.latencies += d.latency.count;
+        stats.timeouts += d.latency.timeouts;
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-d doors] [-r rigs] [-t seconds] [-i seconds] [-l micros] [-s seed] [-v]\n"
+                    "  -d  Doors per rig (default and max %u)\n"
+                    "  -r  Number of rigs, run one after the other (default 1)\n"
+                    "  -t  Simulated seconds per rig (default 3600)\n"
+                    "  -i  Mean seconds between stimuli, and between controller outputs, per door (default 5)\n"
+                    "  -l  Simulated microseconds per main loop (default 1000)\n"
+                    "  -s  Random seed (default 1)\n"
+                    "  -v  Show the core's log\n", name, SIM_MAX_DOORS);
+}
+
+int main(int argc, char** argv) {
+    unsigned count = SIM_MAX_DOORS;
+    unsigned rigs = 1;
+    double seconds = 3600;
+    double interval = 5;
+    unsigned long loopMicros = 1000;
+    bool verbose = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "d:r:t:i:l:s:vh")) != -1) {
+        switch (option) {
+            case 'd': count = strtoul(optarg, NULL, 10); break;
+            case 'r': rigs = strtoul(optarg, NULL, 10); break;
+            case 't': seconds = atof(optarg); break;
+            case 'i': interval = atof(optarg); break;
+            case 'l': loopMicros = strtoul(optarg, NULL, 10); break;
+            case 's': randomState = strtoul(optarg, NULL, 10); break;
+            case 'v': verbose = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (count == 0 || count > SIM_MAX_DOORS || loopMicros == 0 || randomState == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!verbose)
+        std::cout.rdbuf(NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Simulator::reset();
+    Simulator::watch(&onPinChange);
+
+    uint64_t meanInterval = (uint64_t)(interval * 1000000);
+    uint64_t duration = (uint64_t)(seconds * 1000000);
+    unsigned long loops = 0;
+    for (unsigned rig=0; rig < rigs; rig++) {
+        if (!configure(rig, count, meanInterval)) {
+            fprintf(stderr, "The doors of rig %u do not fit.\n", rig);
+            return 2;
+        }
+        uint64_t rigEnd = Simulator::now() + duration;
+        while (Simulator::now() < rigEnd) {
+            runLoop(loopMicros);
+            loops++;
+            for (uint8_t i=0; i < doorCount; i++) {
+                SimDoor_t& d = doors[i];
+                if (Simulator::now() >= d.nextStimulus) {
+                    stimulate(d);
+                    d.nextStimulus = randomTime(meanInterval);
+                }
+                if (Simulator::now() >= d.nextResponse) {
+                    uint8_t offset = SIM_LOCK + nextRandom() % 3;
+                    driveOutput(d, offset, Simulator::level(d.firstPin + offset) ? LOW : HIGH);
+                    d.nextResponse = randomTime(meanInterval);
+                }
+            }
+        }
+        settle(loopMicros);
+        collect();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double simulated = Simulator::now() / 1e6;
+    bool framesOk = (stats.framesSent == stats.framesQueued) && (stats.pulses == stats.bitsQueued);
+    bool outputsOk = (stats.reported == stats.driven);
+
+    printf("doors=%u\nrigs=%u\nsimulated_s=%.3f\nwall_s=%.3f\nspeedup=%.0f\nloops=%lu\nticks=%llu\n",
+           count, rigs, simulated, wall, wall > 0 ? simulated / wall : 0, loops, 
+           (unsigned long long)Simulator::ticks());
+    printf("cards=%lu\npins=%lu\nrex_pushes=%lu\ndoor_changes=%lu\nqueue_full=%lu\n",
+           stats.cards, stats.pins, stats.rexPushes, stats.doorChanges, stats.queueFull);
+    printf("frames_queued=%lu\nframes_sent=%lu\nbits_queued=%lu\npulses=%lu\n",
+           stats.framesQueued, stats.framesSent, stats.bitsQueued, stats.pulses);
+    printf("outputs_driven=%lu\noutputs_reported=%lu\nlatencies=%lu\nlatency_timeouts=%lu\n",
+           stats.driven, stats.reported, stats.latencies, stats.timeouts);
+    printf("frames=%s\noutputs=%s\n", framesOk ? "ok" : "FAIL", outputsOk ? "ok" : "FAIL");
+    return (framesOk && outputsOk) ? 0 : 1;
+}
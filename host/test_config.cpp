@@ -0,0 +1,195 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Parses pins and doors configs with DoorConfig, and checks the doors that
+* come out of them: keys and doors in any order, single objects and arrays,
+* unknown keys skipped, and the errors that make a config fail (bad
+* separators, an unknown active level, format or pin, missing pins).
+*/
+
+#include "Simulator.h"
+#include "DoorConfig.h"
+#include "WiegandFormat.h"
+
+static PACSDoorManager doorManager;
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+/*
+* A stream over a string.
+*/
+class StringStream : public Stream {
+    public:
+        StringStream(const char* s) : data(s), position(0) {}
+
+        virtual int available() { return strlen(data + position); }
+        virtual int read() { return data[position] ? (uint8_t)data[position++] : -1; }
+        virtual int peek() { return data[position] ? (uint8_t)data[position] : -1; }
+        virtual size_t write(uint8_t) { return 0; }
+        using Print::write;
+
+    private:
+        const char* data;
+        size_t position;
+};
+
+static const char* pins =
+    "{\"2\": \"R01\", \"3\": \"R11\", \"4\": \"LK1\", \"5\": \"RX1\", \"6\": \"DM1\", \"7\": \"BP1\", "
+    "\"A0\": \"IO1\", \"A15\": \"IO2\"}";
+
+// Keys in a different order in every object, and keys the parser doesn't
+// know, which it skips.
+static const char* doors =
+    "{\"Front\": {"
+        "\"Lock\": {\"ActiveLevel\": \"HIGH\", \"Pin\": \"LK1\", \"Id\": \"lock\"}, "
+        "\"Comment\": {\"Nested\": [1, {\"Lock\": \"x\"}]}, "
+        "\"Reader\": [{\"Beeper\": {\"Pin\": \"BP1\", \"Id\": \"beeper\", \"PulseGap\": 250}, \"Direction\": \"In\", "
+                      "\"Wiegand\": {\"Format\": \"H10306\", \"Pin1\": \"R11\", \"Pin0\": \"R01\", \"Id\": \"reader\"}}], "
+        "\"REX\": [{\"Id\": \"rex1\", \"Pin\": \"RX1\"}, {\"Pin\": \"IO1\", \"Id\": \"rex2\", \"ActiveLevel\": \"HIGH\"}], "
+        "\"Id\": \"MainEntrance\"}, "
+    "\"Back\": {\"Input\": {\"Id\": \"in\", \"Pin\": \"IO2\"}, "
+        "\"DoorMonitor\": {\"Debounce\": \"20\", \"Id\": \"monitor\", \"Pin\": \"DM1\"}}}";
+
+static bool parsePins(const char* config) {
+    StringStream stream(config);
+    return DoorConfig::parsePins(stream);
+}
+
+/*
+* Parses a doors config, and throws the records away.
+*/
+static bool parseDoors(const char* config) {
+    StringStream stream(config);
+    bool parsed = DoorConfig::parseDoors(stream, doorManager);
+    doorManager.discardRecords();
+    return parsed;
+}
+
+static PACSPeripheral* peripheral(const char* doorId, const char* id) {
+    for (unsigned i=0; i < doorManager.doors.size(); i++) {
+        if (strcmp(doorManager.doors[i].id, doorId) == 0)
+            return doorManager.doors[i].findPeripheralById((char*)id);
+    }
+    return NULL;
+}
+
+static void testPins() {
+    CHECK(DoorConfig::parsePinName("0") == 0);
+    CHECK(DoorConfig::parsePinName("53") == 53);
+    CHECK(DoorConfig::parsePinName("A0") == 54);
+    CHECK(DoorConfig::parsePinName("A15") == 69);
+    CHECK(DoorConfig::parsePinName("54") == -1);
+    CHECK(DoorConfig::parsePinName("A16") == -1);
+    CHECK(DoorConfig::parsePinName("A") == -1);
+    CHECK(DoorConfig::parsePinName("") == -1);
+    CHECK(DoorConfig::parsePinName("1x") == -1);
+
+    CHECK(!parsePins("{\"2\": \"R01\", \"70\": \"R11\"}"));
+    CHECK(!parsePins("{\"2\": 5}"));
+    CHECK(!parsePins("{\"2\": \"R01\" \"3\": \"R11\"}"));
+    CHECK(!parsePins("{\"2\": \"R01\"} {}"));
+
+    CHECK(parsePins(pins));
+    CHECK(DoorConfig::getPinNumber("R01") == 2);
+    CHECK(DoorConfig::getPinNumber("IO1") == A0);
+    CHECK(DoorConfig::getPinNumber("IO2") == A0 + 15);
+    CHECK(DoorConfig::getPinNumber("N/A") != 255); // The pins left out.
+    CHECK(DoorConfig::getPinNumber("XX1") == 255);
+}
+
+static void testDoors() {
+    StringStream stream(doors);
+    CHECK(DoorConfig::parseDoors(stream, doorManager));
+    CHECK(doorManager.initializeDoors());
+    CHECK(doorManager.doors.size() == 2);
+    if (doorManager.doors.size() != 2)
+        return;
+
+    // The Id wins over the key, wherever it is in the door.
+    CHECK(strcmp(doorManager.doors[0].id, "MainEntrance") == 0);
+    CHECK(strcmp(doorManager.doors[1].id, "Back") == 0);
+
+    PACSDoor& front = doorManager.doors[0];
+    CHECK(front.readers.size() == 1);
+    CHECK(front.peripherals.size() == 4);
+    char reader[] = "reader";
+    PACSReader* r = front.findReaderById(reader);
+    CHECK(r != NULL && r->pin0 == 2 && r->pin1 == 3 && r->format == WiegandFormats::find("H10306"));
+
+    PACSPeripheral* p = peripheral("MainEntrance", "lock");
+    CHECK(p != NULL && p->type == LOCK && p->pin() == 4 && p->activeLevel() == HIGH);
+    p = peripheral("MainEntrance", "beeper");
+    CHECK(p != NULL && p->type == BEEPER && p->pin() == 7 && p->activeLevel() == LOW && p->pulseGapMs() == 250);
+    p = peripheral("MainEntrance", "rex1");
+    CHECK(p != NULL && p->type == REX && p->pin() == 5 && p->activeLevel() == LOW);
+    p = peripheral("MainEntrance", "rex2");
+    CHECK(p != NULL && p->type == REX && p->pin() == A0 && p->activeLevel() == HIGH);
+    p = peripheral("Back", "monitor");
+    CHECK(p != NULL && p->type == DOORMONITOR && p->pin() == 6 && p->debounceMs() == 20);
+    p = peripheral("Back", "in");
+    CHECK(p != NULL && p->type == DIGITAL_INPUT && p->pin() == A0 + 15);
+
+    // A single door, reader and peripheral, without an array around them.
+    CHECK(parseDoors("{\"D\": {\"Reader\": {\"Wiegand\": {\"Id\": \"r\", \"Pin0\": \"R01\", \"Pin1\": \"R11\"}}, "
+                     "\"Lock\": {\"Id\": \"l\", \"Pin\": \"LK1\"}}}"));
+    CHECK(parseDoors("{}"));
+}
+
+static void testErrors() {
+    // Unknown values.
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\", \"Pin\": \"LK1\", \"ActiveLevel\": \"MEDIUM\"}}}"));
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\", \"Pin\": \"LK1\", \"ActiveLevel\": \"high\"}}}"));
+    CHECK(!parseDoors("{\"D\": {\"Reader\": {\"Wiegand\": {\"Id\": \"r\", \"Pin0\": \"R01\", \"Pin1\": \"R11\", \"Format\": \"H99999\"}}}}"));
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\", \"Pin\": \"XX1\"}}}"));
+
+    // Missing pins.
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\"}}}"));
+    CHECK(!parseDoors("{\"D\": {\"Reader\": {\"Wiegand\": {\"Id\": \"r\", \"Pin0\": \"R01\"}}}}"));
+
+    // Separators.
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\" \"Pin\": \"LK1\"}}}"));
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\" \"l\", \"Pin\": \"LK1\"}}}"));
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\", \"Pin\": \"LK1\",}}}"));
+    CHECK(!parseDoors("{\"D\": {\"REX\": [{\"Id\": \"r\", \"Pin\": \"RX1\"},, {\"Id\": \"s\", \"Pin\": \"IO1\"}]}}"));
+    CHECK(!parseDoors("{\"D\": {}, }"));
+    CHECK(!parseDoors("{\"D\": {} \"E\": {}}"));
+
+    // Not a door object, cut short, or followed by more.
+    CHECK(!parseDoors("[]"));
+    CHECK(!parseDoors("{\"D\": []}"));
+    CHECK(!parseDoors("{\"D\": {\"Lock\": {\"Id\": \"l\", \"Pin\": \"LK1\"}"));
+    CHECK(!parseDoors("{\"D\": {}} {}"));
+}
+
+int main() {
+    std::cout.rdbuf(NULL);
+    Simulator::reset();
+    testPins();
+    testDoors();
+    testErrors();
+
+    printf("config=%s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
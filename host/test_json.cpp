@@ -0,0 +1,193 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Feeds JSON documents to the validator that checks uploads and to the
+* tokenizer that the config parsers read with, and checks what they make
+* of them: whole documents, documents cut short, mismatched brackets,
+* missing and extra separators, and data after the top level value.
+*/
+
+#include "JsonValidator.h"
+#include "JsonTokenizer.h"
+#include <serstream>
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+/*
+* A stream over a string.
+*/
+class StringStream : public Stream {
+    public:
+        StringStream(const char* s) : data(s), position(0) {}
+
+        virtual int available() { return strlen(data + position); }
+        virtual int read() { return data[position] ? (uint8_t)data[position++] : -1; }
+        virtual int peek() { return data[position] ? (uint8_t)data[position] : -1; }
+        virtual size_t write(uint8_t) { return 0; }
+        using Print::write;
+
+    private:
+        const char* data;
+        size_t position;
+};
+
+/*
+* Is the document accepted by the validator as a whole? It is fed in two
+* parts, as an upload arrives in blocks.
+*/
+static bool validates(const char* document) {
+    JsonValidator validator;
+    size_t half = strlen(document) / 2;
+    bool valid = validator.feed((const uint8_t*)document, half) &&
+                 validator.feed((const uint8_t*)document + half, strlen(document) - half);
+    return valid && validator.isComplete();
+}
+
+/*
+* Is the document fine as far as it goes, even if it isn't complete?
+*/
+static bool validSoFar(const char* document) {
+    JsonValidator validator;
+    return validator.feed((const uint8_t*)document, strlen(document));
+}
+
+static void testValidator() {
+    CHECK(validates("{\"a\": [1, 2.5, -3e2, {\"b\": \"c\\\"}\"}], \"d\": true, \"e\": null}"));
+    CHECK(validates("[]"));
+    CHECK(validates("  {\"a\": {}}\r\n"));
+
+    // Cut short: fine so far, but not complete.
+    CHECK(validSoFar("{\"a\": [1, 2"));
+    CHECK(!validates("{\"a\": [1, 2"));
+    CHECK(!validates("{\"a\": \"not closed"));
+    CHECK(!validates("{\"a\": \"escape \\"));
+    CHECK(!validates("{"));
+    CHECK(!validates(""));
+    CHECK(!validates("   "));
+
+    // Mismatched brackets.
+    CHECK(!validSoFar("{\"a\": [1, 2}"));
+    CHECK(!validSoFar("[1, 2}"));
+    CHECK(!validSoFar("{\"a\": 1]"));
+    CHECK(!validSoFar("}"));
+    CHECK(!validSoFar("[[1]]]"));
+
+    // Trailing data.
+    CHECK(!validSoFar("{\"a\": 1} x"));
+    CHECK(!validSoFar("{\"a\": 1}{}"));
+    CHECK(!validSoFar("[1] [2]"));
+
+    // A raw control character in a string.
+    CHECK(!validSoFar("{\"a\": \"line\nbreak\"}"));
+
+    // Reset makes it take a new document.
+    JsonValidator validator;
+    CHECK(!validator.feed('}'));
+    validator.reset();
+    CHECK(validator.feed('[') && validator.feed(']') && validator.isComplete());
+}
+
+/*
+* Tokenizes the document to its end, and returns the last token: JSON_END
+* if it was read in full, JSON_ERROR if not.
+*/
+static JsonToken_t lastToken(const char* document) {
+    StringStream stream(document);
+    char token[16];
+    JsonTokenizer json(stream, token, sizeof(token));
+    JsonToken_t t;
+    while ((t = json.next()) != JSON_END && t != JSON_ERROR)
+        ;
+    return t;
+}
+
+static void testTokenizer() {
+    StringStream stream("{\"a\": [1, \"x\", true], \"long key beyond the buffer\": {}, \"b\": null}");
+    char token[16];
+    JsonTokenizer json(stream, token, sizeof(token));
+
+    CHECK(json.next() == JSON_BEGIN_OBJECT);
+    CHECK(json.next() == JSON_KEY && strcmp(json.text(), "a") == 0);
+    CHECK(json.next() == JSON_BEGIN_ARRAY);
+    CHECK(json.depth() == 2);
+    CHECK(json.next() == JSON_NUMBER && strcmp(json.text(), "1") == 0);
+    CHECK(json.next() == JSON_STRING && strcmp(json.text(), "x") == 0);
+    CHECK(json.next() == JSON_LITERAL && strcmp(json.text(), "true") == 0);
+    CHECK(json.next() == JSON_END_ARRAY);
+    // Truncated to the buffer.
+    CHECK(json.next() == JSON_KEY && strcmp(json.text(), "long key beyond") == 0);
+    CHECK(json.next() == JSON_BEGIN_OBJECT);
+    CHECK(json.next() == JSON_END_OBJECT);
+    CHECK(json.next() == JSON_KEY && strcmp(json.text(), "b") == 0);
+    CHECK(json.next() == JSON_LITERAL && strcmp(json.text(), "null") == 0);
+    CHECK(json.next() == JSON_END_OBJECT);
+    CHECK(json.depth() == 0);
+    CHECK(json.next() == JSON_END);
+
+    // Skipping a nested value leaves the tokenizer at the next key.
+    StringStream nested("{\"a\": {\"x\": [1, {\"y\": \"}\"}]}, \"b\": 3}");
+    JsonTokenizer skipping(nested, token, sizeof(token));
+    CHECK(skipping.next() == JSON_BEGIN_OBJECT);
+    CHECK(skipping.next() == JSON_KEY);
+    CHECK(skipping.skip());
+    CHECK(skipping.next() == JSON_KEY && strcmp(skipping.text(), "b") == 0);
+    CHECK(skipping.next() == JSON_NUMBER);
+    CHECK(skipping.next() == JSON_END_OBJECT);
+    CHECK(skipping.next() == JSON_END);
+
+    CHECK(lastToken("{\"a\": 1, \"b\": [1, 2, {}]}") == JSON_END);
+    CHECK(lastToken("  [ ]  ") == JSON_END);
+
+    // Separators.
+    CHECK(lastToken("{\"a\" 1}") == JSON_ERROR);
+    CHECK(lastToken("{\"a\": 1 \"b\": 2}") == JSON_ERROR);
+    CHECK(lastToken("{\"a\": 1,}") == JSON_ERROR);
+    CHECK(lastToken("{,\"a\": 1}") == JSON_ERROR);
+    CHECK(lastToken("[1,,2]") == JSON_ERROR);
+    CHECK(lastToken("[1, 2,]") == JSON_ERROR);
+    CHECK(lastToken("[1 2]") == JSON_ERROR);
+    CHECK(lastToken("{\"a\": }") == JSON_ERROR);
+    CHECK(lastToken("{\"a\"}") == JSON_ERROR);
+    CHECK(lastToken("{1: 2}") == JSON_ERROR);
+
+    // Mismatched brackets, documents cut short and trailing data.
+    CHECK(lastToken("[1}") == JSON_ERROR);
+    CHECK(lastToken("{\"a\": [1]]") == JSON_ERROR);
+    CHECK(lastToken("{\"a\": [1, 2") == JSON_ERROR);
+    CHECK(lastToken("{\"a\": \"cut") == JSON_ERROR);
+    CHECK(lastToken("") == JSON_ERROR);
+    CHECK(lastToken("{} {}") == JSON_ERROR);
+    CHECK(lastToken("[1] x") == JSON_ERROR);
+}
+
+int main() {
+    std::cout.rdbuf(NULL);
+    testValidator();
+    testTokenizer();
+
+    printf("json=%s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Drives a beeper in pulse mode on the simulator, and checks what the core
+* reports: a train of short pulses as one change with its pulse count, a
+* long activation as a level when it starts and ends, and the current level
+* (isPeripheralActive() and getActiveStates()) all along.
+*/
+
+#include "Simulator.h"
+#include "PACSDoorManager.h"
+
+#define BEEPER_PIN 2
+#define PULSE_GAP_MS 250
+
+static PACSDoorManager doorManager;
+static uint8_t beeper;
+static unsigned reports = 0;
+static uint8_t lastPulses = 0;
+static bool lastActive = false;
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static void onStateChange(PACSDoor&, PACSPeripheral& p) {
+    reports++;
+    lastPulses = p.pulses();
+    lastActive = p.isActive();
+}
+
+/*
+* Runs the main loop for ms milliseconds, a millisecond at a time.
+*/
+static void run(unsigned ms) {
+    for (unsigned i=0; i < ms; i++) {
+        Simulator::advance(1000);
+        doorManager.updateLevels();
+    }
+}
+
+static bool isActive() {
+    uint8_t bits[PERIPHERAL_BITSET_SIZE(NO_HANDLE)];
+    doorManager.getActiveStates(bits);
+    bool bit = getBit(bits, beeper);
+    CHECK(bit == (doorManager.isPeripheralActive(beeper) == 1));
+    return bit;
+}
+
+static bool configure() {
+    ConfigRecord_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.kind = CONFIG_DOOR;
+    strcpy(record.id, "Door");
+    if (doorManager.addRecord(record) == NULL)
+        return false;
+
+    record.kind = CONFIG_PERIPHERAL;
+    strcpy(record.id, "Beeper");
+    record.type = BEEPER;
+    record.pin = BEEPER_PIN;
+    record.pin1 = 255;
+    record.level = HIGH;
+    record.pulseGapMs = PULSE_GAP_MS;
+    if (doorManager.addRecord(record) == NULL || !doorManager.initializeDoors())
+        return false;
+    doorManager.registerStateChangeCallback(&onStateChange);
+
+    char door[] = "Door";
+    char id[] = "Beeper";
+    beeper = doorManager.findHandle(door, id);
+    return beeper != NO_HANDLE;
+}
+
+int main() {
+    std::cout.rdbuf(NULL);
+    Simulator::reset();
+    Simulator::drive(BEEPER_PIN, LOW);
+    if (!configure()) {
+        fprintf(stderr, "The door does not fit.\n");
+        return 2;
+    }
+    run(10);
+    CHECK(!isActive());
+
+    // Three beeps of 100 ms: one report after the gap, active while beeping.
+    for (int i=0; i < 3; i++) {
+        Simulator::drive(BEEPER_PIN, HIGH);
+        run(50);
+        CHECK(isActive());
+        run(50);
+        Simulator::drive(BEEPER_PIN, LOW);
+        run(100);
+        CHECK(!isActive());
+    }
+    CHECK(reports == 0);
+    run(PULSE_GAP_MS);
+    CHECK(reports == 1);
+    CHECK(lastPulses == 3);
+    CHECK(!lastActive);
+
+    // A long activation: reported as active after the gap, and as inactive
+    // when it ends.
+    Simulator::drive(BEEPER_PIN, HIGH);
+    run(10);
+    CHECK(isActive());
+    CHECK(reports == 1);
+    run(PULSE_GAP_MS);
+    CHECK(reports == 2);
+    CHECK(lastPulses == 0);
+    CHECK(lastActive);
+    run(1000);
+    CHECK(reports == 2);
+    Simulator::drive(BEEPER_PIN, LOW);
+    run(10);
+    CHECK(reports == 3);
+    CHECK(!lastActive);
+    CHECK(!isActive());
+
+    // A beep followed by a long activation: the beep first, then the level.
+    Simulator::drive(BEEPER_PIN, HIGH);
+    run(50);
+    Simulator::drive(BEEPER_PIN, LOW);
+    run(50);
+    Simulator::drive(BEEPER_PIN, HIGH);
+    run(PULSE_GAP_MS + 10);
+    CHECK(reports == 5);
+    CHECK(lastPulses == 0);
+    CHECK(lastActive);
+    Simulator::drive(BEEPER_PIN, LOW);
+    run(PULSE_GAP_MS + 10);
+    CHECK(reports == 6);
+    CHECK(!isActive());
+
+    printf("pulses=%s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+/*
+Copyright (C) 2014 Axis Communications
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+* Reconfigures doors on the simulator, and checks what commitReconfiguration()
+* does: readers and peripherals configured as before are carried over with
+* their state and pins, the rest are set up, pins that are no longer used
+* are released, a frame in transmission is cut short, and the new tables
+* take the place of the old ones in the arena. Also checks that
+* getActiveStates() agrees with isPeripheralActive() for every handle.
+*/
+
+#include "Simulator.h"
+#include "PACSDoorManager.h"
+
+static PACSDoorManager doorManager;
+static unsigned lockReports = 0; // State changes reported for D1's lock.
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static void onStateChange(PACSDoor& door, PACSPeripheral& p) {
+    if (strcmp(door.id, "D1") == 0 && strcmp(p.id(), "lock") == 0)
+        lockReports++;
+}
+
+/*
+* Runs the main loop for ms milliseconds, a millisecond at a time.
+*/
+static void run(unsigned ms) {
+    for (unsigned i=0; i < ms; i++) {
+        Simulator::advance(1000);
+        doorManager.updateLevels();
+    }
+}
+
+static bool addDoor(const char* id) {
+    ConfigRecord_t record;
+    memset(&record, 0, sizeof(record));
+    record.kind = CONFIG_DOOR;
+    strcpy(record.id, id);
+    return doorManager.addRecord(record) != NULL;
+}
+
+static bool addReader(const char* id, uint8_t pin0, uint8_t pin1) {
+    ConfigRecord_t record;
+    memset(&record, 0, sizeof(record));
+    record.kind = CONFIG_READER;
+    strcpy(record.id, id);
+    record.pin = pin0;
+    record.pin1 = pin1;
+    record.level = WIEGAND_DEFAULT_FORMAT;
+    return doorManager.addRecord(record) != NULL;
+}
+
+static bool addPeripheral(const char* id, PACSPeripheralType_t type, uint8_t pin, uint8_t level) {
+    ConfigRecord_t record;
+    memset(&record, 0, sizeof(record));
+    record.kind = CONFIG_PERIPHERAL;
+    strcpy(record.id, id);
+    record.type = type;
+    record.pin = pin;
+    record.pin1 = 255;
+    record.level = level;
+    return doorManager.addRecord(record) != NULL;
+}
+
+/*
+* Config A: two doors, each with a reader, and a REX and a door monitor
+* that the core drives.
+*/
+static bool addConfigA() {
+    return addDoor("D1") && addReader("r", 10, 11) && addPeripheral("lock", LOCK, 12, HIGH) &&
+           addPeripheral("rex", REX, 13, LOW) &&
+           addDoor("D2") && addPeripheral("lock", LOCK, 14, HIGH) && addReader("r", 15, 16) &&
+           addPeripheral("monitor", DOORMONITOR, 19, LOW);
+}
+
+/*
+* Config B: D1 as before but with its REX on another pin, D2 gone, and a
+* new door D3 that takes over the pins of D2's reader.
+*/
+static bool addConfigB() {
+    return addDoor("D1") && addReader("r", 10, 11) && addPeripheral("lock", LOCK, 12, HIGH) &&
+           addPeripheral("rex", REX, 17, LOW) &&
+           addDoor("D3") && addPeripheral("beeper", BEEPER, 18, LOW) && addReader("r", 15, 16);
+}
+
+static bool commit(ReconfigurationResult_t& result) {
+    bool committed = doorManager.commitReconfiguration(result);
+    doorManager.updateLevels();
+    return committed;
+}
+
+static uint8_t handle(const char* doorId, const char* id) {
+    return doorManager.findHandle((char*)doorId, (char*)id);
+}
+
+/*
+* Checks every handle: the bit of a peripheral is its isPeripheralActive(),
+* and the bit of a reader is clear.
+*/
+static void checkActiveStates() {
+    uint8_t bits[PERIPHERAL_BITSET_SIZE(NO_HANDLE)];
+    memset(bits, 0xFF, sizeof(bits));
+    uint8_t count = doorManager.getActiveStates(bits);
+    uint8_t objects = 0;
+    for (unsigned i=0; i < doorManager.doors.size(); i++)
+        objects += doorManager.doors[i].readers.size() + doorManager.doors[i].peripherals.size();
+    CHECK(count == objects);
+    for (uint8_t h=0; h < count; h++) {
+        int active = doorManager.isPeripheralActive(h);
+        CHECK(getBit(bits, h) == (active == 1));
+    }
+}
+
+static void testCarryOver() {
+    ReconfigurationResult_t result;
+
+    Simulator::drive(12, HIGH);
+    Simulator::drive(14, HIGH);
+    run(10);
+    uint8_t lock = handle("D1", "lock");
+    CHECK(doorManager.isPeripheralActive(lock) == 1);
+
+    // A frame that goes out in full, and one that is cut short.
+    uint8_t reader = handle("D1", "r");
+    uint16_t frame;
+    CHECK(doorManager.swipeCard(reader, 12, 3456, -1, &frame));
+    while (doorManager.doors[0].readers[0].isTransmitting())
+        run(1);
+    CHECK(doorManager.isFrameTransmitted(reader, frame) == 1);
+    CHECK(doorManager.swipeCard(handle("D2", "r"), 12, 3456, -1, &frame));
+    CHECK(doorManager.swipeCard(reader, 12, 3456, -1, &frame));
+    run(2);
+    CHECK(doorManager.doors[0].readers[0].isTransmitting());
+
+    unsigned reportsBefore = lockReports;
+    doorManager.beginReconfiguration();
+    CHECK(addConfigB());
+    CHECK(commit(result));
+    CHECK(result.kept == 2); // D1's reader and lock.
+    CHECK(result.initialized == 3); // D1's REX, D3's beeper and reader.
+    // The old REX, D2's lock and monitor, and D2's reader pins, which are
+    // released before D3's reader sets them up again.
+    CHECK(result.released == 5);
+
+    // The lock kept its level without reporting a change, and the reader its
+    // frame count. The frame in transmission was dropped, and the data
+    // lines are idle.
+    lock = handle("D1", "lock");
+    reader = handle("D1", "r");
+    CHECK(doorManager.isPeripheralActive(lock) == 1);
+    run(10);
+    CHECK(lockReports == reportsBefore);
+    PACSReader& r = doorManager.doors[0].readers[0];
+    CHECK(strcmp(r.id, "r") == 0);
+    CHECK(!r.isTransmitting());
+    CHECK(r.lastSentFrame == 1);
+    CHECK(Simulator::level(10) == HIGH && Simulator::level(11) == HIGH);
+    CHECK(doorManager.doors[1].readers[0].lastSentFrame == 0);
+
+    // Pins: the readers' data lines and the moved REX are outputs, the
+    // released pins are inputs again.
+    CHECK(Simulator::isOutput(10) && Simulator::isOutput(11));
+    CHECK(Simulator::isOutput(15) && Simulator::isOutput(16));
+    CHECK(Simulator::isOutput(17));
+    CHECK(!Simulator::isOutput(13));
+    CHECK(!Simulator::isOutput(19));
+
+    // Handles follow the new doors.
+    CHECK(handle("D2", "lock") == NO_HANDLE);
+    CHECK(handle("D3", "beeper") != NO_HANDLE);
+    CHECK(handle("D1", "rex") != NO_HANDLE);
+    char* doorId;
+    char* id;
+    CHECK(doorManager.findObject(handle("D3", "r"), doorId, id) && strcmp(doorId, "D3") == 0 && strcmp(id, "r") == 0);
+}
+
+/*
+* The new tables replace the old ones at the bottom of the arena, so the
+* memory used only depends on the current config.
+*/
+static void testMoveTables() {
+    ReconfigurationResult_t result;
+    size_t usedB = doorManager.memoryUsed();
+
+    doorManager.beginReconfiguration();
+    CHECK(addConfigB());
+    CHECK(commit(result));
+    CHECK(result.kept == 5 && result.initialized == 0 && result.released == 0);
+    CHECK(doorManager.memoryUsed() == usedB);
+
+    doorManager.beginReconfiguration();
+    CHECK(addConfigA());
+    CHECK(commit(result));
+    CHECK(doorManager.memoryUsed() > usedB);
+    doorManager.beginReconfiguration();
+    CHECK(addConfigB());
+    CHECK(commit(result));
+    CHECK(doorManager.memoryUsed() == usedB);
+
+    // The tables were moved as a whole: every object is where its door
+    // says, with its id and pins.
+    CHECK(doorManager.doors.size() == 2);
+    CHECK(strcmp(doorManager.doors[0].id, "D1") == 0 && strcmp(doorManager.doors[1].id, "D3") == 0);
+    PACSDoor& d1 = doorManager.doors[0];
+    CHECK(d1.readers.size() == 1 && d1.readers[0].pin0 == 10 && d1.readers[0].pin1 == 11);
+    CHECK(d1.peripherals.size() == 2);
+    char rex[] = "rex";
+    CHECK(d1.findPeripheralById(rex) != NULL && d1.findPeripheralById(rex)->pin() == 17);
+    char beeper[] = "beeper";
+    CHECK(doorManager.doors[1].findPeripheralById(beeper) != NULL);
+
+    // An aborted reconfiguration leaves the tables as they were.
+    doorManager.beginReconfiguration();
+    CHECK(addConfigA());
+    doorManager.abortReconfiguration();
+    CHECK(doorManager.memoryUsed() == usedB);
+    CHECK(doorManager.doors.size() == 2);
+
+    // No doors at all: everything is released.
+    doorManager.beginReconfiguration();
+    CHECK(commit(result));
+    CHECK(doorManager.doors.size() == 0);
+    CHECK(result.kept == 0 && result.released == 7);
+    CHECK(!Simulator::isOutput(10) && !Simulator::isOutput(15) && !Simulator::isOutput(17));
+    uint8_t bits[PERIPHERAL_BITSET_SIZE(NO_HANDLE)];
+    CHECK(doorManager.getActiveStates(bits) == 0);
+}
+
+static void testActiveStates() {
+    ReconfigurationResult_t result;
+
+    doorManager.beginReconfiguration();
+    CHECK(addConfigB());
+    CHECK(commit(result));
+
+    // Lock active (high), beeper inactive (high, active low).
+    Simulator::drive(12, HIGH);
+    Simulator::drive(18, HIGH);
+    run(10);
+    checkActiveStates();
+    uint8_t bits[PERIPHERAL_BITSET_SIZE(NO_HANDLE)];
+    doorManager.getActiveStates(bits);
+    CHECK(getBit(bits, handle("D1", "lock")));
+    CHECK(!getBit(bits, handle("D3", "beeper")));
+    CHECK(!getBit(bits, handle("D1", "r")));
+
+    // And the other way round, with the REX pushed.
+    Simulator::drive(12, LOW);
+    Simulator::drive(18, LOW);
+    CHECK(doorManager.pushREX(handle("D1", "rex")));
+    run(10);
+    checkActiveStates();
+    doorManager.getActiveStates(bits);
+    CHECK(!getBit(bits, handle("D1", "lock")));
+    CHECK(getBit(bits, handle("D3", "beeper")));
+}
+
+int main() {
+    std::cout.rdbuf(NULL);
+    Simulator::reset();
+    if (!addConfigA() || !doorManager.initializeDoors()) {
+        fprintf(stderr, "The doors do not fit.\n");
+        return 2;
+    }
+    doorManager.registerStateChangeCallback(&onStateChange);
+    checkActiveStates();
+
+    testCarryOver();
+    testMoveTables();
+    testActiveStates();
+
+    printf("reconfigure=%s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
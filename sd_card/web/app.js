@@ -509,9 +509,29 @@ app.controller('DoorsCtrl', ['$scope', 'ConfigService', 'WebsocketService', 'Ale
     * Handle updates from the Arduino.
     */
     WebsocketService.subscribeToUpdates(function(updateMessage) {
-      var doorId = updateMessage["Update"]["DoorId"];
-      var id = updateMessage["Update"]["Id"];
-      var isActive = updateMessage["Update"]["IsActive"];
+      // Only peripheral updates are of interest here. They come one at a
+      // time ("Update") or batched ("Updates").
+      var updates = updateMessage["Updates"];
+      if (!updates) {
+        if (!updateMessage["Update"]) {
+          return;
+        }
+        updates = [updateMessage["Update"]];
+      }
+
+      // The whole batch is applied in one $apply, for angular to know
+      // that it has been changed.
+      $scope.$apply(function () {
+        for (var i = 0; i < updates.length; i++) {
+          applyUpdate(updates[i]);
+        }
+      });
+    });
+
+    function applyUpdate(update) {
+      var doorId = update["DoorId"];
+      var id = update["Id"];
+      var isActive = update["IsActive"];
 
       // First we find which door the update is referring to...
       findById($scope.doors, doorId, function(door) {        
@@ -526,13 +546,10 @@ app.controller('DoorsCtrl', ['$scope', 'ConfigService', 'WebsocketService', 'Ale
             return;
           }            
           // and update its IsActive property!
-          // It is wrapped in $apply for angular to know that it has been changed.
-          $scope.$apply(function () {
-            peripheral["IsActive"] = isActive;
-          });
+          peripheral["IsActive"] = isActive;
         });
       });
-    });
+    }
 
     /*
     * Get the door and network config from the Arduino.
@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Puts the bench sketch for the Mega (dctt_bench/) together with the core
+# sources it runs in one folder, as the Arduino IDE only compiles the files
+# of the sketch's own folder. Open dctt_bench.ino of the result in the IDE,
+# upload it and read the results off the serial monitor (57600 baud).
+#
+
+usage() {
+
+	echo ""
+	echo "Usage: $0 [-d <directory>]"
+	echo -e "  -d\t Where to put the sketch folder. Default: /tmp"
+
+	1>&2;
+	exit 1;
+}
+
+repo="$(dirname "$0")/.."
+dir="/tmp"
+
+while getopts ":d:" o; do
+    case "${o}" in
+        d)
+            dir=${OPTARG}
+            ;;
+        *)
+            usage
+            ;;
+    esac
+done
+
+sketch="${dir}/dctt_bench"
+mkdir -p "${sketch}" || exit 1
+
+# The door core, as in the host build (CMakeLists.txt), without the simulator.
+for name in DoorConfig EdgeCapture FastPin JsonTokenizer JsonWriter LatencyHistogram PACSArena \
+            PACSDoor PACSDoorManager PACSPeripheral PACSReader SimpleTimer Trace WiegandFormat \
+            WiegandTransmitter; do
+	cp "${repo}/${name}.cpp" "${sketch}/" || exit 1
+done
+cp "${repo}"/*.h "${repo}"/dctt_bench/* "${sketch}/" || exit 1
+echo "${sketch}/dctt_bench.ino"
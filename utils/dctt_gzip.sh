@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Makes gzipped copies of the web GUI files for the SD card. The test tool
+# sends the copy in web/gz/ to browsers that accept gzip, and the original
+# in web/ to the rest. Run it again whenever the web files change.
+#
+
+usage() {
+
+	echo ""
+	echo "Usage: $0 [-d <sd card directory>]"
+	echo -e "  -d\t The directory with the SD card's web folder. Default: the sd_card folder of the repository."
+
+	1>&2;
+	exit 1;
+}
+
+dir="$(dirname "$0")/../sd_card"
+
+while getopts ":d:" o; do
+    case "${o}" in
+        d)
+            dir=${OPTARG}
+            ;;
+        *)
+            usage
+            ;;
+    esac
+done
+
+if [ ! -d "${dir}/web" ]; then
+    echo "ERROR: There is no web folder in ${dir}."
+    exit 1
+fi
+
+mkdir -p "${dir}/web/gz"
+for file in index.htm app.js favicon.ico; do
+	# -n leaves out the name and time stamp, so unchanged files give the
+	# same copy (and entity tag) every time.
+	gzip -9 -n -c "${dir}/web/${file}" > "${dir}/web/gz/${file}"
+	echo "${dir}/web/gz/${file}"
+done
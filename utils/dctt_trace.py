@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2014 Axis Communications
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+# Fetches the event trace from the test tool (/api?cmd=trace) and converts
+# it to the Chrome trace event format, which can be opened in
+# chrome://tracing or https://ui.perfetto.dev.
+#
+# Every door becomes a process and every reader/peripheral a thread. Begin
+# and end events (frame start/end, REX push/release, etc.) become slices.
+#
+
+import argparse
+import json
+import sys
+import time
+import urllib.request
+
+# Event name -> (slice name, True for begin, False for end).
+EVENTS = {
+    "frame_start": ("Wiegand frame", True),
+    "frame_end": ("Wiegand frame", False),
+    "rex_push": ("REX", True),
+    "rex_release": ("REX", False),
+    "door_open": ("Door open", True),
+    "door_close": ("Door open", False),
+    "input_activate": ("Input active", True),
+    "input_deactivate": ("Input active", False),
+    "output_active": ("Active", True),
+    "output_inactive": ("Active", False),
+}
+
+
+def fetch(host, since, timeout):
+    """Returns (records, next sequence number) from the device."""
+    url = "http://%s/api?cmd=trace&since=%d" % (host, since)
+    with urllib.request.urlopen(url, timeout=timeout) as response:
+        next_seq = int(response.headers.get("X-Trace-Next", since))
+        lines = response.read().decode("ascii", "replace").splitlines()
+
+    records = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) != 5:
+            continue
+        records.append((int(fields[0]), int(fields[1]), fields[2], fields[3], fields[4]))
+    return records, next_seq
+
+
+class Converter:
+    def __init__(self):
+        self.events = []
+        self.pids = {}
+        self.tids = {}
+        self.last_micros = None
+        self.wraps = 0
+        self.last_seq = None
+
+    def _pid(self, door):
+        if door not in self.pids:
+            pid = len(self.pids) + 1
+            self.pids[door] = pid
+            self.events.append({"ph": "M", "name": "process_name", "pid": pid,
+                                "args": {"name": door}})
+        return self.pids[door]
+
+    def _tid(self, pid, obj):
+        if (pid, obj) not in self.tids:
+            tid = len(self.tids) + 1
+            self.tids[(pid, obj)] = tid
+            self.events.append({"ph": "M", "name": "thread_name", "pid": pid, "tid": tid,
+                                "args": {"name": obj}})
+        return self.tids[(pid, obj)]
+
+    def add(self, seq, micros, event, door, obj):
+        if self.last_seq is not None and seq != self.last_seq + 1:
+            print("Warning: records %d-%d were lost." % (self.last_seq + 1, seq - 1),
+                  file=sys.stderr)
+        self.last_seq = seq
+
+        # micros() wraps every 71 minutes. Captured edges can be slightly
+        # older than the record before them, so only a large step back is
+        # taken as a wrap.
+        if self.last_micros is not None and micros < self.last_micros - (1 << 31):
+            self.wraps += 1
+        self.last_micros = micros
+        ts = micros + (self.wraps << 32)
+
+        name, begin = EVENTS.get(event, (event, None))
+        pid = self._pid(door)
+        tid = self._tid(pid, obj)
+        if begin is None:
+            self.events.append({"ph": "i", "name": name, "pid": pid, "tid": tid, "ts": ts, "s": "t"})
+        else:
+            self.events.append({"ph": "B" if begin else "E", "name": name,
+                                "pid": pid, "tid": tid, "ts": ts})
+
+    def write(self, out):
+        json.dump({"traceEvents": self.events, "displayTimeUnit": "ms"}, out, indent=1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert the test tool trace to Chrome trace JSON.")
+    parser.add_argument("host", help="Address of the test tool, e.g. 192.168.0.100")
+    parser.add_argument("-o", "--output", help="Output file (default: stdout)")
+    parser.add_argument("-s", "--since", type=int, default=0, help="First sequence number to fetch")
+    parser.add_argument("-f", "--follow", action="store_true",
+                        help="Keep fetching until interrupted (Ctrl-C)")
+    parser.add_argument("-i", "--interval", type=float, default=0.5,
+                        help="Seconds between fetches when following (default: 0.5)")
+    parser.add_argument("-t", "--timeout", type=float, default=5, help="HTTP timeout in seconds")
+    args = parser.parse_args()
+
+    converter = Converter()
+    since = args.since
+    try:
+        while True:
+            records, next_seq = fetch(args.host, since, args.timeout)
+            if next_seq < since:
+                # The device was reset, start over from its first record.
+                print("Warning: the trace restarted, the device was probably reset.", file=sys.stderr)
+                converter.last_seq = None
+                converter.last_micros = None
+                since = 0
+                continue
+            for record in records:
+                converter.add(*record)
+            since = next_seq
+            if not args.follow:
+                break
+            time.sleep(args.interval)
+    except KeyboardInterrupt:
+        pass
+
+    if args.output:
+        with open(args.output, "w") as out:
+            converter.write(out)
+    else:
+        converter.write(sys.stdout)
+
+
+if __name__ == "__main__":
+    main()